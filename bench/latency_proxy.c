@@ -0,0 +1,388 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * TCP proxy that adds latency, jitter and a bandwidth limit to the
+ * traffic between RediFS and a local redis-server, to benchmark under
+ * realistic round trip times on a single machine.
+ *
+ * Bytes are forwarded unmodified, so RESP pipelining behaves exactly as
+ * over a real link: a pipeline of N commands pays the delay once.
+*/
+
+
+/* ---- Includes ---- */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+
+/* ---- Defines ---- */
+#define READ_BUF_SIZE (64 * 1024)
+
+
+/* ---- Settings ---- */
+static unsigned long long oneWayDelayNs = 0;
+static unsigned long long jitterNs = 0;
+static unsigned long long bandwidth = 0; // Bytes per second per direction; 0 is unlimited.
+static struct sockaddr_in upstreamAddr;
+
+
+/* ---- Types ---- */
+
+// Data read from one side, waiting for its delivery time:
+struct packet
+{
+    struct packet* next;
+    unsigned long long sendAt;
+    size_t len;
+    size_t sent;
+    char data[];
+};
+
+struct connection
+{
+    int fds[2]; // Client, upstream.
+    int refs;
+};
+
+struct direction
+{
+    struct connection* conn;
+    int from;
+    int to;
+};
+
+
+/* ================ Util functions ================ */
+
+static unsigned long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static unsigned long long randomJitter(unsigned int* seed)
+{
+    return jitterNs ? (unsigned long long)(rand_r(seed) / ((double)RAND_MAX + 1) * jitterNs) : 0;
+}
+
+
+static void releaseConnection(struct connection* conn)
+{
+    if (0 == __atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL))
+    {
+        close(conn->fds[0]);
+        close(conn->fds[1]);
+        free(conn);
+    }
+}
+
+
+/* ================ Forwarding ================ */
+
+static void* forwardMain(void* arg)
+{
+    struct direction* dir = (struct direction*)arg;
+    struct packet* head = NULL;
+    struct packet* tail = NULL;
+    struct packet* packet;
+    struct pollfd pfd;
+    struct timespec timeout;
+    unsigned long long lastSendAt = 0;
+    unsigned long long linkFreeAt = 0;
+    unsigned long long current;
+    unsigned long long wait;
+    unsigned int seed = (unsigned int)(uintptr_t)dir ^ (unsigned int)now();
+    char buf[READ_BUF_SIZE];
+    ssize_t n;
+    int eof = 0;
+
+    while (!eof || head)
+    {
+        // Sleep until there is input or the next packet is due:
+        pfd.fd = dir->from;
+        pfd.events = eof ? 0 : POLLIN;
+        pfd.revents = 0;
+        if (head)
+        {
+            current = now();
+            wait = head->sendAt > current ? head->sendAt - current : 0;
+            timeout.tv_sec = wait / 1000000000ULL;
+            timeout.tv_nsec = wait % 1000000000ULL;
+        }
+        if (0 > ppoll(&pfd, 1, head ? &timeout : NULL, NULL) && errno != EINTR)
+        {
+            break;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            n = read(dir->from, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                eof = 1;
+            }
+            else
+            {
+                packet = malloc(sizeof(struct packet) + n);
+                if (!packet)
+                {
+                    break;
+                }
+                memcpy(packet->data, buf, n);
+                packet->len = n;
+                packet->sent = 0;
+                packet->next = NULL;
+
+                // Delay, plus serialization time on the limited link. Packets
+                // never overtake each other, like on a TCP stream:
+                current = now();
+                packet->sendAt = current + oneWayDelayNs + randomJitter(&seed);
+                if (bandwidth)
+                {
+                    linkFreeAt = (linkFreeAt > current ? linkFreeAt : current) + n * 1000000000ULL / bandwidth;
+                    if (packet->sendAt < linkFreeAt + oneWayDelayNs)
+                    {
+                        packet->sendAt = linkFreeAt + oneWayDelayNs;
+                    }
+                }
+                if (packet->sendAt < lastSendAt)
+                {
+                    packet->sendAt = lastSendAt;
+                }
+                lastSendAt = packet->sendAt;
+
+                if (tail)
+                {
+                    tail->next = packet;
+                }
+                else
+                {
+                    head = packet;
+                }
+                tail = packet;
+            }
+        }
+
+        // Deliver everything that is due:
+        current = now();
+        while (head && head->sendAt <= current)
+        {
+            n = write(dir->to, head->data + head->sent, head->len - head->sent);
+            if (n < 0)
+            {
+                eof = 1;
+                while (head)
+                {
+                    packet = head->next;
+                    free(head);
+                    head = packet;
+                }
+                break;
+            }
+
+            head->sent += n;
+            if (head->sent == head->len)
+            {
+                packet = head;
+                head = head->next;
+                free(packet);
+                if (!head)
+                {
+                    tail = NULL;
+                }
+            }
+        }
+    }
+
+    shutdown(dir->to, SHUT_WR);
+    releaseConnection(dir->conn);
+    free(dir);
+
+    return NULL;
+}
+
+
+static int startDirection(struct connection* conn, int from, int to)
+{
+    struct direction* dir;
+    pthread_t thread;
+
+    dir = malloc(sizeof(struct direction));
+    if (!dir)
+    {
+        return -1;
+    }
+    dir->conn = conn;
+    dir->from = from;
+    dir->to = to;
+
+    if (0 != pthread_create(&thread, NULL, forwardMain, dir))
+    {
+        free(dir);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+
+static void handleClient(int client)
+{
+    struct connection* conn;
+    int upstream;
+    int one = 1;
+
+    upstream = socket(AF_INET, SOCK_STREAM, 0);
+    if (upstream < 0 || 0 > connect(upstream, (struct sockaddr*)&upstreamAddr, sizeof(upstreamAddr)))
+    {
+        perror("Error: Cannot connect upstream");
+        if (upstream >= 0)
+        {
+            close(upstream);
+        }
+        close(client);
+        return;
+    }
+
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn = malloc(sizeof(struct connection));
+    assert(conn);
+    conn->fds[0] = client;
+    conn->fds[1] = upstream;
+    conn->refs = 2;
+
+    if (0 > startDirection(conn, client, upstream))
+    {
+        conn->refs = 1;
+        releaseConnection(conn);
+        return;
+    }
+    if (0 > startDirection(conn, upstream, client))
+    {
+        shutdown(client, SHUT_RDWR);
+        releaseConnection(conn);
+    }
+}
+
+
+/* ================ Main ================ */
+
+static void usage(const char* progName)
+{
+    fprintf(stderr,
+        "usage: %s -l listen_port -u host:port [-d rtt_us] [-j jitter_us] [-b bytes_per_sec]\n"
+        "\n"
+        "  -d  round trip time to add; each direction is delayed by half of it\n"
+        "  -j  extra random delay per direction, uniform in [0, jitter_us]\n"
+        "  -b  bandwidth limit per direction\n", progName);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_in listenAddr;
+    struct addrinfo hints;
+    struct addrinfo* addr;
+    char* upstream = NULL;
+    char* colon;
+    int listenPort = 0;
+    int listenFd;
+    int client;
+    int one = 1;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "l:u:d:j:b:")))
+    {
+        switch (opt)
+        {
+            case 'l': listenPort = atoi(optarg); break;
+            case 'u': upstream = optarg; break;
+            case 'd': oneWayDelayNs = strtoull(optarg, NULL, 10) * 1000ULL / 2; break;
+            case 'j': jitterNs = strtoull(optarg, NULL, 10) * 1000ULL; break;
+            case 'b': bandwidth = strtoull(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!listenPort || !upstream || !(colon = strrchr(upstream, ':')))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Resolve the upstream server:
+    *colon = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(upstream, colon + 1, &hints, &addr))
+    {
+        fprintf(stderr, "Error: Cannot resolve %s.\n", upstream);
+        return 1;
+    }
+    memcpy(&upstreamAddr, addr->ai_addr, sizeof(upstreamAddr));
+    freeaddrinfo(addr);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&listenAddr, 0, sizeof(listenAddr));
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listenAddr.sin_port = htons(listenPort);
+    if (0 > bind(listenFd, (struct sockaddr*)&listenAddr, sizeof(listenAddr)) || 0 > listen(listenFd, 64))
+    {
+        perror("Error: Cannot listen");
+        return 1;
+    }
+
+    while (1)
+    {
+        client = accept(listenFd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error: accept");
+            return 1;
+        }
+
+        handleClient(client);
+    }
+
+    return 0;
+}
@@ -0,0 +1,806 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <fuse.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "backend.h"
+#include "compress.h"
+#include "operations.h"
+#include "stats.h"
+
+
+/* ---- Defines ---- */
+#define PATH_LEN 1024
+#define FILE_SIZE (8 * 1024 * 1024)
+#define SEQ_BLOCK_SIZE (128 * 1024)
+#define RAND_BLOCK_SIZE 4096
+#define SMALL_FILE_SIZE 1024
+
+
+/* ================ Targets ================ */
+
+// A benchmark target either calls the redifs_oper callbacks directly, or
+// issues system calls against a mounted file system.
+struct bench_target
+{
+    const char* mode;
+    int (*getattr)(const char* path);
+    int (*mkdir)(const char* path);
+    int (*create)(const char* path);
+    int (*readdir)(const char* path, int* entries);
+    int (*write)(const char* path, const char* buf, size_t size, off_t offset);
+    int (*read)(const char* path, char* buf, size_t size, off_t offset);
+};
+
+static const char* mountDir = NULL;
+static const char* version = "unknown";
+static int rttUs = 0;
+static const char* backendName = DEFAULT_BACKEND;
+static const char* codec = DEFAULT_CODEC;
+static int dedup = 0;
+static int scale = 1;
+
+
+// ---- Direct calls:
+static int directGetattr(const char* path)
+{
+    struct stat st;
+    return redifs_oper.getattr(path, &st, NULL);
+}
+
+
+static int directMkdir(const char* path)
+{
+    return redifs_oper.mkdir(path, 0755);
+}
+
+
+static int directCreate(const char* path)
+{
+    return redifs_oper.mknod(path, S_IFREG | 0644, 0);
+}
+
+
+static int countEntry(void* buf, const char* name, const struct stat* st, off_t off,
+                      enum fuse_fill_dir_flags flags)
+{
+    ++*(int*)buf;
+    return 0;
+}
+
+
+static int directReaddir(const char* path, int* entries)
+{
+    *entries = 0;
+    return redifs_oper.readdir(path, entries, countEntry, 0, NULL, 0);
+}
+
+
+static int directIo(const char* path, char* buf, size_t size, off_t offset, int writing)
+{
+    struct fuse_file_info fileInfo;
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = writing ? O_WRONLY : O_RDONLY;
+
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (writing)
+    {
+        result = redifs_oper.write ? redifs_oper.write(path, buf, size, offset, &fileInfo) : -ENOSYS;
+    }
+    else
+    {
+        result = redifs_oper.read(path, buf, size, offset, &fileInfo);
+    }
+
+    if (redifs_oper.release)
+    {
+        redifs_oper.release(path, &fileInfo);
+    }
+
+    return result;
+}
+
+
+static int directWrite(const char* path, const char* buf, size_t size, off_t offset)
+{
+    return directIo(path, (char*)buf, size, offset, 1);
+}
+
+
+static int directRead(const char* path, char* buf, size_t size, off_t offset)
+{
+    return directIo(path, buf, size, offset, 0);
+}
+
+
+static struct bench_target directTarget = {
+    "direct", directGetattr, directMkdir, directCreate, directReaddir, directWrite, directRead
+};
+
+
+// ---- System calls on a mount:
+static const char* mountPath(const char* path, char* buf)
+{
+    snprintf(buf, PATH_LEN, "%s%s", mountDir, path);
+    return buf;
+}
+
+
+static int mountGetattr(const char* path)
+{
+    char buf[PATH_LEN];
+    struct stat st;
+    return stat(mountPath(path, buf), &st) < 0 ? -errno : 0;
+}
+
+
+static int mountMkdir(const char* path)
+{
+    char buf[PATH_LEN];
+    return mkdir(mountPath(path, buf), 0755) < 0 ? -errno : 0;
+}
+
+
+static int mountCreate(const char* path)
+{
+    char buf[PATH_LEN];
+    int fd;
+
+    fd = open(mountPath(path, buf), O_CREAT | O_WRONLY, 0644);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    close(fd);
+
+    return 0;
+}
+
+
+static int mountReaddir(const char* path, int* entries)
+{
+    char buf[PATH_LEN];
+    DIR* dir;
+
+    dir = opendir(mountPath(path, buf));
+    if (!dir)
+    {
+        return -errno;
+    }
+
+    *entries = 0;
+    while (readdir(dir))
+    {
+        ++*entries;
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+
+static int mountIo(const char* path, char* buf, size_t size, off_t offset, int writing)
+{
+    char pathBuf[PATH_LEN];
+    ssize_t result;
+    int fd;
+
+    fd = open(mountPath(path, pathBuf), writing ? O_WRONLY : O_RDONLY);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    result = writing ? pwrite(fd, buf, size, offset) : pread(fd, buf, size, offset);
+    if (result < 0)
+    {
+        result = -errno;
+    }
+    close(fd);
+
+    return result;
+}
+
+
+static int mountWrite(const char* path, const char* buf, size_t size, off_t offset)
+{
+    return mountIo(path, (char*)buf, size, offset, 1);
+}
+
+
+static int mountRead(const char* path, char* buf, size_t size, off_t offset)
+{
+    return mountIo(path, buf, size, offset, 0);
+}
+
+
+static struct bench_target mountTarget = {
+    "mount", mountGetattr, mountMkdir, mountCreate, mountReaddir, mountWrite, mountRead
+};
+
+
+/* ================ Measurement ================ */
+
+struct bench_run
+{
+    const char* name;
+    char param[64];
+    unsigned long long* samples;
+    int count;
+    int capacity;
+    unsigned long long bytes;
+    int error;
+    unsigned long long start;
+    char extra[160]; // Additional JSON fields, starting with a comma.
+};
+
+
+static void runBegin(struct bench_run* run, const char* name, int capacity)
+{
+    memset(run, 0, sizeof(struct bench_run));
+    run->name = name;
+    run->capacity = capacity;
+    run->samples = malloc(capacity * sizeof(unsigned long long));
+    assert(run->samples);
+    run->start = statsNow();
+}
+
+
+// Time one operation; returns its result.
+#define MEASURE(run, call) \
+    ({ \
+        unsigned long long opStart = statsNow(); \
+        int opResult = (call); \
+        (run)->samples[(run)->count++] = statsNow() - opStart; \
+        if (opResult < 0 && !(run)->error) (run)->error = opResult; \
+        opResult; \
+    })
+
+
+static unsigned long long transferred(int result)
+{
+    return result > 0 ? result : 0;
+}
+
+
+static int compareSamples(const void* a, const void* b)
+{
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+// Emit one JSON line with the results:
+static void runEnd(struct bench_target* target, struct bench_run* run)
+{
+    double seconds = (statsNow() - run->start) / 1e9;
+    unsigned long long sum = 0;
+    int i;
+
+    printf("{\"suite\":\"redifs\",\"version\":\"%s\",\"mode\":\"%s\",\"backend\":\"%s\",\"codec\":\"%s\",\"dedup\":%d,\"rtt_us\":%d,\"bench\":\"%s\",\"param\":\"%s\"",
+        version, target->mode, backendName, codec, dedup, rttUs, run->name, run->param);
+
+    if (run->error)
+    {
+        printf(",\"error\":\"%s\"}\n", strerror(-run->error));
+        free(run->samples);
+        fflush(stdout);
+        return;
+    }
+
+    qsort(run->samples, run->count, sizeof(unsigned long long), compareSamples);
+    for (i = 0; i < run->count; ++i)
+    {
+        sum += run->samples[i];
+    }
+
+    printf(",\"ops\":%d,\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"mean_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu",
+        run->count, seconds, run->count / seconds, run->count ? sum / run->count : 0,
+        run->count ? run->samples[run->count / 2] : 0,
+        run->count ? run->samples[(int)(run->count * 0.99)] : 0);
+    if (run->bytes)
+    {
+        printf(",\"bytes\":%llu,\"mib_per_sec\":%.2f", run->bytes, run->bytes / seconds / (1024.0 * 1024.0));
+    }
+    printf("%s}\n", run->extra);
+    fflush(stdout);
+
+    free(run->samples);
+}
+
+
+/* ================ Benchmarks ================ */
+
+static void benchCreate(struct bench_target* target, const char* root)
+{
+    struct bench_run run;
+    char path[PATH_LEN];
+    int count = 2000 * scale;
+    int i;
+
+    // mkdir rate:
+    snprintf(path, PATH_LEN, "%s/mkdir", root);
+    target->mkdir(path);
+    runBegin(&run, "mkdir", count);
+    snprintf(run.param, sizeof(run.param), "count=%d", count);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        snprintf(path, PATH_LEN, "%s/mkdir/d%d", root, i);
+        MEASURE(&run, target->mkdir(path));
+    }
+    runEnd(target, &run);
+
+    // create rate:
+    snprintf(path, PATH_LEN, "%s/create", root);
+    target->mkdir(path);
+    runBegin(&run, "create", count);
+    snprintf(run.param, sizeof(run.param), "count=%d", count);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        snprintf(path, PATH_LEN, "%s/create/f%d", root, i);
+        MEASURE(&run, target->create(path));
+    }
+    runEnd(target, &run);
+}
+
+
+static void benchGetattr(struct bench_target* target, const char* root)
+{
+    static const int depths[] = { 1, 2, 4, 8, 16 };
+    struct bench_run run;
+    char path[PATH_LEN];
+    int count = 5000 * scale;
+    int depth;
+    int d;
+    int i;
+
+    for (d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+    {
+        // Build /root/getattr<depth>/x/x/.../x:
+        snprintf(path, PATH_LEN, "%s/getattr%d", root, depths[d]);
+        target->mkdir(path);
+        for (depth = 1; depth < depths[d]; ++depth)
+        {
+            strcat(path, "/x");
+            target->mkdir(path);
+        }
+
+        runBegin(&run, "getattr", count);
+        snprintf(run.param, sizeof(run.param), "depth=%d", depths[d]);
+        for (i = 0; i < count && !run.error; ++i)
+        {
+            MEASURE(&run, target->getattr(path));
+        }
+        runEnd(target, &run);
+    }
+}
+
+
+static void benchReaddir(struct bench_target* target, const char* root)
+{
+    static const int sizes[] = { 10, 100, 1000, 10000 };
+    struct bench_run run;
+    char dir[PATH_LEN / 2];
+    char path[PATH_LEN];
+    int iterations;
+    int entries;
+    int s;
+    int i;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        snprintf(dir, sizeof(dir), "%s/readdir%d", root, sizes[s]);
+        target->mkdir(dir);
+        for (i = 0; i < sizes[s]; ++i)
+        {
+            snprintf(path, PATH_LEN, "%s/e%d", dir, i);
+            target->create(path);
+        }
+
+        iterations = (20000 / sizes[s] + 10) * scale;
+        runBegin(&run, "readdir", iterations);
+        snprintf(run.param, sizeof(run.param), "entries=%d", sizes[s]);
+        for (i = 0; i < iterations && !run.error; ++i)
+        {
+            MEASURE(&run, target->readdir(dir, &entries));
+        }
+        runEnd(target, &run);
+    }
+}
+
+
+static void benchReadWrite(struct bench_target* target, const char* root)
+{
+    struct bench_run run;
+    char path[PATH_LEN];
+    char* buf;
+    off_t offset;
+    int count;
+    int i;
+
+    buf = malloc(SEQ_BLOCK_SIZE);
+    assert(buf);
+    for (i = 0; i < SEQ_BLOCK_SIZE; ++i)
+    {
+        buf[i] = (char)(i * 31 + i / 7); // Not trivially compressible.
+    }
+
+    snprintf(path, PATH_LEN, "%s/data", root);
+    target->create(path);
+
+    // Sequential:
+    count = FILE_SIZE / SEQ_BLOCK_SIZE;
+    runBegin(&run, "seq_write", count);
+    snprintf(run.param, sizeof(run.param), "block=%d", SEQ_BLOCK_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        run.bytes += transferred(MEASURE(&run, target->write(path, buf, SEQ_BLOCK_SIZE, (off_t)i * SEQ_BLOCK_SIZE)));
+    }
+    runEnd(target, &run);
+
+    runBegin(&run, "seq_read", count);
+    snprintf(run.param, sizeof(run.param), "block=%d", SEQ_BLOCK_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        run.bytes += transferred(MEASURE(&run, target->read(path, buf, SEQ_BLOCK_SIZE, (off_t)i * SEQ_BLOCK_SIZE)));
+    }
+    runEnd(target, &run);
+
+    // Random:
+    count = 2000 * scale;
+    srand(42);
+    runBegin(&run, "rand_write", count);
+    snprintf(run.param, sizeof(run.param), "block=%d", RAND_BLOCK_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        offset = (off_t)(rand() % (FILE_SIZE / RAND_BLOCK_SIZE)) * RAND_BLOCK_SIZE;
+        run.bytes += transferred(MEASURE(&run, target->write(path, buf, RAND_BLOCK_SIZE, offset)));
+    }
+    runEnd(target, &run);
+
+    runBegin(&run, "rand_read", count);
+    snprintf(run.param, sizeof(run.param), "block=%d", RAND_BLOCK_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        offset = (off_t)(rand() % (FILE_SIZE / RAND_BLOCK_SIZE)) * RAND_BLOCK_SIZE;
+        run.bytes += transferred(MEASURE(&run, target->read(path, buf, RAND_BLOCK_SIZE, offset)));
+    }
+    runEnd(target, &run);
+
+    free(buf);
+}
+
+
+static void benchSmallFiles(struct bench_target* target, const char* root)
+{
+    struct bench_run run;
+    char path[PATH_LEN];
+    char buf[SMALL_FILE_SIZE];
+    int count = 1000 * scale;
+    int i;
+
+    memset(buf, 'x', sizeof(buf));
+
+    snprintf(path, PATH_LEN, "%s/small", root);
+    target->mkdir(path);
+
+    runBegin(&run, "small_write", count);
+    snprintf(run.param, sizeof(run.param), "size=%d", SMALL_FILE_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        snprintf(path, PATH_LEN, "%s/small/f%d", root, i);
+        target->create(path);
+        run.bytes += transferred(MEASURE(&run, target->write(path, buf, SMALL_FILE_SIZE, 0)));
+    }
+    runEnd(target, &run);
+
+    // Open and read of a whole small file:
+    runBegin(&run, "small_read", count);
+    snprintf(run.param, sizeof(run.param), "size=%d", SMALL_FILE_SIZE);
+    for (i = 0; i < count && !run.error; ++i)
+    {
+        snprintf(path, PATH_LEN, "%s/small/f%d", root, i);
+        run.bytes += transferred(MEASURE(&run, target->read(path, buf, SMALL_FILE_SIZE, 0)));
+    }
+    runEnd(target, &run);
+}
+
+
+// Compression counters of this process; only available for direct calls:
+static void compressionFields(struct bench_target* target, struct bench_run* run,
+                              unsigned long long inBefore, unsigned long long outBefore,
+                              unsigned long long nsBefore, int counter)
+{
+    unsigned long long in = statsCounterTotal(STAT_COUNTER_COMPRESS_IN_BYTES) - inBefore;
+    unsigned long long out = statsCounterTotal(STAT_COUNTER_COMPRESS_OUT_BYTES) - outBefore;
+    unsigned long long ns = statsCounterTotal(counter) - nsBefore;
+
+    if (mountDir || !run->bytes)
+    {
+        return;
+    }
+
+    snprintf(run->extra, sizeof(run->extra), ",\"ratio\":%.3f,\"codec_ns_per_mib\":%.0f",
+        out ? (double)in / out : 1.0, ns * (1024.0 * 1024.0) / run->bytes);
+}
+
+
+static void benchCompression(struct bench_target* target, const char* root)
+{
+    static const char* kinds[] = { "text", "random" };
+    unsigned long long inBefore;
+    unsigned long long outBefore;
+    unsigned long long nsBefore;
+    struct bench_run run;
+    char path[PATH_LEN];
+    char* buf;
+    int count = FILE_SIZE / SEQ_BLOCK_SIZE;
+    int len;
+    int k;
+    int i;
+
+    buf = malloc(SEQ_BLOCK_SIZE);
+    assert(buf);
+
+    for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k)
+    {
+        // Log lines, or bytes no codec can shrink:
+        srand(42);
+        if (k == 0)
+        {
+            for (len = 0; len < SEQ_BLOCK_SIZE; )
+            {
+                len += snprintf(buf + len, SEQ_BLOCK_SIZE - len,
+                    "2011-06-%02d 12:%02d:%02d INFO worker-%d: request %d handled in %d ms\n",
+                    rand() % 28 + 1, rand() % 60, rand() % 60, rand() % 16, rand(), rand() % 500);
+                if (len >= SEQ_BLOCK_SIZE - 1)
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            for (i = 0; i < SEQ_BLOCK_SIZE; ++i)
+            {
+                buf[i] = (char)rand();
+            }
+        }
+
+        snprintf(path, PATH_LEN, "%s/compress-%s", root, kinds[k]);
+        target->create(path);
+
+        inBefore = statsCounterTotal(STAT_COUNTER_COMPRESS_IN_BYTES);
+        outBefore = statsCounterTotal(STAT_COUNTER_COMPRESS_OUT_BYTES);
+        nsBefore = statsCounterTotal(STAT_COUNTER_COMPRESS_NANOSECONDS);
+        runBegin(&run, "compress_write", count);
+        snprintf(run.param, sizeof(run.param), "data=%s", kinds[k]);
+        for (i = 0; i < count && !run.error; ++i)
+        {
+            run.bytes += transferred(MEASURE(&run, target->write(path, buf, SEQ_BLOCK_SIZE, (off_t)i * SEQ_BLOCK_SIZE)));
+        }
+        compressionFields(target, &run, inBefore, outBefore, nsBefore, STAT_COUNTER_COMPRESS_NANOSECONDS);
+        runEnd(target, &run);
+
+        inBefore = statsCounterTotal(STAT_COUNTER_COMPRESS_IN_BYTES);
+        outBefore = statsCounterTotal(STAT_COUNTER_COMPRESS_OUT_BYTES);
+        nsBefore = statsCounterTotal(STAT_COUNTER_DECOMPRESS_NANOSECONDS);
+        runBegin(&run, "compress_read", count);
+        snprintf(run.param, sizeof(run.param), "data=%s", kinds[k]);
+        for (i = 0; i < count && !run.error; ++i)
+        {
+            run.bytes += transferred(MEASURE(&run, target->read(path, buf, SEQ_BLOCK_SIZE, (off_t)i * SEQ_BLOCK_SIZE)));
+        }
+        if (!mountDir && run.bytes)
+        {
+            snprintf(run.extra, sizeof(run.extra), ",\"codec_ns_per_mib\":%.0f",
+                (statsCounterTotal(STAT_COUNTER_DECOMPRESS_NANOSECONDS) - nsBefore) * (1024.0 * 1024.0) / run.bytes);
+        }
+        runEnd(target, &run);
+    }
+
+    free(buf);
+}
+
+
+// Write the same data to two files; with deduplication the copy only sends hashes:
+static void benchDedup(struct bench_target* target, const char* root)
+{
+    static const char* names[] = { "orig", "copy" };
+    unsigned long long linkedBefore;
+    struct bench_run run;
+    char path[PATH_LEN];
+    char* buf;
+    int count = FILE_SIZE / SEQ_BLOCK_SIZE;
+    int k;
+    int i;
+
+    buf = malloc(FILE_SIZE);
+    assert(buf);
+
+    srand(7);
+    for (i = 0; i < FILE_SIZE; ++i)
+    {
+        buf[i] = (char)rand();
+    }
+
+    for (k = 0; k < sizeof(names) / sizeof(names[0]); ++k)
+    {
+        snprintf(path, PATH_LEN, "%s/dedup-%s", root, names[k]);
+        target->create(path);
+
+        linkedBefore = statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED);
+        runBegin(&run, "dedup_write", count);
+        snprintf(run.param, sizeof(run.param), "file=%s", names[k]);
+        for (i = 0; i < count && !run.error; ++i)
+        {
+            run.bytes += transferred(MEASURE(&run, target->write(path, buf + (size_t)i * SEQ_BLOCK_SIZE,
+                SEQ_BLOCK_SIZE, (off_t)i * SEQ_BLOCK_SIZE)));
+        }
+        if (!mountDir)
+        {
+            snprintf(run.extra, sizeof(run.extra), ",\"chunks_linked\":%llu",
+                statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED) - linkedBefore);
+        }
+        runEnd(target, &run);
+    }
+
+    free(buf);
+}
+
+
+/* ================ Main ================ */
+
+static void usage(const char* progName)
+{
+    fprintf(stderr,
+        "usage: %s [-h host] [-p port] [-N name] [-m mountpoint] [-s scale] [-v version] [-r rtt_us]\n"
+        "       [-b backend] [-c codec] [-d]\n"
+        "\n"
+        "Without -m the redifs_oper callbacks are called directly; with -m the\n"
+        "benchmarks run through system calls on a mounted file system.\n"
+        "Results are written to stdout as one JSON object per line; -r only labels\n"
+        "them with the round trip time injected by the latency proxy. -b selects\n"
+        "the storage engine, -c the compression codec and -d deduplication for\n"
+        "direct calls; they only label mounted runs.\n", progName);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .dir = NULL,
+        .port = 0,
+        .create_fs = 1,
+        .name = "redifs_bench",
+        .inline_max = DEFAULT_INLINE_MAX,
+    };
+    struct bench_target* target;
+    char root[PATH_LEN];
+    int result;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:m:s:v:r:b:c:d")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 'm': mountDir = optarg; break;
+            case 's': scale = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'v': version = optarg; break;
+            case 'r': rttUs = atoi(optarg); break;
+            case 'b': backendName = optarg; break;
+            case 'c': codec = optarg; break;
+            case 'd': dedup = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (mountDir)
+    {
+        target = &mountTarget;
+    }
+    else
+    {
+        settings.dedup = dedup;
+        g_settings = &settings;
+
+        g_defaultCodec = codecFromName(codec);
+        if (g_defaultCodec < 0)
+        {
+            fprintf(stderr, "Error: Unknown codec '%s'.\n", codec);
+            return 1;
+        }
+
+        g_backend = findBackend(backendName);
+        if (!g_backend)
+        {
+            fprintf(stderr, "Error: Unknown backend '%s'.\n", backendName);
+            return 1;
+        }
+
+        if (0 > g_backend->open())
+        {
+            fprintf(stderr, "Error: Cannot open the %s backend.\n", backendName);
+            return 1;
+        }
+
+        result = g_backend->fs_exists();
+        if (result == 0)
+        {
+            result = g_backend->fs_create();
+        }
+        if (result <= 0)
+        {
+            fprintf(stderr, "Error: Cannot create file system '%s'.\n", settings.name);
+            return 1;
+        }
+
+        if (redifs_oper.init)
+        {
+            redifs_oper.init(NULL, NULL);
+        }
+
+        target = &directTarget;
+    }
+
+    // Separate root per run, so a file system can be reused:
+    snprintf(root, PATH_LEN, "/bench-%d", (int)getpid());
+    result = target->mkdir(root);
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Cannot create %s: %s\n", root, strerror(-result));
+        return 1;
+    }
+
+    benchCreate(target, root);
+    benchGetattr(target, root);
+    benchReaddir(target, root);
+    benchReadWrite(target, root);
+    benchSmallFiles(target, root);
+    benchCompression(target, root);
+    benchDedup(target, root);
+
+    if (!mountDir)
+    {
+        if (redifs_oper.destroy)
+        {
+            redifs_oper.destroy(NULL);
+        }
+        g_backend->close();
+    }
+
+    return 0;
+}
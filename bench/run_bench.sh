@@ -0,0 +1,126 @@
+#!/bin/bash
+#
+# RediFS micro-benchmarks.
+#
+# Starts a throwaway redis-server, runs the benchmarks against the
+# redifs_oper callbacks directly and, when FUSE is usable, through a real
+# mount. For every non-zero round trip time in BENCH_RTTS, the runs are
+# repeated through redifs_latency_proxy. Results are JSON lines, written
+# to stdout and to $BUILD_DIR/bench/results-<version>-<time>.jsonl.
+# A final direct run on the in-memory backend gives the RediFS overhead
+# without Redis.
+#
+# Environment:
+#   REDIS_SERVER  redis-server binary (default: redis-server)
+#   BENCH_PORT    port for the throwaway server (default: 16379)
+#   BENCH_SCALE   multiplier for the iteration counts (default: 1)
+#   BENCH_MOUNT   set to 0 to skip the mounted run
+#   BENCH_RTTS    round trip times in microseconds (default: "0 500 2000 5000")
+#   BENCH_JITTER  jitter in microseconds added per direction (default: 0)
+#   BENCH_BANDWIDTH  bytes per second per direction, 0 is unlimited (default: 0)
+#
+
+set -e
+set -o pipefail
+
+BUILD_DIR=${1:-build}
+REDIS_SERVER=${REDIS_SERVER:-redis-server}
+BENCH_PORT=${BENCH_PORT:-16379}
+BENCH_SCALE=${BENCH_SCALE:-1}
+BENCH_MOUNT=${BENCH_MOUNT:-1}
+BENCH_RTTS=${BENCH_RTTS:-0 500 2000 5000}
+BENCH_JITTER=${BENCH_JITTER:-0}
+BENCH_BANDWIDTH=${BENCH_BANDWIDTH:-0}
+PROXY_PORT=$((BENCH_PORT + 1))
+
+VERSION=$(git describe --always --dirty 2>/dev/null || echo unknown)
+RESULTS_DIR="$BUILD_DIR/bench"
+RESULTS="$RESULTS_DIR/results-$VERSION-$(date +%Y%m%d-%H%M%S).jsonl"
+
+WORK_DIR=$(mktemp -d)
+REDIS_PID=
+PROXY_PID=
+MOUNTED=
+
+stop_proxy()
+{
+    if [ -n "$PROXY_PID" ]; then
+        kill "$PROXY_PID" 2>/dev/null || true
+        wait "$PROXY_PID" 2>/dev/null || true
+        PROXY_PID=
+    fi
+}
+
+cleanup()
+{
+    if [ -n "$MOUNTED" ]; then
+        fusermount3 -u "$WORK_DIR/mnt" 2>/dev/null || true
+    fi
+    stop_proxy
+    if [ -n "$REDIS_PID" ]; then
+        kill "$REDIS_PID" 2>/dev/null || true
+        wait "$REDIS_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+wait_for_port()
+{
+    local i=0
+    until (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null || [ $i -ge 50 ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+}
+
+mkdir -p "$RESULTS_DIR"
+
+# Throwaway Redis without persistence:
+"$REDIS_SERVER" --port "$BENCH_PORT" --bind 127.0.0.1 --save "" --appendonly no \
+    --dir "$WORK_DIR" --logfile "$WORK_DIR/redis.log" &
+REDIS_PID=$!
+wait_for_port "$BENCH_PORT"
+
+: > "$RESULTS"
+mkdir "$WORK_DIR/mnt"
+
+for RTT in $BENCH_RTTS; do
+    PORT=$BENCH_PORT
+    if [ "$RTT" != 0 ]; then
+        "$BUILD_DIR/redifs_latency_proxy" -l "$PROXY_PORT" -u "127.0.0.1:$BENCH_PORT" \
+            -d "$RTT" -j "$BENCH_JITTER" -b "$BENCH_BANDWIDTH" &
+        PROXY_PID=$!
+        wait_for_port "$PROXY_PORT"
+        PORT=$PROXY_PORT
+    fi
+
+    # Direct calls into the operations:
+    "$BUILD_DIR/redifs_bench" -h 127.0.0.1 -p "$PORT" -N "bench_direct_$RTT" \
+        -s "$BENCH_SCALE" -v "$VERSION" -r "$RTT" | tee -a "$RESULTS"
+
+    # Through a real mount:
+    if [ "$BENCH_MOUNT" != 0 ] && [ -c /dev/fuse ] && command -v fusermount3 >/dev/null; then
+        if "$BUILD_DIR/redifs" "$WORK_DIR/mnt" 127.0.0.1: "$PORT" -C; then
+            MOUNTED=1
+            "$BUILD_DIR/redifs_bench" -m "$WORK_DIR/mnt" -s "$BENCH_SCALE" -v "$VERSION" -r "$RTT" | tee -a "$RESULTS"
+            fusermount3 -u "$WORK_DIR/mnt"
+            MOUNTED=
+        else
+            echo "Mounting failed; skipping the mounted run." >&2
+        fi
+    else
+        echo "FUSE not available; skipping the mounted run." >&2
+    fi
+
+    stop_proxy
+done
+
+# RediFS's own overhead and the cost of compression and deduplication,
+# without Redis:
+for CODEC in none lz4 zstd; do
+    "$BUILD_DIR/redifs_bench" -b memory -c "$CODEC" -s "$BENCH_SCALE" -v "$VERSION" | tee -a "$RESULTS"
+done
+"$BUILD_DIR/redifs_bench" -b memory -d -s "$BENCH_SCALE" -v "$VERSION" | tee -a "$RESULTS"
+
+echo "Results written to $RESULTS" >&2
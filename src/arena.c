@@ -0,0 +1,110 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+/* ---- Types ---- */
+
+// Heap block, used once the static block of a thread is full:
+struct arena_block
+{
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+
+/* ---- Globals ---- */
+static __thread char firstBlock[ARENA_BLOCK_SIZE] __attribute__((aligned(16)));
+static __thread size_t firstUsed = 0;
+static __thread struct arena_block* blocks = NULL;
+
+
+/* ================ Arena functions ================ */
+
+/*
+ * Allocate size bytes, aligned to 16 bytes. Returns NULL when out of memory.
+*/
+void* arenaAlloc(size_t size)
+{
+    struct arena_block* block;
+    size_t blockSize;
+
+    size = (size + 15) & ~(size_t)15;
+
+    // Common case: the static block has room, no heap allocation:
+    if (!blocks && size <= ARENA_BLOCK_SIZE - firstUsed)
+    {
+        firstUsed += size;
+        return firstBlock + firstUsed - size;
+    }
+
+    block = blocks;
+    if (!block || size > block->size - block->used)
+    {
+        blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct arena_block) + blockSize);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->size = blockSize;
+        block->used = 0;
+        block->next = blocks;
+        blocks = block;
+    }
+
+    block->used += size;
+    return block->data + block->used - size;
+}
+
+
+/*
+ * Copy len bytes of str into the arena and terminate them.
+*/
+char* arenaStrndup(const char* str, size_t len)
+{
+    char* copy;
+
+    copy = arenaAlloc(len + 1);
+    if (copy)
+    {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+
+    return copy;
+}
+
+
+/*
+ * Release everything allocated by this thread.
+*/
+void arenaReset()
+{
+    struct arena_block* next;
+
+    while (blocks)
+    {
+        next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+
+    firstUsed = 0;
+}
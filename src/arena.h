@@ -0,0 +1,33 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+
+
+/* ---- Defines ---- */
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+
+/* ================ Arena functions ================ */
+
+// Per-thread bump allocator for memory that lives until the current
+// operation returns. arenaReset() is called after every FUSE operation.
+extern void* arenaAlloc(size_t size);
+extern char* arenaStrndup(const char* str, size_t len);
+extern void arenaReset();
+
+
+#endif // _ARENA_H_
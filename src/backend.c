@@ -0,0 +1,47 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <string.h>
+
+#include "backend.h"
+
+
+/* ---- Globals ---- */
+const struct redifs_backend* g_backend = &redisBackend;
+
+
+static const struct redifs_backend* backends[] = {
+    &redisBackend,
+    &memoryBackend,
+};
+
+
+/* ================ Backend functions ================ */
+
+/*
+ * Look up a backend by name.
+*/
+const struct redifs_backend* findBackend(const char* name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i)
+    {
+        if (0 == strcmp(backends[i]->name, name))
+        {
+            return backends[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,246 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _BACKEND_H_
+#define _BACKEND_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "redifs_types.h"
+
+
+/* ---- Defines ---- */
+#define CHUNK_SIZE (64 * 1024)
+#define DEFAULT_BACKEND "redis"
+#define DEFAULT_INLINE_MAX 4096
+#define DEFAULT_CAPACITY_MB (1024 * 1024) // Size statfs reports without a root quota.
+#define INLINE_MAX_LIMIT CHUNK_SIZE
+#define CHUNK_FRAME_MAX (CHUNK_SIZE + 1) // Compressed chunk with its codec byte.
+#define APPEND_SLACK CHUNK_SIZE // Growth by other writers that an append tolerates, see file_append.
+
+
+/* ---- Node info fields ---- */
+enum
+{
+    NODE_INFO_MODE = 0,
+    NODE_INFO_UID,
+    NODE_INFO_GID,
+    NODE_INFO_ACCESS_TIME_SEC,
+    NODE_INFO_ACCESS_TIME_NSEC,
+    NODE_INFO_MOD_TIME_SEC,
+    NODE_INFO_MOD_TIME_NSEC,
+    NODE_INFO_SIZE,
+    NODE_INFO_FLAGS,
+    NODE_INFO_COUNT
+};
+
+// Node flags:
+#define NODE_FLAG_INLINE 0x1 // File data is stored with the node info.
+#define NODE_FLAG_DEDUP 0x2 // Chunks are content-addressed blobs, see dedup.h.
+#define NODE_FLAG_TIERED 0x4 // Chunks may be in the cold store, see tier.c.
+#define NODE_FLAG_CODEC_SHIFT 4
+#define NODE_FLAG_CODEC_MASK 0xf0 // Compression codec + 1, see compress.h.
+
+// dir_unlink flags:
+#define DIR_UNLINK_DIR 0x1 // Remove an empty directory instead of a file.
+#define DIR_UNLINK_TREE 0x2 // Remove a file or a whole directory tree.
+
+// dir_rename flags:
+#define DIR_RENAME_NOREPLACE 0x1 // Fail if the new name exists.
+#define DIR_RENAME_EXCHANGE 0x2 // Swap two existing entries.
+
+
+/* ---- Types ---- */
+
+// Called for every directory entry; a non-zero return value stops the listing.
+typedef int (*dir_entry_fn)(void* ctx, const char* name);
+
+// Called for every snapshot with its generation; a non-zero return value stops the listing.
+typedef int (*snapshot_entry_fn)(void* ctx, const char* name, long long gen);
+
+// Called for every node of a tree walk, with its path below the root of the walk:
+typedef void (*tree_entry_fn)(void* ctx, const char* path, node_id_t nodeId, long long mode, long long size);
+
+// Node info together with the inline data of small files:
+struct node_record
+{
+    long long info[NODE_INFO_COUNT];
+    const char* data; // Valid until the end of the operation.
+    size_t len;
+};
+
+// Space used below a directory and its quota; a limit of 0 means none:
+struct dir_usage
+{
+    long long bytes; // Logical file sizes.
+    long long inodes; // Nodes below the directory, not counting itself.
+    long long maxBytes;
+    long long maxInodes;
+};
+
+
+/* ================ Backend interface ================ */
+
+// Storage engine for metadata and file data. All functions return a
+// negative errno value on failure. Node IDs are never negative; the
+// root directory is node 0.
+struct redifs_backend
+{
+    const char* name;
+
+    int (*open)();
+    void (*close)();
+    int (*fs_exists)();
+    int (*fs_create)();
+
+    // Paths and nodes. The path to resolve is a view of len bytes.
+    // create_node atomically creates a node with info and links it as name
+    // in dirId, returning its ID. It fails with -EEXIST if the name exists,
+    // and with -EDQUOT past a quota, without creating anything.
+    node_id_t (*resolve)(const char* path, size_t len);
+    node_id_t (*create_node)(node_id_t dirId, const char* name, const long long info[NODE_INFO_COUNT]);
+    int (*get_info)(node_id_t nodeId, long long info[NODE_INFO_COUNT]);
+    int (*set_info)(node_id_t nodeId, int first, int count, const long long values[]);
+    int (*get_node)(node_id_t nodeId, struct node_record* node);
+    int (*set_inline)(node_id_t nodeId, const char* data, size_t len);
+
+    // Set the access and modification times of count nodes at once, as
+    // seconds and nanoseconds of each; a time with UTIME_OMIT nanoseconds
+    // stays. Nodes that no longer exist are skipped.
+    int (*set_times)(int count, const node_id_t nodeIds[], const long long times[][4]);
+
+    // Directories. dir_list passes the entry names to fn until it returns
+    // non-zero; entries changed during a listing of a large directory may
+    // be passed twice, or not at all if they were added or removed.
+    int (*dir_list)(node_id_t dirId, dir_entry_fn fn, void* ctx);
+
+    // Atomically remove an entry and queue its node for reclaim. The entry
+    // must be an empty directory with DIR_UNLINK_DIR, and must not be a
+    // directory without it; DIR_UNLINK_TREE accepts any entry. Returns the
+    // ID of the removed node.
+    node_id_t (*dir_unlink)(node_id_t dirId, const char* name, int flags);
+
+    // Atomically move an entry, possibly to another directory. An existing
+    // entry at the new name is replaced following rename(2): directories
+    // only by empty directories, files only by files. The replaced node is
+    // queued for reclaim and its ID returned, or 0 if there was none.
+    node_id_t (*dir_rename)(node_id_t srcDirId, const char* srcName, node_id_t dstDirId, const char* dstName,
+                            int flags);
+
+    // Free the storage of queued nodes: their chunks, blob references and
+    // info, and the entries of directories, which are queued in turn.
+    // reclaim does about max units of work, a chunk or an entry each, and
+    // returns the units done, 0 once the queue is empty; freed receives the
+    // number of objects freed.
+    int (*reclaim)(int max, int* freed);
+
+    // Walk the tree below a directory inside the backend, breadth first.
+    // tree_walk_next passes about max more nodes to fn and returns 1 while
+    // nodes remain, 0 once the walk is complete. Changes made during a walk
+    // may or may not be seen. tree_walk_close ends a walk at any point.
+    int (*tree_walk_open)(node_id_t dirId, void** walk);
+    int (*tree_walk_next)(void* walk, tree_entry_fn fn, void* ctx, int max);
+    void (*tree_walk_close)(void* walk);
+
+    // Usage accounting. Every change that would take a directory or one
+    // above it past its quota fails with -EDQUOT. dir_quota sets the limits
+    // of a directory, 0 to lift one.
+    int (*dir_usage)(node_id_t dirId, struct dir_usage* usage);
+    int (*dir_quota)(node_id_t dirId, long long maxBytes, long long maxInodes);
+
+    // File data, per chunk of CHUNK_SIZE bytes. chunk_read returns the number
+    // of stored bytes copied; anything past that reads as zeros.
+    int (*chunk_read)(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset);
+    int (*chunk_write)(node_id_t nodeId, long long chunk, const char* buf, size_t size, off_t offset);
+    int (*chunk_truncate)(node_id_t nodeId, long long chunk, off_t length);
+
+    // Atomically append len bytes at the end of a file without a codec or
+    // deduplication, together with its size and modification time. Inline
+    // data grows up to inlineMax and moves to the chunks past that. *size
+    // is the end as the caller knows it; the chunks up to len + APPEND_SLACK
+    // bytes past it are prepared for the change. Returns 0 with *size set to
+    // the offset the data went to, or -EAGAIN with *size set to the actual
+    // end if the data would land elsewhere or in a chunk of the cold store.
+    int (*file_append)(node_id_t nodeId, const char* data, size_t len, size_t inlineMax, const long long mtime[2],
+                       off_t* size);
+
+    // Atomically set the modification time of a file and raise its size to
+    // *size unless it is larger already, charging the growth to the
+    // directories above it. Writers call it before they store data, so
+    // writers extending a file at once never shrink it, and a quota refuses
+    // a write with -EDQUOT before anything changes. *size is set to the
+    // resulting size.
+    int (*file_extend)(node_id_t nodeId, const long long mtime[2], off_t* size);
+
+    // Whole chunk values, for compressed chunks. chunk_get returns the
+    // value length, 0 for a missing chunk:
+    int (*chunk_get)(node_id_t nodeId, long long chunk, char* buf, size_t size);
+    int (*chunk_put)(node_id_t nodeId, long long chunk, const char* data, size_t len);
+
+    // Chunks of NODE_FLAG_TIERED files that were moved to the cold store
+    // leave a stub with the name of their object. chunk_stub copies the
+    // object name of a chunk into name and returns 1, or returns 0 if the
+    // chunk is not in the cold store. chunk_restore puts the chunk value
+    // back, unless data is NULL for a chunk being deleted, and removes the
+    // stub if it still names object; it returns 0 if not, 1 if it did, and
+    // 2 if that was the last stub of the file, which then loses
+    // NODE_FLAG_TIERED.
+    int (*chunk_stub)(node_id_t nodeId, long long chunk, char* name, size_t size);
+    int (*chunk_restore)(node_id_t nodeId, long long chunk, const char* object, const char* data, size_t len);
+
+    // Content-addressed chunks of NODE_FLAG_DEDUP files. A chunk refers to a
+    // reference counted blob by the hash of its raw data; blobs hold chunk
+    // frames. dedup_get works like chunk_get. dedup_link points a chunk at
+    // the blob of hash and returns 1, or returns 0 if no such blob exists and
+    // data is NULL; with data it creates the blob. dedup_drop removes the
+    // reference of a chunk. Blobs losing their last reference become
+    // candidates for blob_gc, which checks up to max candidates and returns
+    // the number checked. Every call is atomic in the backend.
+    int (*dedup_get)(node_id_t nodeId, long long chunk, char* buf, size_t size);
+    int (*dedup_link)(node_id_t nodeId, long long chunk, const char* hash, const char* data, size_t len);
+    int (*dedup_drop)(node_id_t nodeId, long long chunk);
+    int (*blob_gc)(int max, int* freed);
+
+    // Copies between files that keep the data in the backend. chunk_copy
+    // copies len bytes of plain chunk data between any file offsets;
+    // chunk_clone copies count whole stored chunks, or shares their blobs
+    // if dedup is set. Missing source chunks become holes.
+    int (*chunk_copy)(node_id_t srcId, off_t srcOffset, node_id_t dstId, off_t dstOffset, size_t len);
+    int (*chunk_clone)(node_id_t srcId, long long srcChunk, node_id_t dstId, long long dstChunk,
+                       long long count, int dedup);
+
+    // Point-in-time snapshots of the whole file system. Creating one is
+    // constant time; objects are copied when they first change afterwards.
+    // snapshot_delete frees what no other snapshot shares and returns the
+    // number of objects freed. When the settings name a snapshot, open()
+    // gives a read-only view of it instead of the live file system.
+    int (*snapshot_create)(const char* name);
+    int (*snapshot_delete)(const char* name);
+    int (*snapshot_list)(snapshot_entry_fn fn, void* ctx);
+};
+
+
+/* ---- Globals ---- */
+extern const struct redifs_backend* g_backend;
+
+extern const struct redifs_backend redisBackend;
+extern const struct redifs_backend memoryBackend;
+
+
+/* ================ Backend functions ================ */
+
+extern const struct redifs_backend* findBackend(const char* name);
+
+
+#endif // _BACKEND_H_
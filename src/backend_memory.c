@@ -0,0 +1,1851 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * In-process storage engine. Nothing is persisted; the file system lives
+ * as long as the mount. It is used to measure RediFS's own overhead
+ * without Redis, for tests, and as a tmpfs-like fast path.
+ *
+ * All tables grow by installing zeroed pages with compare-and-swap, so
+ * lookups, reads and writes take no lock. Links, renames and removals
+ * are serialized by a mutex, and so is reclaim by its own. Memory that
+ * concurrent readers may still look at (directory entries, dropped
+ * chunks) is only freed when the engine is closed.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "backend.h"
+#include "dedup.h"
+#include "options.h"
+#include "path.h"
+
+
+/* ---- Defines ---- */
+#define MEM_NODE_PAGE_SIZE 4096
+#define MEM_NODE_PAGES 4096
+#define MEM_DIR_BUCKETS 256
+#define MEM_CHUNK_PAGE_SIZE 512
+#define MEM_CHUNK_PAGES 1024
+#define MEM_BLOB_BUCKETS 65536
+
+#define MEM_NODE_REMOVED -1
+#define MEM_BLOB_DEAD -1
+
+
+/* ---- Types ---- */
+struct mem_dirent
+{
+    struct mem_dirent* next;
+    node_id_t nodeId; // MEM_NODE_REMOVED after unlinking.
+    unsigned int hash;
+    size_t len;
+    char name[];
+};
+
+struct mem_chunk
+{
+    size_t len; // Stored bytes; the rest of the chunk reads as zeros.
+    size_t capacity;
+    char data[];
+};
+
+// Deduplicated chunk. Blobs stay in the table for the life of the engine;
+// collecting one only drops its frame.
+struct mem_blob
+{
+    struct mem_blob* next;
+    long refs; // MEM_BLOB_DEAD once collected.
+    struct mem_chunk* frame;
+    char hash[CHUNK_HASH_LEN + 1];
+};
+
+struct mem_gc_entry
+{
+    struct mem_gc_entry* next;
+    struct mem_blob* blob;
+};
+
+struct mem_inline
+{
+    size_t len;
+    char data[];
+};
+
+struct mem_node
+{
+    long long info[NODE_INFO_COUNT];
+    struct mem_inline* inlineData;
+    struct mem_dirent** buckets;
+    struct mem_chunk*** chunkPages;
+    struct mem_blob*** blobPages; // Chunks of deduplicated files.
+};
+
+struct mem_retired
+{
+    struct mem_retired* next;
+    void* ptr;
+};
+
+struct mem_orphan
+{
+    struct mem_orphan* next;
+    node_id_t nodeId;
+};
+
+// Directory that a tree walk has yet to visit:
+struct mem_walk_dir
+{
+    struct mem_walk_dir* next;
+    node_id_t nodeId;
+    char path[]; // Below the root of the walk, ending with a slash unless empty.
+};
+
+struct mem_walk
+{
+    struct mem_walk_dir* head;
+    struct mem_walk_dir* tail;
+};
+
+
+/* ---- Globals ---- */
+static struct mem_node** nodePages[MEM_NODE_PAGES];
+static node_id_t nextNodeId = 0;
+static struct mem_retired* retired = NULL;
+static struct mem_blob* blobBuckets[MEM_BLOB_BUCKETS];
+static struct mem_gc_entry* gcCandidates = NULL;
+static struct mem_orphan* orphans = NULL; // Removed nodes waiting for reclaim.
+
+
+/* ================ Util functions ================ */
+
+// Return the pointer in slot, installing a zeroed allocation of size bytes first if it is empty:
+static void* installZeroed(void** slot, size_t size)
+{
+    void* expected = NULL;
+    void* ptr;
+
+    ptr = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (ptr)
+    {
+        return ptr;
+    }
+
+    ptr = calloc(1, size);
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(slot, &expected, ptr, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(ptr);
+        return expected; // Another thread won.
+    }
+
+    return ptr;
+}
+
+
+// Free ptr when the engine is closed:
+static void retire(void* ptr)
+{
+    struct mem_retired* entry;
+
+    entry = malloc(sizeof(struct mem_retired));
+    if (!entry)
+    {
+        return; // Leak rather than risk a use after free.
+    }
+
+    entry->ptr = ptr;
+    entry->next = __atomic_load_n(&retired, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&retired, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+static unsigned int hashName(const char* name, size_t len)
+{
+    unsigned int hash = 2166136261u; // FNV-1a.
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+static struct mem_node* getNode(node_id_t nodeId)
+{
+    struct mem_node** page;
+
+    if (nodeId < 0 || nodeId >= (node_id_t)MEM_NODE_PAGE_SIZE * MEM_NODE_PAGES)
+    {
+        return NULL;
+    }
+
+    page = __atomic_load_n(&nodePages[nodeId / MEM_NODE_PAGE_SIZE], __ATOMIC_ACQUIRE);
+    if (!page)
+    {
+        return NULL;
+    }
+
+    return __atomic_load_n(&page[nodeId % MEM_NODE_PAGE_SIZE], __ATOMIC_ACQUIRE);
+}
+
+
+static struct mem_dirent* findEntry(struct mem_node* dir, const char* name, size_t len)
+{
+    struct mem_dirent** buckets;
+    struct mem_dirent* entry;
+    unsigned int hash;
+
+    buckets = __atomic_load_n(&dir->buckets, __ATOMIC_ACQUIRE);
+    if (!buckets)
+    {
+        return NULL;
+    }
+
+    hash = hashName(name, len);
+    entry = __atomic_load_n(&buckets[hash % MEM_DIR_BUCKETS], __ATOMIC_ACQUIRE);
+    for (; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->len == len && 0 == memcmp(entry->name, name, len))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+// Slot of a chunk in a two level page table of pointers:
+static void** pageSlot(void**** pagesPtr, long long chunk, int create)
+{
+    void*** pages;
+    void** page;
+
+    if (chunk < 0 || chunk >= (long long)MEM_CHUNK_PAGE_SIZE * MEM_CHUNK_PAGES)
+    {
+        return NULL;
+    }
+
+    if (create)
+    {
+        pages = installZeroed((void**)pagesPtr, MEM_CHUNK_PAGES * sizeof(void**));
+        page = pages ? installZeroed((void**)&pages[chunk / MEM_CHUNK_PAGE_SIZE], MEM_CHUNK_PAGE_SIZE * sizeof(void*)) : NULL;
+    }
+    else
+    {
+        pages = __atomic_load_n(pagesPtr, __ATOMIC_ACQUIRE);
+        page = pages ? __atomic_load_n(&pages[chunk / MEM_CHUNK_PAGE_SIZE], __ATOMIC_ACQUIRE) : NULL;
+    }
+
+    return page ? &page[chunk % MEM_CHUNK_PAGE_SIZE] : NULL;
+}
+
+
+static struct mem_chunk** chunkSlot(struct mem_node* node, long long chunk, int create)
+{
+    return (struct mem_chunk**)pageSlot((void****)&node->chunkPages, chunk, create);
+}
+
+
+static struct mem_blob** blobSlot(struct mem_node* node, long long chunk, int create)
+{
+    return (struct mem_blob**)pageSlot((void****)&node->blobPages, chunk, create);
+}
+
+
+/* ================ Setup ================ */
+
+static node_id_t newNode(const long long info[NODE_INFO_COUNT]);
+
+
+static int memoryOpen()
+{
+    long long info[NODE_INFO_COUNT];
+
+    // Nothing outlives the process, so there are no snapshots to mount:
+    if (g_settings->snapshot)
+    {
+        fprintf(stderr, "Error: The memory backend has no snapshots.\n");
+        return -EOPNOTSUPP;
+    }
+
+    if (getNode(0))
+    {
+        return 0;
+    }
+
+    // The file system always exists; create the root directory:
+    memset(info, 0, sizeof(info));
+    info[NODE_INFO_MODE] = S_IFDIR | 0755;
+
+    return newNode(info) == 0 ? 0 : -ENOMEM;
+}
+
+
+static void memoryClose()
+{
+    struct mem_retired* entry;
+
+    entry = __atomic_exchange_n(&retired, NULL, __ATOMIC_ACQUIRE);
+    while (entry)
+    {
+        struct mem_retired* next = entry->next;
+        free(entry->ptr);
+        free(entry);
+        entry = next;
+    }
+}
+
+
+static int memoryFsExists()
+{
+    return getNode(0) ? 1 : 0;
+}
+
+
+static int memoryFsCreate()
+{
+    return 0 == memoryOpen() ? 1 : 0;
+}
+
+
+/* ================ Nodes ================ */
+
+static node_id_t memoryResolve(const char* path, size_t len)
+{
+    struct path_view rest = { path, len };
+    struct path_view component;
+    struct mem_dirent* entry;
+    struct mem_node* dir;
+    node_id_t nodeId = 0;
+
+    while (nextPathComponent(&rest, &component))
+    {
+        dir = getNode(nodeId);
+        entry = dir ? findEntry(dir, component.ptr, component.len) : NULL;
+        if (!entry)
+        {
+            return -ENOENT;
+        }
+
+        nodeId = __atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE);
+        if (nodeId < 0)
+        {
+            return -ENOENT;
+        }
+    }
+
+    return nodeId;
+}
+
+
+static node_id_t newNode(const long long info[NODE_INFO_COUNT])
+{
+    struct mem_node** page;
+    struct mem_node* node;
+    node_id_t nodeId;
+
+    nodeId = __atomic_fetch_add(&nextNodeId, 1, __ATOMIC_RELAXED);
+    if (nodeId >= (node_id_t)MEM_NODE_PAGE_SIZE * MEM_NODE_PAGES)
+    {
+        return -ENOSPC;
+    }
+
+    node = calloc(1, sizeof(struct mem_node));
+    if (!node)
+    {
+        return -ENOMEM;
+    }
+    memcpy(node->info, info, sizeof(node->info));
+
+    page = installZeroed((void**)&nodePages[nodeId / MEM_NODE_PAGE_SIZE], MEM_NODE_PAGE_SIZE * sizeof(struct mem_node*));
+    if (!page)
+    {
+        free(node);
+        return -ENOMEM;
+    }
+
+    // Publish the fully initialized node:
+    __atomic_store_n(&page[nodeId % MEM_NODE_PAGE_SIZE], node, __ATOMIC_RELEASE);
+
+    return nodeId;
+}
+
+
+static int memoryGetInfo(node_id_t nodeId, long long info[NODE_INFO_COUNT])
+{
+    struct mem_node* node;
+    int i;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    for (i = 0; i < NODE_INFO_COUNT; ++i)
+    {
+        info[i] = __atomic_load_n(&node->info[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+
+static int memorySetInfo(node_id_t nodeId, int first, int count, const long long values[])
+{
+    struct mem_node* node;
+    int i;
+
+    assert(first >= 0 && first + count <= NODE_INFO_COUNT);
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        __atomic_store_n(&node->info[first + i], values[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+
+static int memoryGetNode(node_id_t nodeId, struct node_record* node)
+{
+    struct mem_inline* inlineData;
+    struct mem_node* memNode;
+    int result;
+
+    result = memoryGetInfo(nodeId, node->info);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // Replaced buffers are retired, not freed, so no copy is needed:
+    memNode = getNode(nodeId);
+    inlineData = __atomic_load_n(&memNode->inlineData, __ATOMIC_ACQUIRE);
+    node->data = inlineData ? inlineData->data : NULL;
+    node->len = inlineData ? inlineData->len : 0;
+
+    return 0;
+}
+
+
+static int memorySetInline(node_id_t nodeId, const char* data, size_t len)
+{
+    struct mem_inline* inlineData;
+    struct mem_node* node;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    inlineData = malloc(sizeof(struct mem_inline) + len);
+    if (!inlineData)
+    {
+        return -ENOMEM;
+    }
+    inlineData->len = len;
+    memcpy(inlineData->data, data, len);
+
+    inlineData = __atomic_exchange_n(&node->inlineData, inlineData, __ATOMIC_ACQ_REL);
+    if (inlineData)
+    {
+        retire(inlineData);
+    }
+
+    return 0;
+}
+
+
+static int memorySetTimes(int count, const node_id_t nodeIds[], const long long times[][4])
+{
+    struct mem_node* node;
+    int i;
+    int j;
+
+    for (i = 0; i < count; ++i)
+    {
+        node = getNode(nodeIds[i]);
+        if (!node)
+        {
+            continue;
+        }
+
+        for (j = 0; j < 4; j += 2)
+        {
+            if (times[i][j + 1] != UTIME_OMIT)
+            {
+                __atomic_store_n(&node->info[NODE_INFO_ACCESS_TIME_SEC + j], times[i][j], __ATOMIC_RELAXED);
+                __atomic_store_n(&node->info[NODE_INFO_ACCESS_TIME_SEC + j + 1], times[i][j + 1], __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* ================ Directories ================ */
+
+static int memoryDirList(node_id_t dirId, dir_entry_fn fn, void* ctx)
+{
+    struct mem_dirent** buckets;
+    struct mem_dirent* entry;
+    struct mem_node* dir;
+    int i;
+
+    dir = getNode(dirId);
+    if (!dir)
+    {
+        return -ENOENT;
+    }
+
+    buckets = __atomic_load_n(&dir->buckets, __ATOMIC_ACQUIRE);
+    if (!buckets)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < MEM_DIR_BUCKETS; ++i)
+    {
+        entry = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+        for (; entry; entry = entry->next)
+        {
+            if (__atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE) >= 0 && fn(ctx, entry->name))
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+// Links, renames and removals are serialized among themselves. Lookups
+// never miss a moved entry, but may briefly find it under both names.
+static pthread_mutex_t entryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Queue a removed node for memoryReclaim():
+static int queueOrphan(node_id_t nodeId)
+{
+    struct mem_orphan* entry;
+
+    entry = malloc(sizeof(struct mem_orphan));
+    if (!entry)
+    {
+        return -ENOMEM;
+    }
+
+    entry->nodeId = nodeId;
+    entry->next = __atomic_load_n(&orphans, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&orphans, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+
+// Point entry name of dir at a node, with entryMutex held:
+static int linkEntry(struct mem_node* dir, const char* name, node_id_t nodeId)
+{
+    struct mem_dirent** buckets;
+    struct mem_dirent** bucket;
+    struct mem_dirent* entry;
+    size_t len = strlen(name);
+
+    // Existing (possibly removed) entries are reused, like HSET overwrites a field:
+    entry = findEntry(dir, name, len);
+    if (entry)
+    {
+        __atomic_store_n(&entry->nodeId, nodeId, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    buckets = installZeroed((void**)&dir->buckets, MEM_DIR_BUCKETS * sizeof(struct mem_dirent*));
+    entry = malloc(sizeof(struct mem_dirent) + len + 1);
+    if (!buckets || !entry)
+    {
+        free(entry);
+        return -ENOMEM;
+    }
+
+    entry->nodeId = nodeId;
+    entry->hash = hashName(name, len);
+    entry->len = len;
+    memcpy(entry->name, name, len + 1);
+
+    bucket = &buckets[entry->hash % MEM_DIR_BUCKETS];
+    entry->next = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(bucket, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    return 0;
+}
+
+
+static node_id_t memoryCreateNode(node_id_t dirId, const char* name, const long long info[NODE_INFO_COUNT])
+{
+    struct mem_dirent* entry;
+    struct mem_node* dir;
+    node_id_t nodeId;
+    int result;
+
+    dir = getNode(dirId);
+    if (!dir)
+    {
+        return -ENOENT;
+    }
+    else if (!S_ISDIR(__atomic_load_n(&dir->info[NODE_INFO_MODE], __ATOMIC_RELAXED)))
+    {
+        return -ENOTDIR;
+    }
+
+    // Another create may have taken the name since the lookup:
+    pthread_mutex_lock(&entryMutex);
+    entry = findEntry(dir, name, strlen(name));
+    if (entry && __atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE) >= 0)
+    {
+        nodeId = -EEXIST;
+    }
+    else
+    {
+        nodeId = newNode(info);
+        result = nodeId < 0 ? 0 : linkEntry(dir, name, nodeId);
+        if (result < 0)
+        {
+            queueOrphan(nodeId);
+            nodeId = result;
+        }
+    }
+    pthread_mutex_unlock(&entryMutex);
+
+    return nodeId;
+}
+
+
+static int isDirNode(node_id_t nodeId)
+{
+    struct mem_node* node = getNode(nodeId);
+    return node && S_ISDIR(__atomic_load_n(&node->info[NODE_INFO_MODE], __ATOMIC_RELAXED));
+}
+
+
+static int hasEntries(node_id_t dirId)
+{
+    struct mem_dirent** buckets;
+    struct mem_dirent* entry;
+    struct mem_node* dir;
+    int i;
+
+    dir = getNode(dirId);
+    buckets = dir ? __atomic_load_n(&dir->buckets, __ATOMIC_ACQUIRE) : NULL;
+    if (!buckets)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < MEM_DIR_BUCKETS; ++i)
+    {
+        entry = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+        for (; entry; entry = entry->next)
+        {
+            if (__atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE) >= 0)
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static node_id_t memoryDirUnlink(node_id_t dirId, const char* name, int flags)
+{
+    struct mem_dirent* entry;
+    struct mem_node* dir;
+    node_id_t nodeId = MEM_NODE_REMOVED;
+    node_id_t result;
+
+    dir = getNode(dirId);
+    if (!dir)
+    {
+        return -ENOENT;
+    }
+
+    pthread_mutex_lock(&entryMutex);
+
+    entry = findEntry(dir, name, strlen(name));
+    if (entry)
+    {
+        nodeId = __atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE);
+    }
+
+    if (nodeId < 0)
+    {
+        result = -ENOENT;
+    }
+    else if (flags & DIR_UNLINK_TREE)
+    {
+        result = 0;
+    }
+    else if (!(flags & DIR_UNLINK_DIR))
+    {
+        result = isDirNode(nodeId) ? -EISDIR : 0;
+    }
+    else if (!isDirNode(nodeId))
+    {
+        result = -ENOTDIR;
+    }
+    else
+    {
+        result = hasEntries(nodeId) ? -ENOTEMPTY : 0;
+    }
+
+    if (result == 0)
+    {
+        result = queueOrphan(nodeId);
+        if (result == 0)
+        {
+            __atomic_store_n(&entry->nodeId, MEM_NODE_REMOVED, __ATOMIC_RELEASE);
+            result = nodeId;
+        }
+    }
+
+    pthread_mutex_unlock(&entryMutex);
+
+    return result;
+}
+
+
+static node_id_t memoryDirRename(node_id_t srcDirId, const char* srcName, node_id_t dstDirId, const char* dstName,
+                                 int flags)
+{
+    struct mem_dirent* srcEntry;
+    struct mem_dirent* dstEntry;
+    struct mem_node* srcDir;
+    struct mem_node* dstDir;
+    node_id_t nodeId = MEM_NODE_REMOVED;
+    node_id_t other = MEM_NODE_REMOVED;
+    node_id_t result = 0;
+
+    srcDir = getNode(srcDirId);
+    dstDir = getNode(dstDirId);
+    if (!srcDir || !dstDir)
+    {
+        return -ENOENT;
+    }
+
+    pthread_mutex_lock(&entryMutex);
+
+    srcEntry = findEntry(srcDir, srcName, strlen(srcName));
+    if (srcEntry)
+    {
+        nodeId = __atomic_load_n(&srcEntry->nodeId, __ATOMIC_ACQUIRE);
+    }
+    dstEntry = findEntry(dstDir, dstName, strlen(dstName));
+    if (dstEntry)
+    {
+        other = __atomic_load_n(&dstEntry->nodeId, __ATOMIC_ACQUIRE);
+    }
+
+    if (nodeId < 0)
+    {
+        result = -ENOENT;
+    }
+    else if (flags & DIR_RENAME_EXCHANGE)
+    {
+        if (other < 0)
+        {
+            result = -ENOENT;
+        }
+        else
+        {
+            __atomic_store_n(&dstEntry->nodeId, nodeId, __ATOMIC_RELEASE);
+            __atomic_store_n(&srcEntry->nodeId, other, __ATOMIC_RELEASE);
+        }
+    }
+    else if (other >= 0 && (flags & DIR_RENAME_NOREPLACE))
+    {
+        result = -EEXIST;
+    }
+    else if (other == nodeId)
+    {
+        // Both names already refer to the node.
+    }
+    else if (other >= 0 && isDirNode(nodeId) && !isDirNode(other))
+    {
+        result = -ENOTDIR;
+    }
+    else if (other >= 0 && !isDirNode(nodeId) && isDirNode(other))
+    {
+        result = -EISDIR;
+    }
+    else if (other >= 0 && hasEntries(other))
+    {
+        result = -ENOTEMPTY;
+    }
+    else
+    {
+        result = other > 0 ? queueOrphan(other) : 0;
+        if (result == 0)
+        {
+            result = linkEntry(dstDir, dstName, nodeId);
+        }
+        if (result == 0)
+        {
+            __atomic_store_n(&srcEntry->nodeId, MEM_NODE_REMOVED, __ATOMIC_RELEASE);
+            result = other > 0 ? other : 0;
+        }
+    }
+
+    pthread_mutex_unlock(&entryMutex);
+
+    return result;
+}
+
+
+/* ================ File data ================ */
+
+static struct mem_chunk** findChunkSlot(node_id_t nodeId, long long chunk, int create, int* error)
+{
+    struct mem_chunk** slot;
+    struct mem_node* node;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        *error = -ENOENT;
+        return NULL;
+    }
+
+    slot = chunkSlot(node, chunk, create);
+    *error = slot || !create ? 0 : chunk < 0 ? -EINVAL : -EFBIG;
+
+    return slot;
+}
+
+
+static struct mem_chunk* newChunk(const char* data, size_t len, size_t capacity)
+{
+    struct mem_chunk* memChunk;
+
+    memChunk = malloc(sizeof(struct mem_chunk) + capacity);
+    if (memChunk)
+    {
+        memChunk->len = len;
+        memChunk->capacity = capacity;
+        if (len > 0)
+        {
+            memcpy(memChunk->data, data, len);
+        }
+        memset(memChunk->data + len, 0, capacity - len);
+    }
+
+    return memChunk;
+}
+
+
+static int memoryChunkRead(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset)
+{
+    struct mem_chunk** slot;
+    struct mem_chunk* memChunk;
+    size_t len;
+    int error;
+
+    assert(offset + size <= CHUNK_SIZE);
+
+    slot = findChunkSlot(nodeId, chunk, 0, &error);
+    memChunk = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+    if (!memChunk)
+    {
+        return error; // Hole.
+    }
+
+    len = __atomic_load_n(&memChunk->len, __ATOMIC_ACQUIRE);
+    if (len <= offset)
+    {
+        return 0;
+    }
+    if (size > len - offset)
+    {
+        size = len - offset;
+    }
+
+    memcpy(buf, memChunk->data + offset, size);
+
+    return size;
+}
+
+
+static int memoryChunkWrite(node_id_t nodeId, long long chunk, const char* buf, size_t size, off_t offset)
+{
+    struct mem_chunk** slot;
+    struct mem_chunk* memChunk;
+    struct mem_chunk* grown;
+    size_t len;
+    int error;
+
+    assert(offset + size <= CHUNK_SIZE);
+
+    slot = findChunkSlot(nodeId, chunk, 1, &error);
+    if (!slot)
+    {
+        return error;
+    }
+
+    // Make sure a full sized chunk is installed; values stored with
+    // chunk_put are only as large as needed:
+    memChunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    while (!memChunk || memChunk->capacity < CHUNK_SIZE)
+    {
+        grown = memChunk ? newChunk(memChunk->data, memChunk->len, CHUNK_SIZE) : newChunk(NULL, 0, CHUNK_SIZE);
+        if (!grown)
+        {
+            return -ENOMEM;
+        }
+
+        if (__atomic_compare_exchange_n(slot, &memChunk, grown, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            if (memChunk)
+            {
+                retire(memChunk);
+            }
+            memChunk = grown;
+            break;
+        }
+        free(grown);
+    }
+
+    memcpy(memChunk->data + offset, buf, size);
+
+    // Raise the stored length:
+    len = __atomic_load_n(&memChunk->len, __ATOMIC_RELAXED);
+    while (len < offset + size
+        && !__atomic_compare_exchange_n(&memChunk->len, &len, offset + size, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+
+static int memoryChunkTruncate(node_id_t nodeId, long long chunk, off_t length)
+{
+    struct mem_chunk** slot;
+    struct mem_chunk* memChunk;
+    size_t len;
+    int error;
+
+    slot = findChunkSlot(nodeId, chunk, 0, &error);
+    if (!slot)
+    {
+        return error;
+    }
+
+    if (length == 0)
+    {
+        memChunk = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQ_REL);
+        if (memChunk)
+        {
+            retire(memChunk);
+        }
+    }
+    else
+    {
+        memChunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        len = memChunk ? __atomic_load_n(&memChunk->len, __ATOMIC_ACQUIRE) : 0;
+        if (len > length)
+        {
+            __atomic_store_n(&memChunk->len, length, __ATOMIC_RELEASE);
+            memset(memChunk->data + length, 0, len - length);
+        }
+    }
+
+    return 0;
+}
+
+
+// Without other mounts, appends take the generic path at the known end:
+static int memoryFileAppend(node_id_t nodeId, const char* data, size_t len, size_t inlineMax,
+                            const long long mtime[2], off_t* size)
+{
+    return -EOPNOTSUPP;
+}
+
+
+static int memoryFileExtend(node_id_t nodeId, const long long mtime[2], off_t* size)
+{
+    struct mem_node* node;
+    long long stored;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    stored = __atomic_load_n(&node->info[NODE_INFO_SIZE], __ATOMIC_RELAXED);
+    while (stored < *size
+           && !__atomic_compare_exchange_n(&node->info[NODE_INFO_SIZE], &stored, *size, 1, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED));
+    if (stored > *size)
+    {
+        *size = stored;
+    }
+
+    __atomic_store_n(&node->info[NODE_INFO_MOD_TIME_SEC], mtime[0], __ATOMIC_RELAXED);
+    __atomic_store_n(&node->info[NODE_INFO_MOD_TIME_NSEC], mtime[1], __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+static int memoryChunkGet(node_id_t nodeId, long long chunk, char* buf, size_t size)
+{
+    struct mem_chunk** slot;
+    struct mem_chunk* memChunk;
+    size_t len;
+    int error;
+
+    slot = findChunkSlot(nodeId, chunk, 0, &error);
+    memChunk = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+    if (!memChunk)
+    {
+        return error;
+    }
+
+    len = __atomic_load_n(&memChunk->len, __ATOMIC_ACQUIRE);
+    if (len > size)
+    {
+        len = size;
+    }
+    memcpy(buf, memChunk->data, len);
+
+    return len;
+}
+
+
+static int memoryChunkPut(node_id_t nodeId, long long chunk, const char* data, size_t len)
+{
+    struct mem_chunk** slot;
+    struct mem_chunk* memChunk;
+    int error;
+
+    slot = findChunkSlot(nodeId, chunk, 1, &error);
+    if (!slot)
+    {
+        return error;
+    }
+
+    memChunk = newChunk(data, len, len);
+    if (!memChunk)
+    {
+        return -ENOMEM;
+    }
+
+    memChunk = __atomic_exchange_n(slot, memChunk, __ATOMIC_ACQ_REL);
+    if (memChunk)
+    {
+        retire(memChunk);
+    }
+
+    return 0;
+}
+
+
+// Chunks are only moved to the cold store from Redis:
+static int memoryChunkStub(node_id_t nodeId, long long chunk, char* name, size_t size)
+{
+    return 0;
+}
+
+
+static int memoryChunkRestore(node_id_t nodeId, long long chunk, const char* object, const char* data, size_t len)
+{
+    return 0;
+}
+
+
+/* ================ Deduplicated chunks ================ */
+
+// The leading hex digits of a hash are as good as any index:
+static struct mem_blob** blobBucket(const char* hash)
+{
+    unsigned int index = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        index = index * 16 + (hash[i] <= '9' ? hash[i] - '0' : hash[i] - 'a' + 10);
+    }
+
+    return &blobBuckets[index % MEM_BLOB_BUCKETS];
+}
+
+
+// Take a reference to a live blob; fails once the blob has been collected:
+static int refBlob(struct mem_blob* blob)
+{
+    long refs = __atomic_load_n(&blob->refs, __ATOMIC_ACQUIRE);
+
+    while (refs != MEM_BLOB_DEAD)
+    {
+        if (__atomic_compare_exchange_n(&blob->refs, &refs, refs + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void unrefBlob(struct mem_blob* blob)
+{
+    struct mem_gc_entry* entry;
+
+    if (__atomic_sub_fetch(&blob->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    {
+        return;
+    }
+
+    entry = malloc(sizeof(struct mem_gc_entry));
+    if (!entry)
+    {
+        return; // The blob is never collected.
+    }
+
+    entry->blob = blob;
+    entry->next = __atomic_load_n(&gcCandidates, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&gcCandidates, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+// Find a live blob and take a reference to it:
+static struct mem_blob* findBlob(const char* hash)
+{
+    struct mem_blob* blob;
+
+    blob = __atomic_load_n(blobBucket(hash), __ATOMIC_ACQUIRE);
+    for (; blob; blob = blob->next)
+    {
+        if (0 == memcmp(blob->hash, hash, CHUNK_HASH_LEN) && refBlob(blob))
+        {
+            return blob;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int memoryDedupGet(node_id_t nodeId, long long chunk, char* buf, size_t size)
+{
+    struct mem_blob** slot;
+    struct mem_blob* blob;
+    struct mem_chunk* frame;
+    struct mem_node* node;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    slot = blobSlot(node, chunk, 0);
+    blob = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+    frame = blob ? __atomic_load_n(&blob->frame, __ATOMIC_ACQUIRE) : NULL;
+    if (!frame)
+    {
+        return 0; // Hole.
+    }
+    else if (frame->len > size)
+    {
+        return -EIO;
+    }
+
+    memcpy(buf, frame->data, frame->len);
+
+    return frame->len;
+}
+
+
+static int memoryDedupLink(node_id_t nodeId, long long chunk, const char* hash, const char* data, size_t len)
+{
+    struct mem_blob** bucket;
+    struct mem_blob** slot;
+    struct mem_blob* blob;
+    struct mem_node* node;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    slot = blobSlot(node, chunk, 1);
+    if (!slot)
+    {
+        return chunk < 0 ? -EINVAL : -EFBIG;
+    }
+
+    blob = findBlob(hash);
+    if (!blob)
+    {
+        if (!data)
+        {
+            return 0;
+        }
+
+        // Racing writers of the same data may both add a blob; that only costs memory:
+        blob = malloc(sizeof(struct mem_blob));
+        if (!blob)
+        {
+            return -ENOMEM;
+        }
+        blob->refs = 1;
+        blob->frame = newChunk(data, len, len);
+        memcpy(blob->hash, hash, CHUNK_HASH_LEN + 1);
+        if (!blob->frame)
+        {
+            free(blob);
+            return -ENOMEM;
+        }
+
+        bucket = blobBucket(hash);
+        blob->next = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(bucket, &blob->next, blob, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+
+    blob = __atomic_exchange_n(slot, blob, __ATOMIC_ACQ_REL);
+    if (blob)
+    {
+        unrefBlob(blob);
+    }
+
+    return 1;
+}
+
+
+static int memoryDedupDrop(node_id_t nodeId, long long chunk)
+{
+    struct mem_blob** slot;
+    struct mem_blob* blob;
+    struct mem_node* node;
+
+    node = getNode(nodeId);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    slot = blobSlot(node, chunk, 0);
+    blob = slot ? __atomic_exchange_n(slot, NULL, __ATOMIC_ACQ_REL) : NULL;
+    if (blob)
+    {
+        unrefBlob(blob);
+    }
+
+    return 0;
+}
+
+
+static int memoryBlobGc(int max, int* freed)
+{
+    struct mem_gc_entry* entries;
+    struct mem_gc_entry* entry;
+    struct mem_gc_entry* last;
+    struct mem_chunk* frame;
+    long refs;
+    int checked = 0;
+
+    *freed = 0;
+
+    entries = __atomic_exchange_n(&gcCandidates, NULL, __ATOMIC_ACQUIRE);
+    while (entries && checked < max)
+    {
+        entry = entries;
+        entries = entry->next;
+        ++checked;
+
+        // Blobs that were linked again since are kept:
+        refs = 0;
+        if (__atomic_compare_exchange_n(&entry->blob->refs, &refs, MEM_BLOB_DEAD, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            frame = __atomic_exchange_n(&entry->blob->frame, NULL, __ATOMIC_ACQ_REL);
+            retire(frame);
+            ++*freed;
+        }
+        free(entry);
+    }
+
+    // Put back what is left:
+    if (entries)
+    {
+        for (last = entries; last->next; last = last->next);
+        last->next = __atomic_load_n(&gcCandidates, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&gcCandidates, &last->next, entries, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    return checked;
+}
+
+
+/* ================ Server-side copies ================ */
+
+static int memoryChunkCopy(node_id_t srcId, off_t srcOffset, node_id_t dstId, off_t dstOffset, size_t len)
+{
+    struct mem_chunk** slot;
+    char* buf;
+    size_t part;
+    off_t srcPos;
+    off_t dstPos;
+    int result = 0;
+    int error;
+
+    buf = malloc(CHUNK_SIZE);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+
+    while (len > 0)
+    {
+        srcPos = srcOffset % CHUNK_SIZE;
+        dstPos = dstOffset % CHUNK_SIZE;
+        part = CHUNK_SIZE - (srcPos > dstPos ? srcPos : dstPos);
+        if (part > len)
+        {
+            part = len;
+        }
+
+        result = memoryChunkRead(srcId, srcOffset / CHUNK_SIZE, buf, part, srcPos);
+        if (result < 0)
+        {
+            break;
+        }
+
+        // Holes stay holes unless the destination has data there:
+        slot = findChunkSlot(dstId, dstOffset / CHUNK_SIZE, 0, &error);
+        if (result > 0 || (slot && __atomic_load_n(slot, __ATOMIC_ACQUIRE)))
+        {
+            memset(buf + result, 0, part - result);
+            result = memoryChunkWrite(dstId, dstOffset / CHUNK_SIZE, buf, part, dstPos);
+            if (result < 0)
+            {
+                break;
+            }
+        }
+
+        srcOffset += part;
+        dstOffset += part;
+        len -= part;
+        result = 0;
+    }
+
+    free(buf);
+
+    return result;
+}
+
+
+static int memoryChunkClone(node_id_t srcId, long long srcChunk, node_id_t dstId, long long dstChunk,
+                            long long count, int dedup)
+{
+    struct mem_node* src;
+    struct mem_node* dst;
+    struct mem_chunk** chunkSrc;
+    struct mem_chunk** chunkDst;
+    struct mem_chunk* memChunk;
+    struct mem_blob** blobSrc;
+    struct mem_blob** blobDst;
+    struct mem_blob* blob;
+    long long i;
+
+    src = getNode(srcId);
+    dst = getNode(dstId);
+    if (!src || !dst)
+    {
+        return -ENOENT;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        if (dedup)
+        {
+            // Share the blob; it is immutable, so later writes to either file copy on write:
+            blobSrc = blobSlot(src, srcChunk + i, 0);
+            blob = blobSrc ? __atomic_load_n(blobSrc, __ATOMIC_ACQUIRE) : NULL;
+            if (blob && !refBlob(blob))
+            {
+                blob = NULL;
+            }
+
+            blobDst = blobSlot(dst, dstChunk + i, blob != NULL);
+            if (!blobDst)
+            {
+                if (blob)
+                {
+                    unrefBlob(blob);
+                    return dstChunk + i < 0 ? -EINVAL : -EFBIG;
+                }
+                continue;
+            }
+
+            blob = __atomic_exchange_n(blobDst, blob, __ATOMIC_ACQ_REL);
+            if (blob)
+            {
+                unrefBlob(blob);
+            }
+        }
+        else
+        {
+            // Chunks are updated in place, so they are copied:
+            chunkSrc = chunkSlot(src, srcChunk + i, 0);
+            memChunk = chunkSrc ? __atomic_load_n(chunkSrc, __ATOMIC_ACQUIRE) : NULL;
+            if (memChunk)
+            {
+                memChunk = newChunk(memChunk->data, __atomic_load_n(&memChunk->len, __ATOMIC_ACQUIRE), memChunk->capacity);
+                if (!memChunk)
+                {
+                    return -ENOMEM;
+                }
+            }
+
+            chunkDst = chunkSlot(dst, dstChunk + i, memChunk != NULL);
+            if (!chunkDst)
+            {
+                if (memChunk)
+                {
+                    free(memChunk);
+                    return dstChunk + i < 0 ? -EINVAL : -EFBIG;
+                }
+                continue;
+            }
+
+            memChunk = __atomic_exchange_n(chunkDst, memChunk, __ATOMIC_ACQ_REL);
+            if (memChunk)
+            {
+                retire(memChunk);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* ================ Reclaim ================ */
+
+static pthread_mutex_t reclaimMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Retire the pages of a chunk page table, calling drop for every entry.
+// Returns the number of entries:
+static int dropPages(void*** pages, void (*drop)(void* ptr))
+{
+    void** page;
+    void* ptr;
+    int count = 0;
+    int i;
+    int j;
+
+    if (!pages)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < MEM_CHUNK_PAGES; ++i)
+    {
+        page = __atomic_load_n(&pages[i], __ATOMIC_ACQUIRE);
+        if (!page)
+        {
+            continue;
+        }
+
+        for (j = 0; j < MEM_CHUNK_PAGE_SIZE; ++j)
+        {
+            ptr = __atomic_exchange_n(&page[j], NULL, __ATOMIC_ACQ_REL);
+            if (ptr)
+            {
+                drop(ptr);
+                ++count;
+            }
+        }
+        retire(page);
+    }
+    retire(pages);
+
+    return count;
+}
+
+
+static void dropBlob(void* blob)
+{
+    unrefBlob(blob);
+}
+
+
+// Unpublish a node and retire its memory; the entries of a directory are
+// queued in turn. Returns the number of objects freed:
+static int reclaimNode(node_id_t nodeId)
+{
+    struct mem_node** page;
+    struct mem_node* node;
+    struct mem_dirent* entry;
+    struct mem_dirent* next;
+    node_id_t childId;
+    int freed = 1;
+    int i;
+
+    page = __atomic_load_n(&nodePages[nodeId / MEM_NODE_PAGE_SIZE], __ATOMIC_ACQUIRE);
+    node = page ? __atomic_exchange_n(&page[nodeId % MEM_NODE_PAGE_SIZE], NULL, __ATOMIC_ACQ_REL) : NULL;
+    if (!node)
+    {
+        return 0;
+    }
+
+    if (node->buckets)
+    {
+        for (i = 0; i < MEM_DIR_BUCKETS; ++i)
+        {
+            for (entry = __atomic_load_n(&node->buckets[i], __ATOMIC_ACQUIRE); entry; entry = next)
+            {
+                next = entry->next;
+                childId = __atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE);
+                if (childId >= 0 && queueOrphan(childId) < 0)
+                {
+                    fprintf(stderr, "Error: Out of memory, node %lld is never reclaimed.\n", (long long)childId);
+                }
+                retire(entry);
+            }
+        }
+        retire(node->buckets);
+    }
+
+    freed += dropPages((void***)node->chunkPages, retire);
+    freed += dropPages((void***)node->blobPages, dropBlob);
+    if (node->inlineData)
+    {
+        retire(node->inlineData);
+    }
+    retire(node);
+
+    return freed;
+}
+
+
+static int memoryReclaim(int max, int* freed)
+{
+    struct mem_orphan* entries;
+    struct mem_orphan* entry;
+    int done = 0;
+
+    *freed = 0;
+
+    pthread_mutex_lock(&reclaimMutex);
+
+    entries = __atomic_exchange_n(&orphans, NULL, __ATOMIC_ACQUIRE);
+    while (entries && done < max)
+    {
+        entry = entries;
+        entries = entry->next;
+
+        // Nodes are freed whole; in memory that is quick even for large files:
+        *freed += reclaimNode(entry->nodeId);
+        ++done;
+        free(entry);
+    }
+
+    // Queue the rest again:
+    if (entries)
+    {
+        for (entry = entries; entry->next; entry = entry->next);
+        entry->next = __atomic_load_n(&orphans, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&orphans, &entry->next, entries, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_mutex_unlock(&reclaimMutex);
+
+    return done;
+}
+
+
+/* ================ Tree walks ================ */
+
+static int queueWalkDir(struct mem_walk* walk, node_id_t nodeId, const char* path, size_t len)
+{
+    struct mem_walk_dir* dir;
+
+    dir = malloc(sizeof(struct mem_walk_dir) + len + 2);
+    if (!dir)
+    {
+        return -ENOMEM;
+    }
+
+    dir->next = NULL;
+    dir->nodeId = nodeId;
+    memcpy(dir->path, path, len);
+    if (len > 0)
+    {
+        dir->path[len++] = '/';
+    }
+    dir->path[len] = '\0';
+
+    if (walk->tail)
+    {
+        walk->tail->next = dir;
+    }
+    else
+    {
+        walk->head = dir;
+    }
+    walk->tail = dir;
+
+    return 0;
+}
+
+
+static int memoryTreeWalkOpen(node_id_t dirId, void** walk)
+{
+    struct mem_walk* state;
+    int result;
+
+    state = calloc(1, sizeof(struct mem_walk));
+    if (!state)
+    {
+        return -ENOMEM;
+    }
+
+    result = queueWalkDir(state, dirId, "", 0);
+    if (result < 0)
+    {
+        free(state);
+        return result;
+    }
+
+    *walk = state;
+
+    return 0;
+}
+
+
+// Visit one whole directory at a time:
+static int memoryTreeWalkNext(void* walk, tree_entry_fn fn, void* ctx, int max)
+{
+    struct mem_walk* state = (struct mem_walk*)walk;
+    struct mem_walk_dir* dir;
+    struct mem_dirent** buckets;
+    struct mem_dirent* entry;
+    struct mem_node* node;
+    size_t pathLen;
+    node_id_t nodeId;
+    long long mode;
+    int done = 0;
+    int result;
+    int i;
+
+    while (done < max && state->head)
+    {
+        dir = state->head;
+        node = getNode(dir->nodeId);
+        buckets = node ? __atomic_load_n(&node->buckets, __ATOMIC_ACQUIRE) : NULL;
+        pathLen = strlen(dir->path);
+
+        for (i = 0; buckets && i < MEM_DIR_BUCKETS; ++i)
+        {
+            entry = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+            for (; entry; entry = entry->next)
+            {
+                nodeId = __atomic_load_n(&entry->nodeId, __ATOMIC_ACQUIRE);
+                node = getNode(nodeId);
+                if (nodeId < 0 || !node)
+                {
+                    continue;
+                }
+
+                char path[pathLen + entry->len + 1];
+                memcpy(path, dir->path, pathLen);
+                memcpy(path + pathLen, entry->name, entry->len + 1);
+
+                mode = __atomic_load_n(&node->info[NODE_INFO_MODE], __ATOMIC_RELAXED);
+                fn(ctx, path, nodeId, mode, __atomic_load_n(&node->info[NODE_INFO_SIZE], __ATOMIC_RELAXED));
+                ++done;
+
+                if (S_ISDIR(mode))
+                {
+                    result = queueWalkDir(state, nodeId, path, pathLen + entry->len);
+                    if (result < 0)
+                    {
+                        return result;
+                    }
+                }
+            }
+        }
+
+        state->head = dir->next;
+        if (!state->head)
+        {
+            state->tail = NULL;
+        }
+        free(dir);
+        ++done;
+    }
+
+    return state->head ? 1 : 0;
+}
+
+
+static void memoryTreeWalkClose(void* walk)
+{
+    struct mem_walk* state = (struct mem_walk*)walk;
+    struct mem_walk_dir* dir;
+
+    while (state->head)
+    {
+        dir = state->head;
+        state->head = dir->next;
+        free(dir);
+    }
+    free(state);
+}
+
+
+/* ================ Usage ================ */
+
+static void addUsage(void* ctx, const char* path, node_id_t nodeId, long long mode, long long size)
+{
+    struct dir_usage* usage = (struct dir_usage*)ctx;
+
+    usage->inodes += 1;
+    if (!S_ISDIR(mode))
+    {
+        usage->bytes += size;
+    }
+}
+
+
+// Nothing is kept up to date; the usage is summed over the tree on request:
+static int memoryDirUsage(node_id_t dirId, struct dir_usage* usage)
+{
+    void* walk;
+    int result;
+
+    memset(usage, 0, sizeof(struct dir_usage));
+
+    result = memoryTreeWalkOpen(dirId, &walk);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    do
+    {
+        result = memoryTreeWalkNext(walk, addUsage, usage, 4096);
+    }
+    while (result > 0);
+    memoryTreeWalkClose(walk);
+
+    return result;
+}
+
+
+static int memoryDirQuota(node_id_t dirId, long long maxBytes, long long maxInodes)
+{
+    return -EOPNOTSUPP;
+}
+
+
+/* ================ Snapshots ================ */
+
+static int memorySnapshotCreate(const char* name)
+{
+    return -EOPNOTSUPP;
+}
+
+
+static int memorySnapshotDelete(const char* name)
+{
+    return -EOPNOTSUPP;
+}
+
+
+static int memorySnapshotList(snapshot_entry_fn fn, void* ctx)
+{
+    return 0;
+}
+
+
+/* ---- Memory backend ---- */
+const struct redifs_backend memoryBackend = {
+    .name = "memory",
+    .open = memoryOpen,
+    .close = memoryClose,
+    .fs_exists = memoryFsExists,
+    .fs_create = memoryFsCreate,
+    .resolve = memoryResolve,
+    .create_node = memoryCreateNode,
+    .get_info = memoryGetInfo,
+    .set_info = memorySetInfo,
+    .get_node = memoryGetNode,
+    .set_inline = memorySetInline,
+    .set_times = memorySetTimes,
+    .dir_list = memoryDirList,
+    .dir_unlink = memoryDirUnlink,
+    .dir_rename = memoryDirRename,
+    .chunk_read = memoryChunkRead,
+    .chunk_write = memoryChunkWrite,
+    .chunk_truncate = memoryChunkTruncate,
+    .file_append = memoryFileAppend,
+    .file_extend = memoryFileExtend,
+    .chunk_get = memoryChunkGet,
+    .chunk_put = memoryChunkPut,
+    .chunk_stub = memoryChunkStub,
+    .chunk_restore = memoryChunkRestore,
+    .dedup_get = memoryDedupGet,
+    .dedup_link = memoryDedupLink,
+    .dedup_drop = memoryDedupDrop,
+    .blob_gc = memoryBlobGc,
+    .chunk_copy = memoryChunkCopy,
+    .chunk_clone = memoryChunkClone,
+    .snapshot_create = memorySnapshotCreate,
+    .snapshot_delete = memorySnapshotDelete,
+    .snapshot_list = memorySnapshotList,
+    .reclaim = memoryReclaim,
+    .tree_walk_open = memoryTreeWalkOpen,
+    .tree_walk_next = memoryTreeWalkNext,
+    .tree_walk_close = memoryTreeWalkClose,
+    .dir_usage = memoryDirUsage,
+    .dir_quota = memoryDirQuota,
+};
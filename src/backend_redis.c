@@ -0,0 +1,2087 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "backend.h"
+#include "blockcache.h"
+#include "dedup.h"
+#include "connection.h"
+#include "metacache.h"
+#include "options.h"
+#include "tier.h"
+#include "util.h"
+#include "arena.h"
+
+
+/*
+ * Key layout:
+ *   <name>::node_id_ctr           Last allocated node ID.
+ *   <name>::info:<id>             List with the NODE_INFO_* fields, followed by
+ *                                 the data of inline files.
+ *   <name>::node:<id>             Hash of a directory: entry name -> node ID.
+ *                                 A large directory holds its bucket count
+ *                                 in "/buckets" and is bucket 0 of the
+ *                                 hashes "<name>::node:<id>:<bucket>", see
+ *                                 util.c.
+ *   <name>::bloom:<id>            String with the bloom filter of the entry
+ *                                 names of a live directory, built on
+ *                                 demand by a lookup that misses.
+ *   <name>::blooms                Hash: directory ID -> names added to or
+ *                                 removed from its bloom filter.
+ *   <name>::parents               Hash: node ID -> ID of the directory
+ *                                 holding it.
+ *   <name>::usage:<id>            Hash of a directory with the "bytes" and
+ *                                 "inodes" below it, and its "max_bytes"
+ *                                 and "max_inodes" quota if it has one.
+ *                                 Every change of a file size or of an
+ *                                 entry updates the directories above it.
+ *   <name>::quotas                Set of the IDs of directories with a
+ *                                 quota.
+ *   <name>::data:<id>:<chunk>     String with CHUNK_SIZE bytes of file data.
+ *   <name>::refs:<id>             Hash of a deduplicated file: chunk -> hash.
+ *   <name>::cold:<id>             Hash of a tiered file: chunk -> name of the
+ *                                 cold store object that holds it in place
+ *                                 of its data key.
+ *   <name>::blob:<hash>           Hash with the "data" frame of a chunk and its
+ *                                 "refs" count.
+ *   <name>::blob_gc               List of blob hashes that lost their last
+ *                                 reference.
+ *   <name>::orphans               List of removed node IDs waiting for
+ *                                 reclaim.
+ *   <name>::walk_ctr              Last allocated tree walk ID.
+ *   <name>::walk:<n>              List of the directories a tree walk has
+ *                                 yet to visit; expires when abandoned.
+ *   <name>::id_leases             Sorted set of the node ID ranges
+ *                                 ("first:last") of running bulk imports,
+ *                                 scored by expiry time.
+ *
+ * Snapshots and the change journal add the keys described in util.c.
+ * Every write script archives the keys it changes for the snapshots, see
+ * LUA_COW_FUNCTION, and a snapshot mount reads through viewKey(). Changes of node info and of directory entries are
+ * journaled in the same script as the change.
+*/
+
+
+/* ================ Setup ================ */
+
+static int redisOpen()
+{
+    int result;
+
+    if (0 > setKeyPrefix(g_settings->name))
+    {
+        return -ENAMETOOLONG;
+    }
+
+    if (-1 == openRedisConnection(g_settings->host, g_settings->port))
+    {
+        return -EIO;
+    }
+
+    result = loadSnapshots(g_settings->snapshot);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // The journal only covers the live file system; a cache that cannot be opened is left out:
+    if (g_settings->meta_cache && !g_settings->snapshot)
+    {
+        metaCacheOpen(g_settings->meta_cache, g_settings->meta_cache_size, g_settings->meta_cache_ttl);
+    }
+    if (g_settings->block_cache && !g_settings->snapshot)
+    {
+        blockCacheOpen(g_settings->block_cache, g_settings->block_cache_size, g_settings->block_cache_ttl);
+    }
+
+    return tierOpen(g_settings->cold_store);
+}
+
+
+static void redisClose()
+{
+    metaCacheClose();
+    blockCacheClose();
+    tierClose();
+    closeRedisConnection();
+}
+
+
+/* ================ Nodes ================ */
+
+// Writes archive what they change for the snapshots in their own scripts,
+// see LUA_COW_FUNCTION; a mounted snapshot is read-only:
+static int checkWritable()
+{
+    return viewGeneration() >= 0 ? -EROFS : 0;
+}
+
+
+static int redisGetInfo(node_id_t nodeId, long long info[NODE_INFO_COUNT])
+{
+    char key[KEY_LEN];
+    unsigned long token;
+    int result;
+    int count;
+    int handle;
+    int i;
+
+    if (metaCacheGetInfo(nodeId, info))
+    {
+        return 0;
+    }
+
+    formatNodeKey(key, KEY_INFO, nodeId);
+    result = viewKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    token = metaCacheBegin(nodeId);
+    handle = redisCommand_LRANGE(key, 0, NODE_INFO_COUNT - 1, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count == 0)
+    {
+        releaseReplyHandle(handle);
+        return -ENOENT;
+    }
+
+    // Nodes of older file systems lack the trailing fields:
+    {
+        char* fields[count];
+        retrieveStringArrayElements(handle, 0, count, fields);
+        for (i = 0; i < NODE_INFO_COUNT; ++i)
+        {
+            info[i] = i < count ? atoll(fields[i]) : 0;
+        }
+    }
+
+    releaseReplyHandle(handle);
+    metaCacheStoreInfo(token, nodeId, info);
+
+    return 0;
+}
+
+
+// KEYS: info, journal generation, journal log; ARGV: node ID, first field,
+// "<name>::", values. A new file size is charged to the directories above
+// the node; -1 is returned if that exceeds a quota. The info of nodes from
+// before the size and flags fields is padded first.
+static const char* setInfoScript =
+    LUA_COW_FUNCTION
+    LUA_INFO_PAD_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "local p, size = ARGV[3], " LUA_STR(LUA_INFO_SIZE) " - tonumber(ARGV[2]) + 4 "
+    "cowAt(p, KEYS[1]) "
+    "if size >= 4 and size <= #ARGV then "
+    "local f = redis.call('LRANGE', KEYS[1], 0, " LUA_STR(LUA_INFO_SIZE) ") "
+    "local parent = redis.call('HGET', p .. 'parents', ARGV[1]) "
+    "local old = f[" LUA_STR(LUA_INFO_SIZE) " + 1] "
+    "if parent and old and not " LUA_MODE_IS_DIR("tonumber(f[1])") " then "
+    "local delta = tonumber(ARGV[size]) - tonumber(old) "
+    "if not usageFits(p, false, parent, delta, 0) then return -1 end "
+    "usageMove(p, false, parent, delta, 0) end end "
+    "infoPad(KEYS[1]) "
+    "for i = 4, #ARGV do redis.call('LSET', KEYS[1], ARGV[2] + i - 4, ARGV[i]) end "
+    "journal(KEYS[2], KEYS[3], ARGV[1]) "
+    "return 0";
+
+
+static int redisSetInfo(node_id_t nodeId, int first, int count, const long long values[])
+{
+    char key[KEY_LEN];
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char strs[count + 2][24];
+    const char* args[count + 6];
+    long long status;
+    int result;
+    int i;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(key, KEY_INFO, nodeId);
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    formatKey(prefix, "");
+    args[0] = key;
+    args[1] = genKey;
+    args[2] = logKey;
+    snprintf(strs[0], sizeof(strs[0]), "%lld", nodeId);
+    snprintf(strs[1], sizeof(strs[1]), "%d", first);
+    for (i = 0; i < count; ++i)
+    {
+        snprintf(strs[i + 2], sizeof(strs[i + 2]), "%lld", values[i]);
+    }
+    args[3] = strs[0];
+    args[4] = strs[1];
+    args[5] = prefix;
+    for (i = 0; i < count; ++i)
+    {
+        args[i + 6] = strs[i + 2];
+    }
+
+    // One round trip for all fields:
+    result = redisCommand_EVAL_INT(setInfoScript, 3, args, count + 6, &status) ? 0 : -EIO;
+    metaCacheInvalidate(nodeId);
+
+    return result < 0 ? result : status < 0 ? -EDQUOT : 0;
+}
+
+
+static int redisGetNode(node_id_t nodeId, struct node_record* node)
+{
+    char key[KEY_LEN];
+    char* data;
+    unsigned long token;
+    int result;
+    int count;
+    int handle;
+    int i;
+
+    // One round trip for the info and the inline data:
+    formatNodeKey(key, KEY_INFO, nodeId);
+    result = viewKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    token = metaCacheBegin(nodeId);
+    handle = redisCommand_LRANGE(key, 0, NODE_INFO_COUNT, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count == 0)
+    {
+        releaseReplyHandle(handle);
+        return -ENOENT;
+    }
+
+    {
+        char* fields[count];
+        retrieveStringArrayElements(handle, 0, count, fields);
+        for (i = 0; i < NODE_INFO_COUNT; ++i)
+        {
+            node->info[i] = i < count ? atoll(fields[i]) : 0;
+        }
+    }
+    metaCacheStoreInfo(token, nodeId, node->info);
+
+    node->data = NULL;
+    node->len = 0;
+    if (count > NODE_INFO_COUNT)
+    {
+        retrieveBinaryArrayElement(handle, NODE_INFO_COUNT, &data, &node->len);
+        node->data = arenaStrndup(data, node->len);
+        if (!node->data)
+        {
+            releaseReplyHandle(handle);
+            return -ENOMEM;
+        }
+    }
+
+    releaseReplyHandle(handle);
+
+    return 0;
+}
+
+
+// KEYS: info; ARGV: "<name>::", data
+static const char* setInlineScript =
+    LUA_COW_FUNCTION
+    "cowAt(ARGV[1], KEYS[1]) "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_COUNT) ", ARGV[2]) "
+    "return 0";
+
+
+static int redisSetInline(node_id_t nodeId, const char* data, size_t len)
+{
+    char key[KEY_LEN];
+    char prefix[KEY_LEN];
+    const char* args[2] = { key, prefix };
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(key, KEY_INFO, nodeId);
+    formatKey(prefix, "");
+
+    return redisCommand_EVAL_BIN_INT(setInlineScript, 1, args, 2, data, len, NULL) ? 0 : -EIO;
+}
+
+
+// KEYS: journal generation, journal log; ARGV: "<name>::", a line per
+// node with its ID, access time and modification time, "- -" for a time
+// that stays. Nodes without info were removed and are skipped.
+static const char* setTimesScript =
+    LUA_COW_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    "for id, as, ans, ms, mns in string.gmatch(ARGV[2], '(%d+) (%S+) (%S+) (%S+) (%S+)') do "
+    "local key = ARGV[1] .. 'info:' .. id "
+    "if redis.call('EXISTS', key) == 1 then "
+    "cowAt(ARGV[1], key) "
+    "if as ~= '-' then redis.call('LSET', key, " LUA_STR(LUA_INFO_ACCESS_TIME) ", as) redis.call('LSET', key, " LUA_STR(LUA_INFO_ACCESS_TIME) " + 1, ans) end "
+    "if ms ~= '-' then redis.call('LSET', key, " LUA_STR(LUA_INFO_MOD_TIME) ", ms) redis.call('LSET', key, " LUA_STR(LUA_INFO_MOD_TIME) " + 1, mns) end "
+    "journal(KEYS[1], KEYS[2], id) end end "
+    "return 0";
+
+
+static int redisSetTimes(int count, const node_id_t nodeIds[], const long long times[][4])
+{
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    const char* args[4] = { genKey, logKey, prefix, NULL };
+    char* lines;
+    size_t len = 0;
+    int result;
+    int i;
+    int j;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // Every node takes a line of at most five numbers:
+    lines = malloc(count * 5 * 24 + 1);
+    if (!lines)
+    {
+        return -ENOMEM;
+    }
+    lines[0] = '\0';
+
+    for (i = 0; i < count; ++i)
+    {
+        len += sprintf(lines + len, "%lld", (long long)nodeIds[i]);
+        for (j = 0; j < 4; j += 2)
+        {
+            if (times[i][j + 1] == UTIME_OMIT)
+            {
+                len += sprintf(lines + len, " - -");
+            }
+            else
+            {
+                len += sprintf(lines + len, " %lld %lld", times[i][j], times[i][j + 1]);
+            }
+        }
+        lines[len++] = '\n';
+        lines[len] = '\0';
+    }
+
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    formatKey(prefix, "");
+    args[3] = lines;
+
+    // One round trip for the whole batch:
+    result = redisCommand_EVAL_INT(setTimesScript, 2, args, 4, NULL) ? 0 : -EIO;
+    for (i = 0; i < count; ++i)
+    {
+        metaCacheInvalidate(nodeIds[i]);
+    }
+
+    free(lines);
+
+    return result;
+}
+
+
+/* ================ Directories ================ */
+
+// ARGV: name, snapshot generation or -1, directory node ID, cursor,
+// count. Returns the next cursor, then the entry names.
+static const char* dirListScript =
+    LUA_VIEW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_VIEW_FUNCTION
+    "local reply = dirScan(dirViewBuckets(ARGV[1], tonumber(ARGV[2]), ARGV[3]), ARGV[4], tonumber(ARGV[5])) "
+    "local out = { reply[1] } "
+    "for i = 2, #reply, 2 do out[#out + 1] = reply[i] end "
+    "return out";
+
+static int redisDirList(node_id_t dirId, dir_entry_fn fn, void* ctx)
+{
+    char cursor[DIR_CURSOR_LEN] = "0";
+    char genStr[24];
+    char dirStr[24];
+    char countStr[24];
+    const char* args[5] = { g_settings->name, genStr, dirStr, cursor, countStr };
+    char* name;
+    int stop = 0;
+    int count;
+    int handle;
+    int i;
+
+    snprintf(genStr, sizeof(genStr), "%lld", viewGeneration());
+    snprintf(dirStr, sizeof(dirStr), "%lld", dirId);
+    snprintf(countStr, sizeof(countStr), "%d", DIR_SCAN_BATCH);
+
+    // Entries moved by a split while the listing runs may be passed twice:
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(dirListScript, 0, args, 5, &count);
+        if (!handle)
+        {
+            return -EIO;
+        }
+        else if (count < 1)
+        {
+            releaseReplyHandle(handle);
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, &name);
+        snprintf(cursor, sizeof(cursor), "%s", name);
+
+        for (i = 1; i < count && !stop; ++i)
+        {
+            retrieveStringArrayElements(handle, i, 1, &name);
+            stop = fn(ctx, name);
+        }
+
+        releaseReplyHandle(handle);
+    }
+    while (!stop && 0 != strcmp(cursor, "0"));
+
+    return 0;
+}
+
+
+// KEYS: directory, journal generation, journal log; ARGV: entries per
+// bucket, directory ID, "<name>::", name, then the NODE_INFO_COUNT values
+// of the node info. Allocates the node ID, stores the node and links it,
+// so that no failure leaves a node that nothing refers to. The directory
+// is journaled, as mounts may cache that the name did not exist. Returns
+// the node ID, or an error as a negative index into createErrors.
+static const char* createScript =
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "local d, p, name = ARGV[2], ARGV[3], ARGV[4] "
+    "local dirMode = redis.call('LINDEX', p .. 'info:' .. d, 0) "
+    "if not dirMode then return -1 end "
+    "if not " LUA_MODE_IS_DIR("tonumber(dirMode)") " then return -2 end "
+    "if redis.call('HEXISTS', dirEntryKey(KEYS[1], name), name) == 1 then return -3 end "
+    "local isDir = " LUA_MODE_IS_DIR("tonumber(ARGV[5])") " "
+    "local bytes = isDir and 0 or tonumber(ARGV[5 + " LUA_STR(LUA_INFO_SIZE) "]) "
+    "if not usageFits(p, false, d, bytes, 1) then return -4 end "
+    "local id = redis.call('INCR', p .. '" KEY_NODE_ID_CTR "') "
+    "if id < 1 then return -5 end "
+    "redis.call('RPUSH', p .. 'info:' .. id, unpack(ARGV, 5, 4 + " LUA_STR(LUA_INFO_COUNT) ")) "
+    "redis.call('RPUSH', p .. 'info:' .. id, '') "
+    "cowAt(p, KEYS[1]) "
+    "journal(KEYS[2], KEYS[3], d) "
+    "dirLink(KEYS[1], name, id, tonumber(ARGV[1])) "
+    "redis.call('HSET', p .. 'parents', id, d) "
+    "usageMove(p, false, d, bytes, 1) "
+    "return id";
+
+static const int createErrors[] = { 0, ENOENT, ENOTDIR, EEXIST, EDQUOT, ENOSPC };
+
+
+static node_id_t redisCreateNode(node_id_t dirId, const char* name, const long long info[NODE_INFO_COUNT])
+{
+    char key[KEY_LEN];
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char maxStr[24];
+    char dirStr[24];
+    char values[NODE_INFO_COUNT][24];
+    const char* args[7 + NODE_INFO_COUNT] = { key, genKey, logKey, maxStr, dirStr, prefix, name };
+    node_id_t nodeId;
+    int result;
+    int i;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(key, KEY_NODE, dirId);
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    formatKey(prefix, "");
+    snprintf(maxStr, sizeof(maxStr), "%d", DIR_BUCKET_ENTRIES);
+    snprintf(dirStr, sizeof(dirStr), "%lld", dirId);
+    for (i = 0; i < NODE_INFO_COUNT; ++i)
+    {
+        snprintf(values[i], sizeof(values[i]), "%lld", info[i]);
+        args[7 + i] = values[i];
+    }
+
+    if (!redisCommand_EVAL_INT(createScript, 3, args, 7 + NODE_INFO_COUNT, &nodeId))
+    {
+        return -EIO;
+    }
+
+    // Also after -EEXIST, as the cache may not know the name yet:
+    metaCacheChangeDir(dirId, name);
+
+    if (nodeId == -5)
+    {
+        fprintf(stderr, "Error: Run out of node IDs.\n");
+    }
+
+    return nodeId < 0 ? -createErrors[-nodeId] : nodeId;
+}
+
+
+// KEYS: directory, orphan list, journal generation, journal log; ARGV:
+// name, DIR_UNLINK_* flags, info key prefix, directory key prefix,
+// directory ID, "<name>::". Errors are returned as negative indexes into
+// unlinkErrors.
+static const char* unlinkScript =
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "cowAt(ARGV[6], KEYS[1]) "
+    "local key = dirEntryKey(KEYS[1], ARGV[1]) "
+    "local id = redis.call('HGET', key, ARGV[1]) "
+    "if not id then return -1 end "
+    "local mode = tonumber(redis.call('LINDEX', ARGV[3] .. id, 0) or '0') "
+    "local isDir = " LUA_MODE_IS_DIR("mode") " "
+    "local flags = tonumber(ARGV[2]) "
+    "if math.floor(flags / 2) % 2 == 0 then "
+    "if flags % 2 == 1 then "
+    "if not isDir then return -2 end "
+    "if not dirEmpty(ARGV[4] .. id) then return -3 end "
+    "elseif isDir then return -4 end "
+    "end "
+    "local bytes, inodes = usageOf(ARGV[6], id) "
+    "usageMove(ARGV[6], ARGV[5], false, bytes, inodes) "
+    "redis.call('HDEL', ARGV[6] .. 'parents', id) "
+    "redis.call('HDEL', key, ARGV[1]) "
+    "dirBloomNote(KEYS[1]) "
+    "redis.call('RPUSH', KEYS[2], id) "
+    "journal(KEYS[3], KEYS[4], ARGV[5]) "
+    "journal(KEYS[3], KEYS[4], id) "
+    "return tonumber(id)";
+
+static const int unlinkErrors[] = { 0, ENOENT, ENOTDIR, ENOTEMPTY, EISDIR };
+
+
+static node_id_t redisDirUnlink(node_id_t dirId, const char* name, int flags)
+{
+    char key[KEY_LEN];
+    char orphansKey[KEY_LEN];
+    char infoPrefix[KEY_LEN];
+    char nodePrefix[KEY_LEN];
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char flagsStr[24];
+    char dirStr[24];
+    const char* args[10];
+    long long nodeId;
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(key, KEY_NODE, dirId);
+    formatKey(orphansKey, KEY_ORPHANS);
+    formatKey(infoPrefix, KEY_INFO ":");
+    formatKey(nodePrefix, KEY_NODE ":");
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    formatKey(prefix, "");
+    snprintf(flagsStr, sizeof(flagsStr), "%d", flags);
+    snprintf(dirStr, sizeof(dirStr), "%lld", dirId);
+
+    args[0] = key;
+    args[1] = orphansKey;
+    args[2] = genKey;
+    args[3] = logKey;
+    args[4] = name;
+    args[5] = flagsStr;
+    args[6] = infoPrefix;
+    args[7] = nodePrefix;
+    args[8] = dirStr;
+    args[9] = prefix;
+
+    if (!redisCommand_EVAL_INT(unlinkScript, 4, args, 10, &nodeId))
+    {
+        return -EIO;
+    }
+    else if (nodeId < 0)
+    {
+        return -unlinkErrors[-nodeId];
+    }
+
+    metaCacheChangeDir(dirId, NULL);
+    metaCacheInvalidate(nodeId);
+
+    return nodeId;
+}
+
+
+// KEYS: source directory, destination directory, orphan list, journal
+// generation, journal log; ARGV: source name, destination name,
+// DIR_RENAME_* flags, info key prefix, directory key prefix, source
+// directory ID, destination directory ID, entries per bucket, "<name>::".
+// Errors are returned as negative indexes into renameErrors.
+static const char* renameScript =
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "cowAt(ARGV[9], KEYS[1]) "
+    "cowAt(ARGV[9], KEYS[2]) "
+    "local src, dst = dirEntryKey(KEYS[1], ARGV[1]), dirEntryKey(KEYS[2], ARGV[2]) "
+    "local id = redis.call('HGET', src, ARGV[1]) "
+    "if not id then return -1 end "
+    "local other = redis.call('HGET', dst, ARGV[2]) "
+    "local flags, p = tonumber(ARGV[3]), ARGV[9] "
+    "local bytes, inodes = usageOf(p, id) "
+    "if flags == 2 then "
+    "if not other then return -1 end "
+    "local ob, oi = usageOf(p, other) "
+    "if not usageFits(p, ARGV[6], ARGV[7], bytes - ob, inodes - oi) "
+    "or not usageFits(p, ARGV[7], ARGV[6], ob - bytes, oi - inodes) then return -6 end "
+    "usageMove(p, ARGV[6], ARGV[7], bytes - ob, inodes - oi) "
+    "redis.call('HSET', p .. 'parents', id, ARGV[7]) "
+    "redis.call('HSET', p .. 'parents', other, ARGV[6]) "
+    "redis.call('HSET', src, ARGV[1], other) "
+    "redis.call('HSET', dst, ARGV[2], id) "
+    "journal(KEYS[4], KEYS[5], ARGV[6]) "
+    "if ARGV[7] ~= ARGV[6] then journal(KEYS[4], KEYS[5], ARGV[7]) end "
+    "return 0 end "
+    "if other then "
+    "if flags == 1 then return -2 end "
+    "if other == id then return 0 end "
+    "local srcDir = " LUA_MODE_IS_DIR("tonumber(redis.call('LINDEX', ARGV[4] .. id, 0))") " "
+    "local dstDir = " LUA_MODE_IS_DIR("tonumber(redis.call('LINDEX', ARGV[4] .. other, 0))") " "
+    "if srcDir and not dstDir then return -3 end "
+    "if dstDir and not srcDir then return -4 end "
+    "if dstDir and not dirEmpty(ARGV[5] .. other) then return -5 end "
+    "end "
+    "local ob, oi = 0, 0 "
+    "if other then ob, oi = usageOf(p, other) end "
+    "if not usageFits(p, ARGV[6], ARGV[7], bytes - ob, inodes - oi) then return -6 end "
+    "if other then "
+    "usageMove(p, ARGV[7], false, ob, oi) "
+    "redis.call('HDEL', p .. 'parents', other) end "
+    "usageMove(p, ARGV[6], ARGV[7], bytes, inodes) "
+    "redis.call('HSET', p .. 'parents', id, ARGV[7]) "
+    "redis.call('HDEL', src, ARGV[1]) "
+    "redis.call('HSET', dst, ARGV[2], id) "
+    "dirBloomNote(KEYS[1]) "
+    "if not other then "
+    "dirBloomNote(KEYS[2], ARGV[2]) "
+    "dirGrow(KEYS[2], dst, tonumber(ARGV[8])) end "
+    "journal(KEYS[4], KEYS[5], ARGV[6]) "
+    "if ARGV[7] ~= ARGV[6] then journal(KEYS[4], KEYS[5], ARGV[7]) end "
+    "if not other then return 0 end "
+    "redis.call('RPUSH', KEYS[3], other) "
+    "journal(KEYS[4], KEYS[5], other) "
+    "return tonumber(other)";
+
+static const int renameErrors[] = { 0, ENOENT, EEXIST, ENOTDIR, EISDIR, ENOTEMPTY, EDQUOT };
+
+
+static node_id_t redisDirRename(node_id_t srcDirId, const char* srcName, node_id_t dstDirId, const char* dstName,
+                                int flags)
+{
+    char srcKey[KEY_LEN];
+    char dstKey[KEY_LEN];
+    char orphansKey[KEY_LEN];
+    char infoPrefix[KEY_LEN];
+    char nodePrefix[KEY_LEN];
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char flagsStr[24];
+    char srcStr[24];
+    char dstStr[24];
+    char maxStr[24];
+    char prefix[KEY_LEN];
+    const char* args[14];
+    long long replaced;
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(srcKey, KEY_NODE, srcDirId);
+    formatNodeKey(dstKey, KEY_NODE, dstDirId);
+    formatKey(orphansKey, KEY_ORPHANS);
+    formatKey(infoPrefix, KEY_INFO ":");
+    formatKey(nodePrefix, KEY_NODE ":");
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    snprintf(flagsStr, sizeof(flagsStr), "%d", flags);
+    snprintf(srcStr, sizeof(srcStr), "%lld", srcDirId);
+    snprintf(dstStr, sizeof(dstStr), "%lld", dstDirId);
+    snprintf(maxStr, sizeof(maxStr), "%d", DIR_BUCKET_ENTRIES);
+    formatKey(prefix, "");
+
+    args[0] = srcKey;
+    args[1] = dstKey;
+    args[2] = orphansKey;
+    args[3] = genKey;
+    args[4] = logKey;
+    args[5] = srcName;
+    args[6] = dstName;
+    args[7] = flagsStr;
+    args[8] = infoPrefix;
+    args[9] = nodePrefix;
+    args[10] = srcStr;
+    args[11] = dstStr;
+    args[12] = maxStr;
+    args[13] = prefix;
+
+    if (!redisCommand_EVAL_INT(renameScript, 5, args, 14, &replaced))
+    {
+        return -EIO;
+    }
+    else if (replaced < 0)
+    {
+        return -renameErrors[-replaced];
+    }
+
+    metaCacheChangeDir(srcDirId, NULL);
+    metaCacheChangeDir(dstDirId, dstName);
+    if (replaced > 0)
+    {
+        metaCacheInvalidate(replaced);
+    }
+
+    return replaced;
+}
+
+
+/* ================ File data ================ */
+
+// "<name>::data:<id>:", the prefix of the chunk keys of a file:
+static void formatChunkPrefix(char* key, node_id_t nodeId)
+{
+    size_t len;
+
+    len = formatNodeKey(key, KEY_DATA, nodeId);
+    key[len++] = ':';
+    key[len] = '\0';
+}
+
+
+static int redisChunkRead(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset)
+{
+    char key[KEY_LEN];
+    char* data;
+    size_t len;
+    int handle;
+    int result;
+
+    formatChunkKey(key, nodeId, chunk);
+    result = viewKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    handle = redisCommand_GETRANGE(key, offset, offset + size - 1, &data, &len);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    assert(len <= size);
+    memcpy(buf, data, len);
+
+    releaseReplyHandle(handle);
+
+    return len;
+}
+
+
+// KEYS: chunk; ARGV: "<name>::", offset, data
+static const char* chunkWriteScript =
+    LUA_COW_FUNCTION
+    "cowAt(ARGV[1], KEYS[1]) "
+    "return redis.call('SETRANGE', KEYS[1], ARGV[2], ARGV[3])";
+
+
+static int redisChunkWrite(node_id_t nodeId, long long chunk, const char* buf, size_t size, off_t offset)
+{
+    char key[KEY_LEN];
+    char prefix[KEY_LEN];
+    char offsetStr[24];
+    const char* args[3] = { key, prefix, offsetStr };
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatChunkKey(key, nodeId, chunk);
+    formatKey(prefix, "");
+    snprintf(offsetStr, sizeof(offsetStr), "%lld", (long long)offset);
+
+    return redisCommand_EVAL_BIN_INT(chunkWriteScript, 1, args, 3, buf, size, NULL) ? 0 : -EIO;
+}
+
+
+// KEYS: chunk; ARGV: "<name>::", length. Keeps the first length bytes of
+// the chunk, in one step so a concurrent write cannot be lost in between.
+static const char* truncateScript =
+    LUA_COW_FUNCTION
+    "cowAt(ARGV[1], KEYS[1]) "
+    "local n = tonumber(ARGV[2]) "
+    "if n == 0 then return redis.call('DEL', KEYS[1]) end "
+    "if redis.call('STRLEN', KEYS[1]) > n then "
+    "redis.call('SET', KEYS[1], redis.call('GETRANGE', KEYS[1], 0, n - 1)) end "
+    "return 0";
+
+
+static int redisChunkTruncate(node_id_t nodeId, long long chunk, off_t length)
+{
+    char key[KEY_LEN];
+    char prefix[KEY_LEN];
+    char lengthStr[24];
+    const char* args[3] = { key, prefix, lengthStr };
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatChunkKey(key, nodeId, chunk);
+    formatKey(prefix, "");
+    snprintf(lengthStr, sizeof(lengthStr), "%lld", (long long)length);
+
+    return redisCommand_EVAL_INT(truncateScript, 1, args, 3, NULL) ? 0 : -EIO;
+}
+
+
+// KEYS: info, cold, journal generation, journal log; ARGV: node ID, chunk
+// key prefix, chunk size, first and last prepared chunk, inline max, mtime
+// seconds and nanoseconds, "<name>::", data. Returns the offset of the
+// data, -1 if the node is gone, -2 if a quota would be exceeded, or -3
+// minus the size of the file to prepare again for. The info of nodes from
+// before the size and flags fields is padded first.
+static const char* appendScript =
+    LUA_COW_FUNCTION
+    LUA_INFO_PAD_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "cowAt(ARGV[9], KEYS[1]) "
+    "infoPad(KEYS[1]) "
+    "local f = redis.call('LRANGE', KEYS[1], 0, " LUA_STR(LUA_INFO_COUNT) ") "
+    "if #f < " LUA_STR(LUA_INFO_COUNT) " then return -1 end "
+    "local size, flags = tonumber(f[" LUA_STR(LUA_INFO_SIZE) " + 1]), tonumber(f[" LUA_STR(LUA_INFO_FLAGS) " + 1]) "
+    "local data, cs = ARGV[10], tonumber(ARGV[3]) "
+    "local inline, first, last = flags % 2 == 1, math.floor(size / cs), math.floor((size + #data - 1) / cs) "
+    "local p = ARGV[9] "
+    "local parent = redis.call('HGET', p .. 'parents', ARGV[1]) "
+    "if parent and not usageFits(p, false, parent, #data, 0) then return -2 end "
+    "local function setInline(v) "
+    "if #f > " LUA_STR(LUA_INFO_COUNT) " then redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_COUNT) ", v) else redis.call('RPUSH', KEYS[1], v) end end "
+    "local function finish() "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_MOD_TIME) ", ARGV[7]) "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_MOD_TIME) " + 1, ARGV[8]) "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_SIZE) ", size + #data) "
+    "if parent then usageMove(p, false, parent, #data, 0) end "
+    "journal(KEYS[3], KEYS[4], ARGV[1]) "
+    "return size end "
+    "local head = inline and string.sub(f[" LUA_STR(LUA_INFO_COUNT) " + 1] or '', 1, size) or '' "
+    "head = head .. string.rep('\\0', inline and size - #head or 0) "
+    "if inline and size + #data <= tonumber(ARGV[6]) then setInline(head .. data) return finish() end "
+    "if inline then first = 0 end "
+    "if first < tonumber(ARGV[4]) or last > tonumber(ARGV[5]) then return -3 - size end "
+    "for c = first, last do if redis.call('HEXISTS', KEYS[2], c) == 1 then return -3 - size end end "
+    "if inline then "
+    "if size > 0 then cowAt(p, ARGV[2] .. 0) redis.call('SETRANGE', ARGV[2] .. 0, 0, head) end "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_FLAGS) ", flags - 1) "
+    "setInline('') "
+    "end "
+    "local off, pos = size, 1 "
+    "while pos <= #data do "
+    "local o = off % cs "
+    "local n = math.min(cs - o, #data - pos + 1) "
+    "local key = ARGV[2] .. math.floor(off / cs) "
+    "cowAt(p, key) "
+    "redis.call('SETRANGE', key, o, string.sub(data, pos, pos + n - 1)) "
+    "off, pos = off + n, pos + n "
+    "end "
+    "return finish()";
+
+
+static int redisFileAppend(node_id_t nodeId, const char* data, size_t len, size_t inlineMax, const long long mtime[2],
+                           off_t* size)
+{
+    char keys[4][KEY_LEN];
+    char prefix[KEY_LEN];
+    char fsPrefix[KEY_LEN];
+    char numbers[7][24];
+    const char* args[13];
+    long long first = *size / CHUNK_SIZE;
+    long long last = (*size + len + APPEND_SLACK - 1) / CHUNK_SIZE;
+    long long offset;
+    int result;
+    int i;
+
+    formatNodeKey(keys[0], KEY_INFO, nodeId);
+    formatNodeKey(keys[1], KEY_COLD, nodeId);
+    formatKey(keys[2], KEY_META_GEN);
+    formatKey(keys[3], KEY_META_LOG);
+    formatChunkPrefix(prefix, nodeId);
+    formatKey(fsPrefix, "");
+
+    // Inline data moves to the first chunk:
+    if (*size <= inlineMax)
+    {
+        first = 0;
+    }
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", nodeId);
+    snprintf(numbers[1], sizeof(numbers[1]), "%d", CHUNK_SIZE);
+    snprintf(numbers[2], sizeof(numbers[2]), "%lld", first);
+    snprintf(numbers[3], sizeof(numbers[3]), "%lld", last);
+    snprintf(numbers[4], sizeof(numbers[4]), "%zu", inlineMax);
+    snprintf(numbers[5], sizeof(numbers[5]), "%lld", mtime[0]);
+    snprintf(numbers[6], sizeof(numbers[6]), "%lld", mtime[1]);
+    for (i = 0; i < 4; ++i)
+    {
+        args[i] = keys[i];
+    }
+    args[4] = numbers[0];
+    args[5] = prefix;
+    for (i = 1; i < 7; ++i)
+    {
+        args[i + 5] = numbers[i];
+    }
+    args[12] = fsPrefix;
+
+    result = redisCommand_EVAL_BIN_INT(appendScript, 4, args, 13, data, len, &offset) ? 0 : -EIO;
+    metaCacheInvalidate(nodeId);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (offset == -1)
+    {
+        return -ENOENT;
+    }
+    else if (offset == -2)
+    {
+        return -EDQUOT;
+    }
+    else if (offset < 0)
+    {
+        *size = -3 - offset;
+        return -EAGAIN;
+    }
+
+    *size = offset;
+
+    return 0;
+}
+
+
+// KEYS: info, journal generation, journal log; ARGV: node ID, "<name>::",
+// size, mtime seconds and nanoseconds. Returns the size of the file, -1 if
+// the node is gone, or -2 if a quota would be exceeded. The info of nodes
+// from before the size and flags fields is padded first.
+static const char* extendScript =
+    LUA_COW_FUNCTION
+    LUA_INFO_PAD_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "local p, size = ARGV[2], tonumber(ARGV[3]) "
+    "if redis.call('EXISTS', KEYS[1]) == 0 then return -1 end "
+    "cowAt(p, KEYS[1]) "
+    "infoPad(KEYS[1]) "
+    "local old = tonumber(redis.call('LINDEX', KEYS[1], " LUA_STR(LUA_INFO_SIZE) ")) "
+    "if size > old then "
+    "local parent = redis.call('HGET', p .. 'parents', ARGV[1]) "
+    "if parent and not usageFits(p, false, parent, size - old, 0) then return -2 end "
+    "if parent then usageMove(p, false, parent, size - old, 0) end "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_SIZE) ", size) "
+    "else size = old end "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_MOD_TIME) ", ARGV[4]) "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_MOD_TIME) " + 1, ARGV[5]) "
+    "journal(KEYS[2], KEYS[3], ARGV[1]) "
+    "return size";
+
+
+static int redisFileExtend(node_id_t nodeId, const long long mtime[2], off_t* size)
+{
+    char keys[3][KEY_LEN];
+    char prefix[KEY_LEN];
+    char numbers[4][24];
+    const char* args[8] = { keys[0], keys[1], keys[2], numbers[0], prefix, numbers[1], numbers[2], numbers[3] };
+    long long newSize;
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(keys[0], KEY_INFO, nodeId);
+    formatKey(keys[1], KEY_META_GEN);
+    formatKey(keys[2], KEY_META_LOG);
+    formatKey(prefix, "");
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", nodeId);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", (long long)*size);
+    snprintf(numbers[2], sizeof(numbers[2]), "%lld", mtime[0]);
+    snprintf(numbers[3], sizeof(numbers[3]), "%lld", mtime[1]);
+
+    result = redisCommand_EVAL_INT(extendScript, 3, args, 8, &newSize) ? 0 : -EIO;
+    metaCacheInvalidate(nodeId);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (newSize < 0)
+    {
+        return newSize == -1 ? -ENOENT : -EDQUOT;
+    }
+
+    *size = newSize;
+
+    return 0;
+}
+
+
+static int redisChunkGet(node_id_t nodeId, long long chunk, char* buf, size_t size)
+{
+    char key[KEY_LEN];
+    char* data;
+    size_t len;
+    int handle;
+    int result;
+
+    formatChunkKey(key, nodeId, chunk);
+    result = viewKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    handle = redisCommand_GETRANGE(key, 0, size - 1, &data, &len);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    assert(len <= size);
+    memcpy(buf, data, len);
+
+    releaseReplyHandle(handle);
+
+    return len;
+}
+
+
+// KEYS: chunk; ARGV: "<name>::", data
+static const char* chunkPutScript =
+    LUA_COW_FUNCTION
+    "cowAt(ARGV[1], KEYS[1]) "
+    "redis.call('SET', KEYS[1], ARGV[2]) "
+    "return 0";
+
+
+static int redisChunkPut(node_id_t nodeId, long long chunk, const char* data, size_t len)
+{
+    char key[KEY_LEN];
+    char prefix[KEY_LEN];
+    const char* args[2] = { key, prefix };
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatChunkKey(key, nodeId, chunk);
+    formatKey(prefix, "");
+
+    return redisCommand_EVAL_BIN_INT(chunkPutScript, 1, args, 2, data, len, NULL) ? 0 : -EIO;
+}
+
+
+/* ================ Tiered chunks ================ */
+
+// redifs_tier moves a chunk to the cold store by replacing its data key
+// with a field of the cold hash of its file. The value comes back
+// unchanged, so restoring it is not journaled, unless the file loses
+// NODE_FLAG_TIERED with its last stub.
+
+// KEYS: data, cold, info, journal generation, journal log; ARGV: chunk,
+// object, node ID, flag, restore, "<name>::", value
+static const char* restoreScript =
+    LUA_COW_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    "if redis.call('EXISTS', KEYS[3]) == 0 or redis.call('HGET', KEYS[2], ARGV[1]) ~= ARGV[2] then return 0 end "
+    "for i = 1, 3 do cowAt(ARGV[6], KEYS[i]) end "
+    "if ARGV[5] == '1' and redis.call('EXISTS', KEYS[1]) == 0 then redis.call('SET', KEYS[1], ARGV[7]) end "
+    "redis.call('HDEL', KEYS[2], ARGV[1]) "
+    "if redis.call('EXISTS', KEYS[2]) == 1 then return 1 end "
+    "local flags, f = tonumber(redis.call('LINDEX', KEYS[3], " LUA_STR(LUA_INFO_FLAGS) ") or '0'), tonumber(ARGV[4]) "
+    "if math.floor(flags / f) % 2 == 1 then redis.call('LSET', KEYS[3], " LUA_STR(LUA_INFO_FLAGS) ", flags - f) end "
+    "journal(KEYS[4], KEYS[5], ARGV[3]) "
+    "return 2";
+
+
+static int redisChunkStub(node_id_t nodeId, long long chunk, char* name, size_t size)
+{
+    char key[KEY_LEN];
+    char field[24];
+    char* object;
+    int handle;
+    int result;
+
+    formatNodeKey(key, KEY_COLD, nodeId);
+    result = viewKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    snprintf(field, sizeof(field), "%lld", chunk);
+    handle = redisCommand_HGET(key, field, &object);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    result = 0;
+    if (object && strlen(object) < size)
+    {
+        strcpy(name, object);
+        result = 1;
+    }
+    else if (object)
+    {
+        result = -EIO;
+    }
+
+    releaseReplyHandle(handle);
+
+    return result;
+}
+
+
+static int redisChunkRestore(node_id_t nodeId, long long chunk, const char* object, const char* data, size_t len)
+{
+    char keys[5][KEY_LEN];
+    char prefix[KEY_LEN];
+    char numbers[3][24];
+    const char* args[11];
+    long long restored;
+    int result;
+    int i;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatChunkKey(keys[0], nodeId, chunk);
+    formatNodeKey(keys[1], KEY_COLD, nodeId);
+    formatNodeKey(keys[2], KEY_INFO, nodeId);
+    formatKey(keys[3], KEY_META_GEN);
+    formatKey(keys[4], KEY_META_LOG);
+    formatKey(prefix, "");
+
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", chunk);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", nodeId);
+    snprintf(numbers[2], sizeof(numbers[2]), "%d", NODE_FLAG_TIERED);
+    for (i = 0; i < 5; ++i)
+    {
+        args[i] = keys[i];
+    }
+    args[5] = numbers[0];
+    args[6] = object;
+    args[7] = numbers[1];
+    args[8] = numbers[2];
+    args[9] = data ? "1" : "0";
+    args[10] = prefix;
+
+    if (!redisCommand_EVAL_BIN_INT(restoreScript, 5, args, 11, data ? data : "", data ? len : 0, &restored))
+    {
+        return -EIO;
+    }
+    if (restored == 2)
+    {
+        metaCacheInvalidate(nodeId);
+    }
+
+    return (int)restored;
+}
+
+
+/* ================ Deduplicated chunks ================ */
+
+// Reference counts only change inside these scripts, so linking, dropping
+// and collecting a blob cannot interleave.
+
+// KEYS: refs, blob; ARGV: chunk, hash, blob key prefix, gc list,
+// "<name>::"[, data]
+static const char* linkScript =
+    LUA_COW_FUNCTION
+    "local old = redis.call('HGET', KEYS[1], ARGV[1]) "
+    "if ARGV[6] then redis.call('HSETNX', KEYS[2], 'data', ARGV[6]) "
+    "elseif redis.call('HEXISTS', KEYS[2], 'data') == 0 then return 0 end "
+    "if old == ARGV[2] then return 1 end "
+    "cowAt(ARGV[5], KEYS[1]) "
+    "redis.call('HINCRBY', KEYS[2], 'refs', 1) "
+    "redis.call('HSET', KEYS[1], ARGV[1], ARGV[2]) "
+    "if old and redis.call('HINCRBY', ARGV[3] .. old, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', ARGV[4], old) end "
+    "return 1";
+
+// KEYS: refs; ARGV: chunk, blob key prefix, gc list, "<name>::"
+static const char* dropScript =
+    LUA_COW_FUNCTION
+    "local old = redis.call('HGET', KEYS[1], ARGV[1]) "
+    "if not old then return 0 end "
+    "cowAt(ARGV[4], KEYS[1]) "
+    "redis.call('HDEL', KEYS[1], ARGV[1]) "
+    "if redis.call('HINCRBY', ARGV[2] .. old, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', ARGV[3], old) end "
+    "return 1";
+
+// KEYS: refs; ARGV: chunk, blob key prefix
+static const char* getScript =
+    "local h = redis.call('HGET', KEYS[1], ARGV[1]) "
+    "if not h then return false end "
+    "return redis.call('HGET', ARGV[2] .. h, 'data')";
+
+// KEYS: gc list; ARGV: blob key prefix, max. Blobs linked again since
+// they were queued are kept.
+static const char* gcScript =
+    "local checked, freed = 0, 0 "
+    "while checked < tonumber(ARGV[2]) do "
+    "local h = redis.call('LPOP', KEYS[1]) "
+    "if not h then break end "
+    "checked = checked + 1 "
+    "local key = ARGV[1] .. h "
+    "if tonumber(redis.call('HGET', key, 'refs') or '0') <= 0 then "
+    "freed = freed + redis.call('DEL', key) end "
+    "end "
+    "return { tostring(checked), tostring(freed) }";
+
+
+static int redisDedupGet(node_id_t nodeId, long long chunk, char* buf, size_t size)
+{
+    char refsKey[KEY_LEN];
+    char blobPrefix[KEY_LEN];
+    char chunkStr[24];
+    const char* args[3];
+    char* data;
+    size_t len;
+    int handle;
+    int result;
+
+    formatNodeKey(refsKey, KEY_REFS, nodeId);
+    result = viewKey(refsKey);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatKey(blobPrefix, KEY_BLOB);
+    snprintf(chunkStr, sizeof(chunkStr), "%lld", chunk);
+
+    args[0] = refsKey;
+    args[1] = chunkStr;
+    args[2] = blobPrefix;
+
+    handle = redisCommand_EVAL_STR(getScript, 1, args, 3, &data, &len);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (!data)
+    {
+        return 0;
+    }
+
+    if (len > size)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+    memcpy(buf, data, len);
+
+    releaseReplyHandle(handle);
+
+    return len;
+}
+
+
+static int redisDedupLink(node_id_t nodeId, long long chunk, const char* hash, const char* data, size_t len)
+{
+    char refsKey[KEY_LEN];
+    char blobKey[KEY_LEN];
+    char blobPrefix[KEY_LEN];
+    char gcKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char chunkStr[24];
+    const char* args[7];
+    long long linked;
+    size_t prefixLen;
+    int ok;
+
+    ok = checkWritable();
+    if (ok < 0)
+    {
+        return ok;
+    }
+
+    formatNodeKey(refsKey, KEY_REFS, nodeId);
+    formatKey(prefix, "");
+    prefixLen = formatKey(blobPrefix, KEY_BLOB);
+    memcpy(blobKey, blobPrefix, prefixLen);
+    memcpy(blobKey + prefixLen, hash, CHUNK_HASH_LEN + 1);
+    formatKey(gcKey, KEY_BLOB_GC);
+    snprintf(chunkStr, sizeof(chunkStr), "%lld", chunk);
+
+    args[0] = refsKey;
+    args[1] = blobKey;
+    args[2] = chunkStr;
+    args[3] = hash;
+    args[4] = blobPrefix;
+    args[5] = gcKey;
+    args[6] = prefix;
+
+    if (data)
+    {
+        ok = redisCommand_EVAL_BIN_INT(linkScript, 2, args, 7, data, len, &linked);
+    }
+    else
+    {
+        ok = redisCommand_EVAL_INT(linkScript, 2, args, 7, &linked);
+    }
+
+    return ok ? (int)linked : -EIO;
+}
+
+
+static int redisDedupDrop(node_id_t nodeId, long long chunk)
+{
+    char refsKey[KEY_LEN];
+    char blobPrefix[KEY_LEN];
+    char gcKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char chunkStr[24];
+    const char* args[5];
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatNodeKey(refsKey, KEY_REFS, nodeId);
+    formatKey(prefix, "");
+    formatKey(blobPrefix, KEY_BLOB);
+    formatKey(gcKey, KEY_BLOB_GC);
+    snprintf(chunkStr, sizeof(chunkStr), "%lld", chunk);
+
+    args[0] = refsKey;
+    args[1] = chunkStr;
+    args[2] = blobPrefix;
+    args[3] = gcKey;
+    args[4] = prefix;
+
+    return redisCommand_EVAL_INT(dropScript, 1, args, 5, NULL) ? 0 : -EIO;
+}
+
+
+static int redisBlobGc(int max, int* freed)
+{
+    char gcKey[KEY_LEN];
+    char blobPrefix[KEY_LEN];
+    char maxStr[24];
+    const char* args[3];
+    char* counts[2];
+    int checked;
+    int count;
+    int handle;
+
+    formatKey(gcKey, KEY_BLOB_GC);
+    formatKey(blobPrefix, KEY_BLOB);
+    snprintf(maxStr, sizeof(maxStr), "%d", max);
+
+    args[0] = gcKey;
+    args[1] = blobPrefix;
+    args[2] = maxStr;
+
+    handle = redisCommand_EVAL_ARRAY(gcScript, 1, args, 3, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count != 2)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+
+    retrieveStringArrayElements(handle, 0, 2, counts);
+    checked = atoi(counts[0]);
+    *freed = atoi(counts[1]);
+
+    releaseReplyHandle(handle);
+
+    return checked;
+}
+
+
+/* ================ Server-side copies ================ */
+
+// ARGV: source data key prefix, source offset, destination prefix,
+// destination offset, length, chunk size, "<name>::"
+static const char* copyScript =
+    LUA_COW_FUNCTION
+    "local cs = tonumber(ARGV[6]) "
+    "local s, d, n = tonumber(ARGV[2]), tonumber(ARGV[4]), tonumber(ARGV[5]) "
+    "while n > 0 do "
+    "local so, dof = s % cs, d % cs "
+    "local part = math.min(n, cs - so, cs - dof) "
+    "local data = redis.call('GETRANGE', ARGV[1] .. math.floor(s / cs), so, so + part - 1) "
+    "local key = ARGV[3] .. math.floor(d / cs) "
+    "if #data > 0 or redis.call('EXISTS', key) == 1 then "
+    "if #data < part then data = data .. string.rep('\\0', part - #data) end "
+    "cowAt(ARGV[7], key) "
+    "redis.call('SETRANGE', key, dof, data) end "
+    "s, d, n = s + part, d + part, n - part "
+    "end "
+    "return 0";
+
+// ARGV: source data key prefix, first source chunk, destination prefix,
+// first destination chunk, count, "<name>::"
+static const char* cloneScript =
+    LUA_COW_FUNCTION
+    "for i = 0, tonumber(ARGV[5]) - 1 do "
+    "local value = redis.call('GET', ARGV[1] .. tostring(ARGV[2] + i)) "
+    "local key = ARGV[3] .. tostring(ARGV[4] + i) "
+    "cowAt(ARGV[6], key) "
+    "if value then redis.call('SET', key, value) else redis.call('DEL', key) end "
+    "end "
+    "return 0";
+
+// ARGV: source refs, first source chunk, destination refs, first
+// destination chunk, count, blob key prefix, gc list, "<name>::"
+static const char* shareScript =
+    LUA_COW_FUNCTION
+    "cowAt(ARGV[8], ARGV[3]) "
+    "for i = 0, tonumber(ARGV[5]) - 1 do "
+    "local sc, dc = tostring(ARGV[2] + i), tostring(ARGV[4] + i) "
+    "local h = redis.call('HGET', ARGV[1], sc) "
+    "local old = redis.call('HGET', ARGV[3], dc) "
+    "if h ~= old then "
+    "if h then redis.call('HINCRBY', ARGV[6] .. h, 'refs', 1) redis.call('HSET', ARGV[3], dc, h) "
+    "else redis.call('HDEL', ARGV[3], dc) end "
+    "if old and redis.call('HINCRBY', ARGV[6] .. old, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', ARGV[7], old) end "
+    "end "
+    "end "
+    "return 0";
+
+
+static int redisChunkCopy(node_id_t srcId, off_t srcOffset, node_id_t dstId, off_t dstOffset, size_t len)
+{
+    char srcPrefix[KEY_LEN];
+    char dstPrefix[KEY_LEN];
+    char prefix[KEY_LEN];
+    char numbers[4][24];
+    const char* args[7];
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatChunkPrefix(srcPrefix, srcId);
+    formatChunkPrefix(dstPrefix, dstId);
+    formatKey(prefix, "");
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", (long long)srcOffset);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", (long long)dstOffset);
+    snprintf(numbers[2], sizeof(numbers[2]), "%zu", len);
+    snprintf(numbers[3], sizeof(numbers[3]), "%d", CHUNK_SIZE);
+
+    args[0] = srcPrefix;
+    args[1] = numbers[0];
+    args[2] = dstPrefix;
+    args[3] = numbers[1];
+    args[4] = numbers[2];
+    args[5] = numbers[3];
+    args[6] = prefix;
+
+    return redisCommand_EVAL_INT(copyScript, 0, args, 7, NULL) ? 0 : -EIO;
+}
+
+
+static int redisChunkClone(node_id_t srcId, long long srcChunk, node_id_t dstId, long long dstChunk,
+                           long long count, int dedup)
+{
+    char srcKey[KEY_LEN];
+    char dstKey[KEY_LEN];
+    char blobPrefix[KEY_LEN];
+    char gcKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char numbers[3][24];
+    const char* args[8];
+    int result;
+
+    result = checkWritable();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    formatKey(prefix, "");
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", srcChunk);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", dstChunk);
+    snprintf(numbers[2], sizeof(numbers[2]), "%lld", count);
+
+    args[0] = srcKey;
+    args[1] = numbers[0];
+    args[2] = dstKey;
+    args[3] = numbers[1];
+    args[4] = numbers[2];
+
+    if (!dedup)
+    {
+        formatChunkPrefix(srcKey, srcId);
+        formatChunkPrefix(dstKey, dstId);
+        args[5] = prefix;
+        return redisCommand_EVAL_INT(cloneScript, 0, args, 6, NULL) ? 0 : -EIO;
+    }
+
+    formatNodeKey(srcKey, KEY_REFS, srcId);
+    formatNodeKey(dstKey, KEY_REFS, dstId);
+    formatKey(blobPrefix, KEY_BLOB);
+    formatKey(gcKey, KEY_BLOB_GC);
+    args[5] = blobPrefix;
+    args[6] = gcKey;
+    args[7] = prefix;
+
+    return redisCommand_EVAL_INT(shareScript, 0, args, 8, NULL) ? 0 : -EIO;
+}
+
+
+/* ================ Reclaim ================ */
+
+// ARGV: "<name>::", max, ready node ID, ready first chunk, chunk size,
+// generation the ready part was archived in.
+// Frees queued nodes from the head of the orphan list. A file goes from
+// its last chunk down, and a directory queues its entries in turn; the
+// size field of the node keeps the position to resume at, the remaining
+// size or the directory cursor. Returns { done, freed }. While snapshots
+// exist, every part is archived before it is freed, so the script stops
+// at a part that is not the ready one, or was archived before the live
+// generation started, and returns { done, freed, id, first chunk, chunk
+// count, flags, is directory, generation } instead; the buckets of a
+// directory past its key are archived here.
+static const char* reclaimScript =
+    LUA_INFO_PAD_FUNCTION
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    "redis.replicate_commands() "
+    "local p, max, cs = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[5]) "
+    "local orphans = p .. 'orphans' "
+    "local snap = redis.call('HLEN', p .. 'snapshots') > 0 "
+    "local gen = redis.call('GET', p .. 'gen') or '0' "
+    "local done, freed = 0, 0 "
+    "while done < max do "
+    "local id = redis.call('LINDEX', orphans, 0) "
+    "if not id then break end "
+    "local info, node, refs, cold = p .. 'info:' .. id, p .. 'node:' .. id, p .. 'refs:' .. id, p .. 'cold:' .. id "
+    "local f = redis.call('LRANGE', info, 0, " LUA_STR(LUA_INFO_FLAGS) ") "
+    "local mode, flags = tonumber(f[1] or '0'), tonumber(f[" LUA_STR(LUA_INFO_FLAGS) " + 1] or '0') "
+    "local pos = f[" LUA_STR(LUA_INFO_SIZE) " + 1] or '0' "
+    "local isDir = " LUA_MODE_IS_DIR("mode") " "
+    "local last, first, resume = 0, 0, nil "
+    "if not isDir then "
+    "last = math.ceil(tonumber(pos) / cs) "
+    "first = math.max(0, last - (max - done)) end "
+    "if snap and (id ~= ARGV[3] or first ~= tonumber(ARGV[4]) or gen ~= ARGV[6]) then "
+    "return { tostring(done), tostring(freed), id, tostring(first), tostring(last - first), "
+    "tostring(flags), isDir and '1' or '0', gen } end "
+    "if isDir then "
+    "local bk = dirBuckets(node) "
+    "local n = dirCount(bk) "
+    "if snap then for b = 1, n - 1 do dirCow(node, bk(b)) end end "
+    "local reply = dirScan(bk, pos, max - done) "
+    "for i = 2, #reply, 2 do "
+    "redis.call('RPUSH', orphans, reply[i + 1]) "
+    "redis.call('HDEL', p .. 'parents', reply[i + 1]) "
+    "redis.call('HDEL', bk(dirSlot(n, reply[i])), reply[i]) end "
+    "done = done + (#reply - 1) / 2 "
+    "if reply[1] ~= '0' then resume = reply[1] end "
+    "elseif math.floor(flags / 2) % 2 == 1 then "
+    "for c = last - 1, first, -1 do "
+    "local h = redis.call('HGET', refs, c) "
+    "if h then "
+    "redis.call('HDEL', refs, c) "
+    "if redis.call('HINCRBY', p .. 'blob:' .. h, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', p .. 'blob_gc', h) end "
+    "freed = freed + 1 end end "
+    "else "
+    "for c = last - 1, first, -1 do "
+    "freed = freed + redis.call('UNLINK', p .. 'data:' .. id .. ':' .. c) end "
+    "end "
+    "done = done + last - first + 1 "
+    "if first > 0 then resume = first * cs end "
+    "if resume then "
+    "infoPad(info) "
+    "redis.call('LSET', info, " LUA_STR(LUA_INFO_SIZE) ", resume) "
+    "else "
+    "freed = freed + redis.call('UNLINK', info, node, refs, cold) "
+    "redis.call('HDEL', p .. 'parents', id) "
+    "if isDir then "
+    "redis.call('UNLINK', p .. 'bloom:' .. id, p .. 'usage:' .. id) "
+    "redis.call('HDEL', p .. 'blooms', id) "
+    "redis.call('SREM', p .. 'quotas', id) end "
+    "redis.call('LPOP', orphans) "
+    "end "
+    "end "
+    "return { tostring(done), tostring(freed) }";
+
+
+// Archive the parts of a queued node that the reclaim script frees next:
+static int archiveOrphan(node_id_t nodeId, long long first, long long count, long long flags, int isDir)
+{
+    char key[KEY_LEN];
+    int result;
+
+    formatNodeKey(key, KEY_INFO, nodeId);
+    result = cowKey(key);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (isDir)
+    {
+        formatNodeKey(key, KEY_NODE, nodeId);
+        return cowKey(key);
+    }
+
+    if (flags & NODE_FLAG_DEDUP)
+    {
+        formatNodeKey(key, KEY_REFS, nodeId);
+        return cowKey(key);
+    }
+
+    if (flags & NODE_FLAG_TIERED)
+    {
+        formatNodeKey(key, KEY_COLD, nodeId);
+        result = cowKey(key);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    return cowChunks(nodeId, first, count);
+}
+
+
+static int redisReclaim(int max, int* freed)
+{
+    char prefix[KEY_LEN];
+    char numbers[5][24];
+    const char* args[6];
+    char* values[8];
+    node_id_t nodeId;
+    long long first;
+    long long count;
+    long long flags;
+    int isDir;
+    int done = 0;
+    int result;
+    int handle;
+
+    formatKey(prefix, "");
+    snprintf(numbers[1], sizeof(numbers[1]), "-1");
+    snprintf(numbers[2], sizeof(numbers[2]), "-1");
+    snprintf(numbers[3], sizeof(numbers[3]), "%d", CHUNK_SIZE);
+    snprintf(numbers[4], sizeof(numbers[4]), "-1");
+
+    args[0] = prefix;
+    args[1] = numbers[0];
+    args[2] = numbers[1];
+    args[3] = numbers[2];
+    args[4] = numbers[3];
+    args[5] = numbers[4];
+
+    *freed = 0;
+    while (done < max)
+    {
+        snprintf(numbers[0], sizeof(numbers[0]), "%d", max - done);
+
+        handle = redisCommand_EVAL_ARRAY(reclaimScript, 0, args, 6, &result);
+        if (!handle)
+        {
+            return -EIO;
+        }
+        else if (result != 2 && result != 8)
+        {
+            releaseReplyHandle(handle);
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, result, values);
+        done += atoi(values[0]);
+        *freed += atoi(values[1]);
+        if (result == 2)
+        {
+            releaseReplyHandle(handle);
+            break;
+        }
+
+        // A snapshot may still read the next part:
+        nodeId = atoll(values[2]);
+        first = atoll(values[3]);
+        count = atoll(values[4]);
+        flags = atoll(values[5]);
+        isDir = atoi(values[6]);
+        snprintf(numbers[4], sizeof(numbers[4]), "%s", values[7]);
+        releaseReplyHandle(handle);
+
+        result = archiveOrphan(nodeId, first, count, flags, isDir);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        snprintf(numbers[1], sizeof(numbers[1]), "%lld", (long long)nodeId);
+        snprintf(numbers[2], sizeof(numbers[2]), "%lld", first);
+    }
+
+    return done;
+}
+
+
+/* ================ Tree walks ================ */
+
+// Tree walk in progress, stored with the walk:
+struct redis_walk
+{
+    char job[KEY_LEN];
+    node_id_t root; // -1 once queued.
+};
+
+
+// KEYS: walk job; ARGV: "<name>::", max, root directory ID or "", seconds
+// to keep an abandoned job. The job is a list of "<id> <cursor> <path>"
+// items, one per directory left to visit, where path is relative to the
+// root and ends with a slash. Returns { more, path, id, mode, size, ... }.
+static const char* walkScript =
+    LUA_DIR_FUNCTIONS
+    "redis.replicate_commands() "
+    "local p, max = ARGV[1], tonumber(ARGV[2]) "
+    "if ARGV[3] ~= '' then redis.call('RPUSH', KEYS[1], ARGV[3] .. ' 0 ') end "
+    "local out = { '0' } "
+    "local done = 0 "
+    "while done < max do "
+    "local head = redis.call('LINDEX', KEYS[1], 0) "
+    "if not head then break end "
+    "local id, cursor, path = string.match(head, '^(%d+) (%S+) (.*)$') "
+    "local reply = dirScan(dirBuckets(p .. 'node:' .. id), cursor, max - done) "
+    "for i = 2, #reply, 2 do "
+    "local child, name = reply[i + 1], path .. reply[i] "
+    "local f = redis.call('LRANGE', p .. 'info:' .. child, 0, " LUA_STR(LUA_INFO_SIZE) ") "
+    "local mode = f[1] or '0' "
+    "out[#out + 1] = name "
+    "out[#out + 1] = child "
+    "out[#out + 1] = mode "
+    "out[#out + 1] = f[" LUA_STR(LUA_INFO_SIZE) " + 1] or '0' "
+    "if " LUA_MODE_IS_DIR("tonumber(mode)") " then "
+    "redis.call('RPUSH', KEYS[1], child .. ' 0 ' .. name .. '/') end end "
+    "done = done + (#reply - 1) / 2 + 1 "
+    "if reply[1] == '0' then "
+    "redis.call('LPOP', KEYS[1]) "
+    "else "
+    "redis.call('LSET', KEYS[1], 0, id .. ' ' .. reply[1] .. ' ' .. path) end "
+    "end "
+    "if redis.call('EXISTS', KEYS[1]) == 1 then "
+    "redis.call('EXPIRE', KEYS[1], ARGV[4]) "
+    "out[1] = '1' end "
+    "return out";
+
+
+static int redisTreeWalkOpen(node_id_t dirId, void** walk)
+{
+    struct redis_walk* state;
+    char key[KEY_LEN];
+    long long jobId;
+
+    // The script reads the live keys:
+    if (g_settings->snapshot)
+    {
+        return -EOPNOTSUPP;
+    }
+
+    formatKey(key, KEY_WALK_CTR);
+    if (!redisCommand_INCR(key, &jobId))
+    {
+        return -EIO;
+    }
+
+    state = malloc(sizeof(struct redis_walk));
+    if (!state)
+    {
+        return -ENOMEM;
+    }
+
+    snprintf(key, sizeof(key), KEY_WALK ":%lld", jobId);
+    formatKey(state->job, key);
+    state->root = dirId;
+    *walk = state;
+
+    return 0;
+}
+
+
+static int redisTreeWalkNext(void* walk, tree_entry_fn fn, void* ctx, int max)
+{
+    struct redis_walk* state = (struct redis_walk*)walk;
+    char prefix[KEY_LEN];
+    char numbers[3][24];
+    const char* args[5];
+    int count;
+    int handle;
+    int i;
+
+    formatKey(prefix, "");
+    snprintf(numbers[0], sizeof(numbers[0]), "%d", max);
+    numbers[1][0] = '\0';
+    if (state->root >= 0)
+    {
+        snprintf(numbers[1], sizeof(numbers[1]), "%lld", (long long)state->root);
+    }
+    snprintf(numbers[2], sizeof(numbers[2]), "%d", TREE_WALK_EXPIRE_SECONDS);
+
+    args[0] = state->job;
+    args[1] = prefix;
+    args[2] = numbers[0];
+    args[3] = numbers[1];
+    args[4] = numbers[2];
+
+    handle = redisCommand_EVAL_ARRAY(walkScript, 1, args, 5, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count < 1 || count % 4 != 1)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+    state->root = -1;
+
+    {
+        char* values[count];
+        retrieveStringArrayElements(handle, 0, count, values);
+        for (i = 1; i < count; i += 4)
+        {
+            fn(ctx, values[i], atoll(values[i + 1]), atoll(values[i + 2]), atoll(values[i + 3]));
+        }
+        count = atoi(values[0]);
+    }
+
+    releaseReplyHandle(handle);
+
+    return count;
+}
+
+
+static void redisTreeWalkClose(void* walk)
+{
+    struct redis_walk* state = (struct redis_walk*)walk;
+    const char* keys[1] = { state->job };
+
+    // Nothing is left of a finished walk; an unfinished one would expire:
+    redisCommand_DEL(keys, 1, NULL);
+    free(state);
+}
+
+
+/* ================ Usage ================ */
+
+// KEYS: usage of the directory.
+static const char* usageScript =
+    "local u = redis.call('HMGET', KEYS[1], 'bytes', 'inodes', 'max_bytes', 'max_inodes') "
+    "for i = 1, 4 do u[i] = u[i] or '0' end "
+    "return u";
+
+
+static int redisDirUsage(node_id_t dirId, struct dir_usage* usage)
+{
+    char key[KEY_LEN];
+    const char* args[1] = { key };
+    char* values[4];
+    int count;
+    int handle;
+
+    formatNodeKey(key, KEY_USAGE, dirId);
+    handle = redisCommand_EVAL_ARRAY(usageScript, 1, args, 1, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count != 4)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+
+    retrieveStringArrayElements(handle, 0, 4, values);
+    usage->bytes = atoll(values[0]);
+    usage->inodes = atoll(values[1]);
+    usage->maxBytes = atoll(values[2]);
+    usage->maxInodes = atoll(values[3]);
+    releaseReplyHandle(handle);
+
+    return 0;
+}
+
+
+// KEYS: usage of the directory, quotas; ARGV: directory ID, max bytes, max
+// inodes. The quotas set lists the directories with a limit, for fsck.
+static const char* quotaScript =
+    "local fields = { 'max_bytes', 'max_inodes' } "
+    "for i = 1, 2 do "
+    "if ARGV[i + 1] == '0' then redis.call('HDEL', KEYS[1], fields[i]) "
+    "else redis.call('HSET', KEYS[1], fields[i], ARGV[i + 1]) end end "
+    "if ARGV[2] == '0' and ARGV[3] == '0' then redis.call('SREM', KEYS[2], ARGV[1]) "
+    "else redis.call('SADD', KEYS[2], ARGV[1]) end "
+    "return 0";
+
+
+static int redisDirQuota(node_id_t dirId, long long maxBytes, long long maxInodes)
+{
+    char key[KEY_LEN];
+    char quotasKey[KEY_LEN];
+    char numbers[3][24];
+    const char* args[5] = { key, quotasKey, numbers[0], numbers[1], numbers[2] };
+
+    // Usage is not part of snapshots:
+    if (viewGeneration() >= 0)
+    {
+        return -EROFS;
+    }
+
+    formatNodeKey(key, KEY_USAGE, dirId);
+    formatKey(quotasKey, KEY_QUOTAS);
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", (long long)dirId);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", maxBytes);
+    snprintf(numbers[2], sizeof(numbers[2]), "%lld", maxInodes);
+
+    return redisCommand_EVAL_INT(quotaScript, 2, args, 5, NULL) ? 0 : -EIO;
+}
+
+
+/* ---- Redis backend ---- */
+const struct redifs_backend redisBackend = {
+    .name = "redis",
+    .open = redisOpen,
+    .close = redisClose,
+    .fs_exists = checkFileSystemExists,
+    .fs_create = createFileSystem,
+    .resolve = retrievePathNodeId,
+    .create_node = redisCreateNode,
+    .get_info = redisGetInfo,
+    .set_info = redisSetInfo,
+    .get_node = redisGetNode,
+    .set_inline = redisSetInline,
+    .set_times = redisSetTimes,
+    .dir_list = redisDirList,
+    .dir_unlink = redisDirUnlink,
+    .dir_rename = redisDirRename,
+    .chunk_read = redisChunkRead,
+    .chunk_write = redisChunkWrite,
+    .chunk_truncate = redisChunkTruncate,
+    .file_append = redisFileAppend,
+    .file_extend = redisFileExtend,
+    .chunk_get = redisChunkGet,
+    .chunk_put = redisChunkPut,
+    .chunk_stub = redisChunkStub,
+    .chunk_restore = redisChunkRestore,
+    .dedup_get = redisDedupGet,
+    .dedup_link = redisDedupLink,
+    .dedup_drop = redisDedupDrop,
+    .blob_gc = redisBlobGc,
+    .chunk_copy = redisChunkCopy,
+    .chunk_clone = redisChunkClone,
+    .snapshot_create = createSnapshot,
+    .snapshot_delete = deleteSnapshot,
+    .snapshot_list = listSnapshots,
+    .reclaim = redisReclaim,
+    .tree_walk_open = redisTreeWalkOpen,
+    .tree_walk_next = redisTreeWalkNext,
+    .tree_walk_close = redisTreeWalkClose,
+    .dir_usage = redisDirUsage,
+    .dir_quota = redisDirQuota,
+};
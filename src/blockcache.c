@@ -0,0 +1,774 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Persistent cache of file data on a local disk, so that reading a file
+ * again, also after a remount, needs no transfer from Redis. The cache is
+ * a memory-mapped file of whole decoded chunks in blocks of CHUNK_SIZE
+ * bytes, found through a hash table of (node, chunk) with buckets of
+ * BLOCKCACHE_BUCKET_SLOTS block numbers. When the cache is full, blocks are
+ * replaced in CLOCK order: a block read since the hand last passed it gets
+ * another round.
+ *
+ * Chunks carry no version of their own, but every change of file data also
+ * stores the info of its node, and that is recorded in the change journal
+ * of the file system (see util.c). So, as in the metadata cache, every node
+ * has a stamp that is renewed when the journal or a write through this
+ * mount names it, and a block is valid while the stamp it was stored with
+ * matches the one of its node. The journal is read at open and at most
+ * every ttl milliseconds while mounted; if it no longer reaches back to the
+ * generation of the cache, or the mount ended without closing the cache,
+ * everything is dropped.
+ *
+ * A block is only filled by the thread that took it from the clock, and is
+ * only read through the hash table with its bucket locked, so taking a
+ * block locks the bucket that still refers to it first.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "blockcache.h"
+#include "backend.h"
+#include "options.h"
+#include "stats.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define BLOCKCACHE_MAGIC "RDFSBC01"
+#define BLOCKCACHE_HEADER_SIZE 4096
+#define BLOCKCACHE_BUCKET_SLOTS 8
+#define BLOCKCACHE_LOCKS 256
+#define BLOCKCACHE_MIN_BLOCKS 64
+
+
+/* ---- Types ---- */
+
+// Start of the cache file:
+struct blockcache_header
+{
+    char magic[8];
+    uint32_t clean; // Set by a clean close, cleared while mounted.
+    uint32_t bucketSlots;
+    char identity[256]; // Redis server and file system name.
+    int64_t gen; // Journal generation the contents are valid for.
+    int64_t nextStamp;
+    int64_t minStamp; // Nodes with an older stamp are invalid.
+    uint64_t nodeBuckets;
+    uint64_t indexBuckets;
+    uint64_t blocks;
+    uint64_t hand; // Next block the clock looks at.
+};
+
+struct blockcache_node
+{
+    int64_t key; // Node ID + 1, 0 for a free slot.
+    int64_t stamp;
+};
+
+struct blockcache_block
+{
+    int64_t key; // Node ID + 1, 0 for a free block.
+    int64_t chunk;
+    int64_t stamp;
+    uint32_t len;
+    uint8_t ref; // Read since the hand passed.
+    uint8_t busy; // Taken by the clock and being filled.
+};
+
+
+/* ---- Globals ---- */
+static int cacheFd = -1;
+static char* cacheMap = NULL;
+static size_t cacheSize = 0;
+static struct blockcache_header* header = NULL;
+static struct blockcache_node* nodes = NULL;
+static struct blockcache_block* blocks = NULL;
+static uint32_t* chunkIndex = NULL; // Block number + 1 per slot, 0 for a free slot.
+static char* data = NULL;
+static char* cachePath = NULL;
+
+static pthread_mutex_t nodeLocks[BLOCKCACHE_LOCKS];
+static pthread_mutex_t indexLocks[BLOCKCACHE_LOCKS];
+static unsigned long epochs[BLOCKCACHE_LOCKS]; // Invalidations per node lock stripe.
+static pthread_mutex_t clockMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int victim = 0; // Rotates the slot replaced in a full bucket.
+
+static pthread_mutex_t pollMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long ttlNs = 0;
+static unsigned long long lastPollNs = 0;
+static unsigned long long polls = 0;
+static unsigned long long invalidations = 0;
+static unsigned long long clears = 0;
+static unsigned long long evictions = 0;
+static int statsCache = -1;
+
+
+/* ================ Util functions ================ */
+
+static uint64_t hashNode(node_id_t nodeId)
+{
+    uint64_t x = (uint64_t)nodeId;
+
+    // splitmix64 finalizer:
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+
+static uint64_t hashChunk(node_id_t nodeId, long long chunk)
+{
+    return hashNode(nodeId ^ (uint64_t)chunk * 0x9e3779b97f4a7c15ULL);
+}
+
+
+static int64_t newStamp()
+{
+    return __atomic_fetch_add(&header->nextStamp, 1, __ATOMIC_RELAXED);
+}
+
+
+// Find the slot of a node in its bucket, with the bucket locked:
+static struct blockcache_node* findNode(struct blockcache_node* bucket, node_id_t nodeId)
+{
+    int i;
+
+    for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS; ++i)
+    {
+        if (bucket[i].key == nodeId + 1 && bucket[i].stamp >= header->minStamp)
+        {
+            return &bucket[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+// Find or add the slot of a node and return its stamp:
+static int64_t claimNode(node_id_t nodeId)
+{
+    struct blockcache_node* bucket = nodes + (hashNode(nodeId) % header->nodeBuckets) * BLOCKCACHE_BUCKET_SLOTS;
+    struct blockcache_node* node;
+    int i;
+
+    node = findNode(bucket, nodeId);
+    if (!node)
+    {
+        for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS && !node; ++i)
+        {
+            if (bucket[i].key == 0 || bucket[i].stamp < header->minStamp)
+            {
+                node = &bucket[i];
+            }
+        }
+        if (!node)
+        {
+            // The blocks of the node replaced no longer match any stamp:
+            node = &bucket[__atomic_fetch_add(&victim, 1, __ATOMIC_RELAXED) % BLOCKCACHE_BUCKET_SLOTS];
+        }
+        node->key = nodeId + 1;
+        node->stamp = newStamp();
+    }
+
+    return node->stamp;
+}
+
+
+// Current stamp of a node, 0 if it has none:
+static int64_t nodeStamp(node_id_t nodeId)
+{
+    uint64_t h = hashNode(nodeId);
+    struct blockcache_node* node;
+    int64_t stamp = 0;
+    int stripe = h % BLOCKCACHE_LOCKS;
+
+    pthread_mutex_lock(&nodeLocks[stripe]);
+    node = findNode(nodes + (h % header->nodeBuckets) * BLOCKCACHE_BUCKET_SLOTS, nodeId);
+    if (node)
+    {
+        stamp = node->stamp;
+    }
+    pthread_mutex_unlock(&nodeLocks[stripe]);
+
+    return stamp;
+}
+
+
+static void invalidateNode(void* ctx, node_id_t nodeId)
+{
+    uint64_t h = hashNode(nodeId);
+    struct blockcache_node* node;
+    int stripe = h % BLOCKCACHE_LOCKS;
+
+    pthread_mutex_lock(&nodeLocks[stripe]);
+    node = findNode(nodes + (h % header->nodeBuckets) * BLOCKCACHE_BUCKET_SLOTS, nodeId);
+    if (node)
+    {
+        node->stamp = newStamp();
+    }
+    __atomic_add_fetch(&epochs[stripe], 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&nodeLocks[stripe]);
+
+    __atomic_add_fetch(&invalidations, 1, __ATOMIC_RELAXED);
+}
+
+
+// Stores in progress see either the new lowest stamp or a new epoch:
+static void clearAll()
+{
+    int i;
+
+    for (i = 0; i < BLOCKCACHE_LOCKS; ++i)
+    {
+        pthread_mutex_lock(&nodeLocks[i]);
+    }
+    header->minStamp = newStamp() + 1;
+    for (i = BLOCKCACHE_LOCKS - 1; i >= 0; --i)
+    {
+        __atomic_add_fetch(&epochs[i], 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&nodeLocks[i]);
+    }
+    __atomic_add_fetch(&clears, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Drop the nodes changed since the generation of the cache. Called with
+ * pollMutex locked.
+*/
+static int applyJournal()
+{
+    long long gen;
+    int result;
+
+    result = readJournal(header->gen, &gen, invalidateNode, NULL);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (result == 0)
+    {
+        clearAll();
+    }
+    header->gen = gen;
+    ++polls;
+
+    return 0;
+}
+
+
+static void pollIfDue()
+{
+    unsigned long long now = statsNow();
+
+    if (now - __atomic_load_n(&lastPollNs, __ATOMIC_RELAXED) < ttlNs || 0 != pthread_mutex_trylock(&pollMutex))
+    {
+        return;
+    }
+
+    // A failed read is retried by the next lookup:
+    if (now - lastPollNs >= ttlNs && 0 == applyJournal())
+    {
+        __atomic_store_n(&lastPollNs, now, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pollMutex);
+}
+
+
+/* ================ Block functions ================ */
+
+static uint32_t* indexBucket(node_id_t nodeId, long long chunk, int* stripe)
+{
+    uint64_t h = hashChunk(nodeId, chunk);
+
+    *stripe = h % BLOCKCACHE_LOCKS;
+    return chunkIndex + (h % header->indexBuckets) * BLOCKCACHE_BUCKET_SLOTS;
+}
+
+
+// Remove a block from the hash table, if it is still in there:
+static void detachBlock(uint64_t block)
+{
+    struct blockcache_block* desc = &blocks[block];
+    uint32_t* bucket;
+    int64_t key = desc->key;
+    int stripe;
+    int i;
+
+    if (key == 0)
+    {
+        return;
+    }
+
+    // The key only changes to 0 while the block is in the table, so it is checked again:
+    bucket = indexBucket(key - 1, desc->chunk, &stripe);
+    pthread_mutex_lock(&indexLocks[stripe]);
+    if (desc->key == key)
+    {
+        for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS; ++i)
+        {
+            if (bucket[i] == block + 1)
+            {
+                bucket[i] = 0;
+            }
+        }
+        desc->key = 0;
+        __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&indexLocks[stripe]);
+}
+
+
+/*
+ * Take a block for new data from the clock. The block is marked busy, so
+ * the clock passes it until it is stored.
+*/
+static uint64_t takeBlock()
+{
+    struct blockcache_block* desc;
+    uint64_t block;
+
+    pthread_mutex_lock(&clockMutex);
+    for (;;)
+    {
+        block = header->hand;
+        header->hand = (block + 1) % header->blocks;
+        desc = &blocks[block];
+
+        if (desc->busy)
+        {
+            continue;
+        }
+        else if (__atomic_exchange_n(&desc->ref, 0, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        desc->busy = 1;
+        break;
+    }
+    pthread_mutex_unlock(&clockMutex);
+
+    detachBlock(block);
+
+    return block;
+}
+
+
+/* ================ Block cache functions ================ */
+
+static void initFile(const char* identity, uint64_t nodeBuckets, uint64_t indexBuckets, uint64_t blockCount)
+{
+    memset(header, 0, sizeof(struct blockcache_header));
+    memcpy(header->magic, BLOCKCACHE_MAGIC, sizeof(header->magic));
+    header->bucketSlots = BLOCKCACHE_BUCKET_SLOTS;
+    snprintf(header->identity, sizeof(header->identity), "%s", identity);
+    header->gen = -1; // No generation matches, so the journal is never trusted.
+    header->nextStamp = 1;
+    header->minStamp = 1;
+    header->nodeBuckets = nodeBuckets;
+    header->indexBuckets = indexBuckets;
+    header->blocks = blockCount;
+}
+
+
+/*
+ * Map the cache file at path, creating it if needed, and bring it up to
+ * date with the change journal.
+*/
+int blockCacheOpen(const char* path, unsigned long sizeMb, unsigned long ttlMs)
+{
+    char identity[256];
+    struct stat st;
+    uint64_t blockCount;
+    uint64_t buckets;
+    size_t tables;
+    int reset;
+    int result;
+    uint64_t i;
+
+    // Per block: its descriptor, and two slots in both hash tables:
+    cacheSize = (size_t)(sizeMb ? sizeMb : BLOCKCACHE_DEFAULT_SIZE_MB) * 1024 * 1024;
+    blockCount = (cacheSize - 2 * BLOCKCACHE_HEADER_SIZE)
+        / (CHUNK_SIZE + sizeof(struct blockcache_block) + 2 * sizeof(struct blockcache_node) + 2 * sizeof(uint32_t));
+    buckets = (2 * blockCount + BLOCKCACHE_BUCKET_SLOTS - 1) / BLOCKCACHE_BUCKET_SLOTS;
+    if (blockCount < BLOCKCACHE_MIN_BLOCKS)
+    {
+        fprintf(stderr, "Error: Block cache too small.\n");
+        return -EINVAL;
+    }
+
+    cacheFd = open(path, O_RDWR | O_CREAT, 0600);
+    if (cacheFd < 0)
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot open block cache %s: %s\n", path, strerror(errno));
+        return result;
+    }
+    else if (0 != flock(cacheFd, LOCK_EX | LOCK_NB))
+    {
+        fprintf(stderr, "Error: Block cache %s is in use by another mount.\n", path);
+        close(cacheFd);
+        cacheFd = -1;
+        return -EBUSY;
+    }
+
+    // A cache of another size starts over:
+    reset = 0 != fstat(cacheFd, &st) || st.st_size != cacheSize;
+    if (reset && (0 != ftruncate(cacheFd, 0) || 0 != ftruncate(cacheFd, cacheSize)))
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot size block cache %s: %s\n", path, strerror(errno));
+        close(cacheFd);
+        cacheFd = -1;
+        return result;
+    }
+
+    cacheMap = mmap(NULL, cacheSize, PROT_READ | PROT_WRITE, MAP_SHARED, cacheFd, 0);
+    if (cacheMap == MAP_FAILED)
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot map block cache %s: %s\n", path, strerror(errno));
+        cacheMap = NULL;
+        close(cacheFd);
+        cacheFd = -1;
+        return result;
+    }
+
+    // The blocks start on a page boundary after the tables:
+    header = (struct blockcache_header*)cacheMap;
+    nodes = (struct blockcache_node*)(cacheMap + BLOCKCACHE_HEADER_SIZE);
+    blocks = (struct blockcache_block*)(nodes + buckets * BLOCKCACHE_BUCKET_SLOTS);
+    chunkIndex = (uint32_t*)(blocks + blockCount);
+    tables = (char*)(chunkIndex + buckets * BLOCKCACHE_BUCKET_SLOTS) - cacheMap;
+    data = cacheMap + (tables + BLOCKCACHE_HEADER_SIZE - 1) / BLOCKCACHE_HEADER_SIZE * BLOCKCACHE_HEADER_SIZE;
+
+    // Blocks written by a mount that did not close the cache may be torn:
+    snprintf(identity, sizeof(identity), "%s:%d/%s", g_settings->host ? g_settings->host : "",
+             (int)g_settings->port, g_settings->name);
+    if (reset || 0 != memcmp(header->magic, BLOCKCACHE_MAGIC, sizeof(header->magic)) || !header->clean
+        || header->bucketSlots != BLOCKCACHE_BUCKET_SLOTS || header->blocks != blockCount
+        || header->nodeBuckets != buckets || header->indexBuckets != buckets
+        || 0 != strncmp(header->identity, identity, sizeof(header->identity)))
+    {
+        if (!reset)
+        {
+            memset(cacheMap, 0, tables);
+        }
+        initFile(identity, buckets, buckets, blockCount);
+    }
+
+    // A block taken but not stored at close is out of the table already:
+    for (i = 0; i < blockCount; ++i)
+    {
+        blocks[i].busy = 0;
+    }
+
+    for (i = 0; i < BLOCKCACHE_LOCKS; ++i)
+    {
+        pthread_mutex_init(&nodeLocks[i], NULL);
+        pthread_mutex_init(&indexLocks[i], NULL);
+    }
+
+    result = applyJournal();
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Cannot read the change journal.\n");
+        blockCacheClose();
+        return result;
+    }
+
+    header->clean = 0;
+    msync(cacheMap, BLOCKCACHE_HEADER_SIZE, MS_SYNC);
+
+    ttlNs = (unsigned long long)ttlMs * 1000000ULL;
+    lastPollNs = statsNow();
+    cachePath = strdup(path);
+    statsCache = statsRegisterCache("blocks");
+
+    return 0;
+}
+
+
+/*
+ * Write the cache back and mark it clean for the next mount.
+*/
+void blockCacheClose()
+{
+    if (!cacheMap)
+    {
+        return;
+    }
+
+    msync(cacheMap, cacheSize, MS_SYNC);
+    header->clean = 1;
+    msync(cacheMap, BLOCKCACHE_HEADER_SIZE, MS_SYNC);
+    munmap(cacheMap, cacheSize);
+    close(cacheFd);
+
+    cacheMap = NULL;
+    header = NULL;
+    cacheFd = -1;
+    free(cachePath);
+    cachePath = NULL;
+}
+
+
+int blockCacheEnabled()
+{
+    return cacheMap != NULL;
+}
+
+
+/*
+ * Start a read of a chunk of node nodeId from Redis. Returns the token to
+ * pass to blockCacheStore() afterwards.
+*/
+unsigned long blockCacheBegin(node_id_t nodeId)
+{
+    if (!cacheMap)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&epochs[hashNode(nodeId) % BLOCKCACHE_LOCKS], __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Copy size bytes at offset of a chunk into buf. Returns the number of
+ * bytes copied, which is less than size past the end of the chunk, or
+ * -ENOENT if the chunk is not cached.
+*/
+int blockCacheRead(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset)
+{
+    struct blockcache_block* desc;
+    uint32_t* bucket;
+    int64_t stamp;
+    int stripe;
+    int result = -ENOENT;
+    int i;
+
+    if (!cacheMap)
+    {
+        return -ENOENT;
+    }
+
+    pollIfDue();
+
+    stamp = nodeStamp(nodeId);
+    if (stamp > 0)
+    {
+        bucket = indexBucket(nodeId, chunk, &stripe);
+        pthread_mutex_lock(&indexLocks[stripe]);
+        for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS && result < 0; ++i)
+        {
+            desc = bucket[i] ? &blocks[bucket[i] - 1] : NULL;
+            if (desc && desc->key == nodeId + 1 && desc->chunk == chunk && desc->stamp == stamp)
+            {
+                result = offset < desc->len ? desc->len - offset : 0;
+                if ((size_t)result > size)
+                {
+                    result = size;
+                }
+                memcpy(buf, data + (size_t)(bucket[i] - 1) * CHUNK_SIZE + offset, result);
+                __atomic_store_n(&desc->ref, 1, __ATOMIC_RELAXED);
+            }
+        }
+        pthread_mutex_unlock(&indexLocks[stripe]);
+    }
+
+    statsRecordCacheLookup(statsCache, result >= 0);
+
+    return result;
+}
+
+
+/*
+ * Store a whole chunk of len bytes, read from Redis after the call to
+ * blockCacheBegin() that returned token.
+*/
+void blockCacheStore(unsigned long token, node_id_t nodeId, long long chunk, const char* buf, size_t len)
+{
+    struct blockcache_block* desc;
+    struct blockcache_block* old;
+    uint32_t* bucket;
+    uint64_t block;
+    int64_t stamp;
+    int stripe = hashNode(nodeId) % BLOCKCACHE_LOCKS;
+    int slot = -1;
+    int i;
+
+    if (!cacheMap || len > CHUNK_SIZE)
+    {
+        return;
+    }
+
+    // The stamp is only used if the node was not invalidated since the read:
+    pthread_mutex_lock(&nodeLocks[stripe]);
+    if (token != __atomic_load_n(&epochs[stripe], __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&nodeLocks[stripe]);
+        return;
+    }
+    stamp = claimNode(nodeId);
+    pthread_mutex_unlock(&nodeLocks[stripe]);
+
+    block = takeBlock();
+    desc = &blocks[block];
+    memcpy(data + block * CHUNK_SIZE, buf, len);
+
+    // Replace an older copy of the chunk, else take a free slot or push one out:
+    bucket = indexBucket(nodeId, chunk, &stripe);
+    pthread_mutex_lock(&indexLocks[stripe]);
+    for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS && slot < 0; ++i)
+    {
+        old = bucket[i] ? &blocks[bucket[i] - 1] : NULL;
+        if (old && old->key == nodeId + 1 && old->chunk == chunk)
+        {
+            slot = i;
+        }
+    }
+    for (i = 0; i < BLOCKCACHE_BUCKET_SLOTS && slot < 0; ++i)
+    {
+        if (bucket[i] == 0)
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        slot = __atomic_fetch_add(&victim, 1, __ATOMIC_RELAXED) % BLOCKCACHE_BUCKET_SLOTS;
+    }
+    if (bucket[slot])
+    {
+        old = &blocks[bucket[slot] - 1];
+        old->key = 0;
+        __atomic_store_n(&old->ref, 0, __ATOMIC_RELAXED);
+    }
+
+    desc->key = nodeId + 1;
+    desc->chunk = chunk;
+    desc->stamp = stamp;
+    desc->len = len;
+    __atomic_store_n(&desc->ref, 1, __ATOMIC_RELAXED);
+    bucket[slot] = block + 1;
+    pthread_mutex_unlock(&indexLocks[stripe]);
+
+    pthread_mutex_lock(&clockMutex);
+    desc->busy = 0;
+    pthread_mutex_unlock(&clockMutex);
+}
+
+
+/*
+ * Drop the blocks of a node written through this mount.
+*/
+void blockCacheInvalidate(node_id_t nodeId)
+{
+    if (cacheMap)
+    {
+        invalidateNode(NULL, nodeId);
+    }
+}
+
+
+/* ================ Control file ================ */
+
+void blockCacheWriteStatus(FILE* out)
+{
+    uint64_t used = 0;
+    uint64_t i;
+
+    fprintf(out, "enabled %d\n", cacheMap ? 1 : 0);
+    if (!cacheMap)
+    {
+        return;
+    }
+
+    for (i = 0; i < header->blocks; ++i)
+    {
+        if (__atomic_load_n(&blocks[i].key, __ATOMIC_RELAXED) != 0)
+        {
+            ++used;
+        }
+    }
+
+    fprintf(out, "path %s\n", cachePath);
+    fprintf(out, "size_bytes %zu\n", cacheSize);
+    fprintf(out, "blocks %llu\n", (unsigned long long)header->blocks);
+    fprintf(out, "blocks_used %llu\n", (unsigned long long)used);
+    fprintf(out, "ttl_ms %llu\n", ttlNs / 1000000ULL);
+    pthread_mutex_lock(&pollMutex);
+    fprintf(out, "generation %lld\n", (long long)header->gen);
+    fprintf(out, "polls %llu\n", polls);
+    pthread_mutex_unlock(&pollMutex);
+    fprintf(out, "invalidations %llu\n", __atomic_load_n(&invalidations, __ATOMIC_RELAXED));
+    fprintf(out, "clears %llu\n", __atomic_load_n(&clears, __ATOMIC_RELAXED));
+    fprintf(out, "evictions %llu\n", __atomic_load_n(&evictions, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * "clear" drops everything; "sync" reads the change journal now.
+*/
+int blockCacheCommand(const char* cmd, size_t len)
+{
+    int result = 0;
+
+    if (len > 0 && cmd[len - 1] == '\n')
+    {
+        --len;
+    }
+
+    if (!cacheMap)
+    {
+        return -ENOENT;
+    }
+    else if (len == 5 && 0 == strncmp(cmd, "clear", 5))
+    {
+        clearAll();
+    }
+    else if (len == 4 && 0 == strncmp(cmd, "sync", 4))
+    {
+        pthread_mutex_lock(&pollMutex);
+        result = applyJournal();
+        if (result == 0)
+        {
+            lastPollNs = statsNow();
+        }
+        pthread_mutex_unlock(&pollMutex);
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return result;
+}
@@ -0,0 +1,44 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _BLOCKCACHE_H_
+#define _BLOCKCACHE_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "redifs_types.h"
+
+
+/* ---- Defines ---- */
+#define BLOCKCACHE_DEFAULT_SIZE_MB 1024
+#define BLOCKCACHE_DEFAULT_TTL_MS 1000 // Longest time writes by other mounts go unseen.
+
+
+/* ================ Block cache functions ================ */
+
+extern int blockCacheOpen(const char* path, unsigned long sizeMb, unsigned long ttlMs);
+extern void blockCacheClose();
+extern int blockCacheEnabled();
+
+extern unsigned long blockCacheBegin(node_id_t nodeId);
+extern int blockCacheRead(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset);
+extern void blockCacheStore(unsigned long token, node_id_t nodeId, long long chunk, const char* data, size_t len);
+extern void blockCacheInvalidate(node_id_t nodeId);
+
+extern void blockCacheWriteStatus(FILE* out);
+extern int blockCacheCommand(const char* cmd, size_t len);
+
+
+#endif // _BLOCKCACHE_H_
@@ -0,0 +1,77 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coldstore.h"
+
+
+/* ---- Globals ---- */
+const struct cold_store* g_coldStore = NULL;
+
+
+static const struct cold_store* coldStores[] = {
+    &dirColdStore,
+};
+
+
+/* ================ Cold store functions ================ */
+
+/*
+ * Open the cold store given as "[TYPE:]LOCATION", TYPE being
+ * DEFAULT_COLD_STORE if left out, and make it g_coldStore.
+*/
+int coldStoreOpen(const char* spec, const char* fsName)
+{
+    const struct cold_store* store = NULL;
+    const char* location = spec;
+    const char* colon = strchr(spec, ':');
+    int result;
+    int i;
+
+    for (i = 0; i < sizeof(coldStores) / sizeof(coldStores[0]); ++i)
+    {
+        if (colon && colon - spec == strlen(coldStores[i]->name)
+            && 0 == strncmp(coldStores[i]->name, spec, colon - spec))
+        {
+            store = coldStores[i];
+            location = colon + 1;
+        }
+        else if (!store && 0 == strcmp(coldStores[i]->name, DEFAULT_COLD_STORE))
+        {
+            store = coldStores[i];
+        }
+    }
+
+    result = store->open(location, fsName);
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Cannot open the cold store %s: %s\n", spec, strerror(-result));
+        return result;
+    }
+
+    g_coldStore = store;
+
+    return 0;
+}
+
+
+void coldStoreClose()
+{
+    if (g_coldStore)
+    {
+        g_coldStore->close();
+        g_coldStore = NULL;
+    }
+}
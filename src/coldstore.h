@@ -0,0 +1,69 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _COLDSTORE_H_
+#define _COLDSTORE_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <time.h>
+
+
+/* ---- Defines ---- */
+#define DEFAULT_COLD_STORE "dir"
+#define COLD_OBJECT_NAME_MAX 95
+
+
+/* ---- Types ---- */
+
+// Called for every object of a listing with the time it was stored; a
+// non-zero return value stops the listing.
+typedef int (*cold_object_fn)(void* ctx, const char* object, time_t stored);
+
+
+/* ================ Cold store interface ================ */
+
+// Storage for the chunks that tiering moved out of Redis, as objects of
+// up to CHUNK_FRAME_MAX bytes under names of up to COLD_OBJECT_NAME_MAX
+// characters. An object is written once and never changed. All functions
+// are thread-safe and return a negative errno value on failure.
+struct cold_store
+{
+    const char* name;
+
+    // location is store specific; objects of different file systems are
+    // kept apart by fsName.
+    int (*open)(const char* location, const char* fsName);
+    void (*close)();
+
+    // put returns once the object is durable. get returns the object
+    // length, or -ENOENT.
+    int (*put)(const char* object, const char* data, size_t len);
+    int (*get)(const char* object, char* buf, size_t size);
+    int (*drop)(const char* object);
+    int (*list)(cold_object_fn fn, void* ctx);
+};
+
+
+/* ---- Globals ---- */
+extern const struct cold_store* g_coldStore;
+
+extern const struct cold_store dirColdStore;
+
+
+/* ================ Cold store functions ================ */
+
+extern int coldStoreOpen(const char* spec, const char* fsName);
+extern void coldStoreClose();
+
+
+#endif // _COLDSTORE_H_
@@ -0,0 +1,339 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Cold store of one file per object in a local or network mounted
+ * directory. The objects of a file system are spread over
+ * DIR_STORE_FANOUT subdirectories of <location>/<name> by a hash of their
+ * name. An object is written to a temporary file that is synced and then
+ * renamed, so a crash never leaves a partial object under its name.
+ * Listings skip temporary files, and remove those older than
+ * DIR_STORE_TEMP_AGE seconds, which a crash left behind.
+*/
+
+
+/* ---- Includes ---- */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "coldstore.h"
+
+
+/* ---- Defines ---- */
+#define DIR_STORE_FANOUT 256
+#define DIR_STORE_TEMP_AGE 86400
+#define DIR_STORE_TEMP_TAG ".tmp."
+#define DIR_STORE_ROOT_MAX (PATH_MAX - COLD_OBJECT_NAME_MAX - 64) // Leaves room for the rest of a path.
+
+
+/* ---- Globals ---- */
+static char rootPath[DIR_STORE_ROOT_MAX];
+static unsigned long tempCounter = 0;
+
+
+/* ================ Util functions ================ */
+
+static unsigned int fanoutOf(const char* object)
+{
+    unsigned int h = 2166136261U; // FNV-1a.
+
+    for (; *object; ++object)
+    {
+        h = (h ^ (unsigned char)*object) * 16777619U;
+    }
+
+    return h % DIR_STORE_FANOUT;
+}
+
+
+static int formatObjectPath(char* path, const char* object)
+{
+    if (strlen(object) > COLD_OBJECT_NAME_MAX || strchr(object, '/'))
+    {
+        return -EINVAL;
+    }
+
+    snprintf(path, PATH_MAX, "%s/%02x/%s", rootPath, fanoutOf(object), object);
+
+    return 0;
+}
+
+
+static int writeAll(int fd, const char* data, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = write(fd, data, len);
+        if (written < 0 && errno != EINTR)
+        {
+            return -errno;
+        }
+        else if (written > 0)
+        {
+            data += written;
+            len -= written;
+        }
+    }
+
+    return 0;
+}
+
+
+// Sync the directory of path, so that a rename into it is durable:
+static int syncParent(const char* path)
+{
+    char dir[PATH_MAX];
+    char* slash;
+    int fd;
+    int result = 0;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    *slash = '\0';
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || 0 != fsync(fd))
+    {
+        result = -errno;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return result;
+}
+
+
+/* ================ Cold store ================ */
+
+static int dirOpen(const char* location, const char* fsName)
+{
+    struct stat st;
+
+    if (snprintf(rootPath, sizeof(rootPath), "%s/%s", location, fsName) >= sizeof(rootPath))
+    {
+        return -ENAMETOOLONG;
+    }
+    else if (0 != stat(location, &st))
+    {
+        return -errno;
+    }
+    else if (!S_ISDIR(st.st_mode))
+    {
+        return -ENOTDIR;
+    }
+    else if (0 != mkdir(rootPath, 0700) && errno != EEXIST)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+
+static void dirClose()
+{
+    rootPath[0] = '\0';
+}
+
+
+static int dirPut(const char* object, const char* data, size_t len)
+{
+    char path[PATH_MAX];
+    char temp[PATH_MAX + 64];
+    char* slash;
+    int fd;
+    int result;
+
+    result = formatObjectPath(path, object);
+    if (result < 0)
+    {
+        return result;
+    }
+    snprintf(temp, sizeof(temp), "%s" DIR_STORE_TEMP_TAG "%d.%lu", path, (int)getpid(),
+             __atomic_add_fetch(&tempCounter, 1, __ATOMIC_RELAXED));
+
+    fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == ENOENT)
+    {
+        // First object of its subdirectory:
+        slash = strrchr(path, '/');
+        *slash = '\0';
+        if (0 != mkdir(path, 0700) && errno != EEXIST)
+        {
+            return -errno;
+        }
+        *slash = '/';
+        fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    result = writeAll(fd, data, len);
+    if (result == 0 && 0 != fsync(fd))
+    {
+        result = -errno;
+    }
+    close(fd);
+
+    if (result == 0 && 0 != rename(temp, path))
+    {
+        result = -errno;
+    }
+    if (result < 0)
+    {
+        unlink(temp);
+        return result;
+    }
+
+    return syncParent(path);
+}
+
+
+static int dirGet(const char* object, char* buf, size_t size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    size_t len = 0;
+    ssize_t got;
+    int fd;
+    int result;
+
+    result = formatObjectPath(path, object);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    else if (0 != fstat(fd, &st))
+    {
+        result = -errno;
+        close(fd);
+        return result;
+    }
+    else if (st.st_size > size)
+    {
+        close(fd);
+        return -EIO;
+    }
+
+    while (len < st.st_size)
+    {
+        got = read(fd, buf + len, st.st_size - len);
+        if (got < 0 && errno != EINTR)
+        {
+            result = -errno;
+            break;
+        }
+        else if (got == 0)
+        {
+            result = -EIO; // Shorter than it was a moment ago.
+            break;
+        }
+        else if (got > 0)
+        {
+            len += got;
+        }
+    }
+    close(fd);
+
+    return result < 0 ? result : (int)len;
+}
+
+
+static int dirDrop(const char* object)
+{
+    char path[PATH_MAX];
+    int result;
+
+    result = formatObjectPath(path, object);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return 0 == unlink(path) ? 0 : -errno;
+}
+
+
+static int dirList(cold_object_fn fn, void* ctx)
+{
+    char path[PATH_MAX];
+    struct dirent* entry;
+    struct stat st;
+    DIR* dir;
+    time_t now = time(NULL);
+    int stop = 0;
+    int i;
+
+    for (i = 0; i < DIR_STORE_FANOUT && !stop; ++i)
+    {
+        snprintf(path, sizeof(path), "%s/%02x", rootPath, i);
+        dir = opendir(path);
+        if (!dir)
+        {
+            if (errno == ENOENT)
+            {
+                continue;
+            }
+            return -errno;
+        }
+
+        while (!stop && (entry = readdir(dir)))
+        {
+            if (entry->d_name[0] == '.'
+                || 0 != fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) || !S_ISREG(st.st_mode))
+            {
+                continue;
+            }
+            else if (strstr(entry->d_name, DIR_STORE_TEMP_TAG))
+            {
+                if (now - st.st_mtime > DIR_STORE_TEMP_AGE)
+                {
+                    unlinkat(dirfd(dir), entry->d_name, 0);
+                }
+                continue;
+            }
+            stop = fn(ctx, entry->d_name, st.st_mtime);
+        }
+        closedir(dir);
+    }
+
+    return 0;
+}
+
+
+const struct cold_store dirColdStore = {
+    .name = "dir",
+    .open = dirOpen,
+    .close = dirClose,
+    .put = dirPut,
+    .get = dirGet,
+    .drop = dirDrop,
+    .list = dirList,
+};
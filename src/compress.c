@@ -0,0 +1,265 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Chunk compression. A compressed chunk is stored as one codec byte
+ * followed by the payload; chunks that do not shrink are stored with
+ * CODEC_NONE and their raw bytes. All work is done on the calling FUSE
+ * thread, before or after the Redis command.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <lz4.h>
+#include <zstd.h>
+
+#include "compress.h"
+#include "path.h"
+#include "stats.h"
+
+
+/* ---- Globals ---- */
+int g_defaultCodec = CODEC_NONE;
+
+static const char* codecNames[CODEC_COUNT] = {
+    /* CODEC_NONE */ "none",
+    /* CODEC_LZ4  */ "lz4",
+    /* CODEC_ZSTD */ "zstd",
+};
+
+// zstd contexts are expensive to create; one per thread:
+static __thread ZSTD_CCtx* zstdCompressContext = NULL;
+static __thread ZSTD_DCtx* zstdDecompressContext = NULL;
+
+
+/* ================ Compression functions ================ */
+
+/*
+ * Look up a codec by name. Returns -1 for unknown names.
+*/
+int codecFromName(const char* name)
+{
+    int i;
+
+    for (i = 0; i < CODEC_COUNT; ++i)
+    {
+        if (0 == strcmp(codecNames[i], name))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+const char* codecName(int codec)
+{
+    return codec >= 0 && codec < CODEC_COUNT ? codecNames[codec] : "inherit";
+}
+
+
+/*
+ * Compress len bytes into frame, which holds CHUNK_FRAME_MAX bytes.
+ * Returns the frame length.
+*/
+size_t compressChunk(int codec, const char* src, size_t len, char* frame)
+{
+    unsigned long long start = statsNow();
+    size_t payload = 0;
+
+    assert(len <= CHUNK_SIZE);
+
+    // Only accept output that is smaller than the raw chunk:
+    switch (codec)
+    {
+        case CODEC_LZ4:
+            if (len > 1)
+            {
+                payload = LZ4_compress_default(src, frame + 1, len, len - 1);
+            }
+            break;
+
+        case CODEC_ZSTD:
+            if (!zstdCompressContext)
+            {
+                zstdCompressContext = ZSTD_createCCtx();
+            }
+            if (zstdCompressContext && len > 1)
+            {
+                payload = ZSTD_compressCCtx(zstdCompressContext, frame + 1, len - 1, src, len, ZSTD_LEVEL);
+                if (ZSTD_isError(payload))
+                {
+                    payload = 0;
+                }
+            }
+            break;
+    }
+
+    if (payload == 0)
+    {
+        codec = CODEC_NONE;
+        payload = len;
+        memcpy(frame + 1, src, len);
+        statsIncrCounter(STAT_COUNTER_CHUNKS_STORED_RAW);
+    }
+    frame[0] = (char)codec;
+
+    statsAddCounter(STAT_COUNTER_COMPRESS_IN_BYTES, len);
+    statsAddCounter(STAT_COUNTER_COMPRESS_OUT_BYTES, payload + 1);
+    statsAddCounter(STAT_COUNTER_COMPRESS_NANOSECONDS, statsNow() - start);
+
+    return payload + 1;
+}
+
+
+/*
+ * Decompress a frame into dst, which holds CHUNK_SIZE bytes. Returns the
+ * chunk length.
+*/
+int decompressChunk(const char* frame, size_t frameLen, char* dst)
+{
+    unsigned long long start = statsNow();
+    size_t result;
+    int len;
+
+    if (frameLen == 0)
+    {
+        return 0;
+    }
+
+    switch (frame[0])
+    {
+        case CODEC_NONE:
+            if (frameLen - 1 > CHUNK_SIZE)
+            {
+                return -EIO;
+            }
+            memcpy(dst, frame + 1, frameLen - 1);
+            return frameLen - 1;
+
+        case CODEC_LZ4:
+            len = LZ4_decompress_safe(frame + 1, dst, frameLen - 1, CHUNK_SIZE);
+            break;
+
+        case CODEC_ZSTD:
+            if (!zstdDecompressContext)
+            {
+                zstdDecompressContext = ZSTD_createDCtx();
+                if (!zstdDecompressContext)
+                {
+                    return -ENOMEM;
+                }
+            }
+            result = ZSTD_decompressDCtx(zstdDecompressContext, dst, CHUNK_SIZE, frame + 1, frameLen - 1);
+            len = ZSTD_isError(result) ? -1 : (int)result;
+            break;
+
+        default:
+            len = -1;
+            break;
+    }
+
+    if (len < 0)
+    {
+        fprintf(stderr, "Error: Corrupt compressed chunk.\n");
+        return -EIO;
+    }
+
+    statsAddCounter(STAT_COUNTER_DECOMPRESS_NANOSECONDS, statsNow() - start);
+
+    return len;
+}
+
+
+/* ================ Control file ================ */
+
+void compressWriteStatus(FILE* out)
+{
+    fprintf(out, "default %s\n", codecName(__atomic_load_n(&g_defaultCodec, __ATOMIC_RELAXED)));
+}
+
+
+/*
+ * "default CODEC" changes the codec for new files outside configured
+ * subtrees; "CODEC /dir" sets it for new files below /dir, "inherit /dir"
+ * removes that setting again.
+*/
+int compressCommand(const char* cmd, size_t len)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    char buf[1024];
+    char* arg;
+    int codec;
+    int result;
+
+    if (len >= sizeof(buf))
+    {
+        return -EINVAL;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+    {
+        buf[--len] = '\0';
+    }
+
+    arg = strchr(buf, ' ');
+    if (!arg)
+    {
+        return -EINVAL;
+    }
+    *arg++ = '\0';
+
+    if (0 == strcmp(buf, "default"))
+    {
+        codec = codecFromName(arg);
+        if (codec < 0)
+        {
+            return -EINVAL;
+        }
+        __atomic_store_n(&g_defaultCodec, codec, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    codec = 0 == strcmp(buf, "inherit") ? CODEC_UNSET : codecFromName(buf);
+    if (codec == -1 && 0 != strcmp(buf, "inherit"))
+    {
+        return -EINVAL;
+    }
+
+    nodeId = resolvePath(arg);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (!S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        return -ENOTDIR;
+    }
+
+    info[NODE_INFO_FLAGS] = WITH_NODE_CODEC(info[NODE_INFO_FLAGS], codec);
+
+    return g_backend->set_info(nodeId, NODE_INFO_FLAGS, 1, &info[NODE_INFO_FLAGS]);
+}
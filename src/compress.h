@@ -0,0 +1,65 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "backend.h"
+
+
+/* ---- Defines ---- */
+#define DEFAULT_CODEC "none"
+#define ZSTD_LEVEL 3
+
+
+/* ---- Codecs ---- */
+
+// Also the header byte of a compressed chunk:
+enum
+{
+    CODEC_NONE = 0,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+    CODEC_COUNT
+};
+
+
+/* ---- Macros ---- */
+
+// Codec stored in the node flags; CODEC_UNSET for directories that follow their parent:
+#define CODEC_UNSET -1
+#define NODE_CODEC(flags) ((int)(((flags) & NODE_FLAG_CODEC_MASK) >> NODE_FLAG_CODEC_SHIFT) - 1)
+#define WITH_NODE_CODEC(flags, codec) \
+    (((flags) & ~NODE_FLAG_CODEC_MASK) | ((long long)((codec) + 1) << NODE_FLAG_CODEC_SHIFT))
+
+
+/* ---- Globals ---- */
+extern int g_defaultCodec;
+
+
+/* ================ Compression functions ================ */
+
+extern int codecFromName(const char* name);
+extern const char* codecName(int codec);
+
+extern size_t compressChunk(int codec, const char* src, size_t len, char* frame);
+extern int decompressChunk(const char* frame, size_t frameLen, char* dst);
+
+extern void compressWriteStatus(FILE* out);
+extern int compressCommand(const char* cmd, size_t len);
+
+
+#endif // _COMPRESS_H_
@@ -13,9 +13,12 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include <hiredis/hiredis.h>
 
 #include "connection.h"
+#include "stats.h"
+#include "trace.h"
 
 
 struct redis_connection_info
@@ -26,14 +29,22 @@ struct redis_connection_info
 
 
 // ---- Redis globals:
+// Every thread uses its own connection, opened on its first command:
 static struct redis_connection_info redis1_info = { NULL, 0 };
-static redisContext* redis1 = NULL;
+static __thread redisContext* redis1 = NULL;
+static pthread_key_t connectionKey;
+static pthread_once_t connectionKeyOnce = PTHREAD_ONCE_INIT;
+
+
+// Commands appended to the pipeline whose replies are not read yet:
+static __thread int pipelinePending = 0;
+static __thread size_t pipelineBytesOut = 0;
 
 
 #define MAX_OPEN_REPLIES 4
-static redisReply* openReplies[MAX_OPEN_REPLIES];
+static __thread redisReply* openReplies[MAX_OPEN_REPLIES];
 #define OPEN_REPLIES_BITMAP_SIZE ((MAX_OPEN_REPLIES - 1) / sizeof(unsigned int)) + 1
-static unsigned int openRepliesBitmap[OPEN_REPLIES_BITMAP_SIZE];
+static __thread unsigned int openRepliesBitmap[OPEN_REPLIES_BITMAP_SIZE];
 
 
 static void clearOpenReplies()
@@ -83,7 +94,8 @@ void releaseReplyHandle(int handle)
 
 
 // ---- Command formatting:
-#define ARGC_MAX 16
+#define ARGC_MAX 16 // Arguments of a command format.
+#define ARGV_MAX 32 // Arguments of a command sent, lists expanded.
 
 struct command_format
 {
@@ -98,11 +110,23 @@ enum {
     REDIS_CMD_HGET,
     REDIS_CMD_HKEYS,
     REDIS_CMD_HSET_INT,
+    REDIS_CMD_HDEL,
     REDIS_CMD_INCR,
     REDIS_CMD_LINDEX,
+    REDIS_CMD_LRANGE,
     REDIS_CMD_LSET_INT,
     REDIS_CMD_SET,
     REDIS_CMD_RPUSH_INT,
+    REDIS_CMD_DEL,
+    REDIS_CMD_GETRANGE,
+    REDIS_CMD_SETRANGE,
+    REDIS_CMD_SET_BIN,
+    REDIS_CMD_LSET_BIN,
+    REDIS_CMD_RPUSH_INT_BIN,
+    REDIS_CMD_EVAL_INT,
+    REDIS_CMD_EVAL_STR,
+    REDIS_CMD_EVAL_BIN_INT,
+    REDIS_CMD_EVAL_ARRAY,
 };
 
 enum {
@@ -110,24 +134,37 @@ enum {
     ARG_INT,
     ARG_STRS,
     ARG_INTS,
+    ARG_BIN, // String from strArgs with its length from intArgs.
 };
 
 static struct command_format commandFormats[] = {
     /* HGET      */ { "HGET",   2, { ARG_STR, ARG_STR }, 2, { REDIS_REPLY_STRING, REDIS_REPLY_NIL } },
     /* HKEYS     */ { "HKEYS",  1, { ARG_STR },          2, { REDIS_REPLY_ARRAY, REDIS_REPLY_NIL } },
     /* HSET_INT  */ { "HSET",   3, { ARG_STR, ARG_STR, ARG_INT }, 1, { REDIS_REPLY_INTEGER } },
+    /* HDEL      */ { "HDEL",   2, { ARG_STR, ARG_STR }, 1, { REDIS_REPLY_INTEGER } },
     /* INCR      */ { "INCR",   1, { ARG_STR },          1, { REDIS_REPLY_INTEGER } },
     /* LINDEX    */ { "LINDEX", 2, { ARG_STR, ARG_INT }, 2, { REDIS_REPLY_STRING, REDIS_REPLY_NIL } },
+    /* LRANGE    */ { "LRANGE", 3, { ARG_STR, ARG_INT, ARG_INT }, 2, { REDIS_REPLY_ARRAY, REDIS_REPLY_NIL } },
     /* LSET_INT  */ { "LSET",   3, { ARG_STR, ARG_INT, ARG_INT }, 1, { REDIS_REPLY_STATUS } },
     /* SET       */ { "SET",    2, { ARG_STR, ARG_STR }, 1, { REDIS_REPLY_STATUS } },
     /* RPUSH_INT */ { "RPUSH",  2, { ARG_STR, ARG_INTS }, 1, { REDIS_REPLY_INTEGER } },
+    /* DEL       */ { "DEL",    1, { ARG_STRS },         1, { REDIS_REPLY_INTEGER } },
+    /* GETRANGE  */ { "GETRANGE", 3, { ARG_STR, ARG_INT, ARG_INT }, 1, { REDIS_REPLY_STRING } },
+    /* SETRANGE  */ { "SETRANGE", 3, { ARG_STR, ARG_INT, ARG_BIN }, 1, { REDIS_REPLY_INTEGER } },
+    /* SET_BIN   */ { "SET",    2, { ARG_STR, ARG_BIN }, 1, { REDIS_REPLY_STATUS } },
+    /* LSET_BIN  */ { "LSET",   3, { ARG_STR, ARG_INT, ARG_BIN }, 1, { REDIS_REPLY_STATUS } },
+    /* RPUSH_INT_BIN */ { "RPUSH", 3, { ARG_STR, ARG_INTS, ARG_BIN }, 1, { REDIS_REPLY_INTEGER } },
+    /* EVAL_INT  */ { "EVAL",   3, { ARG_STR, ARG_INT, ARG_STRS }, 1, { REDIS_REPLY_INTEGER } },
+    /* EVAL_STR  */ { "EVAL",   3, { ARG_STR, ARG_INT, ARG_STRS }, 2, { REDIS_REPLY_STRING, REDIS_REPLY_NIL } },
+    /* EVAL_BIN_INT */ { "EVAL", 4, { ARG_STR, ARG_INT, ARG_STRS, ARG_BIN }, 1, { REDIS_REPLY_INTEGER } },
+    /* EVAL_ARRAY */ { "EVAL",  3, { ARG_STR, ARG_INT, ARG_STRS }, 2, { REDIS_REPLY_ARRAY, REDIS_REPLY_NIL } },
 };
 
 
 // ---- Number conversion buffers:
 #define NUM_CONV_BUF_LEN 32
 #define NUM_CONV_BUF_COUNT 16
-static char num_conv_bufs[NUM_CONV_BUF_LEN][NUM_CONV_BUF_COUNT];
+static __thread char num_conv_bufs[NUM_CONV_BUF_COUNT][NUM_CONV_BUF_LEN];
 
 
 // ---- Util functions:
@@ -170,10 +207,12 @@ static int handleStringReply(redisReply* reply, char** result)
             return getReplyHandle(reply); // Success.
 
         case REDIS_REPLY_NIL:
+            freeReplyObject(reply);
             *result = NULL;
             return 1; // Success.
 
         default:
+            freeReplyObject(reply);
             assert(0);
             return 0; // Failure.
     }
@@ -189,10 +228,12 @@ static int handleStringArrayReply(redisReply* reply, int* result)
             return getReplyHandle(reply); // Success.
 
         case REDIS_REPLY_NIL:
+            freeReplyObject(reply);
             *result = 0;
             return 1; // Success.
 
         default:
+            freeReplyObject(reply);
             assert(0);
             return 0; // Failure.
     }
@@ -220,6 +261,79 @@ void retrieveStringArrayElements(int handle, int offset, int count, char* array[
 }
 
 
+void retrieveBinaryArrayElement(int handle, int index, char** data, size_t* len)
+{
+    redisReply* reply;
+    redisReply* strReply;
+
+    handle -= 2;
+    assert(handle >= 0 && handle < MAX_OPEN_REPLIES);
+    assert(openRepliesBitmap[handle / sizeof(unsigned int)] & (1 << (handle % sizeof(unsigned int))));
+
+    reply = openReplies[handle];
+
+    strReply = reply->element[index];
+    assert(strReply->type == REDIS_REPLY_STRING);
+    *data = strReply->str;
+    *len = strReply->len;
+}
+
+
+// Payload size of a reply, for the statistics:
+static size_t replySize(redisReply* reply)
+{
+    size_t size;
+    size_t i;
+
+    switch (reply->type)
+    {
+        case REDIS_REPLY_STRING:
+        case REDIS_REPLY_STATUS:
+        case REDIS_REPLY_ERROR:
+            return reply->len;
+
+        case REDIS_REPLY_INTEGER:
+            return sizeof(long long);
+
+        case REDIS_REPLY_ARRAY:
+            size = 0;
+            for (i = 0; i < reply->elements; ++i)
+            {
+                size += replySize(reply->element[i]);
+            }
+            return size;
+
+        default:
+            return 0;
+    }
+}
+
+
+// Account a round trip in the statistics and the trace of the current operation:
+static void recordCommand(const char* cmd, size_t bytesOut, size_t bytesIn,
+                          unsigned long long start, int failed)
+{
+    statsRecordRedisCommand(cmd, bytesOut, bytesIn, start, failed);
+    if (TRACE_OP_ACTIVE())
+    {
+        traceRedisCommand(cmd, start, bytesIn, failed);
+    }
+}
+
+
+// Close the connection of an exiting thread:
+static void releaseThreadConnection(void* context)
+{
+    redisFree(context);
+}
+
+
+static void createConnectionKey()
+{
+    pthread_key_create(&connectionKey, releaseThreadConnection);
+}
+
+
 // ---- Interface functions:
 
 // Reconnect to Redis server:
@@ -234,6 +348,9 @@ static int connectToRedisServer()
         return -1; // Failure.
     }
 
+    pthread_once(&connectionKeyOnce, createConnectionKey);
+    pthread_setspecific(connectionKey, redis1);
+
     return 0; // Success.
 }
 
@@ -257,9 +374,12 @@ int openRedisConnection(const char* host, redifs_port_t port)
 }
 
 
-// Close Redis connection:
+// Close the Redis connection of the calling thread:
 void closeRedisConnection()
 {
+    pthread_once(&connectionKeyOnce, createConnectionKey);
+    pthread_setspecific(connectionKey, NULL);
+
     redisFree(redis1);
     redis1 = NULL;
 }
@@ -270,10 +390,15 @@ redisReply* execRedisCommand(int cmd, const char* strArgs[], long long intArgs[]
 {
     redisReply* reply;
     struct command_format* commandFormat;
-    const char* argv[ARGC_MAX+1];
+    const char* argv[ARGV_MAX+1];
+    size_t argvlen[ARGV_MAX+1];
     const char** strArg_ptr = strArgs;
     long long* intArg_ptr = intArgs;
     int numConvBufIndex = 0;
+    unsigned long long start;
+    unsigned long long reconnectStart;
+    size_t bytesOut;
+    int result;
     int replyTypeOk;
     int retries;
     long long numArgs;
@@ -295,44 +420,78 @@ redisReply* execRedisCommand(int cmd, const char* strArgs[], long long intArgs[]
 
     // Fill arguments:
     argv[0] = commandFormat->cmd;
+    argvlen[0] = strlen(argv[0]);
     argIndex = 1;
     for (i = 0; i < commandFormat->argc; ++i)
     {
         switch (commandFormat->arg_types[i])
         {
             case ARG_STR:
-                argv[argIndex++] = *(strArg_ptr++);
+                argv[argIndex] = *(strArg_ptr++);
+                argvlen[argIndex] = strlen(argv[argIndex]);
+                ++argIndex;
                 break;
 
             case ARG_INT:
-                argv[argIndex++] = redifs_lltoa(*(intArg_ptr++), num_conv_bufs[numConvBufIndex++], NUM_CONV_BUF_LEN);
+                argv[argIndex] = redifs_lltoa(*(intArg_ptr++), num_conv_bufs[numConvBufIndex++], NUM_CONV_BUF_LEN);
+                argvlen[argIndex] = strlen(argv[argIndex]);
+                ++argIndex;
                 break;
 
             case ARG_STRS:
                 numArgs = *(intArg_ptr++);
+                if (argIndex + numArgs > ARGV_MAX)
+                {
+                    fprintf(stderr, "Error: Too many arguments for %s.\n", argv[0]);
+                    return NULL;
+                }
                 for (j = 0; j < numArgs; ++j)
                 {
-                    argv[argIndex++] = *(strArg_ptr++);
+                    argv[argIndex] = *(strArg_ptr++);
+                    argvlen[argIndex] = strlen(argv[argIndex]);
+                    ++argIndex;
                 }
                 break;
 
             case ARG_INTS:
                 numArgs = *(intArg_ptr++);
+                if (argIndex + numArgs > ARGV_MAX || numConvBufIndex + numArgs > NUM_CONV_BUF_COUNT)
+                {
+                    fprintf(stderr, "Error: Too many arguments for %s.\n", argv[0]);
+                    return NULL;
+                }
                 for (j = 0; j < numArgs; ++j)
                 {
-                    argv[argIndex++] = redifs_lltoa(*(intArg_ptr++), num_conv_bufs[numConvBufIndex++], NUM_CONV_BUF_LEN);
+                    argv[argIndex] = redifs_lltoa(*(intArg_ptr++), num_conv_bufs[numConvBufIndex++], NUM_CONV_BUF_LEN);
+                    argvlen[argIndex] = strlen(argv[argIndex]);
+                    ++argIndex;
                 }
                 break;
+
+            case ARG_BIN:
+                argv[argIndex] = *(strArg_ptr++);
+                argvlen[argIndex] = (size_t)*(intArg_ptr++);
+                ++argIndex;
+                break;
         }
     }
 
+    bytesOut = 0;
+    for (i = 0; i < argIndex; ++i)
+    {
+        bytesOut += argvlen[i];
+    }
+
     // Perform Redis command:
+    start = statsNow();
     retries = 2;
     while (1)
     {
-        reply = redisCommandArgv(redis1, argIndex, argv, NULL);
+        reply = redisCommandArgv(redis1, argIndex, argv, argvlen);
         if (!reply)
         {
+            statsIncrCounter(STAT_COUNTER_REDIS_ERRORS);
+
             // Try to reconnect:
             if (redis1->err == REDIS_ERR_EOF && retries > 1)
             {
@@ -340,26 +499,40 @@ redisReply* execRedisCommand(int cmd, const char* strArgs[], long long intArgs[]
                 if (--retries > 0)
                 {
                     fprintf(stderr, "Connection to Redis server lost. Trying to reconnect...\n");
-                    if (0 == connectToRedisServer())
+                    statsIncrCounter(STAT_COUNTER_REDIS_RECONNECTS);
+                    reconnectStart = statsNow();
+                    result = connectToRedisServer();
+                    if (TRACE_OP_ACTIVE())
+                    {
+                        traceRedisCommand("(reconnect)", reconnectStart, 0, result != 0);
+                    }
+                    if (0 == result)
                     {
                         continue;
                     }
                     else
                     {
+                        recordCommand(commandFormat->cmd, bytesOut, 0, start, 1);
                         return NULL;
                     }
                 }
             }
 
             fprintf(stderr, "XY Error: %s %d\n", redis1->errstr, redis1->err);
+            recordCommand(commandFormat->cmd, bytesOut, 0, start, 1);
             return NULL; // Failure.
         }
         else if (reply->type == REDIS_REPLY_ERROR)
         {
-            fprintf(stderr, "Error: %s\n", redis1->errstr);
+            // The message of the server, or of the script that failed:
+            fprintf(stderr, "Error: %s\n", reply->str);
+            recordCommand(commandFormat->cmd, bytesOut, reply->len, start, 1);
+            freeReplyObject(reply);
             return NULL; // Failure.
         }
 
+        recordCommand(commandFormat->cmd, bytesOut, replySize(reply), start, 0);
+
         break;
     }
 
@@ -376,6 +549,7 @@ redisReply* execRedisCommand(int cmd, const char* strArgs[], long long intArgs[]
     if (!replyTypeOk)
     {
         fprintf(stderr, "Error: Unexpected Redis reply type.\n");
+        freeReplyObject(reply);
         assert(0);
         return NULL;
     }
@@ -445,6 +619,29 @@ extern int redisCommand_HSET_INT(const char* key, const char* field, long long v
 
 
 
+// Redis HDEL command:
+int redisCommand_HDEL(const char* key, const char* field, int* result)
+{
+    redisReply* reply;
+    const char* args[] = { key, field };
+
+    reply = execRedisCommand(REDIS_CMD_HDEL, args, NULL);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
 // Redis INCR command:
 int redisCommand_INCR(const char* key, long long* result)
 {
@@ -482,6 +679,23 @@ int redisCommand_LINDEX(const char* key, long long index, char** result)
 }
 
 
+// Redis LRANGE command:
+int redisCommand_LRANGE(const char* key, long long start, long long stop, int* result)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key };
+    long long intArgs[] = { start, stop };
+
+    reply = execRedisCommand(REDIS_CMD_LRANGE, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    return handleStringArrayReply(reply, result);
+}
+
+
 // Redis LSET command with integer value:
 int redisCommand_LSET_INT(const char* key, long long index, long long value)
 {
@@ -496,6 +710,8 @@ int redisCommand_LSET_INT(const char* key, long long index, long long value)
     }
     else if (0 != strcmp(reply->str, "OK"))
     {
+        fprintf(stderr, "Error: %s\n", reply->str);
+        freeReplyObject(reply);
         return 0; // Failure.
     }
 
@@ -518,6 +734,8 @@ int redisCommand_SET(const char* key, const char* value)
     }
     else if (0 != strcmp(reply->str, "OK"))
     {
+        fprintf(stderr, "Error: %s\n", reply->str);
+        freeReplyObject(reply);
         return 0; // Failure.
     }
 
@@ -558,3 +776,368 @@ int redisCommand_RPUSH_INT(const char* key, long long values[], long long value_
 }
 
 
+// Redis DEL command:
+int redisCommand_DEL(const char* keys[], long long key_count, int* result)
+{
+    redisReply* reply;
+    long long intArgs[] = { key_count };
+
+    reply = execRedisCommand(REDIS_CMD_DEL, keys, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis GETRANGE command; binary safe:
+int redisCommand_GETRANGE(const char* key, long long start, long long end, char** result, size_t* len)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key };
+    long long intArgs[] = { start, end };
+
+    reply = execRedisCommand(REDIS_CMD_GETRANGE, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    *len = reply->len;
+
+    return handleStringReply(reply, result);
+}
+
+
+// Redis SETRANGE command; binary safe:
+int redisCommand_SETRANGE(const char* key, long long offset, const char* value, size_t len, long long* result)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key, value };
+    long long intArgs[] = { offset, (long long)len };
+
+    reply = execRedisCommand(REDIS_CMD_SETRANGE, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis SET command; binary safe:
+int redisCommand_SET_BIN(const char* key, const char* value, size_t len)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key, value };
+    long long intArgs[] = { (long long)len };
+
+    reply = execRedisCommand(REDIS_CMD_SET_BIN, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+    else if (0 != strcmp(reply->str, "OK"))
+    {
+        fprintf(stderr, "Error: %s\n", reply->str);
+        freeReplyObject(reply);
+        return 0; // Failure.
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis LSET command; binary safe:
+int redisCommand_LSET_BIN(const char* key, long long index, const char* value, size_t len)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key, value };
+    long long intArgs[] = { index, (long long)len };
+
+    reply = execRedisCommand(REDIS_CMD_LSET_BIN, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+    else if (0 != strcmp(reply->str, "OK"))
+    {
+        fprintf(stderr, "Error: %s\n", reply->str);
+        freeReplyObject(reply);
+        return 0; // Failure.
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis RPUSH command with integer values followed by one binary value:
+int redisCommand_RPUSH_INT_BIN(const char* key, long long values[], long long value_count,
+                               const char* value, size_t len, int* result)
+{
+    redisReply* reply;
+    const char* strArgs[] = { key, value };
+    long long intArgs[value_count + 2];
+    long long i;
+
+    intArgs[0] = value_count;
+    for (i = 0; i < value_count; ++i)
+    {
+        intArgs[i + 1] = values[i];
+    }
+    intArgs[value_count + 1] = (long long)len;
+
+    reply = execRedisCommand(REDIS_CMD_RPUSH_INT_BIN, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis EVAL command with an integer reply. The first numKeys args are keys:
+int redisCommand_EVAL_INT(const char* script, int numKeys, const char* args[], int argCount, long long* result)
+{
+    redisReply* reply;
+    const char* strArgs[argCount + 1];
+    long long intArgs[] = { numKeys, argCount };
+
+    strArgs[0] = script;
+    memcpy(strArgs + 1, args, argCount * sizeof(args[0]));
+
+    reply = execRedisCommand(REDIS_CMD_EVAL_INT, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis EVAL command with a binary safe string reply; *result is NULL for nil:
+int redisCommand_EVAL_STR(const char* script, int numKeys, const char* args[], int argCount,
+                          char** result, size_t* len)
+{
+    redisReply* reply;
+    const char* strArgs[argCount + 1];
+    long long intArgs[] = { numKeys, argCount };
+
+    strArgs[0] = script;
+    memcpy(strArgs + 1, args, argCount * sizeof(args[0]));
+
+    reply = execRedisCommand(REDIS_CMD_EVAL_STR, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+    else if (reply->type == REDIS_REPLY_NIL)
+    {
+        freeReplyObject(reply);
+        *result = NULL;
+        *len = 0;
+        return 1; // Success.
+    }
+
+    *len = reply->len;
+
+    return handleStringReply(reply, result);
+}
+
+
+// Redis EVAL command with a trailing binary argument and an integer reply:
+int redisCommand_EVAL_BIN_INT(const char* script, int numKeys, const char* args[], int argCount,
+                              const char* value, size_t len, long long* result)
+{
+    redisReply* reply;
+    const char* strArgs[argCount + 2];
+    long long intArgs[] = { numKeys, argCount, (long long)len };
+
+    strArgs[0] = script;
+    memcpy(strArgs + 1, args, argCount * sizeof(args[0]));
+    strArgs[argCount + 1] = value;
+
+    reply = execRedisCommand(REDIS_CMD_EVAL_BIN_INT, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    if (result)
+    {
+        *result = reply->integer;
+    }
+
+    freeReplyObject(reply);
+
+    return 1; // Success.
+}
+
+
+// Redis EVAL command with a reply array of strings:
+int redisCommand_EVAL_ARRAY(const char* script, int numKeys, const char* args[], int argCount, int* result)
+{
+    redisReply* reply;
+    const char* strArgs[argCount + 1];
+    long long intArgs[] = { numKeys, argCount };
+
+    strArgs[0] = script;
+    memcpy(strArgs + 1, args, argCount * sizeof(args[0]));
+
+    reply = execRedisCommand(REDIS_CMD_EVAL_ARRAY, strArgs, intArgs);
+    if (!reply)
+    {
+        return 0; // Failure.
+    }
+
+    return handleStringArrayReply(reply, result);
+}
+
+
+// ---- Pipelines:
+
+// Queue a command in the pipeline of the calling thread. Nothing is sent
+// before redisPipelineFlush():
+int redisPipelineAppend(int argc, const char* argv[], const size_t argvlen[])
+{
+    int i;
+
+    if (!redis1)
+    {
+        if (0 > connectToRedisServer())
+        {
+            fprintf(stderr, "Error: No connection to the Redis server.\n");
+            return 0; // Failure.
+        }
+    }
+
+    if (REDIS_OK != redisAppendCommandArgv(redis1, argc, argv, argvlen))
+    {
+        fprintf(stderr, "Error: %s\n", redis1->errstr);
+        return 0; // Failure.
+    }
+
+    ++pipelinePending;
+    for (i = 0; i < argc; ++i)
+    {
+        pipelineBytesOut += argvlen[i];
+    }
+
+    return 1; // Success.
+}
+
+
+// Send the pipeline and read the reply of its oldest command, which must
+// return an array of strings, like redisCommand_EVAL_ARRAY():
+int redisPipelineReply(int* result)
+{
+    redisReply* reply;
+    unsigned long long start;
+
+    if (pipelinePending == 0)
+    {
+        return 0; // Failure.
+    }
+
+    start = statsNow();
+    if (REDIS_OK != redisGetReply(redis1, (void**)&reply))
+    {
+        statsIncrCounter(STAT_COUNTER_REDIS_ERRORS);
+        fprintf(stderr, "Error: %s\n", redis1->errstr);
+        recordCommand("PIPELINE", pipelineBytesOut, 0, start, 1);
+        closeRedisConnection();
+        pipelinePending = 0;
+        pipelineBytesOut = 0;
+        return 0; // Failure.
+    }
+    --pipelinePending;
+
+    recordCommand("PIPELINE", pipelineBytesOut, replySize(reply), start, reply->type == REDIS_REPLY_ERROR);
+    pipelineBytesOut = 0;
+
+    if (reply->type == REDIS_REPLY_ERROR)
+    {
+        fprintf(stderr, "Error: %s\n", reply->str);
+        freeReplyObject(reply);
+        return 0; // Failure.
+    }
+
+    return handleStringArrayReply(reply, result);
+}
+
+
+// Send the pipeline and wait for all replies. Returns the number of
+// commands that failed, or -1 if the connection was lost:
+int redisPipelineFlush()
+{
+    redisReply* reply;
+    unsigned long long start;
+    size_t bytesIn = 0;
+    int failed = 0;
+
+    start = statsNow();
+    while (pipelinePending > 0)
+    {
+        if (REDIS_OK != redisGetReply(redis1, (void**)&reply))
+        {
+            statsIncrCounter(STAT_COUNTER_REDIS_ERRORS);
+            fprintf(stderr, "Error: %s\n", redis1->errstr);
+            recordCommand("PIPELINE", pipelineBytesOut, bytesIn, start, 1);
+            closeRedisConnection();
+            pipelinePending = 0;
+            pipelineBytesOut = 0;
+            return -1; // Failure; the replies are lost with the connection.
+        }
+        --pipelinePending;
+
+        if (reply->type == REDIS_REPLY_ERROR)
+        {
+            fprintf(stderr, "Error: %s\n", reply->str);
+            ++failed;
+        }
+        bytesIn += replySize(reply);
+        freeReplyObject(reply);
+    }
+
+    recordCommand("PIPELINE", pipelineBytesOut, bytesIn, start, failed > 0);
+    pipelineBytesOut = 0;
+
+    return failed;
+}
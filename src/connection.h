@@ -12,6 +12,8 @@
 #ifndef _CONNECTION_H_
 #define _CONNECTION_H_
 
+#include <stddef.h>
+
 #include "redifs_types.h"
 
 
@@ -26,15 +28,35 @@ extern void closeRedisConnection();
 extern void releaseReplyHandle(int handle);
 
 extern void retrieveStringArrayElements(int handle, int offset, int count, char* array[]);
+extern void retrieveBinaryArrayElement(int handle, int index, char** data, size_t* len);
 
 extern int redisCommand_HGET(const char* key, const char* field, char** result);
 extern int redisCommand_HKEYS(const char* key, int* result);
 extern int redisCommand_HSET_INT(const char* key, const char* field, long long value, int* result);
+extern int redisCommand_HDEL(const char* key, const char* field, int* result);
 extern int redisCommand_INCR(const char* key, long long* result);
 extern int redisCommand_LINDEX(const char* key, long long index, char** result);
+extern int redisCommand_LRANGE(const char* key, long long start, long long stop, int* result);
 extern int redisCommand_LSET_INT(const char* key, long long index, long long value);
 extern int redisCommand_SET(const char* key, const char* value);
 extern int redisCommand_RPUSH_INT(const char* key, long long values[], long long value_count, int* result);
+extern int redisCommand_DEL(const char* keys[], long long key_count, int* result);
+extern int redisCommand_GETRANGE(const char* key, long long start, long long end, char** result, size_t* len);
+extern int redisCommand_SETRANGE(const char* key, long long offset, const char* value, size_t len, long long* result);
+extern int redisCommand_SET_BIN(const char* key, const char* value, size_t len);
+extern int redisCommand_LSET_BIN(const char* key, long long index, const char* value, size_t len);
+extern int redisCommand_RPUSH_INT_BIN(const char* key, long long values[], long long value_count,
+                                      const char* value, size_t len, int* result);
+extern int redisCommand_EVAL_INT(const char* script, int numKeys, const char* args[], int argCount, long long* result);
+extern int redisCommand_EVAL_STR(const char* script, int numKeys, const char* args[], int argCount,
+                                 char** result, size_t* len);
+extern int redisCommand_EVAL_BIN_INT(const char* script, int numKeys, const char* args[], int argCount,
+                                     const char* value, size_t len, long long* result);
+extern int redisCommand_EVAL_ARRAY(const char* script, int numKeys, const char* args[], int argCount, int* result);
+
+extern int redisPipelineAppend(int argc, const char* argv[], const size_t argvlen[]);
+extern int redisPipelineReply(int* result);
+extern int redisPipelineFlush();
 
 
 #endif // _CONNECTION_H_
@@ -0,0 +1,348 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <fuse.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "control.h"
+#include "blockcache.h"
+#include "compress.h"
+#include "dedup.h"
+#include "metacache.h"
+#include "quota.h"
+#include "reclaim.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "tier.h"
+#include "times.h"
+#include "trace.h"
+#include "tree.h"
+
+
+/* ---- Control file table ---- */
+struct control_file
+{
+    const char* name;
+    void (*generate)(FILE* out);
+    int (*command)(const char* buf, size_t len); // NULL for read-only files.
+
+    // Queries: a write starts one, and its output replaces the content read
+    // through the same handle. produce writes the next part of the output
+    // and returns 0 after the last one; release ends a query at any point.
+    // query sets state to NULL for a command without output.
+    int (*query)(const char* buf, size_t len, void** state);
+    int (*produce)(void* state, FILE* out);
+    void (*release)(void* state);
+};
+
+static struct control_file controlFiles[] = {
+    { "stats", statsWritePrometheus, NULL },
+    { "trace", traceWriteStatus, traceCommand },
+    { "compress", compressWriteStatus, compressCommand },
+    { "dedup", dedupWriteStatus, dedupCommand },
+    { "snapshot", snapshotWriteStatus, snapshotCommand },
+    { "reclaim", reclaimWriteStatus, reclaimCommand },
+    { "tree", treeWriteStatus, NULL, treeQuery, treeProduce, treeRelease },
+    { "metacache", metaCacheWriteStatus, metaCacheCommand },
+    { "blockcache", blockCacheWriteStatus, blockCacheCommand },
+    { "tier", tierWriteStatus, NULL },
+    { "quota", quotaWriteStatus, NULL, quotaQuery, quotaProduce, quotaRelease },
+    { "times", timesWriteStatus, timesCommand },
+};
+
+#define CONTROL_FILE_COUNT (sizeof(controlFiles) / sizeof(controlFiles[0]))
+
+
+// Content of an opened control file, stored in fuse_file_info::fh:
+struct control_handle
+{
+    struct control_file* file;
+    char* data;
+    size_t len;
+    off_t base; // File offset of data.
+    void* state; // Query with more output to produce.
+};
+
+
+/* ================ Util functions ================ */
+
+static struct control_file* findControlFile(const char* path)
+{
+    int i;
+
+    if (0 != strncmp(path, CONTROL_DIR_PATH "/", sizeof(CONTROL_DIR_PATH)))
+    {
+        return NULL;
+    }
+
+    path += sizeof(CONTROL_DIR_PATH);
+    for (i = 0; i < CONTROL_FILE_COUNT; ++i)
+    {
+        if (0 == strcmp(path, controlFiles[i].name))
+        {
+            return &controlFiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static int isWritable(struct control_file* file)
+{
+    return file->command || file->query;
+}
+
+
+static void releaseQuery(struct control_handle* handle)
+{
+    if (handle->state)
+    {
+        handle->file->release(handle->state);
+        handle->state = NULL;
+    }
+}
+
+
+/*
+ * Replace the content with the next part of the query output, which starts
+ * where the current content ends.
+*/
+static int produceOutput(struct control_handle* handle)
+{
+    FILE* out;
+    int result;
+
+    handle->base += handle->len;
+    free(handle->data);
+    handle->data = NULL;
+    handle->len = 0;
+
+    out = open_memstream(&handle->data, &handle->len);
+    if (!out)
+    {
+        return -ENOMEM;
+    }
+    result = handle->file->produce(handle->state, out);
+    fclose(out);
+
+    if (result <= 0)
+    {
+        releaseQuery(handle);
+    }
+
+    return result < 0 ? result : 0;
+}
+
+
+/*
+ * Check whether a path lies inside the control directory.
+*/
+int controlIsPath(const char* path)
+{
+    return 0 == strncmp(path, CONTROL_DIR_PATH, sizeof(CONTROL_DIR_PATH) - 1)
+        && (path[sizeof(CONTROL_DIR_PATH) - 1] == '\0' || path[sizeof(CONTROL_DIR_PATH) - 1] == '/');
+}
+
+
+/* ================ FUSE operations ================ */
+
+int controlGetattr(const char* path, struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+
+    if (0 == strcmp(path, CONTROL_DIR_PATH))
+    {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+        return 0;
+    }
+
+    if (!findControlFile(path))
+    {
+        return -ENOENT;
+    }
+
+    // Size is unknown until the content is generated; files are opened with direct_io.
+    stbuf->st_mode = S_IFREG | (isWritable(findControlFile(path)) ? 0644 : 0444);
+    stbuf->st_nlink = 1;
+
+    return 0;
+}
+
+
+int controlReaddir(const char* path, void* buf, fuse_fill_dir_t filler)
+{
+    int i;
+
+    if (0 != strcmp(path, CONTROL_DIR_PATH))
+    {
+        return -ENOTDIR;
+    }
+
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    for (i = 0; i < CONTROL_FILE_COUNT; ++i)
+    {
+        filler(buf, controlFiles[i].name, NULL, 0, 0);
+    }
+
+    return 0;
+}
+
+
+int controlOpen(const char* path, struct fuse_file_info* fileInfo)
+{
+    struct control_file* file;
+    struct control_handle* handle;
+    FILE* out;
+
+    file = findControlFile(path);
+    if (!file)
+    {
+        return 0 == strcmp(path, CONTROL_DIR_PATH) ? -EISDIR : -ENOENT;
+    }
+
+    if ((fileInfo->flags & 3) != O_RDONLY && !isWritable(file))
+    {
+        return -EACCES;
+    }
+
+    handle = calloc(1, sizeof(struct control_handle));
+    if (!handle)
+    {
+        return -ENOMEM;
+    }
+    handle->file = file;
+
+    // Take a snapshot of the content, so that reads at different offsets are consistent:
+    if ((fileInfo->flags & 3) != O_WRONLY)
+    {
+        out = open_memstream(&handle->data, &handle->len);
+        if (!out)
+        {
+            free(handle);
+            return -ENOMEM;
+        }
+        file->generate(out);
+        fclose(out);
+    }
+
+    fileInfo->fh = (uint64_t)(uintptr_t)handle;
+    fileInfo->direct_io = 1;
+
+    return 0;
+}
+
+
+int controlRead(char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo)
+{
+    struct control_handle* handle = (struct control_handle*)(uintptr_t)fileInfo->fh;
+    int result;
+
+    assert(handle);
+
+    // Query output is read sequentially:
+    while (handle->state && offset >= handle->base + handle->len)
+    {
+        result = produceOutput(handle);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    if (offset < handle->base || offset >= handle->base + handle->len)
+    {
+        return 0;
+    }
+
+    if (offset + size > handle->base + handle->len)
+    {
+        size = handle->base + handle->len - offset;
+    }
+    memcpy(buf, handle->data + (offset - handle->base), size);
+
+    return size;
+}
+
+
+int controlWrite(const char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo)
+{
+    struct control_handle* handle = (struct control_handle*)(uintptr_t)fileInfo->fh;
+    void* state = NULL;
+    int result;
+
+    assert(handle);
+
+    // Every write is one command or query:
+    if (!handle->file->query)
+    {
+        result = handle->file->command(buf, size);
+        return result < 0 ? result : size;
+    }
+
+    result = handle->file->query(buf, size, &state);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // The output follows the write position:
+    releaseQuery(handle);
+    free(handle->data);
+    handle->data = NULL;
+    handle->len = 0;
+    handle->base = offset + size;
+    handle->state = state;
+
+    return size;
+}
+
+
+int controlTruncate(const char* path)
+{
+    struct control_file* file = findControlFile(path);
+
+    if (!file)
+    {
+        return 0 == strcmp(path, CONTROL_DIR_PATH) ? -EISDIR : -ENOENT;
+    }
+
+    // Truncating a command file (as done by "echo cmd > file") is a no-op:
+    return isWritable(file) ? 0 : -EACCES;
+}
+
+
+int controlRelease(struct fuse_file_info* fileInfo)
+{
+    struct control_handle* handle = (struct control_handle*)(uintptr_t)fileInfo->fh;
+
+    if (handle)
+    {
+        releaseQuery(handle);
+        free(handle->data);
+        free(handle);
+        fileInfo->fh = 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+
+/* ---- Includes ---- */
+#include <fuse.h>
+
+
+/* ---- Defines ---- */
+#define CONTROL_DIR_NAME ".redifs"
+#define CONTROL_DIR_PATH "/" CONTROL_DIR_NAME
+
+
+/* ================ Control files ================ */
+
+// The virtual /.redifs directory is not stored in Redis. Its files are
+// generated when opened and never touch the file system's own keys.
+
+extern int controlIsPath(const char* path);
+
+extern int controlGetattr(const char* path, struct stat* stbuf);
+extern int controlReaddir(const char* path, void* buf, fuse_fill_dir_t filler);
+extern int controlOpen(const char* path, struct fuse_file_info* fileInfo);
+extern int controlRead(char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo);
+extern int controlWrite(const char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo);
+extern int controlTruncate(const char* path);
+extern int controlRelease(struct fuse_file_info* fileInfo);
+
+
+#endif // _CONTROL_H_
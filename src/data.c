@@ -0,0 +1,985 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "data.h"
+#include "arena.h"
+#include "backend.h"
+#include "blockcache.h"
+#include "compress.h"
+#include "dedup.h"
+#include "options.h"
+#include "stats.h"
+#include "tier.h"
+#include "times.h"
+
+
+/* ---- Types ---- */
+
+// How the chunks of a file are stored, with scratch buffers for framed
+// chunks that are taken from the arena on first use:
+struct chunk_io
+{
+    int codec;
+    int dedup;
+    int tiered;
+    char* frame;
+    char* raw;
+};
+
+
+/* ================ Chunk functions ================ */
+
+// Files with a compression codec or deduplication store every chunk as one
+// frame, so partial updates load, patch and store the whole chunk.
+
+static void initChunkIo(struct chunk_io* io, long long flags)
+{
+    int codec = NODE_CODEC(flags);
+
+    io->codec = codec > CODEC_NONE && codec < CODEC_COUNT ? codec : CODEC_NONE;
+    io->dedup = (flags & NODE_FLAG_DEDUP) != 0;
+    io->tiered = (flags & NODE_FLAG_TIERED) != 0;
+    io->frame = NULL;
+    io->raw = NULL;
+}
+
+
+static int allocChunkBuffers(struct chunk_io* io)
+{
+    if (!io->frame)
+    {
+        io->frame = arenaAlloc(CHUNK_FRAME_MAX);
+        io->raw = arenaAlloc(CHUNK_SIZE);
+    }
+
+    return io->frame && io->raw ? 0 : -ENOMEM;
+}
+
+
+// Load and decompress a chunk into io->raw; returns its length:
+static int loadFramedChunk(node_id_t nodeId, long long chunk, struct chunk_io* io)
+{
+    int result;
+
+    result = allocChunkBuffers(io);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (io->dedup)
+    {
+        result = g_backend->dedup_get(nodeId, chunk, io->frame, CHUNK_FRAME_MAX);
+    }
+    else
+    {
+        result = g_backend->chunk_get(nodeId, chunk, io->frame, CHUNK_FRAME_MAX);
+    }
+    if (result <= 0)
+    {
+        return result;
+    }
+
+    return decompressChunk(io->frame, result, io->raw);
+}
+
+
+// Link a deduplicated chunk to the blob of its data; only data that is not
+// stored yet is compressed and sent:
+static int storeDedupChunk(node_id_t nodeId, long long chunk, const char* raw, size_t len, struct chunk_io* io)
+{
+    char hash[CHUNK_HASH_LEN + 1];
+    size_t frameLen;
+    int result;
+
+    hashChunk(raw, len, hash);
+
+    result = g_backend->dedup_link(nodeId, chunk, hash, NULL, 0);
+    if (result != 0)
+    {
+        if (result > 0)
+        {
+            statsIncrCounter(STAT_COUNTER_DEDUP_CHUNKS_LINKED);
+        }
+        return result < 0 ? result : 0;
+    }
+
+    frameLen = compressChunk(io->codec, raw, len, io->frame);
+    result = g_backend->dedup_link(nodeId, chunk, hash, io->frame, frameLen);
+    if (result < 0)
+    {
+        return result;
+    }
+    statsIncrCounter(STAT_COUNTER_DEDUP_CHUNKS_STORED);
+
+    return 0;
+}
+
+
+static int storeFramedChunk(node_id_t nodeId, long long chunk, const char* raw, size_t len, struct chunk_io* io)
+{
+    size_t frameLen;
+    int result;
+
+    result = allocChunkBuffers(io);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (io->dedup)
+    {
+        return storeDedupChunk(nodeId, chunk, raw, len, io);
+    }
+
+    frameLen = compressChunk(io->codec, raw, len, io->frame);
+
+    return g_backend->chunk_put(nodeId, chunk, io->frame, frameLen);
+}
+
+
+// Fault a chunk of a tiered file back from the cold store, decoded into
+// io->raw; returns its length, or 0 if it is not in the cold store:
+static int faultChunk(node_id_t nodeId, long long chunk, struct chunk_io* io)
+{
+    int result;
+
+    result = allocChunkBuffers(io);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (io->codec == CODEC_NONE)
+    {
+        return tierFault(nodeId, chunk, io->raw, CHUNK_SIZE);
+    }
+
+    result = tierFault(nodeId, chunk, io->frame, CHUNK_FRAME_MAX);
+
+    return result <= 0 ? result : decompressChunk(io->frame, result, io->raw);
+}
+
+
+// Fault back the chunks of a tiered file that len bytes at offset touch,
+// before they are changed:
+static int faultRange(node_id_t nodeId, off_t offset, size_t len, struct chunk_io* io)
+{
+    long long chunk;
+    int result;
+
+    for (chunk = offset / CHUNK_SIZE; io->tiered && len > 0 && chunk <= (offset + len - 1) / CHUNK_SIZE; ++chunk)
+    {
+        result = faultChunk(nodeId, chunk, io);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+
+// Copy size bytes at offset of a chunk of len bytes in io->raw:
+static int copyFromRaw(char* buf, size_t size, off_t offset, int len, const struct chunk_io* io)
+{
+    if (len <= offset)
+    {
+        return len < 0 ? len : 0;
+    }
+
+    if (size > len - offset)
+    {
+        size = len - offset;
+    }
+    memcpy(buf, io->raw + offset, size);
+
+    return size;
+}
+
+
+// With the block cache, a miss loads the whole chunk into io->raw to store it:
+static int readStoredChunk(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset, struct chunk_io* io)
+{
+    unsigned long token;
+    int len;
+
+    if (blockCacheEnabled())
+    {
+        len = blockCacheRead(nodeId, chunk, buf, size, offset);
+        if (len >= 0)
+        {
+            return len;
+        }
+
+        token = blockCacheBegin(nodeId);
+        if (io->codec == CODEC_NONE && !io->dedup)
+        {
+            len = allocChunkBuffers(io);
+            if (len == 0)
+            {
+                len = g_backend->chunk_get(nodeId, chunk, io->raw, CHUNK_SIZE);
+            }
+        }
+        else
+        {
+            len = loadFramedChunk(nodeId, chunk, io);
+        }
+        if (len >= 0)
+        {
+            blockCacheStore(token, nodeId, chunk, io->raw, len);
+        }
+    }
+    else if (io->codec == CODEC_NONE && !io->dedup)
+    {
+        return g_backend->chunk_read(nodeId, chunk, buf, size, offset);
+    }
+    else
+    {
+        len = loadFramedChunk(nodeId, chunk, io);
+    }
+
+    return copyFromRaw(buf, size, offset, len, io);
+}
+
+
+// Callers keep reads within the file size, so a read of a tiered file that
+// comes back short is of a hole or of a chunk in the cold store:
+static int readChunk(node_id_t nodeId, long long chunk, char* buf, size_t size, off_t offset, struct chunk_io* io)
+{
+    int len;
+    int coldLen;
+
+    len = readStoredChunk(nodeId, chunk, buf, size, offset, io);
+    if (len < 0 || len == size || !io->tiered)
+    {
+        return len;
+    }
+
+    coldLen = faultChunk(nodeId, chunk, io);
+
+    return coldLen == 0 ? len : copyFromRaw(buf, size, offset, coldLen, io);
+}
+
+
+static int writeChunk(node_id_t nodeId, long long chunk, const char* buf, size_t size, off_t offset,
+                      struct chunk_io* io)
+{
+    int len;
+
+    len = io->tiered ? faultChunk(nodeId, chunk, io) : 0;
+    if (len < 0)
+    {
+        return len;
+    }
+
+    if (io->codec == CODEC_NONE && !io->dedup)
+    {
+        return g_backend->chunk_write(nodeId, chunk, buf, size, offset);
+    }
+
+    // Whole chunks need no read:
+    if (offset == 0 && size == CHUNK_SIZE)
+    {
+        return storeFramedChunk(nodeId, chunk, buf, size, io);
+    }
+
+    len = loadFramedChunk(nodeId, chunk, io);
+    if (len < 0)
+    {
+        return len;
+    }
+
+    if (len < offset)
+    {
+        memset(io->raw + len, 0, offset - len);
+    }
+    memcpy(io->raw + offset, buf, size);
+    if (len < offset + size)
+    {
+        len = offset + size;
+    }
+
+    return storeFramedChunk(nodeId, chunk, io->raw, len, io);
+}
+
+
+static int truncateChunk(node_id_t nodeId, long long chunk, off_t length, struct chunk_io* io)
+{
+    int len = 0;
+
+    if (io->tiered)
+    {
+        len = length == 0 ? tierDiscard(nodeId, chunk) : faultChunk(nodeId, chunk, io);
+    }
+    if (len < 0)
+    {
+        return len;
+    }
+
+    if (length == 0)
+    {
+        return io->dedup ? g_backend->dedup_drop(nodeId, chunk) : g_backend->chunk_truncate(nodeId, chunk, 0);
+    }
+    else if (io->codec == CODEC_NONE && !io->dedup)
+    {
+        return g_backend->chunk_truncate(nodeId, chunk, length);
+    }
+
+    len = loadFramedChunk(nodeId, chunk, io);
+    if (len <= length)
+    {
+        return len < 0 ? len : 0;
+    }
+
+    return storeFramedChunk(nodeId, chunk, io->raw, length, io);
+}
+
+
+/* ================ File data functions ================ */
+
+/*
+ * Read file data, splitting the request over chunks. Holes and chunks
+ * shorter than CHUNK_SIZE read as zeros. Returns the number of bytes read.
+*/
+int dataRead(node_id_t nodeId, long long flags, off_t fileSize, char* buf, size_t size, off_t offset)
+{
+    struct chunk_io io;
+    long long chunk;
+    off_t chunkOffset;
+    size_t done = 0;
+    size_t part;
+    int result;
+
+    if (offset >= fileSize)
+    {
+        return 0;
+    }
+    if (offset + size > fileSize)
+    {
+        size = fileSize - offset;
+    }
+
+    initChunkIo(&io, flags);
+    while (done < size)
+    {
+        chunk = (offset + done) / CHUNK_SIZE;
+        chunkOffset = (offset + done) % CHUNK_SIZE;
+        part = CHUNK_SIZE - chunkOffset;
+        if (part > size - done)
+        {
+            part = size - done;
+        }
+
+        result = readChunk(nodeId, chunk, buf + done, part, chunkOffset, &io);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        memset(buf + done + result, 0, part - result);
+        done += part;
+    }
+
+    return done;
+}
+
+
+/*
+ * Write file data, splitting the request over chunks. The caller updates
+ * the file size. Returns the number of bytes written.
+*/
+int dataWrite(node_id_t nodeId, long long flags, const char* buf, size_t size, off_t offset)
+{
+    struct chunk_io io;
+    long long chunk;
+    off_t chunkOffset;
+    size_t done = 0;
+    size_t part;
+    int result;
+
+    initChunkIo(&io, flags);
+    while (done < size)
+    {
+        chunk = (offset + done) / CHUNK_SIZE;
+        chunkOffset = (offset + done) % CHUNK_SIZE;
+        part = CHUNK_SIZE - chunkOffset;
+        if (part > size - done)
+        {
+            part = size - done;
+        }
+
+        result = writeChunk(nodeId, chunk, buf + done, part, chunkOffset, &io);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        done += part;
+    }
+
+    return done;
+}
+
+
+/*
+ * Drop the data past newSize. Growing a file needs no work, as the new
+ * range reads as a hole.
+*/
+int dataTruncate(node_id_t nodeId, long long flags, off_t oldSize, off_t newSize)
+{
+    struct chunk_io io;
+    long long chunk;
+    long long lastChunk;
+    int result;
+
+    if (newSize >= oldSize)
+    {
+        return 0;
+    }
+
+    initChunkIo(&io, flags);
+    lastChunk = (oldSize - 1) / CHUNK_SIZE;
+    chunk = newSize / CHUNK_SIZE;
+
+    // The chunk containing the new end keeps its head:
+    if (newSize % CHUNK_SIZE)
+    {
+        result = truncateChunk(nodeId, chunk, newSize % CHUNK_SIZE, &io);
+        if (result < 0)
+        {
+            return result;
+        }
+        ++chunk;
+    }
+
+    for (; chunk <= lastChunk; ++chunk)
+    {
+        result = truncateChunk(nodeId, chunk, 0, &io);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+
+// Plain chunks hold raw bytes; framed ones a codec byte and payload, and
+// deduplicated ones a blob reference. Whole chunks can be cloned between
+// files of the same kind:
+static int chunkKind(const struct chunk_io* io)
+{
+    return io->dedup ? 2 : io->codec != CODEC_NONE ? 1 : 0;
+}
+
+
+/*
+ * Copy size bytes from one file to another inside the backend where
+ * possible: whole chunks are cloned, plain chunks are copied at any
+ * alignment, and only the rest passes through RediFS. Both ranges must
+ * lie within the files' sizes after the copy; the caller updates the
+ * destination size.
+*/
+static int dataCopy(node_id_t srcId, long long srcFlags, off_t srcSize, off_t srcOffset,
+                    node_id_t dstId, long long dstFlags, off_t dstSize, off_t dstOffset, size_t size)
+{
+    struct chunk_io srcIo;
+    struct chunk_io dstIo;
+    char* buf = NULL;
+    off_t srcPos;
+    off_t dstPos;
+    size_t done = 0;
+    size_t part;
+    long long count;
+    int sameKind;
+    int aligned;
+    int result;
+
+    initChunkIo(&srcIo, srcFlags);
+    initChunkIo(&dstIo, dstFlags);
+    sameKind = chunkKind(&srcIo) == chunkKind(&dstIo);
+    aligned = srcOffset % CHUNK_SIZE == dstOffset % CHUNK_SIZE;
+
+    while (done < size)
+    {
+        srcPos = srcOffset + done;
+        dstPos = dstOffset + done;
+
+        // Whole chunks, including a last chunk that ends both files:
+        count = 0;
+        if (sameKind && aligned && srcPos % CHUNK_SIZE == 0)
+        {
+            count = (size - done) / CHUNK_SIZE;
+            if (srcOffset + size == srcSize && dstOffset + size >= dstSize && (size - done) % CHUNK_SIZE)
+            {
+                ++count;
+            }
+            if (count > COPY_BATCH_CHUNKS)
+            {
+                count = COPY_BATCH_CHUNKS;
+            }
+        }
+
+        if (count > 0)
+        {
+            result = faultRange(srcId, srcPos, count * CHUNK_SIZE, &srcIo);
+            if (result == 0)
+            {
+                result = faultRange(dstId, dstPos, count * CHUNK_SIZE, &dstIo);
+            }
+            if (result == 0)
+            {
+                result = g_backend->chunk_clone(srcId, srcPos / CHUNK_SIZE, dstId, dstPos / CHUNK_SIZE, count,
+                                                srcIo.dedup);
+            }
+            part = count * CHUNK_SIZE < size - done ? count * CHUNK_SIZE : size - done;
+        }
+        else if (chunkKind(&srcIo) == 0 && chunkKind(&dstIo) == 0)
+        {
+            // Up to the next chunk boundary if aligned, else as much as a batch holds:
+            part = aligned ? CHUNK_SIZE - srcPos % CHUNK_SIZE : (size_t)COPY_BATCH_CHUNKS * CHUNK_SIZE;
+            if (part > size - done)
+            {
+                part = size - done;
+            }
+            result = faultRange(srcId, srcPos, part, &srcIo);
+            if (result == 0)
+            {
+                result = faultRange(dstId, dstPos, part, &dstIo);
+            }
+            if (result == 0)
+            {
+                result = g_backend->chunk_copy(srcId, srcPos, dstId, dstPos, part);
+            }
+        }
+        else
+        {
+            // Through a buffer, one piece within a source and a destination chunk at a time:
+            part = CHUNK_SIZE - (srcPos % CHUNK_SIZE > dstPos % CHUNK_SIZE ? srcPos % CHUNK_SIZE : dstPos % CHUNK_SIZE);
+            if (part > size - done)
+            {
+                part = size - done;
+            }
+
+            if (!buf)
+            {
+                buf = arenaAlloc(CHUNK_SIZE);
+                if (!buf)
+                {
+                    return -ENOMEM;
+                }
+            }
+
+            result = readChunk(srcId, srcPos / CHUNK_SIZE, buf, part, srcPos % CHUNK_SIZE, &srcIo);
+            if (result >= 0)
+            {
+                memset(buf + result, 0, part - result);
+                result = writeChunk(dstId, dstPos / CHUNK_SIZE, buf, part, dstPos % CHUNK_SIZE, &dstIo);
+            }
+        }
+
+        if (result < 0)
+        {
+            return result;
+        }
+
+        done += part;
+    }
+
+    return 0;
+}
+
+
+/* ================ File functions ================ */
+
+// Small files keep their data inline, in the node record, until they grow
+// past the inline_max setting. The inline data is as long as the file,
+// except while a write that grows the file stores it; reads pad it with
+// zeros.
+
+// Copy the inline data into a new arena buffer of size bytes, padded with zeros:
+static char* resizeInline(const struct node_record* node, off_t size)
+{
+    size_t copied = node->len < size ? node->len : size;
+    char* data;
+
+    data = arenaAlloc(size);
+    if (data)
+    {
+        if (copied > 0)
+        {
+            memcpy(data, node->data, copied);
+        }
+        memset(data + copied, 0, size - copied);
+    }
+
+    return data;
+}
+
+
+// Move the data of an inline file to chunks, then point the node at them:
+static int promoteInline(node_id_t nodeId, struct node_record* node)
+{
+    long long flags = node->info[NODE_INFO_FLAGS] & ~NODE_FLAG_INLINE;
+    int result;
+
+    if (node->len > 0)
+    {
+        result = dataWrite(nodeId, node->info[NODE_INFO_FLAGS], node->data, node->len, 0);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    result = g_backend->set_info(nodeId, NODE_INFO_FLAGS, 1, &flags);
+    if (result < 0)
+    {
+        return result;
+    }
+    node->info[NODE_INFO_FLAGS] = flags;
+
+    // Drop the inline copy only once the node points at the chunks:
+    if (node->len > 0)
+    {
+        result = g_backend->set_inline(nodeId, "", 0);
+        node->len = 0;
+    }
+
+    return result;
+}
+
+
+// Store the modification time and size in one call; the fields are
+// adjacent. The flags are left alone, as the backend changes them too,
+// e.g. when the last cold chunk of a file is restored or dropped:
+static int storeFileInfo(node_id_t nodeId, struct node_record* node, off_t size)
+{
+    long long values[3];
+    struct timespec now;
+    int result;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    values[0] = now.tv_sec;
+    values[1] = now.tv_nsec;
+    values[2] = size;
+
+    result = g_backend->set_info(nodeId, NODE_INFO_MOD_TIME_SEC, 3, values);
+    if (result < 0)
+    {
+        return result;
+    }
+    memcpy(&node->info[NODE_INFO_MOD_TIME_SEC], values, sizeof(values));
+    timesWritten(nodeId);
+
+    return 0;
+}
+
+
+/*
+ * Store the modification time of a write that ends at end, and raise the
+ * size to end unless the file is larger already, before the data goes
+ * out: a quota refuses the write while nothing has changed, and writers
+ * extending a file at once never shrink it. node gets the resulting size.
+*/
+static int extendFile(node_id_t nodeId, struct node_record* node, off_t end)
+{
+    struct timespec now;
+    long long mtime[2];
+    int result;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    mtime[0] = now.tv_sec;
+    mtime[1] = now.tv_nsec;
+
+    result = g_backend->file_extend(nodeId, mtime, &end);
+    if (result < 0)
+    {
+        return result;
+    }
+    node->info[NODE_INFO_MOD_TIME_SEC] = mtime[0];
+    node->info[NODE_INFO_MOD_TIME_NSEC] = mtime[1];
+    node->info[NODE_INFO_SIZE] = end;
+    timesWritten(nodeId);
+
+    return 0;
+}
+
+
+/*
+ * Read from a file.
+*/
+int fileRead(node_id_t nodeId, const struct node_record* node, char* buf, size_t size, off_t offset)
+{
+    off_t fileSize = node->info[NODE_INFO_SIZE];
+
+    if (!(node->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE))
+    {
+        return dataRead(nodeId, node->info[NODE_INFO_FLAGS], fileSize, buf, size, offset);
+    }
+
+    if (offset >= fileSize)
+    {
+        return 0;
+    }
+    if (offset + size > fileSize)
+    {
+        size = fileSize - offset;
+    }
+
+    if (offset < node->len)
+    {
+        size_t part = node->len - offset < size ? node->len - offset : size;
+        memcpy(buf, node->data + offset, part);
+        memset(buf + part, 0, size - part);
+    }
+    else
+    {
+        memset(buf, 0, size);
+    }
+
+    return size;
+}
+
+
+/*
+ * Write to a file, and update its size and modification time.
+*/
+int fileWrite(node_id_t nodeId, struct node_record* node, const char* buf, size_t size, off_t offset)
+{
+    off_t newSize;
+    char* data;
+    int result;
+
+    result = extendFile(nodeId, node, offset + size);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (node->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE)
+    {
+        newSize = node->info[NODE_INFO_SIZE];
+        if (newSize <= g_settings->inline_max)
+        {
+            data = resizeInline(node, newSize);
+            if (!data)
+            {
+                return -ENOMEM;
+            }
+            memcpy(data + offset, buf, size);
+
+            result = g_backend->set_inline(nodeId, data, newSize);
+            return result < 0 ? result : size;
+        }
+
+        result = promoteInline(nodeId, node);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    // Chunks written before a failure are stale in the block cache too:
+    result = dataWrite(nodeId, node->info[NODE_INFO_FLAGS], buf, size, offset);
+    blockCacheInvalidate(nodeId);
+
+    return result;
+}
+
+
+/*
+ * Append to a file opened with O_APPEND, at its end as the backend sees
+ * it, which writers on other mounts may have moved since node was read.
+ * Files without a codec or deduplication append atomically inside the
+ * backend. The chunks of the others are encoded here and replaced whole,
+ * so a reserved range would not keep appenders sharing a chunk from
+ * losing data either: they append at the end node knows, which is atomic
+ * against the writers of this mount only, as the kernel serialises those.
+*/
+int fileAppend(node_id_t nodeId, struct node_record* node, const char* buf, size_t size)
+{
+    long long flags = node->info[NODE_INFO_FLAGS];
+    off_t end = node->info[NODE_INFO_SIZE];
+    struct chunk_io io;
+    struct timespec now;
+    long long mtime[2];
+    int result;
+
+    initChunkIo(&io, flags);
+    // Not atomic against other mounts, see above:
+    if (io.codec != CODEC_NONE || io.dedup)
+    {
+        return fileWrite(nodeId, node, buf, size, end);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    mtime[0] = now.tv_sec;
+    mtime[1] = now.tv_nsec;
+
+    // Another append got in first when the end moved past the prepared chunks:
+    while (1)
+    {
+        result = faultRange(nodeId, end, size + APPEND_SLACK, &io);
+        if (result == 0)
+        {
+            result = g_backend->file_append(nodeId, buf, size, g_settings->inline_max, mtime, &end);
+        }
+        if (result != -EAGAIN)
+        {
+            break;
+        }
+        statsAddCounter(STAT_COUNTER_APPEND_RETRIES, 1);
+    }
+
+    if (result == -EOPNOTSUPP)
+    {
+        return fileWrite(nodeId, node, buf, size, end);
+    }
+
+    blockCacheInvalidate(nodeId);
+    if (result == 0)
+    {
+        timesWritten(nodeId);
+    }
+
+    return result < 0 ? result : size;
+}
+
+
+/*
+ * Change the size of a file.
+*/
+int fileTruncate(node_id_t nodeId, struct node_record* node, off_t size)
+{
+    off_t oldSize = node->info[NODE_INFO_SIZE];
+    char* data;
+    int result;
+
+    // A quota refuses growth before the data changes:
+    if (size > oldSize)
+    {
+        result = storeFileInfo(nodeId, node, size);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    if (node->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE)
+    {
+        if (size <= g_settings->inline_max)
+        {
+            data = resizeInline(node, size);
+            result = data ? g_backend->set_inline(nodeId, data, size) : -ENOMEM;
+        }
+        else
+        {
+            // Growing past the limit; the rest of the file is a hole:
+            result = promoteInline(nodeId, node);
+        }
+    }
+    else
+    {
+        result = dataTruncate(nodeId, node->info[NODE_INFO_FLAGS], oldSize, size);
+        blockCacheInvalidate(nodeId);
+    }
+
+    if (result < 0 || size > oldSize)
+    {
+        return result;
+    }
+
+    return storeFileInfo(nodeId, node, size);
+}
+
+
+/*
+ * Copy a range of one file into another, for copy_file_range. The data
+ * stays in the backend where the chunk layouts allow. Returns the number
+ * of bytes copied.
+*/
+ssize_t fileCopy(node_id_t srcId, const struct node_record* src, off_t srcOffset,
+                 node_id_t dstId, struct node_record* dst, off_t dstOffset, size_t size)
+{
+    off_t srcSize = src->info[NODE_INFO_SIZE];
+    off_t dstSize = dst->info[NODE_INFO_SIZE];
+    off_t newSize;
+    char* data;
+    int result;
+
+    if (srcOffset >= srcSize)
+    {
+        return 0;
+    }
+    if (size > srcSize - srcOffset)
+    {
+        size = srcSize - srcOffset;
+    }
+
+    if (srcId == dstId && srcOffset < dstOffset + size && dstOffset < srcOffset + size)
+    {
+        return -EINVAL; // Overlapping ranges.
+    }
+
+    newSize = dstOffset + size > dstSize ? dstOffset + size : dstSize;
+
+    // Inline data is small; copy it through a buffer:
+    if ((src->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE)
+        || ((dst->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE) && newSize <= g_settings->inline_max))
+    {
+        data = arenaAlloc(size);
+        if (!data)
+        {
+            return -ENOMEM;
+        }
+
+        result = fileRead(srcId, src, data, size, srcOffset);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        return fileWrite(dstId, dst, data, result, dstOffset);
+    }
+
+    result = extendFile(dstId, dst, dstOffset + size);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    if (dst->info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE)
+    {
+        result = promoteInline(dstId, dst);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    result = dataCopy(srcId, src->info[NODE_INFO_FLAGS], srcSize, srcOffset,
+                      dstId, dst->info[NODE_INFO_FLAGS], dstSize, dstOffset, size);
+    blockCacheInvalidate(dstId);
+
+    return result < 0 ? result : size;
+}
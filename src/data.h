@@ -0,0 +1,43 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _DATA_H_
+#define _DATA_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "redifs_types.h"
+#include "backend.h"
+
+
+/* ---- Defines ---- */
+#define COPY_RANGE_MAX (1024LL * 1024 * 1024) // Bytes per copy_file_range call.
+#define COPY_BATCH_CHUNKS 256 // Chunks per server-side copy command.
+
+
+/* ================ File data functions ================ */
+
+extern int dataRead(node_id_t nodeId, long long flags, off_t fileSize, char* buf, size_t size, off_t offset);
+extern int dataWrite(node_id_t nodeId, long long flags, const char* buf, size_t size, off_t offset);
+extern int dataTruncate(node_id_t nodeId, long long flags, off_t oldSize, off_t newSize);
+
+extern int fileRead(node_id_t nodeId, const struct node_record* node, char* buf, size_t size, off_t offset);
+extern int fileWrite(node_id_t nodeId, struct node_record* node, const char* buf, size_t size, off_t offset);
+extern int fileAppend(node_id_t nodeId, struct node_record* node, const char* buf, size_t size);
+extern int fileTruncate(node_id_t nodeId, struct node_record* node, off_t size);
+extern ssize_t fileCopy(node_id_t srcId, const struct node_record* src, off_t srcOffset,
+                        node_id_t dstId, struct node_record* dst, off_t dstOffset, size_t size);
+
+
+#endif // _DATA_H_
@@ -0,0 +1,195 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Content-addressed chunks. Files created with -o dedup refer to their
+ * chunks by the hash of the raw chunk data; the backend keeps one
+ * reference counted blob per hash. Writing data that is already stored
+ * only sends the hash. Blobs whose count drops to zero stay until the next
+ * collection, so data that is written again soon is not uploaded twice.
+ *
+ * The hash is MurmurHash3 x64 128: fast, but not collision resistant
+ * against crafted input.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dedup.h"
+#include "options.h"
+#include "stats.h"
+
+
+/* ================ Hashing ================ */
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+
+static void murmurHash3_128(const char* data, size_t len, uint64_t out[2])
+{
+    const unsigned char* tail = (const unsigned char*)data + (len & ~(size_t)15);
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    uint64_t k1;
+    uint64_t k2;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        memcpy(&k1, data + i, 8);
+        memcpy(&k2, data + i + 8, 8);
+
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    k1 = 0;
+    k2 = 0;
+    switch (len & 15)
+    {
+        case 15: k2 ^= (uint64_t)tail[14] << 48; /* fall through */
+        case 14: k2 ^= (uint64_t)tail[13] << 40; /* fall through */
+        case 13: k2 ^= (uint64_t)tail[12] << 32; /* fall through */
+        case 12: k2 ^= (uint64_t)tail[11] << 24; /* fall through */
+        case 11: k2 ^= (uint64_t)tail[10] << 16; /* fall through */
+        case 10: k2 ^= (uint64_t)tail[9] << 8;   /* fall through */
+        case 9:  k2 ^= (uint64_t)tail[8];
+                 k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+                 /* fall through */
+        case 8:  k1 ^= (uint64_t)tail[7] << 56;  /* fall through */
+        case 7:  k1 ^= (uint64_t)tail[6] << 48;  /* fall through */
+        case 6:  k1 ^= (uint64_t)tail[5] << 40;  /* fall through */
+        case 5:  k1 ^= (uint64_t)tail[4] << 32;  /* fall through */
+        case 4:  k1 ^= (uint64_t)tail[3] << 24;  /* fall through */
+        case 3:  k1 ^= (uint64_t)tail[2] << 16;  /* fall through */
+        case 2:  k1 ^= (uint64_t)tail[1] << 8;   /* fall through */
+        case 1:  k1 ^= (uint64_t)tail[0];
+                 k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+
+/*
+ * Hash the raw data of a chunk into CHUNK_HASH_LEN hex digits.
+*/
+void hashChunk(const char* data, size_t len, char hash[CHUNK_HASH_LEN + 1])
+{
+    static const char digits[] = "0123456789abcdef";
+    uint64_t h[2];
+    int i;
+
+    murmurHash3_128(data, len, h);
+
+    for (i = 0; i < 16; ++i)
+    {
+        hash[i] = digits[(h[0] >> (60 - 4 * i)) & 0xf];
+        hash[16 + i] = digits[(h[1] >> (60 - 4 * i)) & 0xf];
+    }
+    hash[CHUNK_HASH_LEN] = '\0';
+}
+
+
+/* ================ Garbage collection ================ */
+
+/*
+ * Check up to max candidate blobs and free those that are still
+ * unreferenced. Returns the number of candidates checked.
+*/
+int dedupCollect(int max)
+{
+    int freed = 0;
+    int result;
+
+    result = g_backend->blob_gc(max, &freed);
+    statsAddCounter(STAT_COUNTER_DEDUP_BLOBS_FREED, freed);
+
+    return result;
+}
+
+
+/* ================ Control file ================ */
+
+void dedupWriteStatus(FILE* out)
+{
+    fprintf(out, "enabled %d\n", g_settings->dedup);
+    fprintf(out, "chunks_linked %llu\n", statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED));
+    fprintf(out, "chunks_stored %llu\n", statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED));
+    fprintf(out, "blobs_freed %llu\n", statsCounterTotal(STAT_COUNTER_DEDUP_BLOBS_FREED));
+}
+
+
+/*
+ * "gc" frees unreferenced blobs, "gc MAX" at most MAX of them.
+*/
+int dedupCommand(const char* cmd, size_t len)
+{
+    char buf[64];
+    int max = DEDUP_GC_BATCH;
+    int result;
+
+    if (len >= sizeof(buf))
+    {
+        return -EINVAL;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+
+    if (0 == strncmp(buf, "gc", 2) && (buf[2] == '\0' || buf[2] == '\n'))
+    {
+        // Sweep until no candidates are left:
+        do
+        {
+            result = dedupCollect(max);
+        } while (result == max);
+
+        return result < 0 ? result : 0;
+    }
+    else if (1 == sscanf(buf, "gc %d", &max) && max > 0)
+    {
+        result = dedupCollect(max);
+        return result < 0 ? result : 0;
+    }
+
+    return -EINVAL;
+}
@@ -0,0 +1,37 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "backend.h"
+
+
+/* ---- Defines ---- */
+#define CHUNK_HASH_LEN 32 // Hex digits of a 128 bit chunk hash.
+#define DEDUP_GC_BATCH 1024
+
+
+/* ================ Deduplication functions ================ */
+
+extern void hashChunk(const char* data, size_t len, char hash[CHUNK_HASH_LEN + 1]);
+extern int dedupCollect(int max);
+
+extern void dedupWriteStatus(FILE* out);
+extern int dedupCommand(const char* cmd, size_t len);
+
+
+#endif // _DEDUP_H_
@@ -19,10 +19,14 @@
 #include <libgen.h>
 #include <errno.h>
 
-#include "util.h"
 #include "options.h"
-#include "connection.h"
+#include "backend.h"
+#include "blockcache.h"
+#include "compress.h"
+#include "metacache.h"
 #include "operations.h"
+#include "times.h"
+#include "trace.h"
 
 
 // ---- Main function:
@@ -36,6 +40,24 @@ int main(int argc, char* argv[])
         .port = 0,
         .create_fs = 0,
         .name = DEFAULT_NAME,
+        .stats_socket = NULL,
+        .trace = 0,
+        .trace_log = NULL,
+        .trace_threshold = TRACE_DEFAULT_THRESHOLD_US,
+        .backend = NULL,
+        .inline_max = DEFAULT_INLINE_MAX,
+        .compress = NULL,
+        .snapshot = NULL,
+        .meta_cache = NULL,
+        .meta_cache_size = METACACHE_DEFAULT_SIZE_MB,
+        .meta_cache_ttl = METACACHE_DEFAULT_TTL_MS,
+        .block_cache = NULL,
+        .block_cache_size = BLOCKCACHE_DEFAULT_SIZE_MB,
+        .block_cache_ttl = BLOCKCACHE_DEFAULT_TTL_MS,
+        .cold_store = NULL,
+        .capacity = DEFAULT_CAPACITY_MB,
+        .atime = NULL,
+        .times_flush = TIMES_DEFAULT_FLUSH_MS,
     };
 
     // Parse command line options:
@@ -47,15 +69,54 @@ int main(int argc, char* argv[])
     // Set global settings:
     g_settings = &settings;
 
+    // Snapshots never change:
+    if (settings.snapshot && -1 == fuse_opt_add_arg(&args, "-oro"))
+    {
+        exit(1);
+    }
+
+    if (settings.inline_max > INLINE_MAX_LIMIT)
+    {
+        fprintf(stderr, "Error: inline_max is at most %d bytes.\n", INLINE_MAX_LIMIT);
+        exit(1);
+    }
+
+    g_defaultCodec = codecFromName(settings.compress ? settings.compress : DEFAULT_CODEC);
+    if (g_defaultCodec < 0)
+    {
+        fprintf(stderr, "Error: Unknown compression codec '%s'.\n", settings.compress);
+        exit(1);
+    }
+
+    if (timesConfigure(settings.atime ? settings.atime : DEFAULT_ATIME, settings.times_flush) < 0)
+    {
+        fprintf(stderr, "Error: Unknown atime mode '%s'.\n", settings.atime);
+        exit(1);
+    }
+
+    // A snapshot keeps the times it was taken with:
+    if (settings.snapshot)
+    {
+        timesConfigure("off", settings.times_flush);
+    }
+
+    // Select the storage backend:
+    g_backend = findBackend(settings.backend ? settings.backend : DEFAULT_BACKEND);
+    if (!g_backend)
+    {
+        fprintf(stderr, "Error: Unknown backend '%s'.\n", settings.backend);
+        exit(1);
+    }
+
     // Connect to Redis:
-    if (-1 == openRedisConnection(settings.host, settings.port))
+    if (0 > g_backend->open())
     {
         fprintf(stderr, "Error: Cannot connect to Redis server.\n");
         exit(1);
     }
 
     // Check whether a FS exists:
-    result = checkFileSystemExists();
+    result = g_backend->fs_exists();
     if (result == 0)
     {
         if (settings.create_fs)
@@ -65,7 +126,7 @@ int main(int argc, char* argv[])
                 "Creating new file system '%s'.\n", g_settings->name, g_settings->name
             );
 
-            result = createFileSystem();
+            result = g_backend->fs_create();
             if (result == 0)
             {
                 fprintf(stderr, "Error: Could not create file system.\n");
@@ -97,11 +158,20 @@ int main(int argc, char* argv[])
     result = fuse_main(args.argc, args.argv, &redifs_oper, NULL);
 
     // Close Redis connection:
-    closeRedisConnection();
+    g_backend->close();
 
     // Clean up FUSE stuff:
     fuse_opt_free_args(&args);
     if (settings.host) free(settings.host);
+    if (settings.stats_socket) free(settings.stats_socket);
+    if (settings.trace_log) free(settings.trace_log);
+    if (settings.backend) free(settings.backend);
+    if (settings.compress) free(settings.compress);
+    if (settings.snapshot) free(settings.snapshot);
+    if (settings.meta_cache) free(settings.meta_cache);
+    if (settings.block_cache) free(settings.block_cache);
+    if (settings.cold_store) free(settings.cold_store);
+    if (settings.atime) free(settings.atime);
 
     return result;
 }
@@ -0,0 +1,902 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Persistent cache of directory entries and node info, so that a remount
+ * does not start with a round trip per path component. The cache is a
+ * memory-mapped file of two hash tables with buckets of
+ * METACACHE_BUCKET_SLOTS slots: node info by node ID, and entries by
+ * directory and name. It survives the mount, and at the next mount only
+ * the nodes changed in between are dropped, as found in the change journal
+ * of the file system (see util.c). If the journal no longer reaches back
+ * that far, or the mount ended without closing the cache, it starts empty.
+ *
+ * While mounted, the journal is read again at most every ttl milliseconds,
+ * so changes by other mounts are seen after at most that long. Changes
+ * through this mount invalidate their nodes at once.
+ *
+ * Every info slot carries a stamp, taken from a counter in the header when
+ * the slot is filled or invalidated. An entry is valid while the stamp of
+ * its directory matches the one it was stored with, so invalidating a
+ * directory drops all its entries at once. Raising the lowest valid stamp
+ * drops everything.
+ *
+ * A value read from Redis is only stored if no invalidation of its node
+ * happened since metaCacheBegin() was called before the read; the epochs
+ * that tell are kept per lock stripe.
+ *
+ * Names found missing are stored as entries of node METACACHE_ABSENT. A
+ * lookup that misses may also fetch the bloom filter of the directory
+ * (see LUA_DIR_BLOOM_FUNCTIONS), which is kept in memory with the stamp
+ * of its directory and answers for every name it excludes. Changes
+ * through this mount add their names to it, so it stays in use until the
+ * journal reports them; any other invalidation drops it.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metacache.h"
+#include "options.h"
+#include "stats.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define METACACHE_MAGIC "RDFSMC01"
+#define METACACHE_HEADER_SIZE 4096
+#define METACACHE_BUCKET_SLOTS 8
+#define METACACHE_LOCKS 256
+#define METACACHE_BLOOMS 1024 // Multiple of METACACHE_LOCKS, so a slot stays in its stripe.
+
+
+/* ---- Types ---- */
+
+// Start of the cache file:
+struct metacache_header
+{
+    char magic[8];
+    uint32_t clean; // Set by a clean close, cleared while mounted.
+    uint32_t bucketSlots;
+    char identity[256]; // Redis server and file system name.
+    int64_t gen; // Journal generation the contents are valid for.
+    int64_t nextStamp;
+    int64_t minStamp; // Slots with an older stamp are invalid.
+    uint64_t infoBuckets;
+    uint64_t entryBuckets;
+};
+
+struct metacache_info
+{
+    int64_t key; // Node ID + 1, 0 for a free slot.
+    int64_t stamp;
+    int64_t hasInfo; // 0 for a slot that only holds the stamp of a directory.
+    int64_t info[NODE_INFO_COUNT];
+};
+
+// Bloom filter of a directory, with bits 0 for a directory too large to
+// have one:
+struct metacache_bloom
+{
+    node_id_t dirId;
+    int64_t stamp; // 0 for a free slot.
+    size_t bits;
+    size_t adds; // Names added through this mount.
+    unsigned char* data;
+};
+
+struct metacache_entry
+{
+    int64_t dirKey; // Directory node ID + 1, 0 for a free slot.
+    int64_t dirStamp;
+    int64_t nodeId;
+    uint32_t hash;
+    uint8_t len;
+    char name[METACACHE_NAME_MAX];
+};
+
+
+/* ---- Globals ---- */
+static int cacheFd = -1;
+static char* cacheMap = NULL;
+static size_t cacheSize = 0;
+static struct metacache_header* header = NULL;
+static struct metacache_info* infos = NULL;
+static struct metacache_entry* entries = NULL;
+static char* cachePath = NULL;
+
+static pthread_mutex_t infoLocks[METACACHE_LOCKS];
+static pthread_mutex_t entryLocks[METACACHE_LOCKS];
+static unsigned long epochs[METACACHE_LOCKS]; // Invalidations per info lock stripe.
+static unsigned int victim = 0; // Rotates the slot replaced in a full bucket.
+static struct metacache_bloom blooms[METACACHE_BLOOMS]; // Locked by the info lock stripe.
+
+static pthread_mutex_t pollMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long ttlNs = 0;
+static unsigned long long lastPollNs = 0;
+static unsigned long long polls = 0;
+static unsigned long long invalidations = 0;
+static unsigned long long clears = 0;
+static unsigned long long bloomsStored = 0;
+static int statsCache = -1;
+
+
+/* ================ Util functions ================ */
+
+static uint64_t hashNode(node_id_t nodeId)
+{
+    uint64_t x = (uint64_t)nodeId;
+
+    // splitmix64 finalizer:
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+
+static uint64_t hashEntry(node_id_t dirId, const char* name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL ^ hashNode(dirId); // FNV-1a.
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        h = (h ^ (unsigned char)name[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+static int64_t newStamp()
+{
+    return __atomic_fetch_add(&header->nextStamp, 1, __ATOMIC_RELAXED);
+}
+
+
+// Bit positions of a name in a bloom filter, as dirBloomBits() in Lua:
+static void bloomBits(const char* name, size_t len, size_t bits, uint64_t out[DIR_BLOOM_HASHES])
+{
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        h1 = (h1 * 31 + (unsigned char)name[i]) % 2147483647ULL;
+        h2 = (h2 * 131 + (unsigned char)name[i]) % 2147483629ULL;
+    }
+
+    for (i = 0; i < DIR_BLOOM_HASHES; ++i)
+    {
+        out[i] = (h1 + i * h2) % bits;
+    }
+}
+
+
+// Whether a bloom filter may contain a name. Bits are numbered from the
+// most significant bit of the first byte, as by SETBIT.
+static int bloomMayContain(const struct metacache_bloom* bloom, const char* name, size_t len)
+{
+    uint64_t pos[DIR_BLOOM_HASHES];
+    int i;
+
+    bloomBits(name, len, bloom->bits, pos);
+    for (i = 0; i < DIR_BLOOM_HASHES; ++i)
+    {
+        if (!(bloom->data[pos[i] / 8] & (0x80 >> (pos[i] % 8))))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// The bloom slot of a directory, with its stripe locked:
+static struct metacache_bloom* findBloom(node_id_t dirId, int64_t stamp)
+{
+    struct metacache_bloom* bloom = &blooms[hashNode(dirId) % METACACHE_BLOOMS];
+
+    return bloom->stamp == stamp && bloom->dirId == dirId ? bloom : NULL;
+}
+
+
+static void freeBloom(struct metacache_bloom* bloom)
+{
+    free(bloom->data);
+    memset(bloom, 0, sizeof(struct metacache_bloom));
+}
+
+
+// Find the slot of a node in its bucket, with the bucket locked:
+static struct metacache_info* findInfo(struct metacache_info* bucket, node_id_t nodeId)
+{
+    int i;
+
+    for (i = 0; i < METACACHE_BUCKET_SLOTS; ++i)
+    {
+        if (bucket[i].key == nodeId + 1 && bucket[i].stamp >= header->minStamp)
+        {
+            return &bucket[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static void* pickVictim(void* bucket, size_t slotSize, int64_t (*keyOf)(void* slot))
+{
+    int i;
+
+    for (i = 0; i < METACACHE_BUCKET_SLOTS; ++i)
+    {
+        if (keyOf((char*)bucket + i * slotSize) == 0)
+        {
+            return (char*)bucket + i * slotSize;
+        }
+    }
+
+    i = __atomic_fetch_add(&victim, 1, __ATOMIC_RELAXED) % METACACHE_BUCKET_SLOTS;
+    return (char*)bucket + i * slotSize;
+}
+
+
+static int64_t infoKey(void* slot)
+{
+    struct metacache_info* info = slot;
+    return info->stamp >= header->minStamp ? info->key : 0;
+}
+
+
+static int64_t entryKey(void* slot)
+{
+    return ((struct metacache_entry*)slot)->dirKey;
+}
+
+
+// Find or add the slot of a node and return its stamp:
+static int64_t claimInfo(node_id_t nodeId, struct metacache_info** slot)
+{
+    uint64_t h = hashNode(nodeId);
+    struct metacache_info* bucket = infos + (h % header->infoBuckets) * METACACHE_BUCKET_SLOTS;
+    struct metacache_info* info;
+
+    info = findInfo(bucket, nodeId);
+    if (!info)
+    {
+        info = pickVictim(bucket, sizeof(struct metacache_info), infoKey);
+        info->key = nodeId + 1;
+        info->stamp = newStamp();
+        info->hasInfo = 0;
+    }
+    *slot = info;
+
+    return info->stamp;
+}
+
+
+// Give a node a new stamp. The bloom filter of a directory is kept for a
+// change through this mount, with the name it linked added, if any.
+static void changeNode(node_id_t nodeId, int keepBloom, const char* name)
+{
+    uint64_t h = hashNode(nodeId);
+    struct metacache_info* bucket = infos + (h % header->infoBuckets) * METACACHE_BUCKET_SLOTS;
+    struct metacache_info* info;
+    struct metacache_bloom* bloom = NULL;
+    uint64_t pos[DIR_BLOOM_HASHES];
+    int stripe = h % METACACHE_LOCKS;
+    int i;
+
+    pthread_mutex_lock(&infoLocks[stripe]);
+    info = findInfo(bucket, nodeId);
+    if (info)
+    {
+        bloom = keepBloom ? findBloom(nodeId, info->stamp) : NULL;
+        info->stamp = newStamp();
+        info->hasInfo = 0;
+    }
+    if (bloom && bloom->bits > 0 && name)
+    {
+        bloomBits(name, strlen(name), bloom->bits, pos);
+        for (i = 0; i < DIR_BLOOM_HASHES; ++i)
+        {
+            bloom->data[pos[i] / 8] |= 0x80 >> (pos[i] % 8);
+        }
+
+        // Past the names the filter was sized for, lookups fetch a new one:
+        if (++bloom->adds * 20 > bloom->bits)
+        {
+            bloom = NULL;
+        }
+    }
+    if (bloom)
+    {
+        bloom->stamp = info->stamp;
+    }
+    __atomic_add_fetch(&epochs[stripe], 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    __atomic_add_fetch(&invalidations, 1, __ATOMIC_RELAXED);
+}
+
+
+static void invalidateNode(void* ctx, node_id_t nodeId)
+{
+    changeNode(nodeId, 0, NULL);
+}
+
+
+// Stores in progress see either the new lowest stamp or a new epoch:
+static void clearAll()
+{
+    int i;
+
+    for (i = 0; i < METACACHE_LOCKS; ++i)
+    {
+        pthread_mutex_lock(&infoLocks[i]);
+    }
+    header->minStamp = newStamp() + 1;
+    for (i = METACACHE_LOCKS - 1; i >= 0; --i)
+    {
+        __atomic_add_fetch(&epochs[i], 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&infoLocks[i]);
+    }
+    __atomic_add_fetch(&clears, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Drop the nodes changed since the generation of the cache. Called with
+ * pollMutex locked.
+*/
+static int applyJournal()
+{
+    long long gen;
+    int result;
+
+    result = readJournal(header->gen, &gen, invalidateNode, NULL);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (result == 0)
+    {
+        clearAll();
+    }
+    header->gen = gen;
+    ++polls;
+
+    return 0;
+}
+
+
+static void pollIfDue()
+{
+    unsigned long long now = statsNow();
+
+    if (now - __atomic_load_n(&lastPollNs, __ATOMIC_RELAXED) < ttlNs || 0 != pthread_mutex_trylock(&pollMutex))
+    {
+        return;
+    }
+
+    // A failed read is retried by the next lookup:
+    if (now - lastPollNs >= ttlNs && 0 == applyJournal())
+    {
+        __atomic_store_n(&lastPollNs, now, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pollMutex);
+}
+
+
+static void initFile(const char* identity, uint64_t buckets)
+{
+    memset(header, 0, sizeof(struct metacache_header));
+    memcpy(header->magic, METACACHE_MAGIC, sizeof(header->magic));
+    header->bucketSlots = METACACHE_BUCKET_SLOTS;
+    snprintf(header->identity, sizeof(header->identity), "%s", identity);
+    header->gen = -1; // No generation matches, so the journal is never trusted.
+    header->nextStamp = 1;
+    header->minStamp = 1;
+    header->infoBuckets = buckets;
+    header->entryBuckets = buckets;
+}
+
+
+/* ================ Metadata cache functions ================ */
+
+/*
+ * Map the cache file at path, creating it if needed, and bring it up to
+ * date with the change journal.
+*/
+int metaCacheOpen(const char* path, unsigned long sizeMb, unsigned long ttlMs)
+{
+    char identity[256];
+    struct stat st;
+    uint64_t buckets;
+    int reset;
+    int result;
+    int i;
+
+    cacheSize = (size_t)(sizeMb ? sizeMb : METACACHE_DEFAULT_SIZE_MB) * 1024 * 1024;
+    buckets = (cacheSize - METACACHE_HEADER_SIZE) / 2
+        / (METACACHE_BUCKET_SLOTS * (sizeof(struct metacache_info) > sizeof(struct metacache_entry)
+                                     ? sizeof(struct metacache_info) : sizeof(struct metacache_entry)));
+    if (buckets == 0)
+    {
+        fprintf(stderr, "Error: Metadata cache too small.\n");
+        return -EINVAL;
+    }
+
+    cacheFd = open(path, O_RDWR | O_CREAT, 0600);
+    if (cacheFd < 0)
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot open metadata cache %s: %s\n", path, strerror(errno));
+        return result;
+    }
+    else if (0 != flock(cacheFd, LOCK_EX | LOCK_NB))
+    {
+        fprintf(stderr, "Error: Metadata cache %s is in use by another mount.\n", path);
+        close(cacheFd);
+        cacheFd = -1;
+        return -EBUSY;
+    }
+
+    // A cache of another size starts over:
+    reset = 0 != fstat(cacheFd, &st) || st.st_size != cacheSize;
+    if (reset && (0 != ftruncate(cacheFd, 0) || 0 != ftruncate(cacheFd, cacheSize)))
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot size metadata cache %s: %s\n", path, strerror(errno));
+        close(cacheFd);
+        cacheFd = -1;
+        return result;
+    }
+
+    cacheMap = mmap(NULL, cacheSize, PROT_READ | PROT_WRITE, MAP_SHARED, cacheFd, 0);
+    if (cacheMap == MAP_FAILED)
+    {
+        result = -errno;
+        fprintf(stderr, "Error: Cannot map metadata cache %s: %s\n", path, strerror(errno));
+        cacheMap = NULL;
+        close(cacheFd);
+        cacheFd = -1;
+        return result;
+    }
+
+    header = (struct metacache_header*)cacheMap;
+    infos = (struct metacache_info*)(cacheMap + METACACHE_HEADER_SIZE);
+    entries = (struct metacache_entry*)(infos + buckets * METACACHE_BUCKET_SLOTS);
+
+    // Slots written by a mount that did not close the cache may be torn:
+    snprintf(identity, sizeof(identity), "%s:%d/%s", g_settings->host ? g_settings->host : "",
+             (int)g_settings->port, g_settings->name);
+    if (reset || 0 != memcmp(header->magic, METACACHE_MAGIC, sizeof(header->magic)) || !header->clean
+        || header->bucketSlots != METACACHE_BUCKET_SLOTS || header->infoBuckets != buckets
+        || 0 != strncmp(header->identity, identity, sizeof(header->identity)))
+    {
+        if (!reset)
+        {
+            memset(cacheMap, 0, cacheSize);
+        }
+        initFile(identity, buckets);
+    }
+
+    for (i = 0; i < METACACHE_LOCKS; ++i)
+    {
+        pthread_mutex_init(&infoLocks[i], NULL);
+        pthread_mutex_init(&entryLocks[i], NULL);
+    }
+
+    result = applyJournal();
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Cannot read the change journal.\n");
+        metaCacheClose();
+        return result;
+    }
+
+    header->clean = 0;
+    msync(cacheMap, METACACHE_HEADER_SIZE, MS_SYNC);
+
+    ttlNs = (unsigned long long)ttlMs * 1000000ULL;
+    lastPollNs = statsNow();
+    cachePath = strdup(path);
+    statsCache = statsRegisterCache("metadata");
+
+    return 0;
+}
+
+
+/*
+ * Write the cache back and mark it clean for the next mount.
+*/
+void metaCacheClose()
+{
+    int i;
+
+    if (!cacheMap)
+    {
+        return;
+    }
+
+    msync(cacheMap, cacheSize, MS_SYNC);
+    header->clean = 1;
+    msync(cacheMap, METACACHE_HEADER_SIZE, MS_SYNC);
+    munmap(cacheMap, cacheSize);
+    close(cacheFd);
+
+    for (i = 0; i < METACACHE_BLOOMS; ++i)
+    {
+        freeBloom(&blooms[i]);
+    }
+
+    cacheMap = NULL;
+    header = NULL;
+    cacheFd = -1;
+    free(cachePath);
+    cachePath = NULL;
+}
+
+
+/*
+ * Start a read of node or directory nodeId from Redis. Returns the token
+ * to pass to the store function afterwards.
+*/
+unsigned long metaCacheBegin(node_id_t nodeId)
+{
+    if (!cacheMap)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&epochs[hashNode(nodeId) % METACACHE_LOCKS], __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Look up an entry of a directory. Returns 1 and sets nodeId on a hit,
+ * which is METACACHE_ABSENT for a name known not to exist.
+*/
+int metaCacheLookup(node_id_t dirId, const char* name, size_t len, node_id_t* nodeId)
+{
+    uint64_t dirHash = hashNode(dirId);
+    uint64_t h;
+    struct metacache_info* info;
+    struct metacache_entry* bucket;
+    struct metacache_bloom* bloom;
+    int64_t stamp = 0;
+    int excluded = 0;
+    int stripe;
+    int hit = 0;
+    int i;
+
+    if (!cacheMap)
+    {
+        return 0;
+    }
+
+    pollIfDue();
+
+    stripe = dirHash % METACACHE_LOCKS;
+    pthread_mutex_lock(&infoLocks[stripe]);
+    info = findInfo(infos + (dirHash % header->infoBuckets) * METACACHE_BUCKET_SLOTS, dirId);
+    if (info)
+    {
+        stamp = info->stamp;
+        bloom = findBloom(dirId, stamp);
+        excluded = bloom && bloom->bits > 0 && !bloomMayContain(bloom, name, len);
+    }
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    if (excluded)
+    {
+        statsIncrCounter(STAT_COUNTER_BLOOM_REJECTS);
+        *nodeId = METACACHE_ABSENT;
+        hit = 1;
+    }
+    else if (stamp > 0 && len <= METACACHE_NAME_MAX)
+    {
+        h = hashEntry(dirId, name, len);
+        bucket = entries + (h % header->entryBuckets) * METACACHE_BUCKET_SLOTS;
+        stripe = h % METACACHE_LOCKS;
+        pthread_mutex_lock(&entryLocks[stripe]);
+        for (i = 0; i < METACACHE_BUCKET_SLOTS && !hit; ++i)
+        {
+            if (bucket[i].dirKey == dirId + 1 && bucket[i].dirStamp == stamp && bucket[i].hash == (uint32_t)h
+                && bucket[i].len == len && 0 == memcmp(bucket[i].name, name, len))
+            {
+                *nodeId = bucket[i].nodeId;
+                hit = 1;
+            }
+        }
+        pthread_mutex_unlock(&entryLocks[stripe]);
+    }
+
+    statsRecordCacheLookup(statsCache, hit);
+
+    return hit;
+}
+
+
+void metaCacheStoreEntry(unsigned long token, node_id_t dirId, const char* name, size_t len, node_id_t nodeId)
+{
+    uint64_t dirHash = hashNode(dirId);
+    uint64_t h;
+    struct metacache_info* info;
+    struct metacache_entry* bucket;
+    struct metacache_entry* entry = NULL;
+    int64_t stamp;
+    int stripe = dirHash % METACACHE_LOCKS;
+    int i;
+
+    if (!cacheMap || len > METACACHE_NAME_MAX)
+    {
+        return;
+    }
+
+    // The stamp is only used if the directory was not invalidated since the read:
+    pthread_mutex_lock(&infoLocks[stripe]);
+    if (token != __atomic_load_n(&epochs[stripe], __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&infoLocks[stripe]);
+        return;
+    }
+    stamp = claimInfo(dirId, &info);
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    h = hashEntry(dirId, name, len);
+    bucket = entries + (h % header->entryBuckets) * METACACHE_BUCKET_SLOTS;
+    stripe = h % METACACHE_LOCKS;
+    pthread_mutex_lock(&entryLocks[stripe]);
+    for (i = 0; i < METACACHE_BUCKET_SLOTS && !entry; ++i)
+    {
+        if (bucket[i].dirKey == dirId + 1 && bucket[i].hash == (uint32_t)h && bucket[i].len == len
+            && 0 == memcmp(bucket[i].name, name, len))
+        {
+            entry = &bucket[i];
+        }
+    }
+    if (!entry)
+    {
+        entry = pickVictim(bucket, sizeof(struct metacache_entry), entryKey);
+    }
+    entry->dirKey = dirId + 1;
+    entry->dirStamp = stamp;
+    entry->nodeId = nodeId;
+    entry->hash = (uint32_t)h;
+    entry->len = len;
+    memcpy(entry->name, name, len);
+    pthread_mutex_unlock(&entryLocks[stripe]);
+}
+
+
+/*
+ * Whether a lookup that misses in directory dirId should fetch its bloom
+ * filter.
+*/
+int metaCacheWantsBloom(node_id_t dirId)
+{
+    uint64_t dirHash = hashNode(dirId);
+    struct metacache_info* info;
+    int stripe = dirHash % METACACHE_LOCKS;
+    int wants = 0;
+
+    if (!cacheMap)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&infoLocks[stripe]);
+    info = findInfo(infos + (dirHash % header->infoBuckets) * METACACHE_BUCKET_SLOTS, dirId);
+    wants = !info || !findBloom(dirId, info->stamp);
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    return wants;
+}
+
+
+/*
+ * Store the bloom filter of a directory, of len bytes; an empty one marks
+ * a directory too large to have one.
+*/
+void metaCacheStoreBloom(unsigned long token, node_id_t dirId, const char* data, size_t len)
+{
+    uint64_t dirHash = hashNode(dirId);
+    struct metacache_info* info;
+    struct metacache_bloom* bloom = &blooms[dirHash % METACACHE_BLOOMS];
+    unsigned char* copy = NULL;
+    int stripe = dirHash % METACACHE_LOCKS;
+
+    if (!cacheMap || (len > 0 && !(copy = malloc(len))))
+    {
+        return;
+    }
+    if (copy)
+    {
+        memcpy(copy, data, len);
+    }
+
+    pthread_mutex_lock(&infoLocks[stripe]);
+    if (token == __atomic_load_n(&epochs[stripe], __ATOMIC_ACQUIRE))
+    {
+        freeBloom(bloom);
+        bloom->dirId = dirId;
+        bloom->stamp = claimInfo(dirId, &info);
+        bloom->bits = len * 8;
+        bloom->data = copy;
+        copy = NULL;
+        __atomic_add_fetch(&bloomsStored, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    free(copy);
+}
+
+
+/*
+ * Get the info of a node. Returns 1 on a hit.
+*/
+int metaCacheGetInfo(node_id_t nodeId, long long info[NODE_INFO_COUNT])
+{
+    uint64_t h = hashNode(nodeId);
+    struct metacache_info* slot;
+    int stripe = h % METACACHE_LOCKS;
+    int hit = 0;
+
+    if (!cacheMap)
+    {
+        return 0;
+    }
+
+    pollIfDue();
+
+    pthread_mutex_lock(&infoLocks[stripe]);
+    slot = findInfo(infos + (h % header->infoBuckets) * METACACHE_BUCKET_SLOTS, nodeId);
+    if (slot && slot->hasInfo)
+    {
+        memcpy(info, slot->info, sizeof(slot->info));
+        hit = 1;
+    }
+    pthread_mutex_unlock(&infoLocks[stripe]);
+
+    statsRecordCacheLookup(statsCache, hit);
+
+    return hit;
+}
+
+
+void metaCacheStoreInfo(unsigned long token, node_id_t nodeId, const long long info[NODE_INFO_COUNT])
+{
+    uint64_t h = hashNode(nodeId);
+    struct metacache_info* slot;
+    int stripe = h % METACACHE_LOCKS;
+
+    if (!cacheMap)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&infoLocks[stripe]);
+    if (token == __atomic_load_n(&epochs[stripe], __ATOMIC_ACQUIRE))
+    {
+        claimInfo(nodeId, &slot);
+        memcpy(slot->info, info, sizeof(slot->info));
+        slot->hasInfo = 1;
+    }
+    pthread_mutex_unlock(&infoLocks[stripe]);
+}
+
+
+/*
+ * Drop the info and the entries of a node changed through this mount.
+*/
+void metaCacheInvalidate(node_id_t nodeId)
+{
+    if (cacheMap)
+    {
+        invalidateNode(NULL, nodeId);
+    }
+}
+
+
+/*
+ * Drop the entries of a directory whose entries changed through this
+ * mount, keeping its bloom filter. name is the name linked, if any.
+*/
+void metaCacheChangeDir(node_id_t dirId, const char* name)
+{
+    if (cacheMap)
+    {
+        changeNode(dirId, 1, name);
+    }
+}
+
+
+/* ================ Control file ================ */
+
+void metaCacheWriteStatus(FILE* out)
+{
+    fprintf(out, "enabled %d\n", cacheMap ? 1 : 0);
+    if (!cacheMap)
+    {
+        return;
+    }
+
+    fprintf(out, "path %s\n", cachePath);
+    fprintf(out, "size_bytes %zu\n", cacheSize);
+    fprintf(out, "slots %llu\n", (unsigned long long)header->infoBuckets * METACACHE_BUCKET_SLOTS);
+    fprintf(out, "ttl_ms %llu\n", ttlNs / 1000000ULL);
+    pthread_mutex_lock(&pollMutex);
+    fprintf(out, "generation %lld\n", (long long)header->gen);
+    fprintf(out, "polls %llu\n", polls);
+    pthread_mutex_unlock(&pollMutex);
+    fprintf(out, "invalidations %llu\n", __atomic_load_n(&invalidations, __ATOMIC_RELAXED));
+    fprintf(out, "clears %llu\n", __atomic_load_n(&clears, __ATOMIC_RELAXED));
+    fprintf(out, "blooms_stored %llu\n", __atomic_load_n(&bloomsStored, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * "clear" drops everything; "sync" reads the change journal now.
+*/
+int metaCacheCommand(const char* cmd, size_t len)
+{
+    int result = 0;
+
+    if (len > 0 && cmd[len - 1] == '\n')
+    {
+        --len;
+    }
+
+    if (!cacheMap)
+    {
+        return -ENOENT;
+    }
+    else if (len == 5 && 0 == strncmp(cmd, "clear", 5))
+    {
+        clearAll();
+    }
+    else if (len == 4 && 0 == strncmp(cmd, "sync", 4))
+    {
+        pthread_mutex_lock(&pollMutex);
+        result = applyJournal();
+        if (result == 0)
+        {
+            lastPollNs = statsNow();
+        }
+        pthread_mutex_unlock(&pollMutex);
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return result;
+}
@@ -0,0 +1,51 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _METACACHE_H_
+#define _METACACHE_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "redifs_types.h"
+#include "backend.h"
+
+
+/* ---- Defines ---- */
+#define METACACHE_DEFAULT_SIZE_MB 64
+#define METACACHE_DEFAULT_TTL_MS 1000 // Longest time changes by other mounts go unseen.
+#define METACACHE_NAME_MAX 63 // Longer entry names are not cached.
+#define METACACHE_ABSENT ((node_id_t)-1) // Node ID of a name known not to exist.
+
+
+/* ================ Metadata cache functions ================ */
+
+extern int metaCacheOpen(const char* path, unsigned long sizeMb, unsigned long ttlMs);
+extern void metaCacheClose();
+
+extern unsigned long metaCacheBegin(node_id_t nodeId);
+extern int metaCacheLookup(node_id_t dirId, const char* name, size_t len, node_id_t* nodeId);
+extern void metaCacheStoreEntry(unsigned long token, node_id_t dirId, const char* name, size_t len,
+                                node_id_t nodeId);
+extern int metaCacheWantsBloom(node_id_t dirId);
+extern void metaCacheStoreBloom(unsigned long token, node_id_t dirId, const char* data, size_t len);
+extern int metaCacheGetInfo(node_id_t nodeId, long long info[NODE_INFO_COUNT]);
+extern void metaCacheStoreInfo(unsigned long token, node_id_t nodeId, const long long info[NODE_INFO_COUNT]);
+extern void metaCacheInvalidate(node_id_t nodeId);
+extern void metaCacheChangeDir(node_id_t dirId, const char* name);
+
+extern void metaCacheWriteStatus(FILE* out);
+extern int metaCacheCommand(const char* cmd, size_t len);
+
+
+#endif // _METACACHE_H_
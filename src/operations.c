@@ -20,74 +20,166 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
-#include <libgen.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 
 #include "operations.h"
 #include "options.h"
-#include "util.h"
-#include "connection.h"
+#include "arena.h"
+#include "backend.h"
+#include "compress.h"
+#include "data.h"
+#include "path.h"
+#include "control.h"
+#include "reclaim.h"
+#include "stats.h"
+#include "times.h"
+#include "trace.h"
 
 
-/* ---- Defines ---- */
-#define KEY_NODE_ID_CTR "node_id_ctr"
+/* ---- Macros ---- */
+#define CLEAR_STRUCT(ptr, type) memset(ptr, 0, sizeof(type));
+
+// rename(2) flags, from <linux/fs.h>:
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+
+/* ================ Util functions ================ */
 
-enum
+// Fill the node info of a new node and link it into its parent directory:
+static int createNode(const char* path, mode_t mode)
 {
-    NODE_INFO_MODE = 0,
-    NODE_INFO_UID,
-    NODE_INFO_GID,
-    NODE_INFO_ACCESS_TIME_SEC,
-    NODE_INFO_ACCESS_TIME_NSEC,
-    NODE_INFO_MOD_TIME_SEC,
-    NODE_INFO_MOD_TIME_NSEC,
-    NODE_INFO_COUNT
-};
+    long long parentInfo[NODE_INFO_COUNT];
+    long long info[NODE_INFO_COUNT];
+    struct fuse_context* context;
+    struct timespec now;
+    node_id_t parentNodeId;
+    node_id_t nodeId;
+    const char* name;
+    long long flags;
+    int codec;
+    int result;
 
+    // Determine parent dir node ID before creating anything:
+    parentNodeId = resolveParent(path, &name);
+    if (parentNodeId < 0)
+    {
+        return parentNodeId;
+    }
 
-/* ---- Macros ---- */
-#define CLEAR_STRUCT(ptr, type) memset(ptr, 0, sizeof(type));
+    result = g_backend->get_info(parentNodeId, parentInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (!S_ISDIR(parentInfo[NODE_INFO_MODE]))
+    {
+        return -ENOTDIR;
+    }
+
+    // Directories pass on a compression codec set for their subtree; files
+    // fix the codec for their chunks at creation:
+    flags = 0;
+    codec = NODE_CODEC(parentInfo[NODE_INFO_FLAGS]);
+    if (S_ISREG(mode))
+    {
+        if (codec == CODEC_UNSET)
+        {
+            codec = __atomic_load_n(&g_defaultCodec, __ATOMIC_RELAXED);
+        }
+        flags = WITH_NODE_CODEC(flags, codec);
+        if (g_settings->inline_max > 0)
+        {
+            flags |= NODE_FLAG_INLINE;
+        }
+        if (g_settings->dedup)
+        {
+            flags |= NODE_FLAG_DEDUP;
+        }
+    }
+    else if (codec != CODEC_UNSET)
+    {
+        flags = WITH_NODE_CODEC(flags, codec);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    context = fuse_get_context();
+
+    info[NODE_INFO_MODE] = mode;
+    info[NODE_INFO_UID] = context ? context->uid : 0;
+    info[NODE_INFO_GID] = context ? context->gid : 0;
+    info[NODE_INFO_ACCESS_TIME_SEC] = now.tv_sec;
+    info[NODE_INFO_ACCESS_TIME_NSEC] = now.tv_nsec;
+    info[NODE_INFO_MOD_TIME_SEC] = now.tv_sec;
+    info[NODE_INFO_MOD_TIME_NSEC] = now.tv_nsec;
+    info[NODE_INFO_SIZE] = 0;
+    info[NODE_INFO_FLAGS] = flags;
+
+    // A name another create took since the lookup fails with -EEXIST:
+    nodeId = g_backend->create_node(parentNodeId, name, info);
+
+    return nodeId < 0 ? nodeId : 0;
+}
+
+
+// Node an operation applies to; open files skip the path lookup:
+static node_id_t operationNode(const char* path, struct fuse_file_info* fileInfo)
+{
+    if (fileInfo && !controlIsPath(path))
+    {
+        return (node_id_t)fileInfo->fh;
+    }
+
+    return resolvePath(path);
+}
 
 
 /* ================ FUSE operations ================ */
 
 /* ---- getattr ---- */
-int redifs_getattr(const char* path, struct stat* stbuf)
+int redifs_getattr(const char* path, struct stat* stbuf, struct fuse_file_info* fileInfo)
 {
-    char* lpath;
-    char* dirName;
+    long long info[NODE_INFO_COUNT];
     node_id_t nodeId;
-    long long mode;
+    int result;
 
-    lpath = strdup(path);
-    dirName = strdup(basename(lpath));
-    free(lpath);
+    if (controlIsPath(path))
+    {
+        return controlGetattr(path, stbuf);
+    }
 
     CLEAR_STRUCT(stbuf, struct stat);
 
-    nodeId = retrievePathNodeId(path);
+    nodeId = operationNode(path, fileInfo);
     if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
     }
 
-    mode = retrieveNodeInfo(nodeId, NODE_INFO_MODE);
-    if (mode < 0)
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
     {
-        return mode;
+        return result;
     }
+    timesApply(nodeId, info);
 
-    if (mode & S_IFDIR)
-    {
-        stbuf->st_mode = mode;
-        stbuf->st_nlink = 2;
-    }
-    else
-    {
-        stbuf->st_mode = mode;
-        stbuf->st_nlink = 1;
-        stbuf->st_size = strlen("blablabla");
-    }
+    stbuf->st_mode = info[NODE_INFO_MODE];
+    stbuf->st_nlink = S_ISDIR(info[NODE_INFO_MODE]) ? 2 : 1;
+    stbuf->st_uid = info[NODE_INFO_UID];
+    stbuf->st_gid = info[NODE_INFO_GID];
+    stbuf->st_atim.tv_sec = info[NODE_INFO_ACCESS_TIME_SEC];
+    stbuf->st_atim.tv_nsec = info[NODE_INFO_ACCESS_TIME_NSEC];
+    stbuf->st_mtim.tv_sec = info[NODE_INFO_MOD_TIME_SEC];
+    stbuf->st_mtim.tv_nsec = info[NODE_INFO_MOD_TIME_NSEC];
+    stbuf->st_ctim = stbuf->st_mtim;
+    stbuf->st_size = info[NODE_INFO_SIZE];
 
     return 0;
 }
@@ -96,345 +188,638 @@ int redifs_getattr(const char* path, struct stat* stbuf)
 // ---- mknod:
 int redifs_mknod(const char* path, mode_t mode, dev_t dev)
 {
-    node_id_t nodeId;
-    node_id_t parentNodeId;
-    long long args[NODE_INFO_COUNT];
-    char* newFileName;
-    char key[1024];
-    char* lpath;
-    int redisResult;
+    return createNode(path, mode);
+}
+
+
+/* ---- mkdir ---- */
+int redifs_mkdir(const char* path, mode_t mode)
+{
+    return createNode(path, mode | S_IFDIR);
+}
+
+
+/* ---- rename ---- */
+
+// Whether path lies inside the directory dir:
+static int isBelow(const char* path, const char* dir)
+{
+    size_t len = strlen(dir);
+    return 0 == strncmp(path, dir, len) && path[len] == '/';
+}
+
 
-    // Create a new node ID:
-    nodeId = createUniqueNodeId();
-    if (nodeId == 0)
+int redifs_rename(const char* from, const char* to, unsigned int flags)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t srcDirId;
+    node_id_t dstDirId;
+    node_id_t replaced;
+    const char* srcName;
+    const char* dstName;
+    int backendFlags;
+    int result;
+
+    if (controlIsPath(from) || controlIsPath(to))
     {
-        fprintf(stderr, "Error: Run out of node IDs.\n");
-        return -ENOSPC;
+        return -EPERM;
     }
-    else if (nodeId < 0)
+
+    if (flags == RENAME_NOREPLACE)
     {
-        return nodeId;
+        backendFlags = DIR_RENAME_NOREPLACE;
+    }
+    else if (flags == RENAME_EXCHANGE)
+    {
+        backendFlags = DIR_RENAME_EXCHANGE;
+    }
+    else if (flags == 0)
+    {
+        backendFlags = 0;
+    }
+    else
+    {
+        return -EINVAL;
     }
 
-    // Create node info:
-    snprintf(key, 1024, "%s::info:%lld", g_settings->name, nodeId);
-    args[NODE_INFO_MODE] = mode;
-    args[NODE_INFO_UID] = 0; // TODO: UID.
-    args[NODE_INFO_GID] = 0; // TODO: GID.
-    args[NODE_INFO_ACCESS_TIME_SEC] = 1; // TODO. 
-    args[NODE_INFO_ACCESS_TIME_NSEC] = 1; // TODO. 
-    args[NODE_INFO_MOD_TIME_SEC] = 1; // TODO. 
-    args[NODE_INFO_MOD_TIME_NSEC] = 1; // TODO. 
-    redisResult = redisCommand_RPUSH_INT(key, args, NODE_INFO_COUNT, NULL);
-    if (!redisResult)
+    // A directory cannot move into itself:
+    if (isBelow(to, from) || (flags == RENAME_EXCHANGE && isBelow(from, to)))
     {
-        return -EIO;
+        return -EINVAL;
     }
 
-    // Determine name of new file:
-    lpath = strdup(path);
-    newFileName = strdup(basename(lpath));
-    free(lpath);
+    srcDirId = resolveParent(from, &srcName);
+    if (srcDirId < 0)
+    {
+        return srcDirId;
+    }
 
-    // Determine parent dir node ID:
-    lpath = strdup(path);
-    parentNodeId = retrievePathNodeId(dirname(lpath));
-    free(lpath);
-    if (parentNodeId < 0)
+    dstDirId = resolveParent(to, &dstName);
+    if (dstDirId < 0)
     {
-        return -ENOENT;
+        return dstDirId;
     }
 
-    // Execute Redis command:
-    snprintf(key, 1024, "%s::node:%lld", g_settings->name, parentNodeId);
-    redisResult = redisCommand_HSET_INT(key, newFileName, nodeId, NULL);
+    if (srcName[0] == '\0' || dstName[0] == '\0')
+    {
+        return -EBUSY; // The root directory.
+    }
 
-    free(newFileName);
+    result = g_backend->get_info(dstDirId, info);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (!S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        return -ENOTDIR;
+    }
 
-    if (!redisResult)
+    // Only the directory entries change, whatever the size of the moved node:
+    replaced = g_backend->dir_rename(srcDirId, srcName, dstDirId, dstName, backendFlags);
+    if (replaced < 0)
     {
-        return -EIO;
+        return replaced;
+    }
+    else if (replaced > 0)
+    {
+        reclaimWake();
     }
 
     return 0;
 }
 
 
-/* ---- mkdir ---- */
-int redifs_mkdir(const char* path, mode_t mode)
+/* ---- unlink / rmdir ---- */
+
+// Detach the entry; the node is freed in the background, see reclaim.c:
+static int removeEntry(const char* path, int flags)
 {
-    node_id_t nodeId;
     node_id_t parentNodeId;
-    long long args[NODE_INFO_COUNT];
-    char* newDirName;
-    char key[1024];
-    char* lpath;
-    int redisResult;
+    node_id_t nodeId;
+    const char* name;
 
-    // Create a new node ID:
-    nodeId = createUniqueNodeId();
-    if (nodeId == 0)
+    if (controlIsPath(path))
     {
-        fprintf(stderr, "Error: Run out of node IDs.\n");
-        return -ENOSPC;
+        return -EPERM;
     }
-    else if (nodeId < 0)
+
+    parentNodeId = resolveParent(path, &name);
+    if (parentNodeId < 0)
     {
-        return nodeId;
+        return parentNodeId;
     }
-
-    // Create node info:
-    snprintf(key, 1024, "%s::info:%lld", g_settings->name, nodeId);
-    args[NODE_INFO_MODE] = mode | S_IFDIR;
-    args[NODE_INFO_UID] = 0; // TODO: UID.
-    args[NODE_INFO_GID] = 0; // TODO: GID.
-    args[NODE_INFO_ACCESS_TIME_SEC] = 1; // TODO. 
-    args[NODE_INFO_ACCESS_TIME_NSEC] = 1; // TODO. 
-    args[NODE_INFO_MOD_TIME_SEC] = 1; // TODO. 
-    args[NODE_INFO_MOD_TIME_NSEC] = 1; // TODO. 
-    redisResult = redisCommand_RPUSH_INT(key, args, NODE_INFO_COUNT, NULL);
-    if (!redisResult)
+    else if (name[0] == '\0')
     {
-        return -EIO;
+        return -EBUSY; // The root directory.
     }
 
-    // Determine name of new directory:
-    lpath = strdup(path);
-    newDirName = strdup(basename(lpath));
-    free(lpath);
-
-    // Determine parent dir node ID:
-    lpath = strdup(path);
-    parentNodeId = retrievePathNodeId(dirname(lpath));
-    free(lpath);
-    if (parentNodeId < 0)
+    nodeId = g_backend->dir_unlink(parentNodeId, name, flags);
+    if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
     }
 
-    // Execute Redis command:
-    snprintf(key, 1024, "%s::node:%lld", g_settings->name, parentNodeId);
-    redisResult = redisCommand_HSET_INT(key, newDirName, nodeId, NULL);
+    reclaimWake();
 
-    free(newDirName);
+    return 0;
+}
 
-    if (!redisResult)
-    {
-        return -EIO;
-    }
 
-    return 0;
+int redifs_unlink(const char* path)
+{
+    return removeEntry(path, 0);
+}
+
+
+int redifs_rmdir(const char* path)
+{
+    return removeEntry(path, DIR_UNLINK_DIR);
 }
 
 
 /* ---- readdir ---- */
+
+struct readdir_context
+{
+    void* buf;
+    fuse_fill_dir_t filler;
+};
+
+static int readdirEntry(void* ctx, const char* name)
+{
+    struct readdir_context* context = (struct readdir_context*)ctx;
+    return context->filler(context->buf, name, NULL, 0, 0);
+}
+
+
 int redifs_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
-                          off_t offset, struct fuse_file_info* fileInfo)
+                   off_t offset, struct fuse_file_info* fileInfo, enum fuse_readdir_flags flags)
 {
-    char key[1024];
+    struct readdir_context context = { buf, filler };
     node_id_t nodeId;
-    int result;
-    int handle;
-    int i;
 
     // TODO: Make Redis key safe (remove space and newline chars).
 
+    if (controlIsPath(path))
+    {
+        return controlReaddir(path, buf, filler);
+    }
+
     // Determine dir node ID:
-    nodeId = retrievePathNodeId(path);
+    nodeId = resolvePath(path);
     if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
     }
 
-    snprintf(key, 1024, "%s::node:%lld", g_settings->name, nodeId);
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    return g_backend->dir_list(nodeId, readdirEntry, &context);
+}
+
 
-    handle = redisCommand_HKEYS(key, &result);
-    if (!handle)
+// ---- chmod:
+int redifs_chmod(const char* path, mode_t mode, struct fuse_file_info* fileInfo)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    int result;
+
+    // Retrieve the node ID:
+    nodeId = operationNode(path, fileInfo);
+    if (nodeId < 0)
     {
-        return -EIO;
+        return nodeId;
     }
 
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
-
-    if (result > 0)
+    // Keep the file type bits:
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
     {
-        char* entries[result];
-        retrieveStringArrayElements(handle, 0, result, entries);
-        for (i = 0; i < result; ++i)
-        {
-            filler(buf, entries[i], NULL, 0);
-        }
+        return result;
     }
 
-    releaseReplyHandle(handle);
+    info[NODE_INFO_MODE] = (info[NODE_INFO_MODE] & S_IFMT) | (mode & 07777);
 
-    return 0;
+    return g_backend->set_info(nodeId, NODE_INFO_MODE, 1, &info[NODE_INFO_MODE]);
 }
 
 
-// ---- chmod:
-int redifs_chmod(const char* path, mode_t mode)
+// ---- chown:
+int redifs_chown(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fileInfo)
 {
-    char key[1024];
     node_id_t nodeId;
-    int redisResult;
+    long long value;
+    int result;
 
     // Retrieve the node ID:
-    nodeId = retrievePathNodeId(path);
+    nodeId = operationNode(path, fileInfo);
     if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
     }
 
-    // Update node info:
-    snprintf(key, 1024, "%s::info:%lld", g_settings->name, nodeId);
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_MODE, mode | S_IFDIR);
-    if (!redisResult)
+    // Update UID; -1 leaves it unchanged:
+    if (uid != (uid_t)-1)
     {
-        return -EIO;
+        value = uid;
+        result = g_backend->set_info(nodeId, NODE_INFO_UID, 1, &value);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    // Update GID:
+    if (gid != (gid_t)-1)
+    {
+        value = gid;
+        result = g_backend->set_info(nodeId, NODE_INFO_GID, 1, &value);
+        if (result < 0)
+        {
+            return result;
+        }
     }
 
     return 0; // Success.
 }
 
 
-// ---- chown:
-int redifs_chown(const char* path, uid_t uid, gid_t gid)
+// ---- utimens:
+int redifs_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fileInfo)
 {
-    char key[1024];
     node_id_t nodeId;
-    int redisResult;
 
     // Retrieve the node ID:
-    nodeId = retrievePathNodeId(path);
+    nodeId = operationNode(path, fileInfo);
     if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
     }
 
-    snprintf(key, 1024, "%s::info:%lld", g_settings->name, nodeId);
+    // Written with the next flush; getattr shows them until then:
+    timesChange(nodeId, tv);
+
+    return 0;
+}
 
-    // Update UID:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_UID, uid);
-    if (!redisResult)
+
+/* ---- open ---- */
+int redifs_open(const char* path, struct fuse_file_info* fileInfo)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    int result;
+
+    if (controlIsPath(path))
     {
-        return -EIO;
+        return controlOpen(path, fileInfo);
     }
 
-    // Update GID:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_GID, gid);
-    if (!redisResult)
+    nodeId = resolvePath(path);
+    if (nodeId < 0)
     {
-        return -EIO;
+        return nodeId;
     }
 
-    return 0; // Success.
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        return -EISDIR;
+    }
+
+    // Remember the node, so read and write skip the path lookup:
+    fileInfo->fh = nodeId;
+
+    return 0;
 }
 
 
-// ---- utimens:
-int redifs_utimens(const char* path, const struct timespec tv[2])
+/* ---- read ---- */
+int redifs_read(const char* path, char* buf, size_t size, off_t offset,
+                       struct fuse_file_info* fileInfo)
 {
-    char key[1024];
+    struct node_record node;
+    int result;
+
+    if (controlIsPath(path))
+    {
+        return controlRead(buf, size, offset, fileInfo);
+    }
+
+    // Small files come with their data:
+    result = g_backend->get_node(fileInfo->fh, &node);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = fileRead(fileInfo->fh, &node, buf, size, offset);
+    if (result >= 0)
+    {
+        timesAccessed(fileInfo->fh, node.info);
+    }
+
+    return result;
+}
+
+
+/* ---- write ---- */
+int redifs_write(const char* path, const char* buf, size_t size, off_t offset,
+                 struct fuse_file_info* fileInfo)
+{
+    struct node_record node;
+    int result;
+
+    if (controlIsPath(path))
+    {
+        return controlWrite(buf, size, offset, fileInfo);
+    }
+
+    result = g_backend->get_node(fileInfo->fh, &node);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // The kernel passes its idea of the end, which misses appends by other mounts:
+    if (fileInfo->flags & O_APPEND)
+    {
+        return fileAppend(fileInfo->fh, &node, buf, size);
+    }
+
+    return fileWrite(fileInfo->fh, &node, buf, size, offset);
+}
+
+
+/* ---- truncate ---- */
+int redifs_truncate(const char* path, off_t size, struct fuse_file_info* fileInfo)
+{
+    struct node_record node;
     node_id_t nodeId;
-    int redisResult;
+    int result;
 
-    // Retrieve the node ID:
-    nodeId = retrievePathNodeId(path);
+    if (controlIsPath(path))
+    {
+        return controlTruncate(path);
+    }
+
+    nodeId = operationNode(path, fileInfo);
     if (nodeId < 0)
     {
-        return -ENOENT;
+        return nodeId;
+    }
+
+    result = g_backend->get_node(nodeId, &node);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (S_ISDIR(node.info[NODE_INFO_MODE]))
+    {
+        return -EISDIR;
     }
 
-    snprintf(key, 1024, "%s::info:%lld", g_settings->name, nodeId);
+    return fileTruncate(nodeId, &node, size);
+}
+
+
+/* ---- copy_file_range ---- */
+ssize_t redifs_copy_file_range(const char* pathIn, struct fuse_file_info* fileInfoIn, off_t offsetIn,
+                               const char* pathOut, struct fuse_file_info* fileInfoOut, off_t offsetOut,
+                               size_t size, int flags)
+{
+    struct node_record src;
+    struct node_record dst;
+    int result;
 
-    // Update access time sec:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_ACCESS_TIME_SEC, tv[0].tv_sec);
-    if (!redisResult)
+    // The kernel falls back to reading and writing:
+    if (controlIsPath(pathIn) || controlIsPath(pathOut))
+    {
+        return -EOPNOTSUPP;
+    }
+    else if (flags != 0)
     {
-        return -EIO;
+        return -EINVAL;
     }
 
-    // Update access time usec:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_ACCESS_TIME_NSEC, tv[0].tv_nsec);
-    if (!redisResult)
+    if (size > COPY_RANGE_MAX)
     {
-        return -EIO;
+        size = COPY_RANGE_MAX;
     }
 
-    // Update modification time sec:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_MOD_TIME_SEC, tv[1].tv_sec);
-    if (!redisResult)
+    result = g_backend->get_node(fileInfoIn->fh, &src);
+    if (result < 0)
     {
-        return -EIO;
+        return result;
     }
 
-    // Update modification time usec:
-    redisResult = redisCommand_LSET_INT(key, NODE_INFO_MOD_TIME_NSEC, tv[1].tv_nsec);
-    if (!redisResult)
+    result = g_backend->get_node(fileInfoOut->fh, &dst);
+    if (result < 0)
     {
-        return -EIO;
+        return result;
     }
 
-    return 0; // Success.
+    return fileCopy(fileInfoIn->fh, &src, offsetIn, fileInfoOut->fh, &dst, offsetOut, size);
 }
 
 
-/* ---- open ---- */
-int redifs_open(const char* path, struct fuse_file_info* fileInfo)
+/* ---- statfs ---- */
+int redifs_statfs(const char* path, struct statvfs* stbuf)
 {
-    if (0 != strcmp(path, "/bla"))
+    struct dir_usage usage;
+    unsigned long long blocks;
+    unsigned long long used;
+    int result;
+
+    CLEAR_STRUCT(stbuf, struct statvfs);
+
+    result = g_backend->dir_usage(0, &usage);
+    if (result < 0)
     {
-        return -ENOENT;
+        return result;
     }
 
-    if ((fileInfo->flags & 3) != O_RDONLY)
+    // The root directory's quota is the size of the file system:
+    stbuf->f_bsize = CHUNK_SIZE;
+    stbuf->f_frsize = CHUNK_SIZE;
+    stbuf->f_namemax = NAME_MAX;
+    blocks = usage.maxBytes > 0 ? usage.maxBytes / CHUNK_SIZE
+                                : (unsigned long long)g_settings->capacity * (1024 * 1024 / CHUNK_SIZE);
+    used = (usage.bytes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    stbuf->f_blocks = blocks;
+    stbuf->f_bfree = used < blocks ? blocks - used : 0;
+    stbuf->f_bavail = stbuf->f_bfree;
+
+    // Every node counts, the root directory included. Without a limit, a
+    // node fits in every free page:
+    used = usage.inodes + 1;
+    if (usage.maxInodes > 0)
+    {
+        stbuf->f_files = usage.maxInodes + 1;
+        stbuf->f_ffree = used < stbuf->f_files ? stbuf->f_files - used : 0;
+    }
+    else
     {
-        return -EACCES;
+        stbuf->f_ffree = stbuf->f_bfree * (CHUNK_SIZE / 4096);
+        stbuf->f_files = used + stbuf->f_ffree;
     }
+    stbuf->f_favail = stbuf->f_ffree;
 
     return 0;
 }
 
 
-/* ---- read ---- */
-int redifs_read(const char* path, char* buf, size_t size, off_t offset,
-                       struct fuse_file_info* fileInfo)
+/* ---- fsync ---- */
+int redifs_fsync(const char* path, int dataSync, struct fuse_file_info* fileInfo)
 {
-    size_t len;
+    if (controlIsPath(path))
+    {
+        return 0;
+    }
+
+    // Data and size are stored by the time write returns; only times wait:
+    return dataSync ? 0 : timesFlush(fileInfo->fh);
+}
+
 
-    if (0 != strcmp(path, "/bla"))
+/* ---- release ---- */
+int redifs_release(const char* path, struct fuse_file_info* fileInfo)
+{
+    if (controlIsPath(path))
     {
-        return -ENOENT;
+        return controlRelease(fileInfo);
     }
 
-    len = strlen("blablabla");
-    if (offset < len)
+    return timesFlush(fileInfo->fh);
+}
+
+
+/* ---- init ---- */
+void* redifs_init(struct fuse_conn_info* conn, struct fuse_config* config)
+{
+    // Background threads are started here rather than in main(), because
+    // fuse_main() forks when daemonizing:
+    if (g_settings->stats_socket)
     {
-        if (offset + size > len) size = len - offset;
-        memcpy(buf, "blablabla" + offset, size);
+        statsStartSocketServer(g_settings->stats_socket);
     }
-    else
+
+    traceInit(g_settings->trace_log, g_settings->trace_threshold, g_settings->trace);
+
+    // A mounted snapshot never changes, so there is nothing to free:
+    if (!g_settings->snapshot)
     {
-        size = 0;
+        reclaimStart();
+        timesStart();
     }
 
-    return size;
+    return NULL;
+}
+
+
+/* ---- destroy ---- */
+void redifs_destroy(void* privateData)
+{
+    timesStop();
+    reclaimStop();
+    statsStopSocketServer();
+    traceShutdown();
 }
 
 
+/* ================ Instrumentation ================ */
+
+// Wraps an operation so its latency and result end up in the statistics,
+// and in the trace ring when tracing is enabled:
+#define INSTRUMENTED_OPERATION(op, name, params, args) \
+    INSTRUMENTED_OPERATION_TYPED(int, op, name, params, args)
+
+#define INSTRUMENTED_OPERATION_TYPED(type, op, name, params, args) \
+    static type instrumented_##name params \
+    { \
+        unsigned long long start = statsNow(); \
+        type result; \
+        if (TRACE_ENABLED()) traceOpBegin(op, path, start); \
+        result = redifs_##name args; \
+        arenaReset(); \
+        statsRecordOp(op, start, result); \
+        if (TRACE_OP_ACTIVE()) traceOpEnd(result); \
+        return result; \
+    }
+
+INSTRUMENTED_OPERATION(STAT_OP_GETATTR, getattr,
+    (const char* path, struct stat* stbuf, struct fuse_file_info* fileInfo), (path, stbuf, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_MKNOD, mknod,
+    (const char* path, mode_t mode, dev_t dev), (path, mode, dev))
+INSTRUMENTED_OPERATION(STAT_OP_MKDIR, mkdir,
+    (const char* path, mode_t mode), (path, mode))
+INSTRUMENTED_OPERATION(STAT_OP_RENAME, rename,
+    (const char* path, const char* to, unsigned int flags), (path, to, flags))
+INSTRUMENTED_OPERATION(STAT_OP_UNLINK, unlink, (const char* path), (path))
+INSTRUMENTED_OPERATION(STAT_OP_RMDIR, rmdir, (const char* path), (path))
+INSTRUMENTED_OPERATION(STAT_OP_READDIR, readdir,
+    (const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fileInfo,
+     enum fuse_readdir_flags flags),
+    (path, buf, filler, offset, fileInfo, flags))
+INSTRUMENTED_OPERATION(STAT_OP_CHMOD, chmod,
+    (const char* path, mode_t mode, struct fuse_file_info* fileInfo), (path, mode, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_CHOWN, chown,
+    (const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fileInfo), (path, uid, gid, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_UTIMENS, utimens,
+    (const char* path, const struct timespec tv[2], struct fuse_file_info* fileInfo), (path, tv, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_OPEN, open,
+    (const char* path, struct fuse_file_info* fileInfo), (path, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_READ, read,
+    (const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo),
+    (path, buf, size, offset, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_WRITE, write,
+    (const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fileInfo),
+    (path, buf, size, offset, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_TRUNCATE, truncate,
+    (const char* path, off_t size, struct fuse_file_info* fileInfo), (path, size, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_RELEASE, release,
+    (const char* path, struct fuse_file_info* fileInfo), (path, fileInfo))
+INSTRUMENTED_OPERATION(STAT_OP_STATFS, statfs,
+    (const char* path, struct statvfs* stbuf), (path, stbuf))
+INSTRUMENTED_OPERATION(STAT_OP_FSYNC, fsync,
+    (const char* path, int dataSync, struct fuse_file_info* fileInfo), (path, dataSync, fileInfo))
+
+// The destination is the path that gets traced:
+INSTRUMENTED_OPERATION_TYPED(ssize_t, STAT_OP_COPY_FILE_RANGE, copy_file_range,
+    (const char* pathIn, struct fuse_file_info* fileInfoIn, off_t offsetIn,
+     const char* path, struct fuse_file_info* fileInfoOut, off_t offsetOut, size_t size, int flags),
+    (pathIn, fileInfoIn, offsetIn, path, fileInfoOut, offsetOut, size, flags))
+
+
 /* ---- redifs fuse operations ---- */
 struct fuse_operations redifs_oper = {
-    .getattr = redifs_getattr,
-    .mknod = redifs_mknod,
-    .mkdir = redifs_mkdir,
-    .readdir = redifs_readdir,
-    .chmod = redifs_chmod,
-    .chown = redifs_chown,
-    .utimens = redifs_utimens,
-    .open = redifs_open,
-    .read = redifs_read,
+    .getattr = instrumented_getattr,
+    .mknod = instrumented_mknod,
+    .mkdir = instrumented_mkdir,
+    .rename = instrumented_rename,
+    .unlink = instrumented_unlink,
+    .rmdir = instrumented_rmdir,
+    .readdir = instrumented_readdir,
+    .chmod = instrumented_chmod,
+    .chown = instrumented_chown,
+    .utimens = instrumented_utimens,
+    .open = instrumented_open,
+    .read = instrumented_read,
+    .write = instrumented_write,
+    .truncate = instrumented_truncate,
+    .release = instrumented_release,
+    .copy_file_range = instrumented_copy_file_range,
+    .statfs = instrumented_statfs,
+    .fsync = instrumented_fsync,
+    .init = redifs_init,
+    .destroy = redifs_destroy,
 };
 
 
@@ -11,6 +11,7 @@
 
 /* ---- Includes ---- */
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,42 @@ static void usage(const char* progName)
 {
     printf(
         "usage: %s mountpoint [[host]:[dir]] [port] [options]\n"
+        "\n"
+        "RediFS options:\n"
+        "    -N NAME                name of the file system (default " DEFAULT_NAME ")\n"
+        "    -C                     create the file system if it does not exist\n"
+        "    -o backend=NAME        storage engine: redis (default) or memory\n"
+        "    -o inline_max=BYTES    store files up to this size with their node info\n"
+        "                           (default 4096, at most 65536, 0 disables)\n"
+        "    -o compress=CODEC      compress new files: none (default), lz4 or zstd\n"
+        "    -o dedup               store the chunks of new files once per content\n"
+        "                           (appends to compressed or deduplicated files\n"
+        "                           are atomic within one mount only)\n"
+        "    -o snapshot=NAME       mount the snapshot NAME read-only\n"
+        "    -o meta_cache=PATH     keep entries and node info in a cache file that\n"
+        "                           persists across mounts\n"
+        "    -o meta_cache_size=MB  size of the cache file (default 64)\n"
+        "    -o meta_cache_ttl=MS   longest time changes by other mounts go unseen\n"
+        "                           (default 1000)\n"
+        "    -o block_cache=PATH    keep file data in a cache file on a local disk\n"
+        "                           that persists across mounts\n"
+        "    -o block_cache_size=MB size of the block cache file (default 1024)\n"
+        "    -o block_cache_ttl=MS  longest time writes by other mounts go unseen\n"
+        "                           (default 1000)\n"
+        "    -o cold_store=[TYPE:]LOCATION\n"
+        "                           cold store that redifs_tier moved idle file\n"
+        "                           data to (TYPE dir by default)\n"
+        "    -o capacity=MB         size reported to df when the root directory has\n"
+        "                           no quota (default 1048576)\n"
+        "    -o atime=MODE          access times on reads: off, relatime (default)\n"
+        "                           or strict\n"
+        "    -o times_flush=MS      longest time changed file times stay in memory\n"
+        "                           (default 1000, 0 writes them at once)\n"
+        "    -o stats_socket=PATH   serve Prometheus statistics on a unix socket\n"
+        "    -o trace               start with operation tracing enabled\n"
+        "    -o trace_log=PATH      append slow traced operations to a log file\n"
+        "    -o trace_threshold=US  slow operation threshold in microseconds\n"
+        "                           (default 10000, 0 logs every operation)\n"
         "\n", progName
     );
 }
@@ -37,12 +74,32 @@ struct redifs_settings* g_settings;
 enum {
     KEY_HELP,
     KEY_CREATE_FS,
-    KEY_FS_NAME,
 };
 
 
+#define REDIFS_OPT(templ, field, value) { templ, offsetof(struct redifs_settings, field), value }
+
 struct fuse_opt redifs_opts[] = {
-    FUSE_OPT_KEY("-N", KEY_FS_NAME),
+    REDIFS_OPT("backend=%s", backend, 0),
+    REDIFS_OPT("inline_max=%lu", inline_max, 0),
+    REDIFS_OPT("compress=%s", compress, 0),
+    REDIFS_OPT("dedup", dedup, 1),
+    REDIFS_OPT("snapshot=%s", snapshot, 0),
+    REDIFS_OPT("meta_cache=%s", meta_cache, 0),
+    REDIFS_OPT("meta_cache_size=%lu", meta_cache_size, 0),
+    REDIFS_OPT("meta_cache_ttl=%lu", meta_cache_ttl, 0),
+    REDIFS_OPT("block_cache=%s", block_cache, 0),
+    REDIFS_OPT("block_cache_size=%lu", block_cache_size, 0),
+    REDIFS_OPT("block_cache_ttl=%lu", block_cache_ttl, 0),
+    REDIFS_OPT("cold_store=%s", cold_store, 0),
+    REDIFS_OPT("capacity=%lu", capacity, 0),
+    REDIFS_OPT("atime=%s", atime, 0),
+    REDIFS_OPT("times_flush=%lu", times_flush, 0),
+    REDIFS_OPT("stats_socket=%s", stats_socket, 0),
+    REDIFS_OPT("trace", trace, 1),
+    REDIFS_OPT("trace_log=%s", trace_log, 0),
+    REDIFS_OPT("trace_threshold=%lu", trace_threshold, 0),
+    REDIFS_OPT("-N %s", name, 0),
     FUSE_OPT_KEY("-C", KEY_CREATE_FS),
     FUSE_OPT_KEY("-h", KEY_HELP),
     FUSE_OPT_KEY("--help", KEY_HELP),
@@ -83,10 +140,6 @@ int redifs_opts_proc(void* data, const char* arg, int key, struct fuse_args* out
             settings->create_fs = 1;
             return 0;
 
-        case KEY_FS_NAME:
-            // TODO
-            return 0;
-
         default:
             fprintf(stderr, "internal error\n");
             abort();
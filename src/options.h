@@ -14,7 +14,7 @@
 
 
 /* ---- Includes ---- */
-#include <fuse/fuse_opt.h>
+#include <fuse_opt.h>
 
 #include "redifs_types.h"
 
@@ -32,6 +32,25 @@ struct redifs_settings {
     redifs_port_t port;
     int create_fs;
     char* name;
+    char* stats_socket;
+    int trace;
+    char* trace_log;
+    unsigned long trace_threshold;
+    char* backend;
+    unsigned long inline_max;
+    char* compress;
+    int dedup;
+    char* snapshot;
+    char* meta_cache;
+    unsigned long meta_cache_size;
+    unsigned long meta_cache_ttl;
+    char* block_cache;
+    unsigned long block_cache_size;
+    unsigned long block_cache_ttl;
+    char* cold_store;
+    unsigned long capacity;
+    char* atime;
+    unsigned long times_flush;
 };
 
 extern struct redifs_settings* g_settings;
@@ -0,0 +1,96 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <string.h>
+
+#include "path.h"
+#include "backend.h"
+
+
+/* ================ Path functions ================ */
+
+/*
+ * Split an absolute path into views of its parent directory and its last
+ * component, without copying. FUSE paths have no trailing slashes; the
+ * name of "/" is empty.
+*/
+void splitPath(const char* path, struct path_view* parent, struct path_view* name)
+{
+    const char* slash;
+
+    assert(path[0] == '/');
+
+    slash = strrchr(path, '/');
+    name->ptr = slash + 1;
+    name->len = strlen(slash + 1);
+    parent->ptr = path;
+    parent->len = slash == path ? 1 : slash - path;
+}
+
+
+/*
+ * Take the next component from rest. Returns 0 when there is none left.
+*/
+int nextPathComponent(struct path_view* rest, struct path_view* component)
+{
+    const char* end = rest->ptr + rest->len;
+    const char* ptr = rest->ptr;
+
+    while (ptr < end && *ptr == '/')
+    {
+        ++ptr;
+    }
+    if (ptr == end)
+    {
+        rest->ptr = ptr;
+        rest->len = 0;
+        return 0;
+    }
+
+    component->ptr = ptr;
+    while (ptr < end && *ptr != '/')
+    {
+        ++ptr;
+    }
+    component->len = ptr - component->ptr;
+
+    rest->ptr = ptr;
+    rest->len = end - ptr;
+
+    return 1;
+}
+
+
+/*
+ * Resolve a path to its node ID.
+*/
+node_id_t resolvePath(const char* path)
+{
+    return g_backend->resolve(path, strlen(path));
+}
+
+
+/*
+ * Resolve the parent directory of a path; name points at the last
+ * component inside path.
+*/
+node_id_t resolveParent(const char* path, const char** name)
+{
+    struct path_view parent;
+    struct path_view last;
+
+    splitPath(path, &parent, &last);
+    *name = last.ptr;
+
+    return g_backend->resolve(parent.ptr, parent.len);
+}
@@ -0,0 +1,40 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _PATH_H_
+#define _PATH_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+
+#include "redifs_types.h"
+
+
+/* ---- Types ---- */
+
+// Part of a path, not necessarily NUL-terminated:
+struct path_view
+{
+    const char* ptr;
+    size_t len;
+};
+
+
+/* ================ Path functions ================ */
+
+extern void splitPath(const char* path, struct path_view* parent, struct path_view* name);
+extern int nextPathComponent(struct path_view* rest, struct path_view* component);
+extern node_id_t resolvePath(const char* path);
+extern node_id_t resolveParent(const char* path, const char** name);
+
+
+#endif // _PATH_H_
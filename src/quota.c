@@ -0,0 +1,203 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Directory quotas, through the "quota" control file. The backend keeps
+ * the bytes and inodes below every directory up to date;
+ *
+ *   echo "set /some/dir 1073741824 10000" > .redifs/quota
+ *
+ * limits the directory to 1 GiB of file data and 10000 nodes, 0 lifting
+ * a limit, and
+ *
+ *   exec 3<>.redifs/quota; echo "get /some/dir" >&3; cat <&3
+ *
+ * reads its "bytes", "inodes", "max_bytes" and "max_inodes" lines. A quota
+ * on the root directory is the size df reports.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "quota.h"
+#include "backend.h"
+#include "control.h"
+#include "path.h"
+
+
+/* ================ Quota operations ================ */
+
+static node_id_t resolveDir(const char* path)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    int result;
+
+    if (controlIsPath(path))
+    {
+        return -EPERM;
+    }
+
+    nodeId = resolvePath(path);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return S_ISDIR(info[NODE_INFO_MODE]) ? nodeId : -ENOTDIR;
+}
+
+
+static int setQuota(char* args)
+{
+    long long maxBytes;
+    long long maxInodes;
+    node_id_t nodeId;
+    char* path;
+    char* end;
+
+    // The path is everything before the two numbers:
+    end = strrchr(args, ' ');
+    if (!end)
+    {
+        return -EINVAL;
+    }
+    maxInodes = strtoll(end + 1, &path, 10);
+    if (*path != '\0' || end[1] == '\0')
+    {
+        return -EINVAL;
+    }
+    *end = '\0';
+
+    end = strrchr(args, ' ');
+    if (!end)
+    {
+        return -EINVAL;
+    }
+    maxBytes = strtoll(end + 1, &path, 10);
+    if (*path != '\0' || end[1] == '\0' || maxBytes < 0 || maxInodes < 0)
+    {
+        return -EINVAL;
+    }
+    *end = '\0';
+
+    nodeId = resolveDir(args);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    return g_backend->dir_quota(nodeId, maxBytes, maxInodes);
+}
+
+
+/* ================ Control file ================ */
+
+void quotaWriteStatus(FILE* out)
+{
+    struct dir_usage usage;
+
+    if (g_backend->dir_usage(0, &usage) == 0)
+    {
+        fprintf(out, "bytes %lld\n", usage.bytes);
+        fprintf(out, "inodes %lld\n", usage.inodes);
+    }
+}
+
+
+/*
+ * "set PATH MAX_BYTES MAX_INODES" sets the quota of a directory, "get
+ * PATH" reports its usage and quota.
+*/
+int quotaQuery(const char* cmd, size_t len, void** state)
+{
+    char buf[PATH_MAX + 64];
+    struct dir_usage* usage;
+    node_id_t nodeId;
+    int result;
+
+    if (len >= sizeof(buf))
+    {
+        return -ENAMETOOLONG;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+
+    if (len > 0 && buf[len - 1] == '\n')
+    {
+        buf[--len] = '\0';
+    }
+
+    *state = NULL;
+
+    if (0 == strncmp(buf, "set /", 5))
+    {
+        return setQuota(buf + 4);
+    }
+
+    if (0 == strncmp(buf, "get /", 5))
+    {
+        nodeId = resolveDir(buf + 4);
+        if (nodeId < 0)
+        {
+            return nodeId;
+        }
+
+        usage = malloc(sizeof(struct dir_usage));
+        if (!usage)
+        {
+            return -ENOMEM;
+        }
+
+        result = g_backend->dir_usage(nodeId, usage);
+        if (result < 0)
+        {
+            free(usage);
+            return result;
+        }
+
+        *state = usage;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+
+int quotaProduce(void* state, FILE* out)
+{
+    struct dir_usage* usage = (struct dir_usage*)state;
+
+    fprintf(out, "bytes %lld\n", usage->bytes);
+    fprintf(out, "inodes %lld\n", usage->inodes);
+    fprintf(out, "max_bytes %lld\n", usage->maxBytes);
+    fprintf(out, "max_inodes %lld\n", usage->maxInodes);
+
+    return 0;
+}
+
+
+void quotaRelease(void* state)
+{
+    free(state);
+}
@@ -0,0 +1,29 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _QUOTA_H_
+#define _QUOTA_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ================ Quota functions ================ */
+
+extern void quotaWriteStatus(FILE* out);
+extern int quotaQuery(const char* cmd, size_t len, void** state);
+extern int quotaProduce(void* state, FILE* out);
+extern void quotaRelease(void* state);
+
+
+#endif // _QUOTA_H_
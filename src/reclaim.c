@@ -0,0 +1,183 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Background reclaim of removed nodes. unlink, rmdir and rename only
+ * detach an entry and queue its node in the backend, so they take the
+ * same time for any file or tree. A thread frees the queued nodes in
+ * batches of RECLAIM_BATCH chunks or entries, pausing between full
+ * batches so that the deletes do not crowd out other Redis clients.
+ *
+ * The queue lives in the backend, so nodes that one mount removed are
+ * also freed by the others. "run" in the "reclaim" control file empties
+ * the queue at once.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#include "reclaim.h"
+#include "backend.h"
+#include "stats.h"
+
+
+/* ---- Globals ---- */
+static pthread_t reclaimThread;
+static pthread_mutex_t reclaimMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaimCond = PTHREAD_COND_INITIALIZER;
+static int reclaimRunning = 0;
+static int reclaimWoken = 0; // Nodes were queued since the last batch started.
+
+
+/* ================ Reclaim ================ */
+
+/*
+ * Free up to about max chunks or entries of removed nodes. Returns the
+ * amount of work done, 0 once nothing is queued.
+*/
+int reclaimBatch(int max)
+{
+    int freed = 0;
+    int result;
+
+    result = g_backend->reclaim(max, &freed);
+    statsAddCounter(STAT_COUNTER_RECLAIM_OBJECTS_FREED, freed);
+
+    return result;
+}
+
+
+static void* reclaimThreadMain(void* arg)
+{
+    struct timespec deadline;
+    struct timespec pause = { 0, RECLAIM_PAUSE_NS };
+    int result;
+
+    pthread_mutex_lock(&reclaimMutex);
+    while (reclaimRunning)
+    {
+        reclaimWoken = 0;
+        pthread_mutex_unlock(&reclaimMutex);
+
+        result = reclaimBatch(RECLAIM_BATCH);
+        if (result >= RECLAIM_BATCH)
+        {
+            nanosleep(&pause, NULL);
+        }
+
+        // Go on until a batch finds nothing to do:
+        pthread_mutex_lock(&reclaimMutex);
+        if (result > 0 || (result == 0 && reclaimWoken) || !reclaimRunning)
+        {
+            continue;
+        }
+
+        // Idle, or the backend failed; wait for new work:
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += RECLAIM_IDLE_NS % 1000000000L;
+        deadline.tv_sec += RECLAIM_IDLE_NS / 1000000000L + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (reclaimRunning && !reclaimWoken)
+        {
+            if (ETIMEDOUT == pthread_cond_timedwait(&reclaimCond, &reclaimMutex, &deadline))
+            {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&reclaimMutex);
+
+    return NULL;
+}
+
+
+/*
+ * Start the reclaim thread.
+*/
+int reclaimStart()
+{
+    pthread_mutex_lock(&reclaimMutex);
+    reclaimRunning = 1;
+    if (0 != pthread_create(&reclaimThread, NULL, reclaimThreadMain, NULL))
+    {
+        fprintf(stderr, "Error: Cannot start reclaim thread.\n");
+        reclaimRunning = 0;
+    }
+    pthread_mutex_unlock(&reclaimMutex);
+
+    return reclaimRunning ? 0 : -EAGAIN;
+}
+
+
+void reclaimStop()
+{
+    pthread_mutex_lock(&reclaimMutex);
+    if (reclaimRunning)
+    {
+        reclaimRunning = 0;
+        pthread_cond_signal(&reclaimCond);
+        pthread_mutex_unlock(&reclaimMutex);
+        pthread_join(reclaimThread, NULL);
+    }
+    else
+    {
+        pthread_mutex_unlock(&reclaimMutex);
+    }
+}
+
+
+/*
+ * Tell the reclaim thread that a node was queued.
+*/
+void reclaimWake()
+{
+    pthread_mutex_lock(&reclaimMutex);
+    reclaimWoken = 1;
+    pthread_cond_signal(&reclaimCond);
+    pthread_mutex_unlock(&reclaimMutex);
+}
+
+
+/* ================ Control file ================ */
+
+void reclaimWriteStatus(FILE* out)
+{
+    pthread_mutex_lock(&reclaimMutex);
+    fprintf(out, "running %d\n", reclaimRunning);
+    pthread_mutex_unlock(&reclaimMutex);
+    fprintf(out, "objects_freed %llu\n", statsCounterTotal(STAT_COUNTER_RECLAIM_OBJECTS_FREED));
+}
+
+
+/*
+ * "run" frees everything that is queued before returning.
+*/
+int reclaimCommand(const char* cmd, size_t len)
+{
+    int result;
+
+    if (len >= 3 && 0 == strncmp(cmd, "run", 3) && (len == 3 || (len == 4 && cmd[3] == '\n')))
+    {
+        do
+        {
+            result = reclaimBatch(RECLAIM_BATCH);
+        } while (result > 0);
+
+        return result < 0 ? result : 0;
+    }
+
+    return -EINVAL;
+}
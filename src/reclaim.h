@@ -0,0 +1,38 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _RECLAIM_H_
+#define _RECLAIM_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ---- Defines ---- */
+#define RECLAIM_BATCH 256 // Chunks or directory entries freed per round trip.
+#define RECLAIM_PAUSE_NS 10000000L // Pause after a full batch, so Redis stays responsive.
+#define RECLAIM_IDLE_NS 1000000000L // Check for nodes removed by other mounts.
+
+
+/* ================ Reclaim functions ================ */
+
+extern int reclaimStart();
+extern void reclaimStop();
+extern void reclaimWake();
+extern int reclaimBatch(int max);
+
+extern void reclaimWriteStatus(FILE* out);
+extern int reclaimCommand(const char* cmd, size_t len);
+
+
+#endif // _RECLAIM_H_
@@ -0,0 +1,110 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Point-in-time snapshots of the file system, managed through the
+ * "snapshot" control file:
+ *
+ *   echo "create NAME" > .redifs/snapshot
+ *   echo "delete NAME" > .redifs/snapshot
+ *
+ * A snapshot is mounted read-only with -o snapshot=NAME. Snapshots are
+ * created and deleted through the mount of the live file system. Every
+ * other client writing to the same file system honours a new snapshot
+ * from its next write on, as the backend checks for snapshots in the
+ * script that makes the write.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "snapshot.h"
+#include "backend.h"
+#include "options.h"
+#include "stats.h"
+
+
+/* ================ Control file ================ */
+
+static int writeSnapshotEntry(void* ctx, const char* name, long long gen)
+{
+    fprintf((FILE*)ctx, "snapshot %s %lld\n", name, gen);
+    return 0;
+}
+
+
+void snapshotWriteStatus(FILE* out)
+{
+    if (g_settings->snapshot)
+    {
+        fprintf(out, "mounted %s\n", g_settings->snapshot);
+    }
+    fprintf(out, "objects_copied %llu\n", statsCounterTotal(STAT_COUNTER_SNAPSHOT_OBJECTS_COPIED));
+    fprintf(out, "objects_freed %llu\n", statsCounterTotal(STAT_COUNTER_SNAPSHOT_OBJECTS_FREED));
+
+    g_backend->snapshot_list(writeSnapshotEntry, out);
+}
+
+
+/*
+ * "create NAME" takes a snapshot, "delete NAME" removes one.
+*/
+int snapshotCommand(const char* cmd, size_t len)
+{
+    char buf[SNAPSHOT_NAME_MAX + 8];
+    const char* name = buf + 7;
+    int create;
+    int result;
+
+    if (len >= sizeof(buf))
+    {
+        return -EINVAL;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+
+    if (len > 0 && buf[len - 1] == '\n')
+    {
+        buf[--len] = '\0';
+    }
+
+    if (0 == strncmp(buf, "create ", 7))
+    {
+        create = 1;
+    }
+    else if (0 == strncmp(buf, "delete ", 7))
+    {
+        create = 0;
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    // Names are single words:
+    if (name[0] == '\0' || strpbrk(name, " \t\n"))
+    {
+        return -EINVAL;
+    }
+
+    if (create)
+    {
+        return g_backend->snapshot_create(name);
+    }
+
+    result = g_backend->snapshot_delete(name);
+
+    return result < 0 ? result : 0;
+}
+
@@ -0,0 +1,32 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ---- Defines ---- */
+#define SNAPSHOT_NAME_MAX 255
+
+
+/* ================ Snapshot functions ================ */
+
+extern void snapshotWriteStatus(FILE* out);
+extern int snapshotCommand(const char* cmd, size_t len);
+
+
+#endif // _SNAPSHOT_H_
+
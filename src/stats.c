@@ -0,0 +1,787 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+
+/* ---- Histogram layout ---- */
+
+// Log-linear (HDR style) buckets: every power of two is split into
+// HIST_SUB_COUNT linear sub-buckets, giving a relative error of at most
+// 1 / HIST_SUB_COUNT. Values are nanoseconds; everything above
+// 2^HIST_MAX_MAGNITUDE ns (about 68 seconds) ends up in the last bucket.
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_MAGNITUDE 36
+#define HIST_BUCKET_COUNT ((HIST_MAX_MAGNITUDE - HIST_SUB_BITS + 2) * HIST_SUB_COUNT)
+
+// Bucket boundaries exported to Prometheus (powers of four, 1us up to 17s):
+#define PROM_FIRST_MAGNITUDE 10
+#define PROM_LAST_MAGNITUDE 34
+#define PROM_MAGNITUDE_STEP 2
+
+
+struct stats_histogram
+{
+    unsigned long long count;
+    unsigned long long errors;
+    unsigned long long sumNs;
+    unsigned long long buckets[HIST_BUCKET_COUNT];
+};
+
+struct stats_redis_command
+{
+    struct stats_histogram latency;
+    unsigned long long bytesOut;
+    unsigned long long bytesIn;
+};
+
+// All counters of one thread. Only the owning thread writes to a block, so
+// updates are plain relaxed stores instead of atomic read-modify-writes.
+struct stats_thread_block
+{
+    struct stats_thread_block* next;
+    int inUse;
+    struct stats_histogram ops[STAT_OP_COUNT];
+    struct stats_redis_command commands[STATS_MAX_REDIS_COMMANDS];
+    unsigned long long cacheHits[STATS_MAX_CACHES];
+    unsigned long long cacheMisses[STATS_MAX_CACHES];
+    unsigned long long counters[STAT_COUNTER_COUNT];
+};
+
+
+/* ---- Names ---- */
+static const char* opNames[STAT_OP_COUNT] = {
+    /* STAT_OP_GETATTR */ "getattr",
+    /* STAT_OP_MKNOD   */ "mknod",
+    /* STAT_OP_MKDIR   */ "mkdir",
+    /* STAT_OP_RENAME  */ "rename",
+    /* STAT_OP_UNLINK  */ "unlink",
+    /* STAT_OP_RMDIR   */ "rmdir",
+    /* STAT_OP_READDIR */ "readdir",
+    /* STAT_OP_CHMOD   */ "chmod",
+    /* STAT_OP_CHOWN   */ "chown",
+    /* STAT_OP_UTIMENS */ "utimens",
+    /* STAT_OP_OPEN    */ "open",
+    /* STAT_OP_READ    */ "read",
+    /* STAT_OP_WRITE   */ "write",
+    /* STAT_OP_TRUNCATE */ "truncate",
+    /* STAT_OP_RELEASE */ "release",
+    /* STAT_OP_COPY_FILE_RANGE */ "copy_file_range",
+    /* STAT_OP_STATFS  */ "statfs",
+    /* STAT_OP_FSYNC   */ "fsync",
+};
+
+static const char* counterNames[STAT_COUNTER_COUNT] = {
+    /* STAT_COUNTER_REDIS_RECONNECTS */ "redifs_redis_reconnects_total",
+    /* STAT_COUNTER_REDIS_ERRORS     */ "redifs_redis_connection_errors_total",
+    /* STAT_COUNTER_COMPRESS_IN_BYTES */ "redifs_compress_input_bytes_total",
+    /* STAT_COUNTER_COMPRESS_OUT_BYTES */ "redifs_compress_output_bytes_total",
+    /* STAT_COUNTER_CHUNKS_STORED_RAW */ "redifs_compress_incompressible_chunks_total",
+    /* STAT_COUNTER_COMPRESS_NANOSECONDS */ "redifs_compress_nanoseconds_total",
+    /* STAT_COUNTER_DECOMPRESS_NANOSECONDS */ "redifs_decompress_nanoseconds_total",
+    /* STAT_COUNTER_DEDUP_CHUNKS_LINKED */ "redifs_dedup_chunks_linked_total",
+    /* STAT_COUNTER_DEDUP_CHUNKS_STORED */ "redifs_dedup_chunks_stored_total",
+    /* STAT_COUNTER_DEDUP_BLOBS_FREED */ "redifs_dedup_blobs_freed_total",
+    /* STAT_COUNTER_SNAPSHOT_OBJECTS_COPIED */ "redifs_snapshot_objects_copied_total",
+    /* STAT_COUNTER_SNAPSHOT_OBJECTS_FREED */ "redifs_snapshot_objects_freed_total",
+    /* STAT_COUNTER_RECLAIM_OBJECTS_FREED */ "redifs_reclaim_objects_freed_total",
+    /* STAT_COUNTER_TREE_DELETES */ "redifs_tree_deletes_total",
+    /* STAT_COUNTER_TREE_NODES_WALKED */ "redifs_tree_nodes_walked_total",
+    /* STAT_COUNTER_TIER_CHUNKS_FAULTED */ "redifs_tier_chunks_faulted_total",
+    /* STAT_COUNTER_TIER_FAULT_NANOSECONDS */ "redifs_tier_fault_nanoseconds_total",
+    /* STAT_COUNTER_APPEND_RETRIES */ "redifs_append_retries_total",
+    /* STAT_COUNTER_BLOOM_REJECTS */ "redifs_lookup_bloom_rejects_total",
+    /* STAT_COUNTER_TIMES_FLUSHED */ "redifs_times_flushed_total",
+};
+
+
+/* ---- Globals ---- */
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_thread_block* threadBlocks = NULL;
+static pthread_key_t threadBlockKey;
+static pthread_once_t threadBlockKeyOnce = PTHREAD_ONCE_INIT;
+static __thread struct stats_thread_block* tlsBlock = NULL;
+
+static const char* redisCommandNames[STATS_MAX_REDIS_COMMANDS];
+static int redisCommandCount = 0;
+
+static const char* cacheNames[STATS_MAX_CACHES];
+static int cacheCount = 0;
+
+static int socketFd = -1;
+static char* socketPath = NULL;
+static pthread_t socketThread;
+
+
+/* ================ Thread blocks ================ */
+
+static void releaseThreadBlock(void* block)
+{
+    // Keep the counts, but let the next new thread reuse the block:
+    __atomic_store_n(&((struct stats_thread_block*)block)->inUse, 0, __ATOMIC_RELEASE);
+}
+
+
+static void createThreadBlockKey()
+{
+    pthread_key_create(&threadBlockKey, releaseThreadBlock);
+}
+
+
+static struct stats_thread_block* acquireThreadBlock()
+{
+    struct stats_thread_block* block;
+
+    pthread_once(&threadBlockKeyOnce, createThreadBlockKey);
+
+    pthread_mutex_lock(&statsMutex);
+
+    for (block = threadBlocks; block; block = block->next)
+    {
+        if (!block->inUse)
+        {
+            break;
+        }
+    }
+
+    if (!block)
+    {
+        block = calloc(1, sizeof(struct stats_thread_block));
+        if (!block)
+        {
+            pthread_mutex_unlock(&statsMutex);
+            return NULL;
+        }
+        block->next = threadBlocks;
+        threadBlocks = block;
+    }
+
+    block->inUse = 1;
+
+    pthread_mutex_unlock(&statsMutex);
+
+    pthread_setspecific(threadBlockKey, block);
+    tlsBlock = block;
+
+    return block;
+}
+
+
+static inline struct stats_thread_block* threadBlock()
+{
+    return __builtin_expect(tlsBlock != NULL, 1) ? tlsBlock : acquireThreadBlock();
+}
+
+
+static inline void bump(unsigned long long* counter, unsigned long long value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+
+/* ================ Histograms ================ */
+
+static int histBucketIndex(unsigned long long value)
+{
+    int magnitude;
+
+    if (value < HIST_SUB_COUNT)
+    {
+        return (int)value;
+    }
+
+    magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > HIST_MAX_MAGNITUDE)
+    {
+        return HIST_BUCKET_COUNT - 1;
+    }
+
+    return (magnitude - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+        + (int)((value >> (magnitude - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+
+// Exclusive upper bound of a bucket in nanoseconds:
+static unsigned long long histBucketUpperBound(int index)
+{
+    int magnitude;
+    int sub;
+
+    if (index < HIST_SUB_COUNT)
+    {
+        return index + 1;
+    }
+
+    magnitude = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    sub = index % HIST_SUB_COUNT;
+
+    return (unsigned long long)(HIST_SUB_COUNT + sub + 1) << (magnitude - HIST_SUB_BITS);
+}
+
+
+static void histRecord(struct stats_histogram* hist, unsigned long long ns, int failed)
+{
+    bump(&hist->count, 1);
+    bump(&hist->sumNs, ns);
+    bump(&hist->buckets[histBucketIndex(ns)], 1);
+    if (failed)
+    {
+        bump(&hist->errors, 1);
+    }
+}
+
+
+static void histAdd(struct stats_histogram* total, struct stats_histogram* hist)
+{
+    int i;
+
+    total->count += __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    total->errors += __atomic_load_n(&hist->errors, __ATOMIC_RELAXED);
+    total->sumNs += __atomic_load_n(&hist->sumNs, __ATOMIC_RELAXED);
+    for (i = 0; i < HIST_BUCKET_COUNT; ++i)
+    {
+        total->buckets[i] += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+
+static unsigned long long histQuantile(struct stats_histogram* hist, double quantile)
+{
+    unsigned long long rank;
+    unsigned long long seen;
+    int i;
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    rank = (unsigned long long)(quantile * hist->count);
+    if (rank >= hist->count)
+    {
+        rank = hist->count - 1;
+    }
+
+    seen = 0;
+    for (i = 0; i < HIST_BUCKET_COUNT; ++i)
+    {
+        seen += hist->buckets[i];
+        if (seen > rank)
+        {
+            return histBucketUpperBound(i);
+        }
+    }
+
+    return histBucketUpperBound(HIST_BUCKET_COUNT - 1);
+}
+
+
+/* ================ Recording ================ */
+
+/*
+ * Monotonic time in nanoseconds.
+*/
+unsigned long long statsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Record a finished FUSE operation.
+*/
+void statsRecordOp(int op, unsigned long long startNs, int result)
+{
+    struct stats_thread_block* block = threadBlock();
+
+    assert(op >= 0 && op < STAT_OP_COUNT);
+
+    if (block)
+    {
+        histRecord(&block->ops[op], statsNow() - startNs, result < 0);
+    }
+}
+
+
+/*
+ * Find or register a Redis command name.
+*/
+static int redisCommandId(const char* cmd)
+{
+    int count;
+    int i;
+
+    count = __atomic_load_n(&redisCommandCount, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; ++i)
+    {
+        if (0 == strcmp(redisCommandNames[i], cmd))
+        {
+            return i;
+        }
+    }
+
+    pthread_mutex_lock(&statsMutex);
+
+    for (i = count; i < redisCommandCount; ++i)
+    {
+        if (0 == strcmp(redisCommandNames[i], cmd))
+        {
+            pthread_mutex_unlock(&statsMutex);
+            return i;
+        }
+    }
+
+    if (redisCommandCount == STATS_MAX_REDIS_COMMANDS)
+    {
+        pthread_mutex_unlock(&statsMutex);
+        return -1; // Table full; command is not tracked.
+    }
+
+    redisCommandNames[redisCommandCount] = strdup(cmd);
+    __atomic_store_n(&redisCommandCount, redisCommandCount + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&statsMutex);
+
+    return i;
+}
+
+
+/*
+ * Record a Redis round trip.
+*/
+void statsRecordRedisCommand(const char* cmd, size_t bytesOut, size_t bytesIn,
+                             unsigned long long startNs, int failed)
+{
+    struct stats_thread_block* block = threadBlock();
+    struct stats_redis_command* command;
+    int id;
+
+    id = redisCommandId(cmd);
+    if (!block || id < 0)
+    {
+        return;
+    }
+
+    command = &block->commands[id];
+    histRecord(&command->latency, statsNow() - startNs, failed);
+    bump(&command->bytesOut, bytesOut);
+    bump(&command->bytesIn, bytesIn);
+}
+
+
+/*
+ * Increment a global event counter.
+*/
+void statsIncrCounter(int counter)
+{
+    struct stats_thread_block* block = threadBlock();
+
+    assert(counter >= 0 && counter < STAT_COUNTER_COUNT);
+
+    if (block)
+    {
+        bump(&block->counters[counter], 1);
+    }
+}
+
+
+/*
+ * Add a value to a global event counter.
+*/
+void statsAddCounter(int counter, unsigned long long value)
+{
+    struct stats_thread_block* block = threadBlock();
+
+    assert(counter >= 0 && counter < STAT_COUNTER_COUNT);
+
+    if (block)
+    {
+        bump(&block->counters[counter], value);
+    }
+}
+
+
+/*
+ * Sum of a global event counter over all threads.
+*/
+unsigned long long statsCounterTotal(int counter)
+{
+    struct stats_thread_block* block;
+    unsigned long long total = 0;
+
+    assert(counter >= 0 && counter < STAT_COUNTER_COUNT);
+
+    pthread_mutex_lock(&statsMutex);
+    for (block = threadBlocks; block; block = block->next)
+    {
+        total += __atomic_load_n(&block->counters[counter], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&statsMutex);
+
+    return total;
+}
+
+
+/*
+ * Register a named cache. Returns the cache ID to pass to statsRecordCacheLookup().
+*/
+int statsRegisterCache(const char* name)
+{
+    int id;
+
+    pthread_mutex_lock(&statsMutex);
+
+    for (id = 0; id < cacheCount; ++id)
+    {
+        if (0 == strcmp(cacheNames[id], name))
+        {
+            pthread_mutex_unlock(&statsMutex);
+            return id;
+        }
+    }
+
+    if (cacheCount == STATS_MAX_CACHES)
+    {
+        pthread_mutex_unlock(&statsMutex);
+        return -1;
+    }
+
+    cacheNames[cacheCount] = strdup(name);
+    __atomic_store_n(&cacheCount, cacheCount + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&statsMutex);
+
+    return id;
+}
+
+
+/*
+ * Record a cache hit or miss.
+*/
+void statsRecordCacheLookup(int cache, int hit)
+{
+    struct stats_thread_block* block = threadBlock();
+
+    if (!block || cache < 0)
+    {
+        return;
+    }
+
+    bump(hit ? &block->cacheHits[cache] : &block->cacheMisses[cache], 1);
+}
+
+
+const char* statsOpName(int op)
+{
+    assert(op >= 0 && op < STAT_OP_COUNT);
+    return opNames[op];
+}
+
+
+/* ================ Reporting ================ */
+
+static void writeHistogram(FILE* out, const char* metric, const char* labelName,
+                           const char* label, struct stats_histogram* hist)
+{
+    unsigned long long cumulative = 0;
+    int magnitude;
+    int i = 0;
+
+    for (magnitude = PROM_FIRST_MAGNITUDE; magnitude <= PROM_LAST_MAGNITUDE; magnitude += PROM_MAGNITUDE_STEP)
+    {
+        for (; i < HIST_BUCKET_COUNT && histBucketUpperBound(i) <= (1ULL << magnitude); ++i)
+        {
+            cumulative += hist->buckets[i];
+        }
+        fprintf(out, "%s_bucket{%s=\"%s\",le=\"%.9g\"} %llu\n",
+            metric, labelName, label, (double)(1ULL << magnitude) / 1e9, cumulative);
+    }
+    fprintf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", metric, labelName, label, hist->count);
+    fprintf(out, "%s_sum{%s=\"%s\"} %.9f\n", metric, labelName, label, hist->sumNs / 1e9);
+    fprintf(out, "%s_count{%s=\"%s\"} %llu\n", metric, labelName, label, hist->count);
+}
+
+
+static void writeQuantiles(FILE* out, const char* metric, const char* labelName,
+                           const char* label, struct stats_histogram* hist)
+{
+    static const char* quantileNames[] = { "0.5", "0.9", "0.99", "0.999" };
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    int i;
+
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+    {
+        fprintf(out, "%s{%s=\"%s\",quantile=\"%s\"} %.9g\n",
+            metric, labelName, label, quantileNames[i], histQuantile(hist, quantiles[i]) / 1e9);
+    }
+}
+
+
+/*
+ * Write all statistics in Prometheus text exposition format.
+*/
+void statsWritePrometheus(FILE* out)
+{
+    struct stats_thread_block* total;
+    struct stats_thread_block* block;
+    int commands;
+    int caches;
+    int i;
+
+    total = calloc(1, sizeof(struct stats_thread_block));
+    if (!total)
+    {
+        return;
+    }
+
+    // Sum the per-thread blocks:
+    pthread_mutex_lock(&statsMutex);
+    commands = redisCommandCount;
+    caches = cacheCount;
+    for (block = threadBlocks; block; block = block->next)
+    {
+        for (i = 0; i < STAT_OP_COUNT; ++i)
+        {
+            histAdd(&total->ops[i], &block->ops[i]);
+        }
+        for (i = 0; i < commands; ++i)
+        {
+            histAdd(&total->commands[i].latency, &block->commands[i].latency);
+            total->commands[i].bytesOut += __atomic_load_n(&block->commands[i].bytesOut, __ATOMIC_RELAXED);
+            total->commands[i].bytesIn += __atomic_load_n(&block->commands[i].bytesIn, __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < caches; ++i)
+        {
+            total->cacheHits[i] += __atomic_load_n(&block->cacheHits[i], __ATOMIC_RELAXED);
+            total->cacheMisses[i] += __atomic_load_n(&block->cacheMisses[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < STAT_COUNTER_COUNT; ++i)
+        {
+            total->counters[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&statsMutex);
+
+    // FUSE operations:
+    fprintf(out, "# HELP redifs_fuse_op_duration_seconds Latency of FUSE operations.\n");
+    fprintf(out, "# TYPE redifs_fuse_op_duration_seconds histogram\n");
+    for (i = 0; i < STAT_OP_COUNT; ++i)
+    {
+        writeHistogram(out, "redifs_fuse_op_duration_seconds", "op", opNames[i], &total->ops[i]);
+    }
+
+    fprintf(out, "# HELP redifs_fuse_op_latency_quantile_seconds Latency quantiles of FUSE operations.\n");
+    fprintf(out, "# TYPE redifs_fuse_op_latency_quantile_seconds gauge\n");
+    for (i = 0; i < STAT_OP_COUNT; ++i)
+    {
+        writeQuantiles(out, "redifs_fuse_op_latency_quantile_seconds", "op", opNames[i], &total->ops[i]);
+    }
+
+    fprintf(out, "# HELP redifs_fuse_op_errors_total FUSE operations that returned an error.\n");
+    fprintf(out, "# TYPE redifs_fuse_op_errors_total counter\n");
+    for (i = 0; i < STAT_OP_COUNT; ++i)
+    {
+        fprintf(out, "redifs_fuse_op_errors_total{op=\"%s\"} %llu\n", opNames[i], total->ops[i].errors);
+    }
+
+    // Redis commands:
+    fprintf(out, "# HELP redifs_redis_command_duration_seconds Round trip time of Redis commands.\n");
+    fprintf(out, "# TYPE redifs_redis_command_duration_seconds histogram\n");
+    for (i = 0; i < commands; ++i)
+    {
+        writeHistogram(out, "redifs_redis_command_duration_seconds", "cmd", redisCommandNames[i], &total->commands[i].latency);
+    }
+
+    fprintf(out, "# HELP redifs_redis_command_errors_total Redis commands that failed.\n");
+    fprintf(out, "# TYPE redifs_redis_command_errors_total counter\n");
+    for (i = 0; i < commands; ++i)
+    {
+        fprintf(out, "redifs_redis_command_errors_total{cmd=\"%s\"} %llu\n", redisCommandNames[i], total->commands[i].latency.errors);
+    }
+
+    fprintf(out, "# HELP redifs_redis_sent_bytes_total Argument bytes sent to Redis.\n");
+    fprintf(out, "# TYPE redifs_redis_sent_bytes_total counter\n");
+    for (i = 0; i < commands; ++i)
+    {
+        fprintf(out, "redifs_redis_sent_bytes_total{cmd=\"%s\"} %llu\n", redisCommandNames[i], total->commands[i].bytesOut);
+    }
+
+    fprintf(out, "# HELP redifs_redis_received_bytes_total Reply payload bytes received from Redis.\n");
+    fprintf(out, "# TYPE redifs_redis_received_bytes_total counter\n");
+    for (i = 0; i < commands; ++i)
+    {
+        fprintf(out, "redifs_redis_received_bytes_total{cmd=\"%s\"} %llu\n", redisCommandNames[i], total->commands[i].bytesIn);
+    }
+
+    // Caches:
+    fprintf(out, "# HELP redifs_cache_hits_total Cache lookups that hit.\n");
+    fprintf(out, "# TYPE redifs_cache_hits_total counter\n");
+    for (i = 0; i < caches; ++i)
+    {
+        fprintf(out, "redifs_cache_hits_total{cache=\"%s\"} %llu\n", cacheNames[i], total->cacheHits[i]);
+    }
+
+    fprintf(out, "# HELP redifs_cache_misses_total Cache lookups that missed.\n");
+    fprintf(out, "# TYPE redifs_cache_misses_total counter\n");
+    for (i = 0; i < caches; ++i)
+    {
+        fprintf(out, "redifs_cache_misses_total{cache=\"%s\"} %llu\n", cacheNames[i], total->cacheMisses[i]);
+    }
+
+    fprintf(out, "# HELP redifs_cache_hit_ratio Fraction of cache lookups that hit.\n");
+    fprintf(out, "# TYPE redifs_cache_hit_ratio gauge\n");
+    for (i = 0; i < caches; ++i)
+    {
+        unsigned long long lookups = total->cacheHits[i] + total->cacheMisses[i];
+        fprintf(out, "redifs_cache_hit_ratio{cache=\"%s\"} %.6f\n", cacheNames[i],
+            lookups ? (double)total->cacheHits[i] / lookups : 0.0);
+    }
+
+    // Event counters:
+    for (i = 0; i < STAT_COUNTER_COUNT; ++i)
+    {
+        fprintf(out, "# TYPE %s counter\n", counterNames[i]);
+        fprintf(out, "%s %llu\n", counterNames[i], total->counters[i]);
+    }
+
+    free(total);
+}
+
+
+/* ================ Unix socket ================ */
+
+static void* socketServerMain(void* arg)
+{
+    char* buf;
+    size_t len;
+    size_t sent;
+    ssize_t n;
+    FILE* out;
+    int client;
+
+    while (1)
+    {
+        client = accept(socketFd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break; // Socket was shut down.
+        }
+
+        out = open_memstream(&buf, &len);
+        if (out)
+        {
+            statsWritePrometheus(out);
+            fclose(out);
+
+            for (sent = 0; sent < len; sent += n)
+            {
+                n = send(client, buf + sent, len - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    break;
+                }
+            }
+
+            free(buf);
+        }
+
+        close(client);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Serve a Prometheus dump to every client connecting to the unix socket.
+*/
+int statsStartSocketServer(const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: Stats socket path too long.\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd < 0)
+    {
+        perror("Error: Cannot create stats socket");
+        return -1;
+    }
+
+    unlink(path);
+    if (0 > bind(socketFd, (struct sockaddr*)&addr, sizeof(addr)) || 0 > listen(socketFd, 8))
+    {
+        perror("Error: Cannot listen on stats socket");
+        close(socketFd);
+        socketFd = -1;
+        return -1;
+    }
+
+    if (0 != pthread_create(&socketThread, NULL, socketServerMain, NULL))
+    {
+        fprintf(stderr, "Error: Cannot start stats socket thread.\n");
+        close(socketFd);
+        socketFd = -1;
+        unlink(path);
+        return -1;
+    }
+
+    socketPath = strdup(path);
+
+    return 0;
+}
+
+
+void statsStopSocketServer()
+{
+    if (socketFd < 0)
+    {
+        return;
+    }
+
+    // Wakes up the blocking accept():
+    shutdown(socketFd, SHUT_RDWR);
+    pthread_join(socketThread, NULL);
+
+    unlink(socketPath);
+    free(socketPath);
+    socketPath = NULL;
+
+    close(socketFd);
+    socketFd = -1;
+}
@@ -0,0 +1,99 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ---- Defines ---- */
+#define STATS_MAX_REDIS_COMMANDS 32
+#define STATS_MAX_CACHES 16
+
+
+/* ---- FUSE operation IDs ---- */
+enum
+{
+    STAT_OP_GETATTR = 0,
+    STAT_OP_MKNOD,
+    STAT_OP_MKDIR,
+    STAT_OP_RENAME,
+    STAT_OP_UNLINK,
+    STAT_OP_RMDIR,
+    STAT_OP_READDIR,
+    STAT_OP_CHMOD,
+    STAT_OP_CHOWN,
+    STAT_OP_UTIMENS,
+    STAT_OP_OPEN,
+    STAT_OP_READ,
+    STAT_OP_WRITE,
+    STAT_OP_TRUNCATE,
+    STAT_OP_RELEASE,
+    STAT_OP_COPY_FILE_RANGE,
+    STAT_OP_STATFS,
+    STAT_OP_FSYNC,
+    STAT_OP_COUNT
+};
+
+
+/* ---- Global event counters ---- */
+enum
+{
+    STAT_COUNTER_REDIS_RECONNECTS = 0,
+    STAT_COUNTER_REDIS_ERRORS,
+    STAT_COUNTER_COMPRESS_IN_BYTES,
+    STAT_COUNTER_COMPRESS_OUT_BYTES,
+    STAT_COUNTER_CHUNKS_STORED_RAW,
+    STAT_COUNTER_COMPRESS_NANOSECONDS,
+    STAT_COUNTER_DECOMPRESS_NANOSECONDS,
+    STAT_COUNTER_DEDUP_CHUNKS_LINKED,
+    STAT_COUNTER_DEDUP_CHUNKS_STORED,
+    STAT_COUNTER_DEDUP_BLOBS_FREED,
+    STAT_COUNTER_SNAPSHOT_OBJECTS_COPIED,
+    STAT_COUNTER_SNAPSHOT_OBJECTS_FREED,
+    STAT_COUNTER_RECLAIM_OBJECTS_FREED,
+    STAT_COUNTER_TREE_DELETES,
+    STAT_COUNTER_TREE_NODES_WALKED,
+    STAT_COUNTER_TIER_CHUNKS_FAULTED,
+    STAT_COUNTER_TIER_FAULT_NANOSECONDS,
+    STAT_COUNTER_APPEND_RETRIES,
+    STAT_COUNTER_BLOOM_REJECTS,
+    STAT_COUNTER_TIMES_FLUSHED,
+    STAT_COUNTER_COUNT
+};
+
+
+/* ================ Stats functions ================ */
+
+extern unsigned long long statsNow();
+
+extern void statsRecordOp(int op, unsigned long long startNs, int result);
+extern void statsRecordRedisCommand(const char* cmd, size_t bytesOut, size_t bytesIn,
+                                    unsigned long long startNs, int failed);
+extern void statsIncrCounter(int counter);
+extern void statsAddCounter(int counter, unsigned long long value);
+extern unsigned long long statsCounterTotal(int counter);
+
+extern int statsRegisterCache(const char* name);
+extern void statsRecordCacheLookup(int cache, int hit);
+
+extern const char* statsOpName(int op);
+
+extern void statsWritePrometheus(FILE* out);
+extern int statsStartSocketServer(const char* socketPath);
+extern void statsStopSocketServer();
+
+
+#endif // _STATS_H_
@@ -0,0 +1,150 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Tiered storage of file data. redifs_tier moves chunks that were not
+ * touched for a while out of Redis into a cold store (see coldstore.h),
+ * leaving a stub with the object name in the cold hash of the file, and
+ * sets NODE_FLAG_TIERED on the file a run before it moves any of its
+ * chunks. Node info and directories stay in Redis.
+ *
+ * For files with the flag, a read that comes back short of the file size
+ * and every change of a chunk first look for a stub. A chunk found in the
+ * cold store is faulted back: read from the store and put back into
+ * Redis, so it is hot again until the next run finds it idle. A snapshot
+ * mount only reads it. Truncation drops the stubs of the chunks it deletes
+ * instead. The file loses the flag with its last stub.
+ *
+ * The objects are dropped by the sweep of redifs_tier once no stub, live
+ * or archived for a snapshot, refers to them any more.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tier.h"
+#include "backend.h"
+#include "blockcache.h"
+#include "coldstore.h"
+#include "options.h"
+#include "stats.h"
+
+
+/* ---- Globals ---- */
+static int missingStoreReported = 0;
+
+
+/* ================ Tiering functions ================ */
+
+/*
+ * Open the cold store of the -o cold_store option, if it is set.
+*/
+int tierOpen(const char* spec)
+{
+    if (!spec)
+    {
+        return 0;
+    }
+
+    return coldStoreOpen(spec, g_settings->name);
+}
+
+
+void tierClose()
+{
+    coldStoreClose();
+}
+
+
+/*
+ * Fault a chunk back from the cold store. Returns the length of its
+ * stored value, copied into buf of size bytes, or 0 if the chunk is not
+ * in the cold store.
+*/
+int tierFault(node_id_t nodeId, long long chunk, char* buf, size_t size)
+{
+    char object[COLD_OBJECT_NAME_MAX + 1];
+    unsigned long long start = statsNow();
+    int len;
+    int result;
+
+    result = g_backend->chunk_stub(nodeId, chunk, object, sizeof(object));
+    if (result <= 0)
+    {
+        return result;
+    }
+    else if (!g_coldStore)
+    {
+        if (!__atomic_exchange_n(&missingStoreReported, 1, __ATOMIC_RELAXED))
+        {
+            fprintf(stderr, "Error: File data is in the cold store, but no cold_store is set.\n");
+        }
+        return -EIO;
+    }
+
+    len = g_coldStore->get(object, buf, size);
+    if (len < 0)
+    {
+        fprintf(stderr, "Error: Cannot read cold object %s: %s\n", object, strerror(-len));
+        return -EIO;
+    }
+
+    if (!g_settings->snapshot)
+    {
+        result = g_backend->chunk_restore(nodeId, chunk, object, buf, len);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        // A block cached while the chunk was out reads as a hole:
+        blockCacheInvalidate(nodeId);
+    }
+
+    statsAddCounter(STAT_COUNTER_TIER_CHUNKS_FAULTED, 1);
+    statsAddCounter(STAT_COUNTER_TIER_FAULT_NANOSECONDS, statsNow() - start);
+
+    return len;
+}
+
+
+/*
+ * Forget a chunk that is being deleted, if it is in the cold store, rather
+ * than fault it back. Its object is left to the sweep.
+*/
+int tierDiscard(node_id_t nodeId, long long chunk)
+{
+    char object[COLD_OBJECT_NAME_MAX + 1];
+    int result;
+
+    result = g_backend->chunk_stub(nodeId, chunk, object, sizeof(object));
+    if (result <= 0)
+    {
+        return result;
+    }
+
+    result = g_backend->chunk_restore(nodeId, chunk, object, NULL, 0);
+
+    return result < 0 ? result : 0;
+}
+
+
+/* ================ Control file ================ */
+
+void tierWriteStatus(FILE* out)
+{
+    fprintf(out, "cold_store %s\n", g_coldStore ? g_coldStore->name : "none");
+    fprintf(out, "chunks_faulted %llu\n", statsCounterTotal(STAT_COUNTER_TIER_CHUNKS_FAULTED));
+    fprintf(out, "fault_nanoseconds %llu\n", statsCounterTotal(STAT_COUNTER_TIER_FAULT_NANOSECONDS));
+}
@@ -0,0 +1,38 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _TIER_H_
+#define _TIER_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "redifs_types.h"
+
+
+/* ---- Defines ---- */
+#define TIER_DEFAULT_IDLE_SECONDS 604800 // Chunks untouched for a week go to the cold store.
+#define TIER_SWEEP_GRACE_SECONDS 3600 // Least age of a cold object that nothing refers to before it is dropped.
+
+
+/* ================ Tiering functions ================ */
+
+extern int tierOpen(const char* spec);
+extern void tierClose();
+extern int tierFault(node_id_t nodeId, long long chunk, char* buf, size_t size);
+extern int tierDiscard(node_id_t nodeId, long long chunk);
+
+extern void tierWriteStatus(FILE* out);
+
+
+#endif // _TIER_H_
@@ -0,0 +1,542 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Deferred access and modification times. utimens and reads only record
+ * the new times of a node in a table in memory, where later changes
+ * replace earlier ones, and getattr shows them from there. A thread
+ * writes the table to the backend every flush interval, in batches of
+ * TIMES_BATCH nodes per round trip; fsync and release write the times of
+ * their file at once. Other mounts see the times once they are written.
+ *
+ * Reads set atime following the atime mode: "off" never, "relatime" only
+ * when atime is not past mtime or is more than a day old, and "strict"
+ * always. utimens is honoured in every mode. Writes store mtime together
+ * with the size, which drops the pending mtime of the file.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "times.h"
+#include "backend.h"
+#include "stats.h"
+
+
+/* ---- Types ---- */
+
+enum
+{
+    ATIME_OFF = 0,
+    ATIME_RELATIME,
+    ATIME_STRICT,
+};
+
+// Times of a node as passed to set_times; UTIME_OMIT nanoseconds leave a time:
+struct pending_times
+{
+    struct pending_times* next;
+    node_id_t nodeId;
+    long long times[4];
+};
+
+
+/* ---- Globals ---- */
+static const char* atimeNames[] = { "off", "relatime", "strict" };
+static int atimeMode = ATIME_RELATIME;
+static unsigned long flushMs = TIMES_DEFAULT_FLUSH_MS;
+
+static pthread_mutex_t timesMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pending_times* buckets[TIMES_BUCKETS];
+static int pendingCount = 0;
+
+static pthread_t timesThread;
+static pthread_cond_t timesCond = PTHREAD_COND_INITIALIZER;
+static int timesRunning = 0;
+static int timesWoken = 0;
+
+
+/* ================ Pending times ================ */
+
+/*
+ * Find the pending times of a node, with timesMutex held. link receives
+ * the pointer that refers to the entry, or to where it would go.
+*/
+static struct pending_times* findPending(node_id_t nodeId, struct pending_times*** link)
+{
+    struct pending_times** l = &buckets[(unsigned long long)nodeId % TIMES_BUCKETS];
+
+    while (*l && (*l)->nodeId != nodeId)
+    {
+        l = &(*l)->next;
+    }
+
+    if (link)
+    {
+        *link = l;
+    }
+
+    return *l;
+}
+
+
+static void dropPending(struct pending_times** link)
+{
+    struct pending_times* entry = *link;
+
+    *link = entry->next;
+    free(entry);
+    __atomic_sub_fetch(&pendingCount, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Record new times for a node, with timesMutex held. Returns 1 if the
+ * table has grown past TIMES_PENDING_MAX.
+*/
+static int recordPending(node_id_t nodeId, const long long times[4])
+{
+    struct pending_times** link;
+    struct pending_times* entry;
+    int i;
+
+    entry = findPending(nodeId, &link);
+    if (!entry)
+    {
+        entry = malloc(sizeof(struct pending_times));
+        if (!entry)
+        {
+            return 0; // The times are lost; they are not worth failing for.
+        }
+        entry->next = NULL;
+        entry->nodeId = nodeId;
+        entry->times[1] = UTIME_OMIT;
+        entry->times[3] = UTIME_OMIT;
+        *link = entry;
+        __atomic_add_fetch(&pendingCount, 1, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < 4; i += 2)
+    {
+        if (times[i + 1] != UTIME_OMIT)
+        {
+            entry->times[i] = times[i];
+            entry->times[i + 1] = times[i + 1];
+        }
+    }
+
+    return pendingCount >= TIMES_PENDING_MAX;
+}
+
+
+static void wakeFlusher()
+{
+    timesWoken = 1;
+    pthread_cond_signal(&timesCond);
+}
+
+
+// Whether time a is before time b, as seconds and nanoseconds:
+static int timeBefore(const long long a[2], const long long b[2])
+{
+    return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+}
+
+
+/*
+ * Record the times that utimens sets; UTIME_NOW stands for the current
+ * time and UTIME_OMIT leaves a time as it is.
+*/
+void timesChange(node_id_t nodeId, const struct timespec tv[2])
+{
+    struct timespec now;
+    long long times[4];
+    int full;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < 2; ++i)
+    {
+        times[2 * i] = tv[i].tv_nsec == UTIME_NOW ? now.tv_sec : tv[i].tv_sec;
+        times[2 * i + 1] = tv[i].tv_nsec == UTIME_NOW ? now.tv_nsec : tv[i].tv_nsec;
+    }
+
+    pthread_mutex_lock(&timesMutex);
+    full = recordPending(nodeId, times);
+    if (full)
+    {
+        wakeFlusher();
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    if (flushMs == 0)
+    {
+        timesFlush(nodeId);
+    }
+}
+
+
+/*
+ * Update the access time after a read of a node with the given info,
+ * following the atime mode.
+*/
+void timesAccessed(node_id_t nodeId, const long long info[])
+{
+    struct pending_times* entry;
+    struct timespec now;
+    long long times[4];
+    int full;
+
+    if (atimeMode == ATIME_OFF)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(times, &info[NODE_INFO_ACCESS_TIME_SEC], sizeof(times));
+
+    pthread_mutex_lock(&timesMutex);
+    entry = findPending(nodeId, NULL);
+    if (entry)
+    {
+        if (entry->times[1] != UTIME_OMIT)
+        {
+            times[0] = entry->times[0];
+            times[1] = entry->times[1];
+        }
+        if (entry->times[3] != UTIME_OMIT)
+        {
+            times[2] = entry->times[2];
+            times[3] = entry->times[3];
+        }
+    }
+
+    // relatime: atime only needs to tell whether the file was read since it changed:
+    if (atimeMode == ATIME_RELATIME && timeBefore(&times[2], &times[0])
+        && now.tv_sec - times[0] < RELATIME_WINDOW_SEC)
+    {
+        pthread_mutex_unlock(&timesMutex);
+        return;
+    }
+
+    times[0] = now.tv_sec;
+    times[1] = now.tv_nsec;
+    times[3] = UTIME_OMIT;
+    full = recordPending(nodeId, times);
+    if (full)
+    {
+        wakeFlusher();
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    if (flushMs == 0)
+    {
+        timesFlush(nodeId);
+    }
+}
+
+
+/*
+ * Forget the pending mtime of a node whose data layer just stored a newer one.
+*/
+void timesWritten(node_id_t nodeId)
+{
+    struct pending_times** link;
+    struct pending_times* entry;
+
+    if (!__atomic_load_n(&pendingCount, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timesMutex);
+    entry = findPending(nodeId, &link);
+    if (entry)
+    {
+        entry->times[3] = UTIME_OMIT;
+        if (entry->times[1] == UTIME_OMIT)
+        {
+            dropPending(link);
+        }
+    }
+    pthread_mutex_unlock(&timesMutex);
+}
+
+
+/*
+ * Show the pending times of a node in its info.
+*/
+void timesApply(node_id_t nodeId, long long info[])
+{
+    struct pending_times* entry;
+    int i;
+
+    if (!__atomic_load_n(&pendingCount, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timesMutex);
+    entry = findPending(nodeId, NULL);
+    if (entry)
+    {
+        for (i = 0; i < 4; i += 2)
+        {
+            if (entry->times[i + 1] != UTIME_OMIT)
+            {
+                info[NODE_INFO_ACCESS_TIME_SEC + i] = entry->times[i];
+                info[NODE_INFO_ACCESS_TIME_SEC + i + 1] = entry->times[i + 1];
+            }
+        }
+    }
+    pthread_mutex_unlock(&timesMutex);
+}
+
+
+/* ================ Flushing ================ */
+
+/*
+ * Write the pending times of one node, or of up to TIMES_BATCH nodes if
+ * nodeId is negative. Entries that changed during the write stay pending.
+ * Returns the number of nodes written.
+*/
+static int flushBatch(node_id_t nodeId)
+{
+    node_id_t ids[TIMES_BATCH];
+    long long times[TIMES_BATCH][4];
+    struct pending_times** link;
+    struct pending_times* entry;
+    int count = 0;
+    int result;
+    int b;
+    int i;
+
+    pthread_mutex_lock(&timesMutex);
+    if (nodeId >= 0)
+    {
+        entry = findPending(nodeId, NULL);
+        if (entry)
+        {
+            ids[0] = entry->nodeId;
+            memcpy(times[0], entry->times, sizeof(times[0]));
+            count = 1;
+        }
+    }
+    else
+    {
+        for (b = 0; b < TIMES_BUCKETS && count < TIMES_BATCH; ++b)
+        {
+            for (entry = buckets[b]; entry && count < TIMES_BATCH; entry = entry->next)
+            {
+                ids[count] = entry->nodeId;
+                memcpy(times[count], entry->times, sizeof(times[count]));
+                ++count;
+            }
+        }
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    result = g_backend->set_times(count, ids, (const long long (*)[4])times);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    pthread_mutex_lock(&timesMutex);
+    for (i = 0; i < count; ++i)
+    {
+        entry = findPending(ids[i], &link);
+        if (entry && 0 == memcmp(entry->times, times[i], sizeof(times[i])))
+        {
+            dropPending(link);
+        }
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    statsAddCounter(STAT_COUNTER_TIMES_FLUSHED, count);
+
+    return count;
+}
+
+
+/*
+ * Write the pending times of a node, for fsync and release.
+*/
+int timesFlush(node_id_t nodeId)
+{
+    int result;
+
+    if (!__atomic_load_n(&pendingCount, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    result = flushBatch(nodeId);
+
+    return result < 0 ? result : 0;
+}
+
+
+/*
+ * Write all times that were pending when called.
+*/
+int timesFlushAll()
+{
+    int batches;
+    int result;
+
+    // Nodes that keep changing must not keep the flush going:
+    pthread_mutex_lock(&timesMutex);
+    batches = pendingCount / TIMES_BATCH + 1;
+    pthread_mutex_unlock(&timesMutex);
+
+    do
+    {
+        result = flushBatch(-1);
+    } while (result >= TIMES_BATCH && --batches > 0);
+
+    return result < 0 ? result : 0;
+}
+
+
+static void* timesThreadMain(void* arg)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&timesMutex);
+    while (timesRunning)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (flushMs % 1000) * 1000000L;
+        deadline.tv_sec += flushMs / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (timesRunning && !timesWoken)
+        {
+            if (ETIMEDOUT == pthread_cond_timedwait(&timesCond, &timesMutex, &deadline))
+            {
+                break;
+            }
+        }
+        timesWoken = 0;
+        pthread_mutex_unlock(&timesMutex);
+
+        // A failed write is retried with the next flush:
+        timesFlushAll();
+
+        pthread_mutex_lock(&timesMutex);
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    return NULL;
+}
+
+
+/* ================ Setup ================ */
+
+/*
+ * Set the atime mode by name and the flush interval; 0 writes every
+ * change at once.
+*/
+int timesConfigure(const char* atime, unsigned long interval)
+{
+    int i;
+
+    for (i = 0; i < sizeof(atimeNames) / sizeof(atimeNames[0]); ++i)
+    {
+        if (0 == strcmp(atime, atimeNames[i]))
+        {
+            atimeMode = i;
+            flushMs = interval;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+
+/*
+ * Start the flush thread.
+*/
+int timesStart()
+{
+    pthread_mutex_lock(&timesMutex);
+    timesRunning = 1;
+    if (0 != pthread_create(&timesThread, NULL, timesThreadMain, NULL))
+    {
+        fprintf(stderr, "Error: Cannot start times thread.\n");
+        timesRunning = 0;
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    return timesRunning ? 0 : -EAGAIN;
+}
+
+
+/*
+ * Stop the flush thread and write what is still pending.
+*/
+void timesStop()
+{
+    pthread_mutex_lock(&timesMutex);
+    if (timesRunning)
+    {
+        timesRunning = 0;
+        pthread_cond_signal(&timesCond);
+        pthread_mutex_unlock(&timesMutex);
+        pthread_join(timesThread, NULL);
+    }
+    else
+    {
+        pthread_mutex_unlock(&timesMutex);
+    }
+
+    timesFlushAll();
+}
+
+
+/* ================ Control file ================ */
+
+void timesWriteStatus(FILE* out)
+{
+    pthread_mutex_lock(&timesMutex);
+    fprintf(out, "atime %s\n", atimeNames[atimeMode]);
+    fprintf(out, "flush_ms %lu\n", flushMs);
+    fprintf(out, "pending %d\n", pendingCount);
+    pthread_mutex_unlock(&timesMutex);
+    fprintf(out, "flushed %llu\n", statsCounterTotal(STAT_COUNTER_TIMES_FLUSHED));
+}
+
+
+/*
+ * "flush" writes all pending times before returning.
+*/
+int timesCommand(const char* cmd, size_t len)
+{
+    if (len >= 5 && 0 == strncmp(cmd, "flush", 5) && (len == 5 || (len == 6 && cmd[5] == '\n')))
+    {
+        return timesFlushAll();
+    }
+
+    return -EINVAL;
+}
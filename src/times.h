@@ -0,0 +1,51 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _TIMES_H_
+#define _TIMES_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "redifs_types.h"
+
+
+/* ---- Defines ---- */
+#define DEFAULT_ATIME "relatime"
+#define TIMES_DEFAULT_FLUSH_MS 1000
+#define TIMES_BATCH 256 // Nodes written per round trip.
+#define TIMES_PENDING_MAX 4096 // Flush early past this many nodes.
+#define TIMES_BUCKETS 1024
+#define RELATIME_WINDOW_SEC (24 * 60 * 60) // Longest time relatime leaves atime alone.
+
+
+/* ================ Times functions ================ */
+
+extern int timesConfigure(const char* atime, unsigned long flushMs);
+extern int timesStart();
+extern void timesStop();
+
+extern void timesChange(node_id_t nodeId, const struct timespec tv[2]);
+extern void timesAccessed(node_id_t nodeId, const long long info[]);
+extern void timesWritten(node_id_t nodeId);
+extern void timesApply(node_id_t nodeId, long long info[]);
+
+extern int timesFlush(node_id_t nodeId);
+extern int timesFlushAll();
+
+extern void timesWriteStatus(FILE* out);
+extern int timesCommand(const char* cmd, size_t len);
+
+
+#endif // _TIMES_H_
@@ -0,0 +1,477 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/* ---- Includes ---- */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+#include "stats.h"
+
+
+/* ---- Defines ---- */
+#define TRACE_RING_SIZE 1024 // Must be a power of two.
+#define TRACE_MAX_COMMANDS 32
+#define TRACE_PATH_LEN 128
+#define TRACE_CMD_LEN 16
+#define TRACE_FLUSH_INTERVAL_NS 100000000LL
+#define TRACE_STATUS_RECORDS 32
+
+
+/* ---- Records ---- */
+struct trace_command
+{
+    char cmd[TRACE_CMD_LEN];
+    unsigned long long durationNs;
+    size_t replyBytes;
+    int failed;
+};
+
+// One FUSE operation with its child Redis commands. Slots in the ring are
+// published with a per-slot sequence number: odd while being written,
+// 2 * position + 2 once complete.
+struct trace_record
+{
+    unsigned long long seq;
+    int op;
+    int result;
+    struct timespec wallStart;
+    unsigned long long startNs;
+    unsigned long long durationNs;
+    int commandCount;
+    int droppedCommands;
+    char path[TRACE_PATH_LEN];
+    struct trace_command commands[TRACE_MAX_COMMANDS];
+};
+
+#define TRACE_RECORD_BODY_OFFSET offsetof(struct trace_record, op)
+#define TRACE_RECORD_SIZE(commandCount) offsetof(struct trace_record, commands[commandCount])
+
+enum
+{
+    RECORD_OK,
+    RECORD_NOT_READY,
+    RECORD_OVERWRITTEN,
+};
+
+
+/* ---- Globals ---- */
+int g_traceEnabled = 0;
+__thread int g_traceOpActive = 0;
+
+static __thread struct trace_record* currentRecord = NULL;
+
+static struct trace_record* ring = NULL;
+static unsigned long long ringHead = 0;
+static unsigned long long thresholdNs = TRACE_DEFAULT_THRESHOLD_US * 1000ULL;
+
+static char* logPath = NULL;
+static FILE* logFile = NULL;
+static unsigned long long flushTail = 0;
+static unsigned long long loggedRecords = 0;
+static unsigned long long droppedRecords = 0;
+
+static pthread_t flushThread;
+static pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushCond = PTHREAD_COND_INITIALIZER;
+static int flushRunning = 0;
+
+
+/* ================ Ring buffer ================ */
+
+static void publishRecord(struct trace_record* record)
+{
+    struct trace_record* slot;
+    unsigned long long pos;
+
+    pos = __atomic_fetch_add(&ringHead, 1, __ATOMIC_RELAXED);
+    slot = &ring[pos & (TRACE_RING_SIZE - 1)];
+
+    __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy((char*)slot + TRACE_RECORD_BODY_OFFSET, (char*)record + TRACE_RECORD_BODY_OFFSET,
+        TRACE_RECORD_SIZE(record->commandCount) - TRACE_RECORD_BODY_OFFSET);
+
+    __atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+}
+
+
+static int readRecord(unsigned long long pos, struct trace_record* record)
+{
+    struct trace_record* slot = &ring[pos & (TRACE_RING_SIZE - 1)];
+    unsigned long long seq;
+    int commandCount;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != 2 * pos + 2)
+    {
+        return seq < 2 * pos + 2 ? RECORD_NOT_READY : RECORD_OVERWRITTEN;
+    }
+
+    memcpy((char*)record + TRACE_RECORD_BODY_OFFSET, (char*)slot + TRACE_RECORD_BODY_OFFSET,
+        TRACE_RECORD_SIZE(0) - TRACE_RECORD_BODY_OFFSET);
+    commandCount = record->commandCount;
+    if (commandCount < 0 || commandCount > TRACE_MAX_COMMANDS)
+    {
+        return RECORD_OVERWRITTEN;
+    }
+    memcpy(record->commands, slot->commands, commandCount * sizeof(struct trace_command));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+    {
+        return RECORD_OVERWRITTEN;
+    }
+
+    return RECORD_OK;
+}
+
+
+static void writeRecord(FILE* out, struct trace_record* record)
+{
+    struct tm tm;
+    char timeStr[32];
+    int i;
+
+    localtime_r(&record->wallStart.tv_sec, &tm);
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &tm);
+
+    fprintf(out, "%s.%06ld %s \"%s\" %.3f ms result=%d\n",
+        timeStr, record->wallStart.tv_nsec / 1000, statsOpName(record->op),
+        record->path, record->durationNs / 1e6, record->result);
+
+    for (i = 0; i < record->commandCount; ++i)
+    {
+        fprintf(out, "    %-12s %.3f ms %zu B%s\n",
+            record->commands[i].cmd, record->commands[i].durationNs / 1e6,
+            record->commands[i].replyBytes, record->commands[i].failed ? " FAILED" : "");
+    }
+
+    if (record->droppedCommands)
+    {
+        fprintf(out, "    (%d more commands)\n", record->droppedCommands);
+    }
+}
+
+
+/* ================ Flushing ================ */
+
+// Write the slow operations recorded since the previous flush to the log:
+static void flushSlowRecords(struct trace_record* record)
+{
+    unsigned long long head;
+    unsigned long long threshold;
+    int status;
+
+    head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+    threshold = __atomic_load_n(&thresholdNs, __ATOMIC_RELAXED);
+
+    if (head - flushTail > TRACE_RING_SIZE)
+    {
+        droppedRecords += head - flushTail - TRACE_RING_SIZE;
+        flushTail = head - TRACE_RING_SIZE;
+    }
+
+    for (; flushTail < head; ++flushTail)
+    {
+        status = readRecord(flushTail, record);
+        if (status == RECORD_NOT_READY)
+        {
+            break; // Retry during the next flush.
+        }
+        else if (status == RECORD_OVERWRITTEN)
+        {
+            ++droppedRecords;
+        }
+        else if (record->durationNs >= threshold)
+        {
+            writeRecord(logFile, record);
+            ++loggedRecords;
+        }
+    }
+
+    fflush(logFile);
+}
+
+
+static void* flushThreadMain(void* arg)
+{
+    struct trace_record* record = (struct trace_record*)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&flushMutex);
+    while (flushRunning)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TRACE_FLUSH_INTERVAL_NS;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&flushCond, &flushMutex, &deadline);
+
+        flushSlowRecords(record);
+    }
+    pthread_mutex_unlock(&flushMutex);
+
+    free(record);
+
+    return NULL;
+}
+
+
+/* ================ Interface functions ================ */
+
+/*
+ * Set up the trace ring buffer and, when a log path is given, the thread
+ * that writes slow operations to the log.
+*/
+int traceInit(const char* path, unsigned long long thresholdUs, int enabled)
+{
+    struct trace_record* record;
+
+    ring = calloc(TRACE_RING_SIZE, sizeof(struct trace_record));
+    if (!ring)
+    {
+        return -ENOMEM;
+    }
+
+    thresholdNs = thresholdUs * 1000ULL;
+
+    if (path)
+    {
+        logFile = fopen(path, "a");
+        if (!logFile)
+        {
+            perror("Error: Cannot open trace log");
+            return -errno;
+        }
+        logPath = strdup(path);
+
+        record = malloc(sizeof(struct trace_record));
+        flushRunning = 1;
+        if (!record || 0 != pthread_create(&flushThread, NULL, flushThreadMain, record))
+        {
+            fprintf(stderr, "Error: Cannot start trace flush thread.\n");
+            free(record);
+            flushRunning = 0;
+        }
+    }
+
+    __atomic_store_n(&g_traceEnabled, enabled, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+void traceShutdown()
+{
+    __atomic_store_n(&g_traceEnabled, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&flushMutex);
+    if (flushRunning)
+    {
+        flushRunning = 0;
+        pthread_cond_signal(&flushCond);
+        pthread_mutex_unlock(&flushMutex);
+        pthread_join(flushThread, NULL);
+    }
+    else
+    {
+        pthread_mutex_unlock(&flushMutex);
+    }
+
+    if (logFile)
+    {
+        fclose(logFile);
+        logFile = NULL;
+    }
+    free(logPath);
+    logPath = NULL;
+
+    // Operations still in flight check the ring before publishing, so it is kept.
+}
+
+
+/*
+ * Start recording an operation on the calling thread.
+*/
+void traceOpBegin(int op, const char* path, unsigned long long startNs)
+{
+    struct trace_record* record = currentRecord;
+
+    if (!ring)
+    {
+        return;
+    }
+
+    if (!record)
+    {
+        record = currentRecord = malloc(sizeof(struct trace_record));
+        if (!record)
+        {
+            return;
+        }
+    }
+
+    record->op = op;
+    record->result = 0;
+    clock_gettime(CLOCK_REALTIME, &record->wallStart);
+    record->startNs = startNs;
+    record->commandCount = 0;
+    record->droppedCommands = 0;
+    strncpy(record->path, path ? path : "", TRACE_PATH_LEN - 1);
+    record->path[TRACE_PATH_LEN - 1] = '\0';
+
+    g_traceOpActive = 1;
+}
+
+
+/*
+ * Finish the operation of the calling thread and publish it to the ring.
+*/
+void traceOpEnd(int result)
+{
+    struct trace_record* record = currentRecord;
+
+    g_traceOpActive = 0;
+
+    record->result = result;
+    record->durationNs = statsNow() - record->startNs;
+
+    publishRecord(record);
+}
+
+
+/*
+ * Add a Redis command to the operation of the calling thread.
+*/
+void traceRedisCommand(const char* cmd, unsigned long long startNs, size_t replyBytes, int failed)
+{
+    struct trace_record* record = currentRecord;
+    struct trace_command* command;
+
+    if (record->commandCount == TRACE_MAX_COMMANDS)
+    {
+        ++record->droppedCommands;
+        return;
+    }
+
+    command = &record->commands[record->commandCount++];
+    strncpy(command->cmd, cmd, TRACE_CMD_LEN - 1);
+    command->cmd[TRACE_CMD_LEN - 1] = '\0';
+    command->durationNs = statsNow() - startNs;
+    command->replyBytes = replyBytes;
+    command->failed = failed;
+}
+
+
+/*
+ * Trace settings and the most recent slow operations, for /.redifs/trace.
+*/
+void traceWriteStatus(FILE* out)
+{
+    struct trace_record* record;
+    unsigned long long threshold;
+    unsigned long long head;
+    unsigned long long pos;
+    int shown;
+
+    threshold = __atomic_load_n(&thresholdNs, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+
+    fprintf(out, "enabled %d\n", __atomic_load_n(&g_traceEnabled, __ATOMIC_RELAXED));
+    fprintf(out, "threshold_us %llu\n", threshold / 1000);
+    fprintf(out, "log %s\n", logPath ? logPath : "-");
+    fprintf(out, "recorded %llu\n", head);
+    fprintf(out, "logged %llu\n", __atomic_load_n(&loggedRecords, __ATOMIC_RELAXED));
+    fprintf(out, "dropped %llu\n", __atomic_load_n(&droppedRecords, __ATOMIC_RELAXED));
+
+    record = malloc(sizeof(struct trace_record));
+    if (!ring || !record)
+    {
+        free(record);
+        return;
+    }
+
+    fprintf(out, "\n");
+
+    // Newest first:
+    shown = 0;
+    for (pos = head; pos > 0 && head - pos < TRACE_RING_SIZE && shown < TRACE_STATUS_RECORDS; --pos)
+    {
+        if (RECORD_OK == readRecord(pos - 1, record) && record->durationNs >= threshold)
+        {
+            writeRecord(out, record);
+            ++shown;
+        }
+    }
+
+    free(record);
+}
+
+
+/*
+ * Handle a command written to /.redifs/trace: "on", "off" or "threshold=<usec>".
+*/
+int traceCommand(const char* cmd, size_t len)
+{
+    unsigned long long thresholdUs;
+    char buf[64];
+    char* end;
+
+    if (len >= sizeof(buf))
+    {
+        return -EINVAL;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+    {
+        buf[--len] = '\0';
+    }
+
+    if (0 == strcmp(buf, "on") || 0 == strcmp(buf, "1"))
+    {
+        if (!ring)
+        {
+            return -ENOMEM;
+        }
+        __atomic_store_n(&g_traceEnabled, 1, __ATOMIC_RELAXED);
+    }
+    else if (0 == strcmp(buf, "off") || 0 == strcmp(buf, "0"))
+    {
+        __atomic_store_n(&g_traceEnabled, 0, __ATOMIC_RELAXED);
+    }
+    else if (0 == strncmp(buf, "threshold=", 10))
+    {
+        thresholdUs = strtoull(buf + 10, &end, 10);
+        if (end == buf + 10 || *end != '\0')
+        {
+            return -EINVAL;
+        }
+        __atomic_store_n(&thresholdNs, thresholdUs * 1000ULL, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ---- Defines ---- */
+#define TRACE_DEFAULT_THRESHOLD_US 10000
+
+
+/* ---- Macros ---- */
+
+// Cheap checks for the hot path; everything else is only called when these hold.
+#define TRACE_ENABLED() __builtin_expect(__atomic_load_n(&g_traceEnabled, __ATOMIC_RELAXED), 0)
+#define TRACE_OP_ACTIVE() __builtin_expect(g_traceOpActive, 0)
+
+
+/* ---- Globals ---- */
+extern int g_traceEnabled;
+extern __thread int g_traceOpActive;
+
+
+/* ================ Trace functions ================ */
+
+extern int traceInit(const char* logPath, unsigned long long thresholdUs, int enabled);
+extern void traceShutdown();
+
+extern void traceOpBegin(int op, const char* path, unsigned long long startNs);
+extern void traceOpEnd(int result);
+extern void traceRedisCommand(const char* cmd, unsigned long long startNs, size_t replyBytes, int failed);
+
+extern void traceWriteStatus(FILE* out);
+extern int traceCommand(const char* cmd, size_t len);
+
+
+#endif // _TRACE_H_
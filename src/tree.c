@@ -0,0 +1,225 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Operations on whole trees that run inside the backend, through the
+ * "tree" control file:
+ *
+ *   echo "delete /some/dir" > .redifs/tree
+ *
+ * detaches the tree in one step, like rm -r would at its end, and leaves
+ * freeing it to the reclaim thread.
+ *
+ *   exec 3<>.redifs/tree; echo "walk /some/dir" >&3; cat <&3
+ *
+ * lists every node below the directory, TREE_WALK_BATCH nodes per round
+ * trip, as "path<TAB>node ID<TAB>octal mode<TAB>size" lines, as the
+ * output is read.
+*/
+
+
+/* ---- Includes ---- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "tree.h"
+#include "backend.h"
+#include "control.h"
+#include "path.h"
+#include "reclaim.h"
+#include "stats.h"
+
+
+/* ---- Types ---- */
+struct tree_walk
+{
+    void* walk; // Backend state.
+    char root[]; // Without a trailing slash, so empty for "/".
+};
+
+struct tree_output
+{
+    FILE* out;
+    struct tree_walk* walk;
+};
+
+
+/* ================ Tree operations ================ */
+
+static int deleteTree(const char* path)
+{
+    node_id_t parentNodeId;
+    node_id_t nodeId;
+    const char* name;
+
+    if (controlIsPath(path))
+    {
+        return -EPERM;
+    }
+
+    parentNodeId = resolveParent(path, &name);
+    if (parentNodeId < 0)
+    {
+        return parentNodeId;
+    }
+    else if (name[0] == '\0')
+    {
+        return -EBUSY; // The root directory.
+    }
+
+    nodeId = g_backend->dir_unlink(parentNodeId, name, DIR_UNLINK_TREE);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    statsAddCounter(STAT_COUNTER_TREE_DELETES, 1);
+    reclaimWake();
+
+    return 0;
+}
+
+
+static int openWalk(const char* path, struct tree_walk** state)
+{
+    long long info[NODE_INFO_COUNT];
+    struct tree_walk* walk;
+    node_id_t nodeId;
+    size_t len;
+    int result;
+
+    nodeId = resolvePath(path);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    result = g_backend->get_info(nodeId, info);
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (!S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        return -ENOTDIR;
+    }
+
+    len = strlen(path);
+    while (len > 0 && path[len - 1] == '/')
+    {
+        --len;
+    }
+
+    walk = malloc(sizeof(struct tree_walk) + len + 1);
+    if (!walk)
+    {
+        return -ENOMEM;
+    }
+    memcpy(walk->root, path, len);
+    walk->root[len] = '\0';
+
+    result = g_backend->tree_walk_open(nodeId, &walk->walk);
+    if (result < 0)
+    {
+        free(walk);
+        return result;
+    }
+
+    *state = walk;
+
+    return 0;
+}
+
+
+/* ================ Control file ================ */
+
+void treeWriteStatus(FILE* out)
+{
+    fprintf(out, "deletes %llu\n", statsCounterTotal(STAT_COUNTER_TREE_DELETES));
+    fprintf(out, "nodes_walked %llu\n", statsCounterTotal(STAT_COUNTER_TREE_NODES_WALKED));
+}
+
+
+/*
+ * "delete PATH" removes a file or a whole tree, "walk PATH" starts a
+ * listing of the tree below a directory.
+*/
+int treeQuery(const char* cmd, size_t len, void** state)
+{
+    char buf[PATH_MAX + 8];
+    const char* path = buf + 7;
+    struct tree_walk* walk;
+    int result;
+
+    if (len >= sizeof(buf))
+    {
+        return -ENAMETOOLONG;
+    }
+    memcpy(buf, cmd, len);
+    buf[len] = '\0';
+
+    if (len > 0 && buf[len - 1] == '\n')
+    {
+        buf[--len] = '\0';
+    }
+
+    *state = NULL;
+
+    if (0 == strncmp(buf, "delete ", 7) && path[0] == '/')
+    {
+        return deleteTree(path);
+    }
+
+    path = buf + 5;
+    if (0 == strncmp(buf, "walk ", 5) && path[0] == '/')
+    {
+        result = openWalk(path, &walk);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        *state = walk;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+
+static void writeTreeEntry(void* ctx, const char* path, node_id_t nodeId, long long mode, long long size)
+{
+    struct tree_output* output = (struct tree_output*)ctx;
+
+    fprintf(output->out, "%s/%s\t%lld\t%llo\t%lld\n", output->walk->root, path, (long long)nodeId, mode, size);
+    statsAddCounter(STAT_COUNTER_TREE_NODES_WALKED, 1);
+}
+
+
+int treeProduce(void* state, FILE* out)
+{
+    struct tree_output output = { out, (struct tree_walk*)state };
+
+    return g_backend->tree_walk_next(output.walk->walk, writeTreeEntry, &output, TREE_WALK_BATCH);
+}
+
+
+void treeRelease(void* state)
+{
+    struct tree_walk* walk = (struct tree_walk*)state;
+
+    g_backend->tree_walk_close(walk->walk);
+    free(walk);
+}
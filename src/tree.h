@@ -0,0 +1,33 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+#ifndef _TREE_H_
+#define _TREE_H_
+
+
+/* ---- Includes ---- */
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* ---- Defines ---- */
+#define TREE_WALK_BATCH 256 // Nodes listed per round trip.
+
+
+/* ================ Tree functions ================ */
+
+extern void treeWriteStatus(FILE* out);
+extern int treeQuery(const char* cmd, size_t len, void** state);
+extern int treeProduce(void* state, FILE* out);
+extern void treeRelease(void* state);
+
+
+#endif // _TREE_H_
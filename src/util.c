@@ -16,122 +16,248 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "util.h"
-#include "options.h"
+#include "arena.h"
+#include "backend.h"
 #include "connection.h"
+#include "metacache.h"
+#include "path.h"
+#include "stats.h"
 
 
-enum
-{
-    NODE_INFO_MODE = 0,
-};
+/* ---- Checks ---- */
 
+// The scripts spell these out, see util.h:
+_Static_assert(LUA_INFO_ACCESS_TIME == NODE_INFO_ACCESS_TIME_SEC && LUA_INFO_MOD_TIME == NODE_INFO_MOD_TIME_SEC
+               && LUA_INFO_SIZE == NODE_INFO_SIZE && LUA_INFO_FLAGS == NODE_INFO_FLAGS
+               && LUA_INFO_COUNT == NODE_INFO_COUNT, "Lua node info fields differ from backend.h");
+_Static_assert(LUA_MODE_TYPE_UNIT * (LUA_MODE_TYPES - 1) == S_IFMT && LUA_MODE_TYPE_UNIT * LUA_MODE_TYPE_DIR == S_IFDIR
+               && LUA_MODE_TYPE_UNIT * LUA_MODE_TYPE_REG == S_IFREG, "Lua file types differ from <sys/stat.h>");
+
+
+/* ---- Globals ---- */
+static char keyPrefix[KEY_PREFIX_MAX_LEN + 3]; // "<name>::"
+static size_t keyPrefixLen = 0;
+static char fsName[KEY_PREFIX_MAX_LEN + 1];
+
+static long long viewGen = -1; // Generation of the mounted snapshot, or -1, see loadSnapshots().
 
-/* ================ Util functions ================ */
+
+/* ================ Keys ================ */
 
 /*
- * Create a new unique node ID.
+ * Precompute the "<name>::" prefix of all keys of a file system.
 */
-node_id_t createUniqueNodeId()
+int setKeyPrefix(const char* name)
 {
-    node_id_t result = 0;
-    char key[1024];
-    int redisResult;
+    size_t len = strlen(name);
 
-    // TODO: Create a list of deleted node IDs and pop one there before creating a new node ID.
-    // TODO: Also decrement the node ctr if the latest node ID is deleted.
+    if (len > KEY_PREFIX_MAX_LEN)
+    {
+        fprintf(stderr, "Error: File system name is too long.\n");
+        return -ENAMETOOLONG;
+    }
 
-    snprintf(key, 1024, "%s::%s", g_settings->name, KEY_NODE_ID_CTR);
+    memcpy(fsName, name, len + 1);
+    memcpy(keyPrefix, name, len);
+    memcpy(keyPrefix + len, "::", 3);
+    keyPrefixLen = len + 2;
+
+    return 0;
+}
 
-    redisResult = redisCommand_INCR(key, &result);
-    if (!redisResult)
+
+static size_t appendNumber(char* buf, long long value)
+{
+    char digits[24];
+    size_t len = 0;
+    size_t i;
+    unsigned long long v = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+
+    do
     {
-        return -EIO;
-    }
+        digits[len++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
 
-    if (result < 1)
+    if (value < 0)
     {
-        redisResult = redisCommand_SET(key, "-1");
-        if (!redisResult)
-        {
-            return -EIO;
-        }
+        digits[len++] = '-';
+    }
 
-        result = 0;
+    for (i = 0; i < len; ++i)
+    {
+        buf[i] = digits[len - 1 - i];
     }
 
-    return result;
+    return len;
+}
+
+
+/*
+ * Format "<name>::<suffix>" into key, which holds KEY_LEN bytes.
+*/
+size_t formatKey(char* key, const char* suffix)
+{
+    size_t len = strlen(suffix);
+
+    assert(keyPrefixLen > 0 && keyPrefixLen + len < KEY_LEN);
+
+    memcpy(key, keyPrefix, keyPrefixLen);
+    memcpy(key + keyPrefixLen, suffix, len + 1);
+
+    return keyPrefixLen + len;
 }
 
 
 /*
- * Retrieve the node ID of the specified path.
+ * Format "<name>::<kind>:<id>" into key, which holds KEY_LEN bytes.
+ * Returns the key length.
 */
-node_id_t retrievePathNodeId(const char* path)
+size_t formatNodeKey(char* key, const char* kind, node_id_t nodeId)
 {
-    char* lpath;
+    size_t kindLen = strlen(kind);
+    size_t len = keyPrefixLen;
+
+    assert(keyPrefixLen > 0 && kindLen < 16);
+
+    memcpy(key, keyPrefix, keyPrefixLen);
+    memcpy(key + len, kind, kindLen);
+    len += kindLen;
+    key[len++] = ':';
+    len += appendNumber(key + len, nodeId);
+    key[len] = '\0';
+
+    return len;
+}
+
+
+/*
+ * Format "<name>::data:<id>:<chunk>" into key.
+*/
+size_t formatChunkKey(char* key, node_id_t nodeId, long long chunk)
+{
+    size_t len;
+
+    len = formatNodeKey(key, KEY_DATA, nodeId);
+    key[len++] = ':';
+    len += appendNumber(key + len, chunk);
+    key[len] = '\0';
+
+    return len;
+}
+
+
+/* ================ Util functions ================ */
+
+/*
+ * A directory starts out as the hash "<name>::node:<id>" of its entries.
+ * Once it holds more than DIR_BUCKET_ENTRIES entries, its buckets split
+ * one at a time by linear hashing: the hash keeps the bucket count in its
+ * "/buckets" field, which no entry name can take, and stays bucket 0,
+ * while bucket b is "<name>::node:<id>:<b>". See LUA_DIR_FUNCTIONS.
+*/
+
+// ARGV: name, snapshot generation or -1, directory node ID, entry name,
+// whether to return the bloom filter, DIR_BLOOM_MAX_ENTRIES. Returns the
+// node ID, or '' for a missing entry followed by the bloom filter of the
+// live directory if asked for, '' for a directory too large to have one.
+static const char* lookupScript =
+    LUA_VIEW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_VIEW_FUNCTION
+    LUA_DIR_BLOOM_FUNCTIONS
+    "redis.replicate_commands() "
+    "local id = dirFind(dirViewBuckets(ARGV[1], tonumber(ARGV[2]), ARGV[3]), ARGV[4]) "
+    "if id then return { id } end "
+    "if ARGV[5] ~= '1' or tonumber(ARGV[2]) >= 0 then return { '' } end "
+    "return { '', dirBloom(ARGV[1] .. '::node:' .. ARGV[3], tonumber(ARGV[6])) or '' }";
+
+
+/*
+ * Retrieve the node ID of the specified path. The path is a view of len
+ * bytes; one lookup is done per component.
+*/
+node_id_t retrievePathNodeId(const char* path, size_t len)
+{
+    struct path_view rest = { path, len };
+    struct path_view component;
     char* curNodeIdStr;
     node_id_t curNodeId;
-    char* curDir;
-    char* nextDir;
-    char* slash;
-    char key[1024];
+    node_id_t nextNodeId;
+    char genStr[24];
+    char dirStr[24];
+    char maxStr[24];
+    const char* args[6] = { fsName, genStr, dirStr, NULL, NULL, maxStr };
+    char* bloom;
+    size_t bloomLen;
+    unsigned long token;
     int handle;
+    int count;
 
-    if (0 == strcmp(path, "/"))
-    {
-        return 0; // Root dir node ID.
-    }
-
-    lpath = strdup(path);
-    curNodeId = 0;
-    curDir = lpath + 1;
+    curNodeId = 0; // Root dir node ID.
+    snprintf(genStr, sizeof(genStr), "%lld", viewGen);
+    snprintf(maxStr, sizeof(maxStr), "%d", DIR_BLOOM_MAX_ENTRIES);
 
-    while (curDir)
+    while (nextPathComponent(&rest, &component))
     {
-        slash = strchr(curDir, '/');
-        if (slash)
+        if (metaCacheLookup(curNodeId, component.ptr, component.len, &nextNodeId))
         {
-            slash[0] = '\0';
-            nextDir = slash + 1;
+            if (nextNodeId == METACACHE_ABSENT)
+            {
+                return -ENOENT;
+            }
+            curNodeId = nextNodeId;
+            continue;
         }
-        else
+
+        args[3] = arenaStrndup(component.ptr, component.len);
+        if (!args[3])
         {
-            nextDir = NULL;
+            return -ENOMEM;
         }
 
-        snprintf(key, 1024, "%s::node:%lld", g_settings->name, curNodeId);
-        handle = redisCommand_HGET(key, curDir, &curNodeIdStr);
+        snprintf(dirStr, sizeof(dirStr), "%lld", curNodeId);
+        args[4] = metaCacheWantsBloom(curNodeId) ? "1" : "0";
+        token = metaCacheBegin(curNodeId);
+        handle = redisCommand_EVAL_ARRAY(lookupScript, 0, args, 6, &count);
         if (!handle)
         {
-            free(lpath);
+            return -EIO;
+        }
+        else if (count < 1)
+        {
+            releaseReplyHandle(handle);
             return -EIO;
         }
 
-        if (!curNodeIdStr)
+        retrieveStringArrayElements(handle, 0, 1, &curNodeIdStr);
+        if (curNodeIdStr[0] == '\0')
         {
+            if (count > 1)
+            {
+                retrieveBinaryArrayElement(handle, 1, &bloom, &bloomLen);
+                metaCacheStoreBloom(token, curNodeId, bloom, bloomLen);
+            }
             releaseReplyHandle(handle);
-            free(lpath);
+            metaCacheStoreEntry(token, curNodeId, component.ptr, component.len, METACACHE_ABSENT);
             return -ENOENT;
         }
 
-        curNodeId = atoll(curNodeIdStr);
-        if (curNodeId < 0)
+        nextNodeId = atoll(curNodeIdStr);
+        releaseReplyHandle(handle);
+        if (nextNodeId < 0)
         {
-            releaseReplyHandle(handle);
-            free(lpath);
             fprintf(stderr, "Error: Invalid node id.\n");
             return -EIO;
         }
 
-        curDir = nextDir;
-
-        releaseReplyHandle(handle);
+        metaCacheStoreEntry(token, curNodeId, component.ptr, component.len, nextNodeId);
+        curNodeId = nextNodeId;
     }
 
-    free(lpath);
-
     return curNodeId; // Success.
 }
 
@@ -147,36 +273,51 @@ int checkFileSystemExists()
 }
 
 
+// KEYS: root info; ARGV: its fields. Another mount may create the file
+// system at the same time, so the root is only pushed if it is missing.
+static const char* createFileSystemScript =
+    "if redis.call('EXISTS', KEYS[1]) == 1 then return 0 end "
+    "redis.call('RPUSH', KEYS[1], unpack(ARGV)) "
+    "return 1";
+
+
 /*
  * Create a FS on the Redis server.
 */
 int createFileSystem()
 {
-    int redisResult;
-    long long args[7];
-    char key[1024];
-    int result;
-
-    snprintf(key, 1024, "%s::info:0", g_settings->name);
-
-    args[0] = S_IFDIR | 0755;
-    args[1] = 0; // TODO: UID.
-    args[2] = 0; // TODO: GID.
-    args[3] = 1; // TODO: Access time sec.
-    args[4] = 1; // TODO: Access time nsec.
-    args[5] = 1; // TODO: Modification time sec.
-    args[6] = 1; // TODO: Modification time nsec.
-    redisResult = redisCommand_RPUSH_INT(key, args, 7, &result);
-    if (!redisResult)
+    long long info[NODE_INFO_COUNT];
+    char values[NODE_INFO_COUNT][24];
+    const char* args[NODE_INFO_COUNT + 1];
+    char key[KEY_LEN];
+    long long created;
+    int i;
+
+    formatNodeKey(key, KEY_INFO, 0);
+
+    info[NODE_INFO_MODE] = S_IFDIR | 0755;
+    info[NODE_INFO_UID] = 0; // TODO: UID.
+    info[NODE_INFO_GID] = 0; // TODO: GID.
+    info[NODE_INFO_ACCESS_TIME_SEC] = 1; // TODO: Access time sec.
+    info[NODE_INFO_ACCESS_TIME_NSEC] = 1; // TODO: Access time nsec.
+    info[NODE_INFO_MOD_TIME_SEC] = 1; // TODO: Modification time sec.
+    info[NODE_INFO_MOD_TIME_NSEC] = 1; // TODO: Modification time nsec.
+    info[NODE_INFO_SIZE] = 0;
+    info[NODE_INFO_FLAGS] = 0;
+
+    args[0] = key;
+    for (i = 0; i < NODE_INFO_COUNT; ++i)
     {
-        return -EIO;
+        snprintf(values[i], sizeof(values[i]), "%lld", info[i]);
+        args[i + 1] = values[i];
     }
-    else if (result != 1)
+
+    if (!redisCommand_EVAL_INT(createFileSystemScript, 1, args, NODE_INFO_COUNT + 1, &created))
     {
-        return 0; // Failure.
+        return -EIO;
     }
 
-    return 1; // Success.
+    return created ? 1 : 0; // 0: The file system existed already.
 }
 
 
@@ -185,12 +326,17 @@ int createFileSystem()
 */
 long long retrieveNodeInfo(node_id_t nodeId, int index)
 {
-    char key[1024];
+    char key[KEY_LEN];
     char* nodeInfoStr;
     long long nodeInfo;
     int handle;
 
-    snprintf(key, 1024, "%s::info:%d", g_settings->name, index);
+    formatNodeKey(key, KEY_INFO, nodeId);
+    if (0 > viewKey(key))
+    {
+        return -EIO;
+    }
+
     handle = redisCommand_LINDEX(key, index, &nodeInfoStr);
     if (!handle)
     {
@@ -209,3 +355,499 @@ long long retrieveNodeInfo(node_id_t nodeId, int index)
     return nodeInfo;
 }
 
+
+
+/* ================ Snapshots ================ */
+
+/*
+ * A snapshot is a generation number. Creating one only starts a new
+ * generation for the live file system. Before a key first changes in the
+ * new generation, its old value is copied to "<name>@<gen>::<suffix>" of
+ * the newest snapshot that sees it, and the key is stamped with the live
+ * generation. A snapshot reads a key from the first archive at or after
+ * its own generation, or else from the live file system if the key has
+ * not changed since.
+ *
+ * Any client may create a snapshot at any time, so the generation is
+ * never cached: the copy is made by the script that changes the key,
+ * with LUA_COW_FUNCTION, against the generation it reads itself.
+ *
+ *   <name>::gen                   Live generation; absent means 0.
+ *   <name>::snapshots             Hash: snapshot name -> generation.
+ *   <name>::snapshot_gens         Sorted set of generations with archives.
+ *   <name>::stamps                Hash: key suffix -> generation it was
+ *                                 last written in, while snapshots existed.
+ *   <name>@<gen>::archived        Hash: archived key suffix -> generation
+ *                                 of the archived value.
+ *   <name>@<gen>::<suffix>        Archived value.
+*/
+
+// ARGV: name, snapshot to view. Returns its generation, or -1 if there is
+// no such snapshot.
+static const char* loadScript =
+    "return tonumber(redis.call('HGET', ARGV[1] .. '::snapshots', ARGV[2]) or -1)";
+
+// ARGV: name, key suffix[, first chunk, count]. With a chunk range the
+// suffix is the chunk key prefix. Returns the number of values archived.
+static const char* cowScript =
+    LUA_COW_FUNCTION
+    "local first, last = 0, 0 "
+    "if ARGV[3] then first, last = tonumber(ARGV[3]), ARGV[3] + ARGV[4] - 1 end "
+    "local copied = 0 "
+    "for i = first, last do copied = copied + cow(ARGV[1], ARGV[3] and ARGV[2] .. i or ARGV[2]) end "
+    "return copied";
+
+// ARGV: name, snapshot generation, key suffix.
+static const char* viewScript =
+    LUA_VIEW_FUNCTION
+    "return view(ARGV[1], tonumber(ARGV[2]), ARGV[3])";
+
+// ARGV: name, snapshot name. Returns the snapshot generation, or -1 if
+// the name is taken.
+static const char* createScript =
+    "local p = ARGV[1] "
+    "local cur = tonumber(redis.call('GET', p .. '::gen') or '0') "
+    "if redis.call('HSETNX', p .. '::snapshots', ARGV[2], cur) == 0 then return -1 end "
+    "redis.call('SET', p .. '::gen', cur + 1) "
+    "return cur";
+
+// ARGV: name, snapshot name. Returns the archive generations to sweep,
+// or nil for an unknown snapshot.
+static const char* deleteScript =
+    "local p = ARGV[1] "
+    "local g = redis.call('HGET', p .. '::snapshots', ARGV[2]) "
+    "if not g then return false end "
+    "redis.call('HDEL', p .. '::snapshots', ARGV[2]) "
+    "return redis.call('ZRANGEBYSCORE', p .. '::snapshot_gens', g, '+inf')";
+
+// ARGV: name, archive generation, cursor, count. Frees the archived
+// values no remaining snapshot reads: a value archived at gen, written in
+// generation v, is seen by the snapshots from v to gen.
+static const char* sweepScript =
+    "redis.replicate_commands() "
+    "local p, g = ARGV[1], tonumber(ARGV[2]) "
+    "local ns = p .. '@' .. ARGV[2] .. '::' "
+    "local gens = redis.call('HVALS', p .. '::snapshots') "
+    "local reply = redis.call('HSCAN', ns .. 'archived', ARGV[3], 'COUNT', ARGV[4]) "
+    "local entries, freed = reply[2], 0 "
+    "for i = 1, #entries, 2 do "
+    "local s, v = entries[i], tonumber(entries[i + 1]) "
+    "local keep = false "
+    "for _, t in ipairs(gens) do t = tonumber(t) "
+    "if t >= v and t <= g then keep = true break end end "
+    "if not keep then "
+    "local key = ns .. s "
+    "if string.sub(s, 1, 5) == 'refs:' then "
+    "for _, h in ipairs(redis.call('HVALS', key)) do "
+    "if redis.call('HINCRBY', p .. '::blob:' .. h, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', p .. '::blob_gc', h) end end end "
+    "freed = freed + redis.call('DEL', key) "
+    "redis.call('HDEL', ns .. 'archived', s) "
+    "end end "
+    "if reply[1] == '0' and redis.call('EXISTS', ns .. 'archived') == 0 then "
+    "redis.call('ZREM', p .. '::snapshot_gens', ARGV[2]) end "
+    "return { reply[1], tostring(freed) }";
+
+// ARGV: name
+static const char* listScript =
+    "return redis.call('HGETALL', ARGV[1] .. '::snapshots')";
+
+
+/*
+ * Select what keys are read from. With a view name, keys are read as of
+ * that snapshot and all writes fail; without one, the live file system is
+ * used.
+*/
+int loadSnapshots(const char* view)
+{
+    const char* args[2] = { fsName, view };
+    long long gen;
+
+    if (!view)
+    {
+        viewGen = -1;
+        return 0;
+    }
+
+    if (!redisCommand_EVAL_INT(loadScript, 0, args, 2, &gen))
+    {
+        return -EIO;
+    }
+    else if (gen < 0)
+    {
+        fprintf(stderr, "Error: No snapshot named '%s'.\n", view);
+        return -ENOENT;
+    }
+
+    viewGen = gen;
+
+    return 0;
+}
+
+
+static int runCowScript(const char* args[], int argCount)
+{
+    long long copied;
+
+    if (!redisCommand_EVAL_INT(cowScript, 0, args, argCount, &copied))
+    {
+        return -EIO;
+    }
+
+    statsAddCounter(STAT_COUNTER_SNAPSHOT_OBJECTS_COPIED, copied);
+
+    return 0;
+}
+
+
+/*
+ * Preserve the value of key for the snapshots, for a change the caller
+ * makes in a later round trip. Writes of the backend archive in their own
+ * scripts instead; a snapshot created in between is only seen by them.
+*/
+int cowKey(const char* key)
+{
+    const char* args[2] = { fsName, key + keyPrefixLen };
+
+    if (viewGen >= 0)
+    {
+        return -EROFS;
+    }
+
+    return runCowScript(args, 2);
+}
+
+
+/*
+ * cowKey() for count chunks of a file from first on, in one round trip.
+*/
+int cowChunks(node_id_t nodeId, long long first, long long count)
+{
+    char prefix[KEY_LEN];
+    char numbers[2][24];
+    const char* args[4] = { fsName, prefix + keyPrefixLen, numbers[0], numbers[1] };
+    size_t len;
+
+    if (viewGen >= 0)
+    {
+        return -EROFS;
+    }
+    else if (count <= 0)
+    {
+        return 0;
+    }
+
+    len = formatNodeKey(prefix, KEY_DATA, nodeId);
+    prefix[len++] = ':';
+    prefix[len] = '\0';
+    snprintf(numbers[0], sizeof(numbers[0]), "%lld", first);
+    snprintf(numbers[1], sizeof(numbers[1]), "%lld", count);
+
+    return runCowScript(args, 4);
+}
+
+
+/*
+ * Replace key by the key holding its value in the mounted snapshot. Keys
+ * of the live file system are left alone.
+*/
+int viewKey(char* key)
+{
+    char gen[24];
+    const char* args[3] = { fsName, gen, key + keyPrefixLen };
+    char* result;
+    size_t len;
+    int handle;
+
+    if (viewGen < 0)
+    {
+        return 0;
+    }
+
+    snprintf(gen, sizeof(gen), "%lld", viewGen);
+    handle = redisCommand_EVAL_STR(viewScript, 0, args, 3, &result, &len);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (!result || len >= KEY_LEN)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+
+    memcpy(key, result, len);
+    key[len] = '\0';
+
+    releaseReplyHandle(handle);
+
+    return 0;
+}
+
+
+/*
+ * Generation of the mounted snapshot, or -1 for the live file system.
+*/
+long long viewGeneration()
+{
+    return viewGen;
+}
+
+
+/*
+ * Create a snapshot of the live file system in constant time.
+*/
+int createSnapshot(const char* name)
+{
+    const char* args[2] = { fsName, name };
+    long long gen;
+
+    if (viewGen >= 0)
+    {
+        return -EROFS;
+    }
+
+    if (!redisCommand_EVAL_INT(createScript, 0, args, 2, &gen))
+    {
+        return -EIO;
+    }
+    else if (gen < 0)
+    {
+        return -EEXIST;
+    }
+
+    return 0;
+}
+
+
+// Free what no remaining snapshot reads from the archive of generation
+// gen, a batch per round trip. Returns the number of values freed:
+static int sweepArchive(const char* gen)
+{
+    char cursor[24] = "0";
+    char batch[24];
+    const char* args[4] = { fsName, gen, cursor, batch };
+    char* values[2];
+    int freed = 0;
+    int count;
+    int handle;
+
+    snprintf(batch, sizeof(batch), "%d", SNAPSHOT_SWEEP_BATCH);
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(sweepScript, 0, args, 4, &count);
+        if (!handle)
+        {
+            return -EIO;
+        }
+        else if (count != 2)
+        {
+            releaseReplyHandle(handle);
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 2, values);
+        snprintf(cursor, sizeof(cursor), "%s", values[0]);
+        freed += atoi(values[1]);
+
+        releaseReplyHandle(handle);
+    } while (0 != strcmp(cursor, "0"));
+
+    statsAddCounter(STAT_COUNTER_SNAPSHOT_OBJECTS_FREED, freed);
+
+    return freed;
+}
+
+
+/*
+ * Delete a snapshot, freeing the archived values only it used. Returns
+ * the number of values freed.
+*/
+int deleteSnapshot(const char* name)
+{
+    const char* args[2] = { fsName, name };
+    int freed = 0;
+    int result = 0;
+    int count;
+    int handle;
+    int i;
+
+    if (viewGen >= 0)
+    {
+        return -EROFS;
+    }
+
+    handle = redisCommand_EVAL_ARRAY(deleteScript, 0, args, 2, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (handle == 1)
+    {
+        return -ENOENT; // Nil reply.
+    }
+
+    {
+        char* gens[count + 1]; // count may be 0.
+        char genCopies[count + 1][24];
+
+        retrieveStringArrayElements(handle, 0, count, gens);
+        for (i = 0; i < count; ++i)
+        {
+            snprintf(genCopies[i], sizeof(genCopies[i]), "%s", gens[i]);
+        }
+        releaseReplyHandle(handle);
+
+        // Archives from the snapshot on may hold values only it read:
+        for (i = 0; i < count && result >= 0; ++i)
+        {
+            result = sweepArchive(genCopies[i]);
+            freed += result;
+        }
+    }
+
+    return result < 0 ? result : freed;
+}
+
+
+/*
+ * Call fn for every snapshot of the file system.
+*/
+int listSnapshots(snapshot_entry_fn fn, void* ctx)
+{
+    const char* args[1] = { fsName };
+    int count;
+    int handle;
+    int i;
+
+    handle = redisCommand_EVAL_ARRAY(listScript, 0, args, 1, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    if (count > 0)
+    {
+        char* fields[count];
+        retrieveStringArrayElements(handle, 0, count, fields);
+        for (i = 0; i + 1 < count; i += 2)
+        {
+            if (fn(ctx, fields[i], atoll(fields[i + 1])))
+            {
+                break;
+            }
+        }
+    }
+
+    releaseReplyHandle(handle);
+
+    return 0;
+}
+
+
+/* ================ Change journal ================ */
+
+/*
+ * Every change of the info or the entries of a node counts a generation
+ * and appends the node ID to a capped log, in the same script as the
+ * change, so that mounts caching metadata can tell what others changed:
+ *
+ *   <name>::meta_gen              Number of changes; absent means 0.
+ *   <name>::meta_log              List of the node IDs of the last 65536
+ *                                 changes, the newest last.
+ *
+ * The newest entry belongs to generation meta_gen, so the changes after
+ * generation g are the last meta_gen - g entries.
+*/
+
+// KEYS: generation, log; ARGV: node IDs.
+static const char* journalScript =
+    LUA_JOURNAL_FUNCTION
+    "for i = 1, #ARGV do journal(KEYS[1], KEYS[2], ARGV[i]) end "
+    "return 0";
+
+// KEYS: generation, log; ARGV: generation to read from. Returns the
+// generation, "1" if the log still holds every change since, and the IDs.
+static const char* readJournalScript =
+    "local g = tonumber(redis.call('GET', KEYS[1]) or '0') "
+    "local n = g - tonumber(ARGV[1]) "
+    "if n == 0 then return { tostring(g), '1' } end "
+    "if n < 0 or n > redis.call('LLEN', KEYS[2]) then return { tostring(g), '0' } end "
+    "local reply = redis.call('LRANGE', KEYS[2], -n, -1) "
+    "table.insert(reply, 1, '1') "
+    "table.insert(reply, 1, tostring(g)) "
+    "return reply";
+
+
+/*
+ * Record changes made outside the backend, such as by the tools.
+*/
+int journalChanges(const node_id_t ids[], int count)
+{
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char idStrs[count][24];
+    const char* args[count + 2];
+    int i;
+
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    args[0] = genKey;
+    args[1] = logKey;
+    for (i = 0; i < count; ++i)
+    {
+        snprintf(idStrs[i], sizeof(idStrs[i]), "%lld", ids[i]);
+        args[i + 2] = idStrs[i];
+    }
+
+    return redisCommand_EVAL_INT(journalScript, 2, args, count + 2, NULL) ? 0 : -EIO;
+}
+
+
+/*
+ * Call fn for every node changed after generation since, and set gen to
+ * the current generation. Returns 1, or 0 without calling fn if the log
+ * no longer reaches back to since.
+*/
+int readJournal(long long since, long long* gen, void (*fn)(void* ctx, node_id_t nodeId), void* ctx)
+{
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char sinceStr[24];
+    const char* args[3] = { genKey, logKey, sinceStr };
+    char* idStr;
+    int complete;
+    int count;
+    int handle;
+    int i;
+
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    snprintf(sinceStr, sizeof(sinceStr), "%lld", since);
+
+    handle = redisCommand_EVAL_ARRAY(readJournalScript, 2, args, 3, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count < 2)
+    {
+        releaseReplyHandle(handle);
+        return -EIO;
+    }
+
+    retrieveStringArrayElements(handle, 0, 1, &idStr);
+    *gen = atoll(idStr);
+    retrieveStringArrayElements(handle, 1, 1, &idStr);
+    complete = atoi(idStr);
+    for (i = 2; i < count && complete; ++i)
+    {
+        retrieveStringArrayElements(handle, i, 1, &idStr);
+        fn(ctx, atoll(idStr));
+    }
+
+    releaseReplyHandle(handle);
+
+    return complete;
+}
@@ -12,21 +12,368 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+#include <stddef.h>
+
 #include "redifs_types.h"
+#include "backend.h"
 
 
 /* ---- Defines ---- */
 #define KEY_NODE_ID_CTR "node_id_ctr"
+#define KEY_LEN 1024
+#define KEY_PREFIX_MAX_LEN (KEY_LEN - 64)
+
+// Key kinds, see backend_redis.c for the layout:
+#define KEY_INFO "info"
+#define KEY_NODE "node"
+#define KEY_DATA "data"
+#define KEY_REFS "refs"
+#define KEY_COLD "cold"
+#define KEY_BLOB "blob:" // Followed by the chunk hash.
+#define KEY_BLOB_GC "blob_gc"
+#define KEY_ORPHANS "orphans"
+#define KEY_WALK_CTR "walk_ctr"
+#define KEY_WALK "walk"
+#define KEY_ID_LEASES "id_leases"
+#define KEY_META_GEN "meta_gen"
+#define KEY_META_LOG "meta_log"
+#define KEY_BLOOM "bloom"
+#define KEY_BLOOMS "blooms"
+#define KEY_PARENTS "parents"
+#define KEY_USAGE "usage"
+#define KEY_QUOTAS "quotas"
+
+#define SNAPSHOT_SWEEP_BATCH 1024 // Archived values checked per round trip.
+#define TREE_WALK_EXPIRE_SECONDS 600 // Lifetime of an abandoned tree walk.
+#define DIR_BUCKET_ENTRIES 4096 // Entries of a directory bucket that make the directory split its next bucket.
+#define DIR_SCAN_BATCH 1024 // Directory entries per round trip of a listing.
+#define DIR_CURSOR_LEN 48 // "<bucket>:<HSCAN cursor>"
+#define DIR_BLOOM_MAX_ENTRIES 16384 // Larger directories have no bloom filter.
+#define DIR_BLOOM_HASHES 6 // Bits set per name, here and in LUA_DIR_BLOOM_FUNCTIONS.
+
+
+/* ---- Lua ---- */
+
+// Numbers the scripts share with C, spelled out in script text by
+// LUA_STR(). util.c checks them against backend.h and <sys/stat.h>.
+#define LUA_STR_(x) #x
+#define LUA_STR(x) LUA_STR_(x)
+#define LUA_INFO_ACCESS_TIME 3 // NODE_INFO_ACCESS_TIME_SEC, then the nanoseconds.
+#define LUA_INFO_MOD_TIME 5 // NODE_INFO_MOD_TIME_SEC, then the nanoseconds.
+#define LUA_INFO_SIZE 7 // NODE_INFO_SIZE
+#define LUA_INFO_FLAGS 8 // NODE_INFO_FLAGS
+#define LUA_INFO_COUNT 9 // NODE_INFO_COUNT
+#define LUA_MODE_TYPE_UNIT 4096 // Lowest bit of S_IFMT.
+#define LUA_MODE_TYPES 16 // S_IFMT / LUA_MODE_TYPE_UNIT + 1
+#define LUA_MODE_TYPE_DIR 4 // S_IFDIR / LUA_MODE_TYPE_UNIT
+#define LUA_MODE_TYPE_REG 8 // S_IFREG / LUA_MODE_TYPE_UNIT
+
+// Lua expressions: whether the Lua expression mode is the mode of a file
+// of the given LUA_MODE_TYPE_*, or of a directory.
+#define LUA_MODE_IS(mode, type) \
+    "(math.floor(" mode " / " LUA_STR(LUA_MODE_TYPE_UNIT) ") % " LUA_STR(LUA_MODE_TYPES) " == " LUA_STR(type) ")"
+#define LUA_MODE_IS_DIR(mode) LUA_MODE_IS(mode, LUA_MODE_TYPE_DIR)
+
+// Lua function view(name, gen, suffix) giving the key that holds the value
+// of key suffix in the snapshot of generation gen, for scripts that read
+// snapshots. A value the snapshot does not have maps to its own, empty,
+// archive key. See util.c for the layout.
+#define LUA_VIEW_FUNCTION \
+    "local function view(p, s, suffix) " \
+    "local own = p .. '@' .. s .. '::' .. suffix " \
+    "for _, g in ipairs(redis.call('ZRANGEBYSCORE', p .. '::snapshot_gens', s, '+inf')) do " \
+    "local ns = p .. '@' .. g .. '::' " \
+    "local v = redis.call('HGET', ns .. 'archived', suffix) " \
+    "if v then " \
+    "if tonumber(v) <= s then return ns .. suffix end " \
+    "return own end " \
+    "end " \
+    "if tonumber(redis.call('HGET', p .. '::stamps', suffix) or '0') <= s then " \
+    "return p .. '::' .. suffix end " \
+    "return own end "
+
+// Lua functions preserving the value of a key for the snapshots, see
+// util.c. Every script that changes a key of the live file system calls
+// one first, so that the generation it checks is the one the change is
+// made in:
+//   cow(p, s): archive key suffix s of file system p. Returns 1 if the
+//     value was archived.
+//   cowAt(pre, key): the same for the whole key and its prefix pre,
+//     "<name>::".
+#define LUA_COW_FUNCTION \
+    "local cowGen, cowGens " \
+    "local function cow(p, s) " \
+    "if not cowGens then " \
+    "cowGen = tonumber(redis.call('GET', p .. '::gen') or '0') " \
+    "cowGens = redis.call('HVALS', p .. '::snapshots') end " \
+    "if #cowGens == 0 then return 0 end " \
+    "local stamps = p .. '::stamps' " \
+    "local stamp = tonumber(redis.call('HGET', stamps, s) or '0') " \
+    "if stamp >= cowGen then return 0 end " \
+    "local target, copied = -1, 0 " \
+    "for _, g in ipairs(cowGens) do g = tonumber(g) " \
+    "if g >= stamp and g < cowGen and g > target then target = g end end " \
+    "local key = p .. '::' .. s " \
+    "if target >= 0 and redis.call('EXISTS', key) == 1 then " \
+    "local ns = p .. '@' .. target .. '::' " \
+    "if redis.call('HSETNX', ns .. 'archived', s, stamp) == 1 then " \
+    "redis.call('RESTORE', ns .. s, 0, redis.call('DUMP', key), 'REPLACE') " \
+    "if string.sub(s, 1, 5) == 'refs:' then " \
+    "for _, h in ipairs(redis.call('HVALS', key)) do " \
+    "redis.call('HINCRBY', p .. '::blob:' .. h, 'refs', 1) end end " \
+    "redis.call('ZADD', p .. '::snapshot_gens', target, target) " \
+    "copied = 1 end end " \
+    "redis.call('HSET', stamps, s, cowGen) " \
+    "return copied end " \
+    "local function cowAt(pre, key) return cow(string.sub(pre, 1, -3), string.sub(key, #pre + 1)) end "
+
+// Lua functions reading directories, whose entries are spread over
+// buckets by name hash once they grow, see util.c. bk(b) gives the key of
+// bucket b of a directory, bucket 0 being the directory key itself:
+//   dirBuckets(k): bk of the live directory key k.
+//   dirBucket(bk, name): the bucket of entry name.
+//   dirFind(bk, name): the node ID of entry name, or false.
+//   dirScan(bk, cursor, count): { next cursor, name, node ID, ... } for
+//     about count entries from cursor on; cursors start and end at "0".
+#define LUA_DIR_FUNCTIONS \
+    "local function dirHash(name) " \
+    "local h = 0 " \
+    "for i = 1, #name do h = (h * 31 + string.byte(name, i)) % 2147483647 end " \
+    "return h end " \
+    "local function dirSlot(n, name) " \
+    "if n < 2 then return 0 end " \
+    "local m = 1 while m * 2 <= n do m = m * 2 end " \
+    "local h = dirHash(name) " \
+    "local b = h % (2 * m) " \
+    "if b >= n then b = h % m end " \
+    "return b end " \
+    "local function dirBuckets(k) " \
+    "return function(b) if b == 0 then return k end return k .. ':' .. b end end " \
+    "local function dirCount(bk) return tonumber(redis.call('HGET', bk(0), '/buckets') or '1') end " \
+    "local function dirBucket(bk, name) return dirSlot(dirCount(bk), name) end " \
+    "local function dirFind(bk, name) " \
+    "local v = redis.call('HMGET', bk(0), name, '/buckets') " \
+    "if v[1] or not v[2] then return v[1] end " \
+    "local b = dirSlot(tonumber(v[2]), name) " \
+    "return b > 0 and redis.call('HGET', bk(b), name) end " \
+    "local function dirScan(bk, cursor, count) " \
+    "local b, c = string.match(cursor, '^(%d+):(%d+)$') " \
+    "b, c = tonumber(b or '0'), c or cursor " \
+    "local n = dirCount(bk) " \
+    "local out = { '0' } " \
+    "while b < n and #out <= count * 2 do " \
+    "local reply = redis.call('HSCAN', bk(b), c, 'COUNT', count) " \
+    "for i = 1, #reply[2], 2 do " \
+    "if reply[2][i] ~= '/buckets' then " \
+    "out[#out + 1] = reply[2][i] " \
+    "out[#out + 1] = reply[2][i + 1] end end " \
+    "c = reply[1] " \
+    "if c == '0' then b = b + 1 end end " \
+    "if b < n then out[1] = b .. ':' .. c end " \
+    "return out end "
+
+// Lua function dirViewBuckets(p, gen, id) giving bk of directory id of
+// file system p as the snapshot of generation gen sees it, or live for
+// gen -1. Needs LUA_VIEW_FUNCTION and LUA_DIR_FUNCTIONS before it.
+#define LUA_DIR_VIEW_FUNCTION \
+    "local function dirViewBuckets(p, g, id) " \
+    "local s = 'node:' .. id " \
+    "return function(b) " \
+    "local sb = b == 0 and s or s .. ':' .. b " \
+    "if g < 0 then return p .. '::' .. sb end " \
+    "return view(p, g, sb) end end "
+
+// Lua functions for the bloom filters of entry names, after
+// LUA_DIR_FUNCTIONS. The filter "<name>::bloom:<id>" of a live directory
+// has DIR_BLOOM_HASHES bits set per name, and the hash "<name>::blooms"
+// counts the names added to or removed from it; once they pass a tenth of
+// its bits the filter is dropped, to be built again on demand:
+//   dirBloom(k, max): the filter of directory k, built if needed, or
+//     false for a directory of more than max entries.
+//   dirBloomNote(k, name): add name to the filter of directory k, or
+//     count a removal without a name.
+#define LUA_DIR_BLOOM_FUNCTIONS \
+    "local function dirBloomBits(name, bits) " \
+    "local h1, h2 = 0, 0 " \
+    "for i = 1, #name do " \
+    "local c = string.byte(name, i) " \
+    "h1 = (h1 * 31 + c) % 2147483647 " \
+    "h2 = (h2 * 131 + c) % 2147483629 end " \
+    "local out = {} " \
+    "for j = 0, " LUA_STR(DIR_BLOOM_HASHES) " - 1 do out[j + 1] = (h1 + j * h2) % bits end " \
+    "return out end " \
+    "local function dirBloomKeys(k) " \
+    "local p, id = string.match(k, '^(.*)::node:(%d+)$') " \
+    "return p .. '::bloom:' .. id, p .. '::blooms', id end " \
+    "local function dirBloom(k, max) " \
+    "local key, counts, id = dirBloomKeys(k) " \
+    "local bloom = redis.call('GET', key) " \
+    "if bloom then return bloom end " \
+    "local bk = dirBuckets(k) " \
+    "local n, size = dirCount(bk), 0 " \
+    "for b = 0, n - 1 do " \
+    "size = size + redis.call('HLEN', bk(b)) " \
+    "if size > max + 1 then return false end end " \
+    "if n > 1 then size = size - 1 end " \
+    "if size > max then return false end " \
+    "local bits = 1024 " \
+    "while bits < (2 * size + 64) * 10 do bits = bits * 2 end " \
+    "local bytes = {} " \
+    "for i = 1, bits / 8 do bytes[i] = 0 end " \
+    "local entries = dirScan(bk, '0', max + 1) " \
+    "for i = 2, #entries, 2 do " \
+    "for _, o in ipairs(dirBloomBits(entries[i], bits)) do " \
+    "local byte, mask = math.floor(o / 8) + 1, 2 ^ (7 - o % 8) " \
+    "if math.floor(bytes[byte] / mask) % 2 == 0 then bytes[byte] = bytes[byte] + mask end end end " \
+    "local parts = {} " \
+    "for i = 1, #bytes, 4096 do parts[#parts + 1] = string.char(unpack(bytes, i, math.min(i + 4095, #bytes))) end " \
+    "bloom = table.concat(parts) " \
+    "redis.call('SET', key, bloom) " \
+    "redis.call('HSET', counts, id, size) " \
+    "return bloom end " \
+    "local function dirBloomNote(k, name) " \
+    "local key, counts, id = dirBloomKeys(k) " \
+    "local bits = redis.call('STRLEN', key) * 8 " \
+    "if bits == 0 then return end " \
+    "if name then for _, o in ipairs(dirBloomBits(name, bits)) do redis.call('SETBIT', key, o, 1) end end " \
+    "if redis.call('HINCRBY', counts, id, 1) * 10 > bits then " \
+    "redis.call('DEL', key) " \
+    "redis.call('HDEL', counts, id) end end "
+
+// Lua functions changing live directories, after LUA_COW_FUNCTION,
+// LUA_DIR_FUNCTIONS and LUA_DIR_BLOOM_FUNCTIONS. Buckets other than the
+// directory key are preserved for the snapshots here, the directory key
+// is left to the caller:
+//   dirEntryKey(k, name): the key of the bucket of entry name.
+//   dirEmpty(k): whether directory k has no entries.
+//   dirLink(k, name, id, max): add or replace an entry, noting it in the
+//     bloom filter.
+//   dirGrow(k, key, max): split the next bucket once bucket key holds
+//     more than max entries.
+#define LUA_DIR_WRITE_FUNCTIONS \
+    "local function dirCow(k, key) " \
+    "if key == k then return end " \
+    "local p = string.match(k, '^(.*)::node:%d+$') " \
+    "cow(p, string.sub(key, #p + 3)) end " \
+    "local function dirEntryKey(k, name) " \
+    "local key = dirBuckets(k)(dirBucket(dirBuckets(k), name)) " \
+    "dirCow(k, key) " \
+    "return key end " \
+    "local function dirEmpty(k) " \
+    "local n = tonumber(redis.call('HGET', k, '/buckets') or '0') " \
+    "if redis.call('HLEN', k) > math.min(n, 1) then return false end " \
+    "for b = 1, n - 1 do if redis.call('EXISTS', k .. ':' .. b) == 1 then return false end end " \
+    "return true end " \
+    "local function dirGrow(k, key, max) " \
+    "if redis.call('HLEN', key) <= max then return end " \
+    "local bk = dirBuckets(k) " \
+    "local n = dirCount(bk) " \
+    "local m = 1 while m * 2 <= n do m = m * 2 end " \
+    "local from, to = bk(n - m), bk(n) " \
+    "dirCow(k, from) dirCow(k, to) " \
+    "local entries = redis.call('HGETALL', from) " \
+    "for i = 1, #entries, 2 do " \
+    "if entries[i] ~= '/buckets' and dirHash(entries[i]) % (2 * m) == n then " \
+    "redis.call('HSET', to, entries[i], entries[i + 1]) " \
+    "redis.call('HDEL', from, entries[i]) end end " \
+    "redis.call('HSET', k, '/buckets', n + 1) end " \
+    "local function dirLink(k, name, id, max) " \
+    "local key = dirEntryKey(k, name) " \
+    "if redis.call('HSET', key, name, id) == 1 then dirBloomNote(k, name) end " \
+    "dirGrow(k, key, max) end "
+
+// Lua function infoPad(key) filling the info of a node created before it
+// had all NODE_INFO_COUNT fields up with zeros, so every field can be set.
+// The info of a removed node stays missing.
+#define LUA_INFO_PAD_FUNCTION \
+    "local function infoPad(key) " \
+    "local n = redis.call('LLEN', key) " \
+    "if n > 0 then for i = n, " LUA_STR(LUA_INFO_COUNT) " - 1 do redis.call('RPUSH', key, '0') end end end "
+
+// Lua function journal(gen key, log key, id) recording a change of the info
+// or the entries of node id in the change journal, see util.c. The log
+// keeps the last 65536 IDs.
+#define LUA_JOURNAL_FUNCTION \
+    "local function journal(gk, lk, id) " \
+    "redis.call('INCR', gk) " \
+    "if redis.call('RPUSH', lk, id) > 65536 then redis.call('LTRIM', lk, 1, -1) end end "
+
+// Lua functions keeping the usage of directories, for p "<name>::". The
+// hash "<name>::parents" maps every linked node but the root to its
+// directory, and the hash "<name>::usage:<id>" of a directory holds the
+// "bytes" and "inodes" of all nodes below it, and the "max_bytes" and
+// "max_inodes" of its quota, if any. Bytes are file sizes.
+//   usageChain(p, id): the directory IDs from id up to the root.
+//   usageOf(p, id): the bytes and inodes node id adds to its directory,
+//     its own and those below it.
+//   usageFits(p, from, to, bytes, inodes): whether moving usage from the
+//     chain of directory from to that of directory to stays within the
+//     quotas; either may be false.
+//   usageMove(p, from, to, bytes, inodes): move usage between the chains.
+//     Only the directories below their common ancestor change.
+#define LUA_USAGE_FUNCTIONS \
+    "local function usageChain(p, id) " \
+    "local chain = {} " \
+    "while id and #chain < 4096 do " \
+    "chain[#chain + 1] = id " \
+    "if id == '0' then break end " \
+    "id = redis.call('HGET', p .. 'parents', id) end " \
+    "return chain end " \
+    "local function usageOf(p, id) " \
+    "local f = redis.call('LRANGE', p .. 'info:' .. id, 0, " LUA_STR(LUA_INFO_SIZE) ") " \
+    "if not " LUA_MODE_IS_DIR("tonumber(f[1] or '0')") " then " \
+    "return tonumber(f[" LUA_STR(LUA_INFO_SIZE) " + 1] or '0'), 1 end " \
+    "local u = redis.call('HMGET', p .. 'usage:' .. id, 'bytes', 'inodes') " \
+    "return tonumber(u[1] or '0'), tonumber(u[2] or '0') + 1 end " \
+    "local function usageSplit(p, from, to) " \
+    "local old, new, shared = from and usageChain(p, from) or {}, to and usageChain(p, to) or {}, {} " \
+    "for _, id in ipairs(old) do shared[id] = true end " \
+    "for i, id in ipairs(new) do if shared[id] then " \
+    "for j, o in ipairs(old) do if o == id then return { unpack(old, 1, j - 1) }, { unpack(new, 1, i - 1) } end end " \
+    "end end " \
+    "return old, new end " \
+    "local function usageFits(p, from, to, bytes, inodes) " \
+    "if bytes <= 0 and inodes <= 0 then return true end " \
+    "local _, new = usageSplit(p, from, to) " \
+    "for _, id in ipairs(new) do " \
+    "local u = redis.call('HMGET', p .. 'usage:' .. id, 'bytes', 'inodes', 'max_bytes', 'max_inodes') " \
+    "if (u[3] and bytes > 0 and tonumber(u[1] or '0') + bytes > tonumber(u[3])) " \
+    "or (u[4] and inodes > 0 and tonumber(u[2] or '0') + inodes > tonumber(u[4])) then return false end end " \
+    "return true end " \
+    "local function usageMove(p, from, to, bytes, inodes) " \
+    "if bytes == 0 and inodes == 0 then return end " \
+    "local old, new = usageSplit(p, from, to) " \
+    "for _, id in ipairs(old) do " \
+    "redis.call('HINCRBY', p .. 'usage:' .. id, 'bytes', -bytes) " \
+    "redis.call('HINCRBY', p .. 'usage:' .. id, 'inodes', -inodes) end " \
+    "for _, id in ipairs(new) do " \
+    "redis.call('HINCRBY', p .. 'usage:' .. id, 'bytes', bytes) " \
+    "redis.call('HINCRBY', p .. 'usage:' .. id, 'inodes', inodes) end end "
 
 
 /* ================ Util functions ================ */
 
-extern node_id_t createUniqueNodeId();
-extern node_id_t retrievePathNodeId(const char* path);
+extern int setKeyPrefix(const char* name);
+extern size_t formatKey(char* key, const char* suffix);
+extern size_t formatNodeKey(char* key, const char* kind, node_id_t nodeId);
+extern size_t formatChunkKey(char* key, node_id_t nodeId, long long chunk);
+extern node_id_t retrievePathNodeId(const char* path, size_t len);
 extern int checkFileSystemExists();
 extern int createFileSystem();
 extern long long retrieveNodeInfo(node_id_t nodeId, int index);
 
+extern int loadSnapshots(const char* view);
+extern int cowKey(const char* key);
+extern int cowChunks(node_id_t nodeId, long long first, long long count);
+extern int viewKey(char* key);
+extern long long viewGeneration();
+extern int createSnapshot(const char* name);
+extern int deleteSnapshot(const char* name);
+extern int listSnapshots(snapshot_entry_fn fn, void* ctx);
+
+extern int journalChanges(const node_id_t ids[], int count);
+extern int readJournal(long long since, long long* gen, void (*fn)(void* ctx, node_id_t nodeId), void* ctx);
+
 
 #endif // _UTIL_H_
 
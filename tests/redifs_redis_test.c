@@ -0,0 +1,1215 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Tests of the Redis backend. Like redifs_test, they call the redifs_oper
+ * callbacks directly, but against a Redis server, for what only the Redis
+ * backend does and for what other clients of the same file system may do
+ * in between. Other clients are forked processes with connections of
+ * their own, or the tools, which run when -x names the directory they
+ * were built in. Run through tests/run_redis_tests.sh, which starts a
+ * throwaway server; every run creates a file system of its own.
+*/
+
+
+/* ---- Includes ---- */
+#include <fuse.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+
+#include "options.h"
+#include "backend.h"
+#include "blockcache.h"
+#include "compress.h"
+#include "connection.h"
+#include "control.h"
+#include "dedup.h"
+#include "metacache.h"
+#include "operations.h"
+#include "reclaim.h"
+#include "stats.h"
+#include "tier.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define NAME_LEN 64
+#define PATH_LEN 4096
+#define BUF_SIZE (3 * CHUNK_SIZE)
+#define TAR_BLOCK 512
+#define EXPORT_BIG_SIZE (40LL * BUF_SIZE) // Larger than what the export buffers ahead.
+#define STATUS_LEN 4096
+#define TEST_CACHE_SIZE_MB 8
+#define TEST_CACHE_TTL_MS (60 * 1000) // Longer than the tests run, so only they read the journal.
+
+
+/* ---- Macros ---- */
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+#define CHECK_RESULT(expr, expected) checkResult((expr), (expected), #expr, __FILE__, __LINE__)
+#define CONTROL_PATH(name) CONTROL_DIR_PATH "/" name
+
+
+/* ---- Globals ---- */
+static int checks = 0;
+static int failures = 0;
+static char bufA[BUF_SIZE];
+static char bufB[BUF_SIZE];
+static char status[STATUS_LEN];
+static const char* toolsDir = NULL;
+
+
+/* ================ Checks ================ */
+
+static void check(int ok, const char* expr, const char* file, int line)
+{
+    ++checks;
+    if (!ok)
+    {
+        ++failures;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    }
+}
+
+
+static void checkResult(long long result, long long expected, const char* expr, const char* file, int line)
+{
+    ++checks;
+    if (result != expected)
+    {
+        ++failures;
+        fprintf(stderr, "%s:%d: %s returned %lld, expected %lld\n", file, line, expr, result, expected);
+    }
+}
+
+
+/* ================ Helpers ================ */
+
+static int create(const char* path)
+{
+    return redifs_oper.mknod(path, S_IFREG | 0644, 0);
+}
+
+
+static int writeFile(const char* path, const char* buf, size_t size, off_t offset, int flags)
+{
+    struct fuse_file_info fileInfo;
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_WRONLY | flags;
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.write(path, buf, size, offset, &fileInfo);
+    redifs_oper.release(path, &fileInfo);
+
+    return result;
+}
+
+
+static int readFile(const char* path, char* buf, size_t size, off_t offset)
+{
+    struct fuse_file_info fileInfo;
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDONLY;
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.read(path, buf, size, offset, &fileInfo);
+    redifs_oper.release(path, &fileInfo);
+
+    return result;
+}
+
+
+static long long fileSize(const char* path)
+{
+    struct stat st;
+    int result;
+
+    result = redifs_oper.getattr(path, &st, NULL);
+
+    return result < 0 ? result : st.st_size;
+}
+
+
+// Fill buf with a pattern that differs per offset and seed:
+static void fillPattern(char* buf, size_t size, off_t offset, int seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        buf[i] = (char)((offset + i) * 31 + seed);
+    }
+}
+
+
+// Fill count chunks of buf with a pattern of a seed of their own:
+static void fillChunks(char* buf, int count, int seed)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        fillPattern(buf + (size_t)i * CHUNK_SIZE, CHUNK_SIZE, 0, seed + i);
+    }
+}
+
+
+static long long fileFlags(const char* path)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    int result;
+
+    nodeId = g_backend->resolve(path, strlen(path));
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    result = g_backend->get_info(nodeId, info);
+
+    return result < 0 ? result : info[NODE_INFO_FLAGS];
+}
+
+
+// Write a query to a control file and read its output into status:
+static int controlQuery(const char* path, const char* query)
+{
+    struct fuse_file_info fileInfo;
+    size_t len = strlen(query);
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDWR;
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.write(path, query, len, 0, &fileInfo);
+    if (result >= 0)
+    {
+        result = redifs_oper.read(path, status, STATUS_LEN - 1, len, &fileInfo);
+    }
+    status[result < 0 ? 0 : result] = '\0';
+    redifs_oper.release(path, &fileInfo);
+
+    return result;
+}
+
+
+// Read a control file into status, as a string:
+static int readControl(const char* path)
+{
+    int result;
+
+    result = readFile(path, status, STATUS_LEN - 1, 0);
+    status[result < 0 ? 0 : result] = '\0';
+
+    return result;
+}
+
+
+// Value of the line "<key> <value>" in status, or -1:
+static long long statusValue(const char* key)
+{
+    size_t len = strlen(key);
+    const char* line = status;
+
+    while (line)
+    {
+        if (0 == strncmp(line, key, len) && line[len] == ' ')
+        {
+            return strtoll(line + len + 1, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line)
+        {
+            ++line;
+        }
+    }
+
+    return -1;
+}
+
+
+// A path in the temporary directory for a file of this run:
+static void tempPath(char* path, const char* suffix)
+{
+    const char* dir = getenv("TMPDIR");
+
+    snprintf(path, PATH_LEN, "%s/%s.%s", dir ? dir : "/tmp", g_settings->name, suffix);
+}
+
+
+static void removeTree(const char* path)
+{
+    char child[PATH_LEN];
+    struct dirent* entry;
+    DIR* dir;
+
+    dir = opendir(path);
+    if (dir)
+    {
+        while (NULL != (entry = readdir(dir)))
+        {
+            if (0 != strcmp(entry->d_name, ".") && 0 != strcmp(entry->d_name, ".."))
+            {
+                snprintf(child, PATH_LEN, "%s/%s", path, entry->d_name);
+                removeTree(child);
+            }
+        }
+        closedir(dir);
+    }
+
+    remove(path);
+}
+
+
+// Free the removed nodes, with the reclaim thread stopped:
+static void reclaimAll()
+{
+    while (reclaimBatch(RECLAIM_BATCH) > 0)
+    {
+    }
+}
+
+
+// Run a script on the key "<name>::<suffix>" for a number:
+static long long evalOnKey(const char* script, const char* suffix)
+{
+    char key[KEY_LEN];
+    const char* args[1] = { key };
+    long long value;
+
+    formatKey(key, suffix);
+
+    return redisCommand_EVAL_INT(script, 1, args, 1, &value) ? value : -EIO;
+}
+
+
+static long long nodeCounter()
+{
+    return evalOnKey("return tonumber(redis.call('GET', KEYS[1]) or '0')", KEY_NODE_ID_CTR);
+}
+
+
+static long long orphanCount()
+{
+    return evalOnKey("return redis.call('LLEN', KEYS[1])", KEY_ORPHANS);
+}
+
+
+// Reference count of the blob of a chunk of data, or -1 once it is gone:
+static long long blobRefs(const char* data, size_t len)
+{
+    char hash[CHUNK_HASH_LEN + 1];
+    char suffix[KEY_LEN];
+
+    hashChunk(data, len, hash);
+    snprintf(suffix, KEY_LEN, KEY_BLOB "%s", hash);
+
+    return evalOnKey("return tonumber(redis.call('HGET', KEYS[1], 'refs') or '-1')", suffix);
+}
+
+
+static long long chunkExists(node_id_t nodeId, long long chunk)
+{
+    char key[KEY_LEN];
+    const char* args[1] = { key };
+    long long exists;
+
+    formatChunkKey(key, nodeId, chunk);
+
+    return redisCommand_EVAL_INT("return redis.call('EXISTS', KEYS[1])", 1, args, 1, &exists) ? exists : -EIO;
+}
+
+
+/*
+ * Run fn in a forked process, as another client of the file system, and
+ * return its exit status. The child drops the connection it inherited so
+ * that it talks to Redis over a connection of its own, and the caches,
+ * whose files it would otherwise change for this process too.
+*/
+static int otherClient(int (*fn)(void* ctx), void* ctx)
+{
+    pid_t pid;
+    int status;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0)
+    {
+        return -errno;
+    }
+    else if (pid == 0)
+    {
+        metaCacheClose();
+        blockCacheClose();
+        closeRedisConnection();
+        _exit(fn(ctx) < 0 ? 1 : 0);
+    }
+
+    if (pid != waitpid(pid, &status, 0))
+    {
+        return -errno;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+// Find the entry of name in the tar archive of len bytes:
+static const char* findTarEntry(const char* tar, size_t len, const char* name, long long* size)
+{
+    size_t offset = 0;
+    long long entrySize;
+
+    while (offset + TAR_BLOCK <= len && tar[offset] != '\0')
+    {
+        entrySize = strtoll(tar + offset + 124, NULL, 8);
+        if (0 == strncmp(tar + offset, name, 100))
+        {
+            *size = entrySize;
+            return tar + offset + TAR_BLOCK;
+        }
+        offset += TAR_BLOCK + (entrySize + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+
+    return NULL;
+}
+
+
+// Start the tool program with the arguments after the connection options,
+// with its standard output going to *fd:
+static pid_t startTool(const char* program, const char* args[], int* fd)
+{
+    const char* argv[16];
+    char path[PATH_LEN];
+    char port[16];
+    int pipeFds[2];
+    int argc = 0;
+    pid_t pid;
+
+    snprintf(path, PATH_LEN, "%s/%s", toolsDir, program);
+    snprintf(port, sizeof(port), "%d", (int)g_settings->port);
+    argv[argc++] = path;
+    if (g_settings->host)
+    {
+        argv[argc++] = "-h";
+        argv[argc++] = g_settings->host;
+    }
+    if (g_settings->port)
+    {
+        argv[argc++] = "-p";
+        argv[argc++] = port;
+    }
+    argv[argc++] = "-N";
+    argv[argc++] = g_settings->name;
+    while (*args && argc < 15)
+    {
+        argv[argc++] = *args++;
+    }
+    argv[argc] = NULL;
+
+    if (0 > pipe(pipeFds))
+    {
+        return -errno;
+    }
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0)
+    {
+        return -errno;
+    }
+    else if (pid == 0)
+    {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        execv(path, (char* const*)argv);
+        perror(path);
+        _exit(127);
+    }
+
+    close(pipeFds[1]);
+    *fd = pipeFds[0];
+
+    return pid;
+}
+
+
+// Read everything from fd into a buffer the caller frees:
+static char* readAll(int fd, size_t* len)
+{
+    size_t capacity = BUF_SIZE;
+    char* buf = malloc(capacity);
+    char* grown;
+    ssize_t n;
+
+    *len = 0;
+    while (buf && 0 < (n = read(fd, buf + *len, capacity - *len)))
+    {
+        *len += n;
+        if (*len == capacity)
+        {
+            capacity *= 2;
+            grown = realloc(buf, capacity);
+            if (!grown)
+            {
+                free(buf);
+            }
+            buf = grown;
+        }
+    }
+
+    return buf;
+}
+
+
+// Run the tool program to its end, and return its exit status:
+static int runTool(const char* program, const char* args[])
+{
+    size_t len;
+    int status;
+    int fd;
+    pid_t pid;
+
+    pid = startTool(program, args, &fd);
+    if (pid < 0)
+    {
+        return pid;
+    }
+
+    free(readAll(fd, &len));
+    close(fd);
+    if (pid != waitpid(pid, &status, 0))
+    {
+        return -errno;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+/* ================ Tests ================ */
+
+static int createSnapshotClient(void* ctx)
+{
+    return g_backend->snapshot_create((const char*)ctx);
+}
+
+
+/*
+ * A snapshot another client creates must be honoured by the writes of
+ * this mount straight away, without a remount.
+*/
+static void testSnapshotFromOtherClient()
+{
+    fillPattern(bufA, BUF_SIZE, 0, 11);
+
+    CHECK_RESULT(redifs_oper.mkdir("/snap", 0755), 0);
+    CHECK_RESULT(create("/snap/small"), 0);
+    CHECK_RESULT(writeFile("/snap/small", "before", 6, 0, 0), 6);
+    CHECK_RESULT(create("/snap/big"), 0);
+    CHECK_RESULT(writeFile("/snap/big", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(create("/snap/gone"), 0);
+
+    CHECK_RESULT(otherClient(createSnapshotClient, "other"), 0);
+
+    // Change everything through this mount:
+    CHECK_RESULT(writeFile("/snap/small", "after!", 6, 0, 0), 6);
+    CHECK_RESULT(writeFile("/snap/big", "x", 1, CHUNK_SIZE + 1, 0), 1);
+    CHECK_RESULT(writeFile("/snap/big", "tail", 4, 0, O_APPEND), 4);
+    CHECK_RESULT(redifs_oper.truncate("/snap/big", 10, NULL), 0);
+    CHECK_RESULT(redifs_oper.unlink("/snap/gone"), 0);
+    CHECK_RESULT(create("/snap/new"), 0);
+
+    // The snapshot still has the old contents:
+    CHECK_RESULT(loadSnapshots("other"), 0);
+    CHECK_RESULT(readFile("/snap/small", bufB, 6, 0), 6);
+    CHECK(0 == memcmp(bufB, "before", 6));
+    CHECK_RESULT(fileSize("/snap/big"), BUF_SIZE);
+    CHECK_RESULT(readFile("/snap/big", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(fileSize("/snap/gone"), 0);
+    CHECK_RESULT(fileSize("/snap/new"), -ENOENT);
+    CHECK_RESULT(create("/snap/ro"), -EROFS);
+
+    // The live file system has the new ones:
+    CHECK_RESULT(loadSnapshots(NULL), 0);
+    CHECK_RESULT(readFile("/snap/small", bufB, 6, 0), 6);
+    CHECK(0 == memcmp(bufB, "after!", 6));
+    CHECK_RESULT(fileSize("/snap/big"), 10);
+    CHECK_RESULT(readFile("/snap/big", bufB, 10, 0), 10);
+    CHECK(0 == memcmp(bufA, bufB, 10));
+    CHECK_RESULT(fileSize("/snap/gone"), -ENOENT);
+    CHECK_RESULT(fileSize("/snap/new"), 0);
+
+    CHECK(0 <= g_backend->snapshot_delete("other"));
+}
+
+
+/*
+ * A create that fails leaves neither a node nor an orphan behind, as the
+ * backend allocates, stores and links the node in one script.
+*/
+static void testCreateFailures()
+{
+    long long info[NODE_INFO_COUNT];
+    long long counter;
+    long long orphans;
+    node_id_t dirId;
+    node_id_t fileId;
+
+    memset(info, 0, sizeof(info));
+    info[NODE_INFO_MODE] = S_IFREG | 0644;
+
+    CHECK_RESULT(redifs_oper.mkdir("/crt", 0755), 0);
+    CHECK_RESULT(create("/crt/a"), 0);
+    dirId = g_backend->resolve("/crt", 4);
+    fileId = g_backend->resolve("/crt/a", 6);
+    CHECK(dirId > 0 && fileId > 0);
+    CHECK_RESULT(g_backend->dir_quota(dirId, 0, 2), 0);
+    CHECK_RESULT(create("/crt/b"), 0);
+
+    counter = nodeCounter();
+    orphans = orphanCount();
+    CHECK(counter > 0 && orphans >= 0);
+
+    CHECK_RESULT(create("/crt/a"), -EEXIST);
+    CHECK_RESULT(create("/crt/c"), -EDQUOT);
+    CHECK_RESULT(g_backend->create_node(fileId, "x", info), -ENOTDIR);
+    CHECK_RESULT(g_backend->create_node(counter + 1000, "x", info), -ENOENT);
+
+    CHECK_RESULT(nodeCounter(), counter);
+    CHECK_RESULT(orphanCount(), orphans);
+    CHECK_RESULT(fileSize("/crt/c"), -ENOENT);
+}
+
+
+/*
+ * The size of a file only grows through a write, whatever size the writer
+ * knew, and a quota refuses a write before any of its data is stored.
+*/
+static void testWriteGrowth()
+{
+    long long mtime[2] = { 1, 0 };
+    node_id_t dirId;
+    node_id_t nodeId;
+    off_t size;
+
+    fillPattern(bufA, BUF_SIZE, 0, 23);
+
+    CHECK_RESULT(redifs_oper.mkdir("/grow", 0755), 0);
+    CHECK_RESULT(create("/grow/f"), 0);
+    CHECK_RESULT(create("/grow/small"), 0);
+    dirId = g_backend->resolve("/grow", 5);
+    nodeId = g_backend->resolve("/grow/f", 7);
+    CHECK(dirId > 0 && nodeId > 0);
+
+    // A writer that knew an older, smaller end:
+    CHECK_RESULT(writeFile("/grow/f", bufA, 2 * CHUNK_SIZE, 0, 0), 2 * CHUNK_SIZE);
+    size = 10;
+    CHECK_RESULT(g_backend->file_extend(nodeId, mtime, &size), 0);
+    CHECK_RESULT(size, 2 * CHUNK_SIZE);
+    CHECK_RESULT(fileSize("/grow/f"), 2 * CHUNK_SIZE);
+    CHECK_RESULT(writeFile("/grow/f", "x", 1, 5, 0), 1);
+    CHECK_RESULT(fileSize("/grow/f"), 2 * CHUNK_SIZE);
+
+    // Past the quota nothing is stored and the size stays:
+    CHECK_RESULT(g_backend->dir_quota(dirId, 3 * CHUNK_SIZE, 0), 0);
+    CHECK_RESULT(writeFile("/grow/f", bufA, 2 * CHUNK_SIZE, 2 * CHUNK_SIZE, 0), -EDQUOT);
+    CHECK_RESULT(fileSize("/grow/f"), 2 * CHUNK_SIZE);
+    CHECK_RESULT(chunkExists(nodeId, 2), 0);
+    CHECK_RESULT(redifs_oper.truncate("/grow/f", 4 * CHUNK_SIZE, NULL), -EDQUOT);
+    CHECK_RESULT(fileSize("/grow/f"), 2 * CHUNK_SIZE);
+    CHECK_RESULT(writeFile("/grow/small", "inline", 6, CHUNK_SIZE, 0), -EDQUOT);
+    CHECK_RESULT(fileSize("/grow/small"), 0);
+    CHECK_RESULT(readFile("/grow/f", bufB, BUF_SIZE, 0), 2 * CHUNK_SIZE);
+    bufA[5] = 'x';
+    CHECK(0 == memcmp(bufA, bufB, 2 * CHUNK_SIZE));
+
+    // Up to the quota writes go on:
+    CHECK_RESULT(writeFile("/grow/f", bufA, CHUNK_SIZE, 2 * CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK_RESULT(fileSize("/grow/f"), 3 * CHUNK_SIZE);
+}
+
+
+/*
+ * redifs_export archives the file system as it was when it started, even
+ * though another client changes it while the export runs. The big file is
+ * exported first and stalls the export on the full pipe, before it has
+ * read the directory with the files that change.
+*/
+static void testExportWhileWriting()
+{
+    const char* args[] = { "/exp", NULL };
+    const char* entry;
+    char* tar;
+    char first;
+    size_t len;
+    long long size;
+    off_t offset;
+    int status;
+    int fd;
+    pid_t pid;
+    int ok;
+
+    if (!toolsDir)
+    {
+        printf("No tools directory given; skipping the export test.\n");
+        return;
+    }
+
+    fillPattern(bufA, BUF_SIZE, 0, 13);
+
+    CHECK_RESULT(redifs_oper.mkdir("/exp", 0755), 0);
+    CHECK_RESULT(create("/exp/big"), 0);
+    for (offset = 0; offset < EXPORT_BIG_SIZE; offset += BUF_SIZE)
+    {
+        fillPattern(bufB, BUF_SIZE, offset, 17);
+        CHECK_RESULT(writeFile("/exp/big", bufB, BUF_SIZE, offset, 0), BUF_SIZE);
+    }
+    CHECK_RESULT(redifs_oper.mkdir("/exp/sub", 0755), 0);
+    CHECK_RESULT(create("/exp/sub/small"), 0);
+    CHECK_RESULT(writeFile("/exp/sub/small", "before", 6, 0, 0), 6);
+    CHECK_RESULT(create("/exp/sub/data"), 0);
+    CHECK_RESULT(writeFile("/exp/sub/data", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(create("/exp/sub/gone"), 0);
+
+    pid = startTool("redifs_export", args, &fd);
+    CHECK(pid > 0);
+    if (pid <= 0)
+    {
+        return;
+    }
+
+    // Once the first block arrives, the export has taken its snapshot:
+    CHECK_RESULT(read(fd, &first, 1), 1);
+
+    fillPattern(bufB, BUF_SIZE, 0, 19);
+    CHECK_RESULT(writeFile("/exp/sub/small", "after!", 6, 0, 0), 6);
+    CHECK_RESULT(writeFile("/exp/sub/data", bufB, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(redifs_oper.truncate("/exp/sub/data", CHUNK_SIZE, NULL), 0);
+    CHECK_RESULT(redifs_oper.unlink("/exp/sub/gone"), 0);
+    CHECK_RESULT(create("/exp/sub/new"), 0);
+    CHECK_RESULT(writeFile("/exp/big", "x", 1, 0, O_APPEND), 1);
+
+    tar = readAll(fd, &len);
+    close(fd);
+    CHECK(pid == waitpid(pid, &status, 0) && WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    CHECK(tar != NULL);
+    if (!tar)
+    {
+        return;
+    }
+
+    // The first byte was read on its own:
+    memmove(tar + 1, tar, len);
+    tar[0] = first;
+    ++len;
+
+    entry = findTarEntry(tar, len, "sub/small", &size);
+    CHECK(entry && size == 6 && 0 == memcmp(entry, "before", 6));
+    entry = findTarEntry(tar, len, "sub/data", &size);
+    CHECK(entry && size == BUF_SIZE && 0 == memcmp(entry, bufA, BUF_SIZE));
+    entry = findTarEntry(tar, len, "sub/gone", &size);
+    CHECK(entry && size == 0);
+    CHECK(!findTarEntry(tar, len, "sub/new", &size));
+    entry = findTarEntry(tar, len, "big", &size);
+    CHECK(entry && size == EXPORT_BIG_SIZE);
+    for (offset = 0, ok = entry != NULL; ok && offset < EXPORT_BIG_SIZE; offset += BUF_SIZE)
+    {
+        fillPattern(bufB, BUF_SIZE, offset, 17);
+        ok = 0 == memcmp(entry + offset, bufB, BUF_SIZE);
+    }
+    CHECK(ok);
+
+    free(tar);
+}
+
+
+/*
+ * Every chunk of a deduplicated file holds a reference on its blob. The
+ * references go with the chunks, and blobs left without any are freed by
+ * the collector. The reclaim thread is stopped so that only the test
+ * frees the removed nodes.
+*/
+static void testDedupRefs()
+{
+    const char* x = bufA;
+    const char* y = bufA + CHUNK_SIZE;
+
+    fillChunks(bufA, 2, 29);
+    memcpy(bufA + 2 * CHUNK_SIZE, x, CHUNK_SIZE);
+
+    reclaimStop();
+
+    CHECK_RESULT(redifs_oper.mkdir("/dd", 0755), 0);
+    g_settings->dedup = 1;
+    CHECK_RESULT(create("/dd/a"), 0);
+    CHECK_RESULT(create("/dd/b"), 0);
+    g_settings->dedup = 0;
+
+    // Chunks x, y, x:
+    CHECK_RESULT(writeFile("/dd/a", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), 2);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), 1);
+    CHECK_RESULT(writeFile("/dd/b", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), 4);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), 2);
+
+    // An overwrite moves the reference of the chunk:
+    CHECK_RESULT(writeFile("/dd/b", y, CHUNK_SIZE, 0, 0), CHUNK_SIZE);
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), 3);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), 3);
+    CHECK_RESULT(readFile("/dd/b", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufB, y, CHUNK_SIZE) && 0 == memcmp(bufB + CHUNK_SIZE, y, CHUNK_SIZE));
+    CHECK(0 == memcmp(bufB + 2 * CHUNK_SIZE, x, CHUNK_SIZE));
+
+    // Freeing a file drops its references:
+    CHECK_RESULT(redifs_oper.unlink("/dd/a"), 0);
+    reclaimAll();
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), 1);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), 2);
+
+    // Blobs without references stay until they are collected:
+    CHECK_RESULT(redifs_oper.unlink("/dd/b"), 0);
+    reclaimAll();
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), 0);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), 0);
+    CHECK(dedupCollect(DEDUP_GC_BATCH) >= 2);
+    CHECK_RESULT(blobRefs(x, CHUNK_SIZE), -1);
+    CHECK_RESULT(blobRefs(y, CHUNK_SIZE), -1);
+
+    CHECK_RESULT(reclaimStart(), 0);
+}
+
+
+/*
+ * Snapshots taken through the control file keep what they saw, compressed
+ * files included, and deleting one leaves the others alone.
+*/
+static void testSnapshots()
+{
+    fillChunks(bufA, 3, 31);
+    fillChunks(bufB, 3, 37);
+
+    CHECK_RESULT(redifs_oper.mkdir("/cow", 0755), 0);
+    CHECK_RESULT(writeFile(CONTROL_PATH("compress"), "zstd /cow\n", 10, 0, 0), 10);
+    CHECK_RESULT(create("/cow/z"), 0);
+    CHECK_RESULT(writeFile("/cow/z", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(create("/cow/small"), 0);
+    CHECK_RESULT(writeFile("/cow/small", "one", 3, 0, 0), 3);
+
+    CHECK_RESULT(writeFile(CONTROL_PATH("snapshot"), "create s1\n", 10, 0, 0), 10);
+    CHECK_RESULT(writeFile("/cow/z", bufB + CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK_RESULT(writeFile("/cow/small", "two", 3, 0, 0), 3);
+    CHECK_RESULT(writeFile(CONTROL_PATH("snapshot"), "create s2\n", 10, 0, 0), 10);
+    CHECK_RESULT(redifs_oper.truncate("/cow/z", CHUNK_SIZE / 2, NULL), 0);
+    CHECK_RESULT(redifs_oper.unlink("/cow/small"), 0);
+
+    CHECK(readControl(CONTROL_PATH("snapshot")) > 0);
+    CHECK(statusValue("snapshot s1") >= 0 && statusValue("snapshot s2") > statusValue("snapshot s1"));
+
+    CHECK_RESULT(loadSnapshots("s1"), 0);
+    CHECK_RESULT(readFile("/cow/z", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(readFile("/cow/small", bufB, 3, 0), 3);
+    CHECK(0 == memcmp(bufB, "one", 3));
+
+    CHECK_RESULT(loadSnapshots("s2"), 0);
+    fillChunks(bufA, 3, 31);
+    fillChunks(bufB, 3, 37);
+    memcpy(bufA + CHUNK_SIZE, bufB + CHUNK_SIZE, CHUNK_SIZE);
+    CHECK_RESULT(readFile("/cow/z", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(readFile("/cow/small", bufB, 3, 0), 3);
+    CHECK(0 == memcmp(bufB, "two", 3));
+
+    CHECK_RESULT(loadSnapshots(NULL), 0);
+    CHECK_RESULT(fileSize("/cow/z"), CHUNK_SIZE / 2);
+    CHECK_RESULT(readFile("/cow/z", bufB, BUF_SIZE, 0), CHUNK_SIZE / 2);
+    CHECK(0 == memcmp(bufA, bufB, CHUNK_SIZE / 2));
+    CHECK_RESULT(fileSize("/cow/small"), -ENOENT);
+
+    // Deleting the older snapshot keeps the newer one intact:
+    CHECK_RESULT(writeFile(CONTROL_PATH("snapshot"), "delete s1\n", 10, 0, 0), 10);
+    CHECK(readControl(CONTROL_PATH("snapshot")) > 0);
+    CHECK_RESULT(statusValue("snapshot s1"), -1);
+    CHECK(statusValue("snapshot s2") > 0);
+    CHECK_RESULT(loadSnapshots("s2"), 0);
+    CHECK_RESULT(readFile("/cow/z", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(loadSnapshots(NULL), 0);
+
+    CHECK_RESULT(writeFile(CONTROL_PATH("snapshot"), "create bad name\n", 16, 0, 0), -EINVAL);
+    CHECK_RESULT(writeFile(CONTROL_PATH("snapshot"), "delete s2\n", 10, 0, 0), 10);
+}
+
+
+/*
+ * Quotas set through the control file refuse what would pass them, and a
+ * quota on the root directory is the size statfs reports.
+*/
+static void testQuotaStatfs()
+{
+    struct statvfs st;
+    long long bytes;
+    long long inodes;
+    char query[64];
+
+    fillPattern(bufA, BUF_SIZE, 0, 41);
+
+    CHECK_RESULT(redifs_oper.mkdir("/quota", 0755), 0);
+    CHECK_RESULT(create("/quota/f"), 0);
+    CHECK_RESULT(writeFile("/quota/f", bufA, CHUNK_SIZE, 0, 0), CHUNK_SIZE);
+
+    snprintf(query, sizeof(query), "set /quota %d 3\n", 2 * CHUNK_SIZE);
+    CHECK_RESULT(controlQuery(CONTROL_PATH("quota"), query), 0);
+    CHECK(controlQuery(CONTROL_PATH("quota"), "get /quota\n") > 0);
+    CHECK_RESULT(statusValue("max_bytes"), 2 * CHUNK_SIZE);
+    CHECK_RESULT(statusValue("max_inodes"), 3);
+    CHECK_RESULT(statusValue("bytes"), CHUNK_SIZE);
+    CHECK_RESULT(statusValue("inodes"), 1);
+
+    // A refused change leaves the size and the usage as they were:
+    CHECK_RESULT(writeFile("/quota/f", bufA, 2 * CHUNK_SIZE, CHUNK_SIZE, 0), -EDQUOT);
+    CHECK_RESULT(redifs_oper.truncate("/quota/f", 3 * CHUNK_SIZE, NULL), -EDQUOT);
+    CHECK_RESULT(fileSize("/quota/f"), CHUNK_SIZE);
+    CHECK(controlQuery(CONTROL_PATH("quota"), "get /quota\n") > 0);
+    CHECK_RESULT(statusValue("bytes"), CHUNK_SIZE);
+
+    // Up to the limits changes go on:
+    CHECK_RESULT(writeFile("/quota/f", bufA, CHUNK_SIZE, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK_RESULT(create("/quota/g"), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/quota/d", 0755), 0);
+    CHECK_RESULT(create("/quota/h"), -EDQUOT);
+    CHECK(controlQuery(CONTROL_PATH("quota"), "get /quota\n") > 0);
+    CHECK_RESULT(statusValue("bytes"), 2 * CHUNK_SIZE);
+    CHECK_RESULT(statusValue("inodes"), 3);
+
+    // A root quota of ten free blocks and five free nodes:
+    CHECK(controlQuery(CONTROL_PATH("quota"), "get /\n") > 0);
+    bytes = statusValue("bytes");
+    inodes = statusValue("inodes");
+    CHECK(bytes > 0 && inodes > 0);
+    snprintf(query, sizeof(query), "set / %lld %lld\n",
+             ((bytes + CHUNK_SIZE - 1) / CHUNK_SIZE + 10) * CHUNK_SIZE, inodes + 5);
+    CHECK_RESULT(controlQuery(CONTROL_PATH("quota"), query), 0);
+    CHECK_RESULT(redifs_oper.statfs("/", &st), 0);
+    CHECK_RESULT((long long)st.f_bfree, 10);
+    CHECK_RESULT((long long)st.f_bavail, 10);
+    CHECK_RESULT((long long)st.f_files, inodes + 6);
+    CHECK_RESULT((long long)st.f_ffree, 5);
+
+    // Without it, the capacity is the size:
+    CHECK_RESULT(controlQuery(CONTROL_PATH("quota"), "set / 0 0\n"), 0);
+    CHECK_RESULT(redifs_oper.statfs("/", &st), 0);
+    CHECK_RESULT((long long)st.f_blocks, (long long)DEFAULT_CAPACITY_MB * (1024 * 1024 / CHUNK_SIZE));
+    CHECK(st.f_bfree > 10);
+}
+
+
+static int changeEntriesClient(void* ctx)
+{
+    int result;
+
+    result = create("/mc/other");
+    if (result >= 0)
+    {
+        result = writeFile("/mc/a", "changed", 7, 0, 0);
+    }
+
+    return result;
+}
+
+
+static int changeAgainClient(void* ctx)
+{
+    int result;
+
+    result = redifs_oper.rename("/mc/other", "/mc/moved", 0);
+    if (result >= 0)
+    {
+        result = redifs_oper.truncate("/mc/a", 1, NULL);
+    }
+
+    return result;
+}
+
+
+/*
+ * The metadata cache answers for names a bloom filter excludes, sees the
+ * changes of this mount at once, and those of other clients once it reads
+ * the journal: on "sync" here, or when it is opened again.
+*/
+static void testMetaCache()
+{
+    unsigned long long rejects;
+    char path[PATH_LEN];
+
+    tempPath(path, "metacache");
+    unlink(path);
+
+    CHECK_RESULT(redifs_oper.mkdir("/mc", 0755), 0);
+    CHECK_RESULT(create("/mc/a"), 0);
+    CHECK_RESULT(writeFile("/mc/a", "data", 4, 0, 0), 4);
+
+    CHECK_RESULT(metaCacheOpen(path, 1, TEST_CACHE_TTL_MS), 0);
+
+    // The first miss fetches the bloom filter, which then answers:
+    CHECK_RESULT(fileSize("/mc/none1"), -ENOENT);
+    rejects = statsCounterTotal(STAT_COUNTER_BLOOM_REJECTS);
+    CHECK_RESULT(fileSize("/mc/none2"), -ENOENT);
+    CHECK_RESULT((long long)(statsCounterTotal(STAT_COUNTER_BLOOM_REJECTS) - rejects), 1);
+
+    // Changes through this mount are seen at once:
+    CHECK_RESULT(create("/mc/local"), 0);
+    CHECK_RESULT(fileSize("/mc/local"), 0);
+    CHECK_RESULT(fileSize("/mc/a"), 4);
+
+    // Those of another client once the journal is read:
+    CHECK_RESULT(otherClient(changeEntriesClient, NULL), 0);
+    CHECK_RESULT(fileSize("/mc/other"), -ENOENT);
+    CHECK_RESULT(fileSize("/mc/a"), 4);
+    CHECK_RESULT(writeFile(CONTROL_PATH("metacache"), "sync\n", 5, 0, 0), 5);
+    CHECK_RESULT(fileSize("/mc/other"), 0);
+    CHECK_RESULT(fileSize("/mc/a"), 7);
+
+    // The changes made while it was closed, when it is opened again:
+    metaCacheClose();
+    CHECK_RESULT(otherClient(changeAgainClient, NULL), 0);
+    CHECK_RESULT(metaCacheOpen(path, 1, TEST_CACHE_TTL_MS), 0);
+    CHECK_RESULT(fileSize("/mc/other"), -ENOENT);
+    CHECK_RESULT(fileSize("/mc/moved"), 0);
+    CHECK_RESULT(fileSize("/mc/a"), 1);
+
+    metaCacheClose();
+    unlink(path);
+}
+
+
+static int writeChunkClient(void* ctx)
+{
+    off_t offset = (off_t)(intptr_t)ctx * CHUNK_SIZE;
+
+    return writeFile("/bc/f", bufB + offset, CHUNK_SIZE, offset, 0);
+}
+
+
+/*
+ * Blocks in the block cache carry the version of their file. A write of
+ * this mount replaces them at once; one of another client is seen once
+ * the journal is read.
+*/
+static void testBlockCache()
+{
+    char path[PATH_LEN];
+    char chunk[CHUNK_SIZE];
+
+    tempPath(path, "blockcache");
+    unlink(path);
+
+    fillChunks(bufA, 3, 43);
+    fillChunks(bufB, 3, 47);
+
+    CHECK_RESULT(redifs_oper.mkdir("/bc", 0755), 0);
+    CHECK_RESULT(create("/bc/f"), 0);
+    CHECK_RESULT(writeFile("/bc/f", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+
+    CHECK_RESULT(blockCacheOpen(path, TEST_CACHE_SIZE_MB, TEST_CACHE_TTL_MS), 0);
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, CHUNK_SIZE), CHUNK_SIZE);
+    CHECK(0 == memcmp(chunk, bufA + CHUNK_SIZE, CHUNK_SIZE));
+
+    // Another client's write, until the journal is read:
+    CHECK_RESULT(otherClient(writeChunkClient, (void*)1), 0);
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, CHUNK_SIZE), CHUNK_SIZE);
+    CHECK(0 == memcmp(chunk, bufA + CHUNK_SIZE, CHUNK_SIZE));
+    CHECK_RESULT(writeFile(CONTROL_PATH("blockcache"), "sync\n", 5, 0, 0), 5);
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, CHUNK_SIZE), CHUNK_SIZE);
+    CHECK(0 == memcmp(chunk, bufB + CHUNK_SIZE, CHUNK_SIZE));
+
+    // A write of this mount:
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK_RESULT(writeFile("/bc/f", bufB, CHUNK_SIZE, 0, 0), CHUNK_SIZE);
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK(0 == memcmp(chunk, bufB, CHUNK_SIZE));
+
+    // A write while the cache was closed, when it is opened again:
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, 2 * CHUNK_SIZE), CHUNK_SIZE);
+    blockCacheClose();
+    CHECK_RESULT(otherClient(writeChunkClient, (void*)2), 0);
+    CHECK_RESULT(blockCacheOpen(path, TEST_CACHE_SIZE_MB, TEST_CACHE_TTL_MS), 0);
+    CHECK_RESULT(readFile("/bc/f", chunk, CHUNK_SIZE, 2 * CHUNK_SIZE), CHUNK_SIZE);
+    CHECK(0 == memcmp(chunk, bufB + 2 * CHUNK_SIZE, CHUNK_SIZE));
+
+    blockCacheClose();
+    unlink(path);
+}
+
+
+/*
+ * redifs_tier moves the chunks of a file it marked before to the cold
+ * store, and reads and writes of the file fault them back. It tiers the
+ * whole file system, so this test runs last.
+*/
+static void testTiering()
+{
+    const char* args[] = { "-s", NULL, "-i", "0", NULL };
+    unsigned long long faulted;
+    char dir[PATH_LEN];
+    char spec[PATH_LEN + 8];
+    node_id_t nodeId;
+
+    if (!toolsDir)
+    {
+        printf("No tools directory given; skipping the tiering test.\n");
+        return;
+    }
+
+    tempPath(dir, "cold");
+    removeTree(dir);
+    CHECK_RESULT(mkdir(dir, 0700), 0);
+    snprintf(spec, sizeof(spec), "dir:%s", dir);
+    args[1] = spec;
+
+    fillChunks(bufA, 3, 53);
+
+    CHECK_RESULT(redifs_oper.mkdir("/tier", 0755), 0);
+    CHECK_RESULT(create("/tier/f"), 0);
+    CHECK_RESULT(writeFile("/tier/f", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    nodeId = g_backend->resolve("/tier/f", 7);
+    CHECK(nodeId > 0);
+
+    // The first run marks the file, the second moves its chunks:
+    CHECK_RESULT(runTool("redifs_tier", args), 0);
+    CHECK(fileFlags("/tier/f") & NODE_FLAG_TIERED);
+    CHECK_RESULT(runTool("redifs_tier", args), 0);
+    CHECK_RESULT(chunkExists(nodeId, 0), 0);
+    CHECK_RESULT(chunkExists(nodeId, 1), 0);
+    CHECK_RESULT(chunkExists(nodeId, 2), 0);
+
+    CHECK_RESULT(tierOpen(spec), 0);
+
+    // A read faults the chunk back:
+    faulted = statsCounterTotal(STAT_COUNTER_TIER_CHUNKS_FAULTED);
+    CHECK_RESULT(readFile("/tier/f", bufB, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, CHUNK_SIZE));
+    CHECK_RESULT(chunkExists(nodeId, 0), 1);
+    CHECK_RESULT((long long)(statsCounterTotal(STAT_COUNTER_TIER_CHUNKS_FAULTED) - faulted), 1);
+
+    // So does a write, before it changes the chunk:
+    CHECK_RESULT(writeFile("/tier/f", "warm", 4, CHUNK_SIZE + 10, 0), 4);
+    CHECK_RESULT(chunkExists(nodeId, 1), 1);
+    memcpy(bufA + CHUNK_SIZE + 10, "warm", 4);
+
+    // The file is no longer tiered once its last cold chunk is gone:
+    CHECK_RESULT(redifs_oper.truncate("/tier/f", 2 * CHUNK_SIZE, NULL), 0);
+    CHECK_RESULT(fileFlags("/tier/f") & NODE_FLAG_TIERED, 0);
+    CHECK_RESULT(readFile("/tier/f", bufB, BUF_SIZE, 0), 2 * CHUNK_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, 2 * CHUNK_SIZE));
+
+    tierClose();
+    removeTree(dir);
+}
+
+
+/* ================ Main ================ */
+
+static void usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-N name] [-x tools-dir]\n", program);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .dir = NULL,
+        .port = 0,
+        .create_fs = 1,
+        .backend = "redis",
+        .inline_max = DEFAULT_INLINE_MAX,
+        .capacity = DEFAULT_CAPACITY_MB,
+    };
+    char name[NAME_LEN];
+    int opt;
+
+    snprintf(name, NAME_LEN, "redifs_test_%d", (int)getpid());
+    settings.name = name;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:x:")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 'x': toolsDir = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    g_settings = &settings;
+    g_defaultCodec = codecFromName(DEFAULT_CODEC);
+    g_backend = findBackend(settings.backend);
+    if (!g_backend || 0 > g_backend->open() || 0 >= g_backend->fs_create())
+    {
+        fprintf(stderr, "Error: Cannot set up file system '%s' on Redis.\n", settings.name);
+        return 1;
+    }
+    redifs_oper.init(NULL, NULL);
+
+    testSnapshotFromOtherClient();
+    testCreateFailures();
+    testWriteGrowth();
+    testExportWhileWriting();
+    testDedupRefs();
+    testSnapshots();
+    testQuotaStatfs();
+    testMetaCache();
+    testBlockCache();
+    testTiering();
+
+    redifs_oper.destroy(NULL);
+    g_backend->close();
+
+    printf("%d checks, %d failed\n", checks, failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,862 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Unit tests of the FUSE operations. They call the redifs_oper callbacks
+ * directly against the in-memory backend, so they need neither Redis nor
+ * a mount. Every test works in a directory of its own.
+*/
+
+
+/* ---- Includes ---- */
+#include <fuse.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "options.h"
+#include "backend.h"
+#include "compress.h"
+#include "control.h"
+#include "dedup.h"
+#include "operations.h"
+#include "reclaim.h"
+#include "stats.h"
+#include "times.h"
+
+
+/* ---- Defines ---- */
+#define PATH_LEN 256
+#define BUF_SIZE (3 * CHUNK_SIZE)
+#define STATUS_LEN (1024 * 1024)
+#define TEST_TIMES_FLUSH_MS (60 * 1000) // Longer than the tests run, so only they flush times.
+
+// rename(2) flags, from <linux/fs.h>:
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+
+/* ---- Macros ---- */
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+#define CHECK_RESULT(expr, expected) checkResult((expr), (expected), #expr, __FILE__, __LINE__)
+#define CONTROL_PATH(name) CONTROL_DIR_PATH "/" name
+
+
+/* ---- Globals ---- */
+static int checks = 0;
+static int failures = 0;
+static char bufA[BUF_SIZE];
+static char bufB[BUF_SIZE];
+static char status[STATUS_LEN];
+
+
+/* ================ Checks ================ */
+
+static void check(int ok, const char* expr, const char* file, int line)
+{
+    ++checks;
+    if (!ok)
+    {
+        ++failures;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    }
+}
+
+
+static void checkResult(long long result, long long expected, const char* expr, const char* file, int line)
+{
+    ++checks;
+    if (result != expected)
+    {
+        ++failures;
+        fprintf(stderr, "%s:%d: %s returned %lld, expected %lld\n", file, line, expr, result, expected);
+    }
+}
+
+
+/* ================ Helpers ================ */
+
+static int create(const char* path)
+{
+    return redifs_oper.mknod(path, S_IFREG | 0644, 0);
+}
+
+
+static int writeFile(const char* path, const char* buf, size_t size, off_t offset, int flags)
+{
+    struct fuse_file_info fileInfo;
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_WRONLY | flags;
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.write(path, buf, size, offset, &fileInfo);
+    redifs_oper.release(path, &fileInfo);
+
+    return result;
+}
+
+
+static int readFile(const char* path, char* buf, size_t size, off_t offset)
+{
+    struct fuse_file_info fileInfo;
+    int result;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDONLY;
+    result = redifs_oper.open(path, &fileInfo);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.read(path, buf, size, offset, &fileInfo);
+    redifs_oper.release(path, &fileInfo);
+
+    return result;
+}
+
+
+static long long fileSize(const char* path)
+{
+    struct stat st;
+    int result;
+
+    result = redifs_oper.getattr(path, &st, NULL);
+
+    return result < 0 ? result : st.st_size;
+}
+
+
+// A field of the node info as stored, without pending times:
+static long long storedInfo(const char* path, int field)
+{
+    long long info[NODE_INFO_COUNT];
+    node_id_t nodeId;
+    int result;
+
+    nodeId = g_backend->resolve(path, strlen(path));
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    result = g_backend->get_info(nodeId, info);
+
+    return result < 0 ? result : info[field];
+}
+
+
+static long long fileFlags(const char* path)
+{
+    return storedInfo(path, NODE_INFO_FLAGS);
+}
+
+
+static long long copyRange(const char* from, off_t fromOffset, const char* to, off_t toOffset, size_t size,
+                           int flags)
+{
+    struct fuse_file_info in;
+    struct fuse_file_info out;
+    long long result;
+
+    memset(&in, 0, sizeof(in));
+    memset(&out, 0, sizeof(out));
+    in.flags = O_RDONLY;
+    out.flags = O_WRONLY;
+    result = redifs_oper.open(from, &in);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    result = redifs_oper.open(to, &out);
+    if (result == 0)
+    {
+        result = redifs_oper.copy_file_range(from, &in, fromOffset, to, &out, toOffset, size, flags);
+        redifs_oper.release(to, &out);
+    }
+    redifs_oper.release(from, &in);
+
+    return result;
+}
+
+
+// Read a control file into status, as a string:
+static int readControl(const char* path)
+{
+    int result;
+
+    result = readFile(path, status, STATUS_LEN - 1, 0);
+    status[result < 0 ? 0 : result] = '\0';
+
+    return result;
+}
+
+
+// Value of the line "<key> <value>" in status, or -1:
+static long long statusValue(const char* key)
+{
+    size_t len = strlen(key);
+    const char* line = status;
+
+    while (line)
+    {
+        if (0 == strncmp(line, key, len) && line[len] == ' ')
+        {
+            return strtoll(line + len + 1, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line)
+        {
+            ++line;
+        }
+    }
+
+    return -1;
+}
+
+
+// Whether a line in status has first, followed by second:
+static int statusHasLine(const char* first, const char* second)
+{
+    const char* line;
+    const char* end;
+    const char* found;
+
+    for (line = strstr(status, first); line; line = strstr(line + 1, first))
+    {
+        end = strchr(line, '\n');
+        found = strstr(line, second);
+        if (found && (!end || found < end))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// Fill buf with a pattern that differs per offset and seed:
+static void fillPattern(char* buf, size_t size, off_t offset, int seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        buf[i] = (char)((offset + i) * 31 + seed);
+    }
+}
+
+
+// Fill count chunks of buf with a pattern of a seed of their own:
+static void fillChunks(char* buf, int count, int seed)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        fillPattern(buf + (size_t)i * CHUNK_SIZE, CHUNK_SIZE, 0, seed + i);
+    }
+}
+
+
+static int isZero(const char* buf, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        if (buf[i])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// Free the removed nodes now rather than after the reclaim thread wakes up:
+static void reclaimAll()
+{
+    while (reclaimBatch(RECLAIM_BATCH) > 0)
+    {
+    }
+}
+
+
+/* ================ Tests ================ */
+
+static void testCreate()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/create", 0755), 0);
+    CHECK_RESULT(create("/create/f"), 0);
+    CHECK_RESULT(create("/create/f"), -EEXIST);
+    CHECK_RESULT(redifs_oper.mkdir("/create/f", 0755), -EEXIST);
+    CHECK_RESULT(create("/create/missing/f"), -ENOENT);
+    CHECK_RESULT(create("/create/f/g"), -ENOTDIR);
+    CHECK_RESULT(fileSize("/create/f"), 0);
+}
+
+
+static void testRenameNoReplace()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/noreplace", 0755), 0);
+    CHECK_RESULT(writeFile("/noreplace/a", "aaa", 3, 0, 0), -ENOENT);
+    CHECK_RESULT(create("/noreplace/a"), 0);
+    CHECK_RESULT(create("/noreplace/b"), 0);
+    CHECK_RESULT(writeFile("/noreplace/a", "aaa", 3, 0, 0), 3);
+
+    CHECK_RESULT(redifs_oper.rename("/noreplace/a", "/noreplace/b", RENAME_NOREPLACE), -EEXIST);
+    CHECK_RESULT(fileSize("/noreplace/a"), 3);
+    CHECK_RESULT(fileSize("/noreplace/b"), 0);
+
+    CHECK_RESULT(redifs_oper.rename("/noreplace/a", "/noreplace/c", RENAME_NOREPLACE), 0);
+    CHECK_RESULT(fileSize("/noreplace/a"), -ENOENT);
+    CHECK_RESULT(fileSize("/noreplace/c"), 3);
+}
+
+
+static void testRenameExchange()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/exchange", 0755), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/exchange/d", 0755), 0);
+    CHECK_RESULT(create("/exchange/a"), 0);
+    CHECK_RESULT(create("/exchange/d/b"), 0);
+    CHECK_RESULT(writeFile("/exchange/a", "first", 5, 0, 0), 5);
+    CHECK_RESULT(writeFile("/exchange/d/b", "second", 6, 0, 0), 6);
+
+    CHECK_RESULT(redifs_oper.rename("/exchange/a", "/exchange/d/b", RENAME_EXCHANGE), 0);
+    CHECK_RESULT(readFile("/exchange/a", bufA, BUF_SIZE, 0), 6);
+    CHECK(0 == memcmp(bufA, "second", 6));
+    CHECK_RESULT(readFile("/exchange/d/b", bufA, BUF_SIZE, 0), 5);
+    CHECK(0 == memcmp(bufA, "first", 5));
+
+    // Both names must exist, and a file and a directory may swap:
+    CHECK_RESULT(redifs_oper.rename("/exchange/a", "/exchange/missing", RENAME_EXCHANGE), -ENOENT);
+    CHECK_RESULT(redifs_oper.rename("/exchange/a", "/exchange/d", RENAME_EXCHANGE), 0);
+    CHECK_RESULT(fileSize("/exchange/d"), 6);
+    CHECK_RESULT(fileSize("/exchange/a/b"), 5);
+}
+
+
+static void testRenameReplace()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/replace", 0755), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/replace/empty", 0755), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/replace/full", 0755), 0);
+    CHECK_RESULT(create("/replace/full/f"), 0);
+    CHECK_RESULT(create("/replace/a"), 0);
+    CHECK_RESULT(create("/replace/b"), 0);
+    CHECK_RESULT(writeFile("/replace/a", "new", 3, 0, 0), 3);
+
+    CHECK_RESULT(redifs_oper.rename("/replace/a", "/replace/b", 0), 0);
+    CHECK_RESULT(fileSize("/replace/a"), -ENOENT);
+    CHECK_RESULT(fileSize("/replace/b"), 3);
+
+    CHECK_RESULT(redifs_oper.rename("/replace/b", "/replace/empty", 0), -EISDIR);
+    CHECK_RESULT(redifs_oper.rename("/replace/empty", "/replace/b", 0), -ENOTDIR);
+    CHECK_RESULT(redifs_oper.rename("/replace/empty", "/replace/full", 0), -ENOTEMPTY);
+    CHECK_RESULT(redifs_oper.rename("/replace/full", "/replace/empty", 0), 0);
+    CHECK_RESULT(fileSize("/replace/full"), -ENOENT);
+    CHECK_RESULT(fileSize("/replace/empty/f"), 0);
+    CHECK_RESULT(redifs_oper.rename("/replace/missing", "/replace/c", 0), -ENOENT);
+}
+
+
+static void testRemove()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/remove", 0755), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/remove/d", 0755), 0);
+    CHECK_RESULT(create("/remove/d/f"), 0);
+
+    CHECK_RESULT(redifs_oper.rmdir("/remove/d"), -ENOTEMPTY);
+    CHECK_RESULT(redifs_oper.unlink("/remove/d"), -EISDIR);
+    CHECK_RESULT(redifs_oper.rmdir("/remove/d/f"), -ENOTDIR);
+    CHECK_RESULT(redifs_oper.unlink("/remove/d/missing"), -ENOENT);
+
+    CHECK_RESULT(redifs_oper.unlink("/remove/d/f"), 0);
+    CHECK_RESULT(fileSize("/remove/d/f"), -ENOENT);
+    CHECK_RESULT(redifs_oper.rmdir("/remove/d"), 0);
+    CHECK_RESULT(fileSize("/remove/d"), -ENOENT);
+
+    // The name is free again:
+    CHECK_RESULT(create("/remove/d"), 0);
+}
+
+
+static void testInline()
+{
+    const size_t small = DEFAULT_INLINE_MAX / 2;
+    const off_t far = CHUNK_SIZE + 100;
+
+    CHECK_RESULT(redifs_oper.mkdir("/inline", 0755), 0);
+    CHECK_RESULT(create("/inline/f"), 0);
+    CHECK(fileFlags("/inline/f") & NODE_FLAG_INLINE);
+
+    fillPattern(bufA, small, 0, 1);
+    CHECK_RESULT(writeFile("/inline/f", bufA, small, 0, 0), small);
+    CHECK(fileFlags("/inline/f") & NODE_FLAG_INLINE);
+    CHECK_RESULT(readFile("/inline/f", bufB, BUF_SIZE, 0), small);
+    CHECK(0 == memcmp(bufA, bufB, small));
+
+    // Writing past inline_max moves the data to the chunks, leaving a hole:
+    fillPattern(bufA + small, 100, far, 2);
+    CHECK_RESULT(writeFile("/inline/f", bufA + small, 100, far, 0), 100);
+    CHECK(!(fileFlags("/inline/f") & NODE_FLAG_INLINE));
+    CHECK_RESULT(fileSize("/inline/f"), far + 100);
+    CHECK_RESULT(readFile("/inline/f", bufB, BUF_SIZE, 0), far + 100);
+    CHECK(0 == memcmp(bufA, bufB, small));
+    CHECK(isZero(bufB + small, far - small));
+    CHECK(0 == memcmp(bufA + small, bufB + far, 100));
+
+    // Truncating an inline file past inline_max promotes it too:
+    CHECK_RESULT(create("/inline/g"), 0);
+    CHECK_RESULT(writeFile("/inline/g", "abc", 3, 0, 0), 3);
+    CHECK_RESULT(redifs_oper.truncate("/inline/g", DEFAULT_INLINE_MAX + 1, NULL), 0);
+    CHECK(!(fileFlags("/inline/g") & NODE_FLAG_INLINE));
+    CHECK_RESULT(readFile("/inline/g", bufB, BUF_SIZE, 0), DEFAULT_INLINE_MAX + 1);
+    CHECK(0 == memcmp(bufB, "abc", 3));
+    CHECK(isZero(bufB + 3, DEFAULT_INLINE_MAX - 2));
+}
+
+
+static void testTruncate()
+{
+    const off_t cut = CHUNK_SIZE + 10;
+
+    CHECK_RESULT(redifs_oper.mkdir("/truncate", 0755), 0);
+    CHECK_RESULT(create("/truncate/f"), 0);
+    fillPattern(bufA, BUF_SIZE, 0, 3);
+    CHECK_RESULT(writeFile("/truncate/f", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+
+    // Shrinking drops the data past the end, also when it grows again:
+    CHECK_RESULT(redifs_oper.truncate("/truncate/f", cut, NULL), 0);
+    CHECK_RESULT(fileSize("/truncate/f"), cut);
+    CHECK_RESULT(readFile("/truncate/f", bufB, BUF_SIZE, 0), cut);
+    CHECK(0 == memcmp(bufA, bufB, cut));
+
+    CHECK_RESULT(redifs_oper.truncate("/truncate/f", 2 * CHUNK_SIZE, NULL), 0);
+    CHECK_RESULT(readFile("/truncate/f", bufB, BUF_SIZE, 0), 2 * CHUNK_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, cut));
+    CHECK(isZero(bufB + cut, 2 * CHUNK_SIZE - cut));
+
+    // Reads stop at the end:
+    CHECK_RESULT(readFile("/truncate/f", bufB, 100, 2 * CHUNK_SIZE - 10), 10);
+    CHECK_RESULT(readFile("/truncate/f", bufB, 100, 2 * CHUNK_SIZE), 0);
+
+    CHECK_RESULT(redifs_oper.truncate("/truncate/f", 0, NULL), 0);
+    CHECK_RESULT(fileSize("/truncate/f"), 0);
+    CHECK_RESULT(redifs_oper.truncate("/truncate", 0, NULL), -EISDIR);
+}
+
+
+static void testAppend()
+{
+    const size_t block = 1000;
+    size_t size = 0;
+    int i;
+
+    CHECK_RESULT(redifs_oper.mkdir("/append", 0755), 0);
+    CHECK_RESULT(create("/append/f"), 0);
+
+    // The offset is ignored; the data grows from inline into the chunks:
+    fillPattern(bufA, BUF_SIZE, 0, 4);
+    for (i = 0; size + block <= CHUNK_SIZE + 2 * block; ++i)
+    {
+        CHECK_RESULT(writeFile("/append/f", bufA + size, block, 0, O_APPEND), block);
+        size += block;
+    }
+
+    CHECK(!(fileFlags("/append/f") & NODE_FLAG_INLINE));
+    CHECK_RESULT(fileSize("/append/f"), size);
+    CHECK_RESULT(readFile("/append/f", bufB, BUF_SIZE, 0), size);
+    CHECK(0 == memcmp(bufA, bufB, size));
+}
+
+
+static void testCodecs()
+{
+    static const char* names[] = { "lz4", "zstd" };
+    static char frame[CHUNK_FRAME_MAX];
+    char command[PATH_LEN];
+    char path[PATH_LEN];
+    unsigned long long in;
+    unsigned long long out;
+    size_t len;
+    int codec;
+    int i;
+
+    // Chunk 1 does not compress:
+    fillChunks(bufA, 3, 5);
+    srand(1);
+    for (i = 0; i < CHUNK_SIZE; ++i)
+    {
+        bufA[CHUNK_SIZE + i] = (char)rand();
+    }
+
+    CHECK_RESULT(codecFromName("none"), CODEC_NONE);
+    CHECK_RESULT(codecFromName("gzip"), -1);
+    CHECK_RESULT(redifs_oper.mkdir("/codec", 0755), 0);
+
+    for (i = 0; i < 2; ++i)
+    {
+        codec = codecFromName(names[i]);
+        CHECK(codec > CODEC_NONE);
+
+        // Frames of data that does not compress hold it raw:
+        len = compressChunk(codec, bufA, CHUNK_SIZE, frame);
+        CHECK(len < CHUNK_SIZE && frame[0] == codec);
+        CHECK_RESULT(decompressChunk(frame, len, bufB), CHUNK_SIZE);
+        CHECK(0 == memcmp(bufA, bufB, CHUNK_SIZE));
+        len = compressChunk(codec, bufA + CHUNK_SIZE, CHUNK_SIZE, frame);
+        CHECK(len == CHUNK_SIZE + 1 && frame[0] == CODEC_NONE);
+        CHECK_RESULT(decompressChunk(frame, len, bufB), CHUNK_SIZE);
+        CHECK(0 == memcmp(bufA + CHUNK_SIZE, bufB, CHUNK_SIZE));
+
+        // New files below a directory take its codec:
+        snprintf(path, PATH_LEN, "/codec/%s", names[i]);
+        CHECK_RESULT(redifs_oper.mkdir(path, 0755), 0);
+        len = snprintf(command, PATH_LEN, "%s %s\n", names[i], path);
+        CHECK_RESULT(writeFile(CONTROL_PATH("compress"), command, len, 0, 0), len);
+        snprintf(path, PATH_LEN, "/codec/%s/f", names[i]);
+        CHECK_RESULT(create(path), 0);
+        CHECK_RESULT(NODE_CODEC(fileFlags(path)), codec);
+
+        // Unaligned writes, partial overwrites and truncation inside compressed chunks:
+        in = statsCounterTotal(STAT_COUNTER_COMPRESS_IN_BYTES);
+        out = statsCounterTotal(STAT_COUNTER_COMPRESS_OUT_BYTES);
+        CHECK_RESULT(writeFile(path, bufA, BUF_SIZE, 100, 0), BUF_SIZE);
+        CHECK(statsCounterTotal(STAT_COUNTER_COMPRESS_OUT_BYTES) - out
+              < statsCounterTotal(STAT_COUNTER_COMPRESS_IN_BYTES) - in);
+        CHECK_RESULT(readFile(path, bufB, BUF_SIZE, 100), BUF_SIZE);
+        CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+        CHECK_RESULT(readFile(path, bufB, 100, 0), 100);
+        CHECK(isZero(bufB, 100));
+
+        CHECK_RESULT(writeFile(path, "codec", 5, 50, 0), 5);
+        CHECK_RESULT(redifs_oper.truncate(path, 2 * CHUNK_SIZE + 10, NULL), 0);
+        CHECK_RESULT(redifs_oper.truncate(path, BUF_SIZE, NULL), 0);
+        CHECK_RESULT(readFile(path, bufB, BUF_SIZE, 0), BUF_SIZE);
+        CHECK(isZero(bufB, 50));
+        CHECK(0 == memcmp(bufB + 50, "codec", 5));
+        CHECK(isZero(bufB + 55, 45));
+        CHECK(0 == memcmp(bufA, bufB + 100, 2 * CHUNK_SIZE - 90));
+        CHECK(isZero(bufB + 2 * CHUNK_SIZE + 10, CHUNK_SIZE - 10));
+    }
+
+    // Without a codec of their own, directories follow the default again:
+    CHECK_RESULT(writeFile(CONTROL_PATH("compress"), "inherit /codec/lz4\n", 19, 0, 0), 19);
+    CHECK_RESULT(create("/codec/lz4/g"), 0);
+    CHECK_RESULT(NODE_CODEC(fileFlags("/codec/lz4/g")), CODEC_NONE);
+    CHECK_RESULT(writeFile(CONTROL_PATH("compress"), "gzip /codec\n", 12, 0, 0), -EINVAL);
+}
+
+
+static void testDedup()
+{
+    unsigned long long stored;
+    unsigned long long linked;
+    unsigned long long freed;
+
+    // Chunks 0 and 2 hold the same data:
+    fillChunks(bufA, 2, 6);
+    memcpy(bufA + 2 * CHUNK_SIZE, bufA, CHUNK_SIZE);
+
+    CHECK_RESULT(redifs_oper.mkdir("/dedup", 0755), 0);
+    g_settings->dedup = 1;
+    CHECK_RESULT(create("/dedup/a"), 0);
+    CHECK_RESULT(create("/dedup/b"), 0);
+    g_settings->dedup = 0;
+    CHECK(fileFlags("/dedup/a") & NODE_FLAG_DEDUP);
+
+    // Data stored once is linked from then on:
+    stored = statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED);
+    linked = statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED);
+    CHECK_RESULT(writeFile("/dedup/a", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED), stored + 2);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED), linked + 1);
+    CHECK_RESULT(writeFile("/dedup/b", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED), stored + 2);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_LINKED), linked + 4);
+
+    // Changing a shared chunk in one file leaves the other alone:
+    CHECK_RESULT(writeFile("/dedup/b", bufA + CHUNK_SIZE, CHUNK_SIZE, 0, 0), CHUNK_SIZE);
+    CHECK_RESULT(readFile("/dedup/a", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(readFile("/dedup/b", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA + CHUNK_SIZE, bufB, CHUNK_SIZE));
+    CHECK(0 == memcmp(bufA + CHUNK_SIZE, bufB + CHUNK_SIZE, 2 * CHUNK_SIZE));
+
+    // Blobs are collected once nothing refers to them:
+    freed = statsCounterTotal(STAT_COUNTER_DEDUP_BLOBS_FREED);
+    CHECK_RESULT(redifs_oper.unlink("/dedup/a"), 0);
+    reclaimAll();
+    CHECK(0 <= dedupCollect(DEDUP_GC_BATCH));
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_BLOBS_FREED), freed);
+    CHECK_RESULT(readFile("/dedup/b", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA + CHUNK_SIZE, bufB + CHUNK_SIZE, 2 * CHUNK_SIZE));
+
+    CHECK_RESULT(redifs_oper.unlink("/dedup/b"), 0);
+    reclaimAll();
+    CHECK(0 <= dedupCollect(DEDUP_GC_BATCH));
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_BLOBS_FREED), freed + 2);
+}
+
+
+static void testCopy()
+{
+    unsigned long long stored;
+
+    fillChunks(bufA, 3, 7);
+
+    CHECK_RESULT(redifs_oper.mkdir("/copy", 0755), 0);
+    CHECK_RESULT(redifs_oper.mkdir("/copy/zstd", 0755), 0);
+    CHECK_RESULT(writeFile(CONTROL_PATH("compress"), "zstd /copy/zstd\n", 16, 0, 0), 16);
+    CHECK_RESULT(create("/copy/src"), 0);
+    CHECK_RESULT(create("/copy/clone"), 0);
+    CHECK_RESULT(create("/copy/part"), 0);
+    CHECK_RESULT(create("/copy/zstd/f"), 0);
+    CHECK_RESULT(writeFile("/copy/src", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+
+    // Ranges off chunk boundaries:
+    CHECK_RESULT(copyRange("/copy/src", 100, "/copy/part", CHUNK_SIZE + 7, CHUNK_SIZE, 0), CHUNK_SIZE);
+    CHECK_RESULT(fileSize("/copy/part"), 2 * CHUNK_SIZE + 7);
+    CHECK_RESULT(readFile("/copy/part", bufB, BUF_SIZE, 0), 2 * CHUNK_SIZE + 7);
+    CHECK(isZero(bufB, CHUNK_SIZE + 7));
+    CHECK(0 == memcmp(bufA + 100, bufB + CHUNK_SIZE + 7, CHUNK_SIZE));
+
+    // Whole chunks are cloned, and the copy keeps its data when the source changes:
+    CHECK_RESULT(copyRange("/copy/src", 0, "/copy/clone", 0, BUF_SIZE, 0), BUF_SIZE);
+    CHECK_RESULT(writeFile("/copy/src", "changed", 7, CHUNK_SIZE, 0), 7);
+    CHECK_RESULT(fileSize("/copy/clone"), BUF_SIZE);
+    CHECK_RESULT(readFile("/copy/clone", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+    CHECK_RESULT(readFile("/copy/src", bufB, 7, CHUNK_SIZE), 7);
+    CHECK(0 == memcmp(bufB, "changed", 7));
+
+    // Into a file of another chunk layout:
+    CHECK_RESULT(copyRange("/copy/clone", 0, "/copy/zstd/f", 0, BUF_SIZE, 0), BUF_SIZE);
+    CHECK_RESULT(readFile("/copy/zstd/f", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+
+    // Ranges stop at the end of the source:
+    CHECK_RESULT(copyRange("/copy/clone", BUF_SIZE - 4, "/copy/part", 0, 100, 0), 4);
+    CHECK_RESULT(copyRange("/copy/clone", BUF_SIZE, "/copy/part", 0, 100, 0), 0);
+    CHECK_RESULT(copyRange("/copy/clone", 0, "/copy/clone", 10, 100, 0), -EINVAL);
+    CHECK_RESULT(copyRange("/copy/clone", 0, "/copy/part", 0, 100, 1), -EINVAL);
+
+    // Inline files stay inline:
+    CHECK_RESULT(create("/copy/small"), 0);
+    CHECK_RESULT(create("/copy/small2"), 0);
+    CHECK_RESULT(writeFile("/copy/small", "inline data", 11, 0, 0), 11);
+    CHECK_RESULT(copyRange("/copy/small", 0, "/copy/small2", 3, 11, 0), 11);
+    CHECK(fileFlags("/copy/small2") & NODE_FLAG_INLINE);
+    CHECK_RESULT(readFile("/copy/small2", bufB, BUF_SIZE, 0), 14);
+    CHECK(isZero(bufB, 3) && 0 == memcmp(bufB + 3, "inline data", 11));
+
+    // Deduplicated chunks are cloned by reference:
+    g_settings->dedup = 1;
+    CHECK_RESULT(create("/copy/dsrc"), 0);
+    CHECK_RESULT(create("/copy/ddst"), 0);
+    g_settings->dedup = 0;
+    CHECK_RESULT(writeFile("/copy/dsrc", bufA, BUF_SIZE, 0, 0), BUF_SIZE);
+    stored = statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED);
+    CHECK_RESULT(copyRange("/copy/dsrc", 0, "/copy/ddst", 0, BUF_SIZE, 0), BUF_SIZE);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_DEDUP_CHUNKS_STORED), stored);
+    CHECK_RESULT(readFile("/copy/ddst", bufB, BUF_SIZE, 0), BUF_SIZE);
+    CHECK(0 == memcmp(bufA, bufB, BUF_SIZE));
+}
+
+
+static void testStatfs()
+{
+    struct statvfs before;
+    struct statvfs after;
+
+    CHECK_RESULT(redifs_oper.statfs("/", &before), 0);
+    CHECK_RESULT(before.f_bsize, CHUNK_SIZE);
+    CHECK_RESULT(before.f_blocks, (long long)DEFAULT_CAPACITY_MB * (1024 * 1024 / CHUNK_SIZE));
+    CHECK(before.f_bfree < before.f_blocks && before.f_ffree < before.f_files);
+
+    CHECK_RESULT(redifs_oper.mkdir("/statfs", 0755), 0);
+    CHECK_RESULT(create("/statfs/f"), 0);
+    CHECK_RESULT(redifs_oper.truncate("/statfs/f", 2 * CHUNK_SIZE, NULL), 0);
+
+    CHECK_RESULT(redifs_oper.statfs("/", &after), 0);
+    CHECK_RESULT((long long)(before.f_bfree - after.f_bfree), 2);
+    CHECK_RESULT((long long)((after.f_files - after.f_ffree) - (before.f_files - before.f_ffree)), 2);
+}
+
+
+/*
+ * utimens and reads only record times in memory, until a flush or the
+ * release of the file writes them.
+*/
+static void testTimes()
+{
+    struct timespec tv[2] = { { 1000, 1 }, { 2000, 2 } };
+    unsigned long long flushed;
+    struct stat st;
+    time_t atime;
+
+    CHECK_RESULT(redifs_oper.mkdir("/times", 0755), 0);
+    CHECK_RESULT(create("/times/f"), 0);
+    CHECK_RESULT(writeFile("/times/f", "data", 4, 0, 0), 4);
+    CHECK_RESULT(timesFlushAll(), 0);
+
+    CHECK_RESULT(redifs_oper.utimens("/times/f", tv, NULL), 0);
+    CHECK_RESULT(redifs_oper.getattr("/times/f", &st, NULL), 0);
+    CHECK(st.st_atim.tv_sec == 1000 && st.st_atim.tv_nsec == 1);
+    CHECK(st.st_mtim.tv_sec == 2000 && st.st_mtim.tv_nsec == 2);
+    CHECK(storedInfo("/times/f", NODE_INFO_MOD_TIME_SEC) != 2000);
+
+    flushed = statsCounterTotal(STAT_COUNTER_TIMES_FLUSHED);
+    CHECK_RESULT(writeFile(CONTROL_PATH("times"), "flush\n", 6, 0, 0), 6);
+    CHECK_RESULT(statsCounterTotal(STAT_COUNTER_TIMES_FLUSHED), flushed + 1);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_ACCESS_TIME_SEC), 1000);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_ACCESS_TIME_NSEC), 1);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_MOD_TIME_SEC), 2000);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_MOD_TIME_NSEC), 2);
+
+    // relatime: a read after a change sets atime, and the next one leaves it:
+    CHECK_RESULT(readFile("/times/f", bufB, 4, 0), 4);
+    CHECK_RESULT(redifs_oper.getattr("/times/f", &st, NULL), 0);
+    atime = st.st_atim.tv_sec;
+    CHECK(atime > 2000);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_ACCESS_TIME_SEC), atime);
+    CHECK_RESULT(readFile("/times/f", bufB, 4, 0), 4);
+    CHECK_RESULT(redifs_oper.getattr("/times/f", &st, NULL), 0);
+    CHECK_RESULT(st.st_atim.tv_sec, atime);
+
+    // A write stores its mtime at once, over a pending one:
+    tv[0].tv_nsec = UTIME_OMIT;
+    tv[1].tv_sec = 3000;
+    CHECK_RESULT(redifs_oper.utimens("/times/f", tv, NULL), 0);
+    CHECK_RESULT(writeFile("/times/f", "x", 1, 0, 0), 1);
+    CHECK_RESULT(timesFlushAll(), 0);
+    CHECK_RESULT(redifs_oper.getattr("/times/f", &st, NULL), 0);
+    CHECK(st.st_mtim.tv_sec > 3000);
+    CHECK_RESULT(storedInfo("/times/f", NODE_INFO_MOD_TIME_SEC), st.st_mtim.tv_sec);
+    CHECK_RESULT(st.st_atim.tv_sec, atime);
+}
+
+
+static void testStats()
+{
+    long long writes;
+    long long errors;
+
+    CHECK_RESULT(redifs_oper.mkdir("/stats", 0755), 0);
+    CHECK_RESULT(create("/stats/f"), 0);
+
+    CHECK(readControl(CONTROL_PATH("stats")) > 0);
+    CHECK(NULL != strstr(status, "# TYPE redifs_fuse_op_duration_seconds histogram\n"));
+    writes = statusValue("redifs_fuse_op_duration_seconds_count{op=\"write\"}");
+    errors = statusValue("redifs_fuse_op_errors_total{op=\"getattr\"}");
+    CHECK(writes >= 0 && errors >= 0);
+
+    CHECK_RESULT(writeFile("/stats/f", "a", 1, 0, 0), 1);
+    CHECK_RESULT(writeFile("/stats/f", "b", 1, 1, 0), 1);
+    CHECK_RESULT(fileSize("/stats/missing"), -ENOENT);
+
+    CHECK(readControl(CONTROL_PATH("stats")) > 0);
+    CHECK_RESULT(statusValue("redifs_fuse_op_duration_seconds_count{op=\"write\"}"), writes + 2);
+    CHECK_RESULT(statusValue("redifs_fuse_op_duration_seconds_bucket{op=\"write\",le=\"+Inf\"}"), writes + 2);
+    CHECK_RESULT(statusValue("redifs_fuse_op_errors_total{op=\"getattr\"}"), errors + 1);
+    CHECK_RESULT(statusValue("redifs_times_flushed_total"), statsCounterTotal(STAT_COUNTER_TIMES_FLUSHED));
+}
+
+
+static void testTrace()
+{
+    CHECK_RESULT(redifs_oper.mkdir("/trace", 0755), 0);
+
+    CHECK_RESULT(writeFile(CONTROL_PATH("trace"), "threshold=0\n", 12, 0, 0), 12);
+    CHECK_RESULT(writeFile(CONTROL_PATH("trace"), "on\n", 3, 0, 0), 3);
+    CHECK_RESULT(fileSize("/trace/missing"), -ENOENT);
+    CHECK_RESULT(writeFile(CONTROL_PATH("trace"), "off\n", 4, 0, 0), 4);
+    CHECK_RESULT(fileSize("/trace/unseen"), -ENOENT);
+    CHECK_RESULT(writeFile(CONTROL_PATH("trace"), "loud\n", 5, 0, 0), -EINVAL);
+
+    CHECK(readControl(CONTROL_PATH("trace")) > 0);
+    CHECK_RESULT(statusValue("enabled"), 0);
+    CHECK_RESULT(statusValue("threshold_us"), 0);
+    CHECK(statusValue("recorded") > 0);
+    CHECK(statusHasLine("getattr \"/trace/missing\"", "result=-2"));
+    CHECK(!strstr(status, "/trace/unseen"));
+}
+
+
+/* ================ Main ================ */
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .dir = NULL,
+        .port = 0,
+        .create_fs = 1,
+        .name = "redifs_test",
+        .backend = "memory",
+        .inline_max = DEFAULT_INLINE_MAX,
+        .capacity = DEFAULT_CAPACITY_MB,
+    };
+
+    g_settings = &settings;
+    g_defaultCodec = codecFromName(DEFAULT_CODEC);
+    timesConfigure(DEFAULT_ATIME, TEST_TIMES_FLUSH_MS);
+    g_backend = findBackend(settings.backend);
+    if (!g_backend || 0 > g_backend->open() || 0 >= g_backend->fs_create())
+    {
+        fprintf(stderr, "Error: Cannot set up the memory backend.\n");
+        return 1;
+    }
+    redifs_oper.init(NULL, NULL);
+
+    testCreate();
+    testRenameNoReplace();
+    testRenameExchange();
+    testRenameReplace();
+    testRemove();
+    testInline();
+    testTruncate();
+    testAppend();
+    testCodecs();
+    testDedup();
+    testCopy();
+    testStatfs();
+    testTimes();
+    testStats();
+    testTrace();
+
+    redifs_oper.destroy(NULL);
+    g_backend->close();
+
+    printf("%d checks, %d failed\n", checks, failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+#!/bin/bash
+#
+# RediFS tests against Redis.
+#
+# Starts a throwaway redis-server and runs redifs_redis_test against it,
+# with the tools in BUILD_DIR.
+#
+# Environment:
+#   REDIS_SERVER  redis-server binary (default: redis-server)
+#   TEST_PORT     port for the throwaway server (default: 16389)
+#
+
+set -e
+
+BUILD_DIR=${1:-build}
+REDIS_SERVER=${REDIS_SERVER:-redis-server}
+TEST_PORT=${TEST_PORT:-16389}
+
+WORK_DIR=$(mktemp -d)
+REDIS_PID=
+
+cleanup()
+{
+    if [ -n "$REDIS_PID" ]; then
+        kill "$REDIS_PID" 2>/dev/null || true
+        wait "$REDIS_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+wait_for_port()
+{
+    local i=0
+    until (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null || [ $i -ge 50 ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+}
+
+# Throwaway Redis without persistence:
+"$REDIS_SERVER" --port "$TEST_PORT" --bind 127.0.0.1 --save "" --appendonly no \
+    --dir "$WORK_DIR" --logfile "$WORK_DIR/redis.log" &
+REDIS_PID=$!
+wait_for_port "$TEST_PORT"
+
+"$BUILD_DIR/redifs_redis_test" -h 127.0.0.1 -p "$TEST_PORT" -x "$BUILD_DIR"
@@ -0,0 +1,1062 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Streaming export of a RediFS file system to a tar archive, without a
+ * mount:
+ *
+ *   redifs_export [-h host] [-p port] [-N name] [-s snapshot] [-c store] [DIR] > out.tar
+ *
+ * writes the tree below DIR (default "/") as it is in the snapshot, or, by
+ * default, in a temporary snapshot of the live file system taken at the
+ * start. Every client archives what it changes for a snapshot from the
+ * moment the snapshot exists, so the archive is consistent while writers
+ * go on. Directories
+ * are read whole, node info EXPORT_INFO_BATCH nodes per round trip, and file
+ * data in windows of chunks that are pipelined ahead of the output across
+ * files. Memory use depends on the size of the directories along the
+ * current path, not on the size of the tree. Chunks that redifs_tier moved
+ * out of Redis are read from the cold store given with -c.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "backend.h"
+#include "coldstore.h"
+#include "compress.h"
+#include "connection.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define EXPORT_INFO_BATCH 256 // Nodes whose info is fetched per round trip.
+#define EXPORT_WINDOW_CHUNKS 16 // Chunks fetched per command.
+#define EXPORT_PIPELINE_CHUNKS 64 // Chunks requested ahead of the output.
+#define EXPORT_PATH_MAX 4096
+#define EXPORT_INFO_WIDTH (NODE_INFO_COUNT + 1) // Node info and inline data.
+#define EXPORT_OUTPUT_BUFFER (1024 * 1024)
+
+#define TAR_BLOCK 512
+#define TAR_SIZE_MAX 077777777777LL // Largest size in a ustar header.
+#define TAR_ID_MAX 07777777 // Largest user or group ID in a ustar header.
+
+
+/* ---- Types ---- */
+
+enum export_kind
+{
+    EXPORT_SKIP = 0,
+    EXPORT_DIR,
+    EXPORT_FILE, // Inline or empty file.
+    EXPORT_CHUNKED_FILE,
+};
+
+// Up to EXPORT_INFO_BATCH entries of the directory being exported, with
+// the chunk requests sent ahead of the output:
+struct export_batch
+{
+    int count;
+    const char* names[EXPORT_INFO_BATCH];
+    size_t nameLens[EXPORT_INFO_BATCH];
+    node_id_t ids[EXPORT_INFO_BATCH];
+    long long info[EXPORT_INFO_BATCH][NODE_INFO_COUNT];
+    char* inlineData[EXPORT_INFO_BATCH];
+    size_t inlineLens[EXPORT_INFO_BATCH];
+    enum export_kind kinds[EXPORT_INFO_BATCH];
+
+    int issueEntry;
+    long long issueChunk;
+    long long outstanding;
+};
+
+// Subdirectory exported after the files of its parent:
+struct export_dir
+{
+    node_id_t nodeId;
+    long long info[NODE_INFO_COUNT];
+    size_t nameLen;
+    char name[];
+};
+
+struct tar_header
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+
+/* ---- Globals ---- */
+static const char* fsName;
+static char viewGenStr[24];
+
+static struct export_batch batch;
+static char path[EXPORT_PATH_MAX];
+static size_t pathLen = 0;
+static char raw[CHUNK_SIZE];
+static char coldData[CHUNK_FRAME_MAX];
+static const char zeros[CHUNK_SIZE];
+static char outputBuffer[EXPORT_OUTPUT_BUFFER];
+
+static volatile sig_atomic_t interrupted = 0;
+static int failed = 0;
+
+static unsigned long long dirCount = 0;
+static unsigned long long fileCount = 0;
+static unsigned long long byteCount = 0;
+static unsigned long long skipCount = 0;
+
+
+/* ---- Scripts ---- */
+
+// Every script reads the snapshot through view(); ARGV starts with the
+// name and the snapshot generation.
+
+// ARGV: name, gen, directory node ID. Returns the name and node ID of
+// every entry, from all buckets.
+static const char* listScript =
+    LUA_VIEW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_VIEW_FUNCTION
+    "local reply = dirScan(dirViewBuckets(ARGV[1], tonumber(ARGV[2]), ARGV[3]), '0', 2147483647) "
+    "table.remove(reply, 1) "
+    "return reply";
+
+// ARGV: name, gen, width, node IDs... Returns width values per node, ''
+// where there are none.
+static const char* infoScript =
+    LUA_VIEW_FUNCTION
+    "local p, s, width = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[3]) "
+    "local out = {} "
+    "for i = 4, #ARGV do "
+    "local info = redis.call('LRANGE', view(p, s, 'info:' .. ARGV[i]), 0, width - 1) "
+    "for j = 1, width do out[#out + 1] = info[j] or '' end "
+    "end "
+    "return out";
+
+// ARGV: name, gen, node ID, first chunk, count, dedup, tiered. Returns the
+// stored chunks, '' for holes. For tiered files a chunk is prefixed with
+// 'd', or is 'c' followed by the name of its cold object.
+static const char* chunkScript =
+    LUA_VIEW_FUNCTION
+    "local p, s, id = ARGV[1], tonumber(ARGV[2]), ARGV[3] "
+    "local first = tonumber(ARGV[4]) "
+    "local out = {} "
+    "if ARGV[6] == '1' then "
+    "local refs = view(p, s, 'refs:' .. id) "
+    "for c = first, first + tonumber(ARGV[5]) - 1 do "
+    "local h = redis.call('HGET', refs, tostring(c)) "
+    "out[#out + 1] = h and redis.call('HGET', p .. '::blob:' .. h, 'data') or '' "
+    "end "
+    "elseif ARGV[7] == '1' then "
+    "local cold = view(p, s, 'cold:' .. id) "
+    "for c = first, first + tonumber(ARGV[5]) - 1 do "
+    "local v = redis.call('GET', view(p, s, 'data:' .. id .. ':' .. c)) "
+    "local o = not v and redis.call('HGET', cold, tostring(c)) "
+    "out[#out + 1] = v and 'd' .. v or o and 'c' .. o or '' "
+    "end "
+    "else "
+    "for c = first, first + tonumber(ARGV[5]) - 1 do "
+    "out[#out + 1] = redis.call('GET', view(p, s, 'data:' .. id .. ':' .. c)) or '' "
+    "end "
+    "end "
+    "return out";
+
+
+/* ================ Output ================ */
+
+static int writeOutput(const void* data, size_t len)
+{
+    if (len > 0 && 1 != fwrite(data, len, 1, stdout))
+    {
+        if (!failed)
+        {
+            fprintf(stderr, "Error: Cannot write the archive: %s\n", strerror(errno));
+        }
+        failed = 1;
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+static int writeZeros(unsigned long long len)
+{
+    size_t part;
+
+    while (len > 0)
+    {
+        part = len < sizeof(zeros) ? len : sizeof(zeros);
+        if (0 > writeOutput(zeros, part))
+        {
+            return -EIO;
+        }
+        len -= part;
+    }
+
+    return 0;
+}
+
+
+// Fill the last block of size bytes of data:
+static int writePadding(unsigned long long size)
+{
+    return writeZeros((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+
+/* ================ Tar headers ================ */
+
+static void formatOctal(char* field, size_t size, unsigned long long value)
+{
+    snprintf(field, size, "%0*llo", (int)size - 1, value);
+}
+
+
+// Split a path over the name and prefix fields; returns 0 if it does not fit:
+static int splitPath(struct tar_header* header, const char* name, size_t len)
+{
+    size_t i;
+
+    if (len <= sizeof(header->name))
+    {
+        memcpy(header->name, name, len);
+        return 1;
+    }
+
+    for (i = len - 1; i > 0; --i)
+    {
+        if (len - i - 1 > sizeof(header->name))
+        {
+            break;
+        }
+        else if (name[i] == '/' && i <= sizeof(header->prefix) && i + 1 < len)
+        {
+            memcpy(header->prefix, name, i);
+            memcpy(header->name, name + i + 1, len - i - 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int writeHeader(const char* name, size_t len, const long long info[NODE_INFO_COUNT], char typeflag,
+                       unsigned long long size)
+{
+    struct tar_header header;
+    unsigned long long mtime = info[NODE_INFO_MOD_TIME_SEC] > 0 ? info[NODE_INFO_MOD_TIME_SEC] : 0;
+    unsigned int checksum = 0;
+    size_t i;
+
+    memset(&header, 0, sizeof(header));
+    splitPath(&header, name, len);
+    formatOctal(header.mode, sizeof(header.mode), info[NODE_INFO_MODE] & 07777);
+    formatOctal(header.uid, sizeof(header.uid), info[NODE_INFO_UID] <= TAR_ID_MAX ? info[NODE_INFO_UID] : 0);
+    formatOctal(header.gid, sizeof(header.gid), info[NODE_INFO_GID] <= TAR_ID_MAX ? info[NODE_INFO_GID] : 0);
+    formatOctal(header.size, sizeof(header.size), size <= TAR_SIZE_MAX ? size : 0);
+    formatOctal(header.mtime, sizeof(header.mtime), mtime);
+    header.typeflag = typeflag;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    for (i = 0; i < sizeof(header); ++i)
+    {
+        checksum += ((unsigned char*)&header)[i];
+    }
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+    return writeOutput(&header, sizeof(header));
+}
+
+
+// Add a "<length> key=value\n" record, where length counts the whole record:
+static size_t formatPaxRecord(char* buf, const char* key, const char* value, size_t valueLen)
+{
+    size_t len = strlen(key) + valueLen + 3;
+    size_t digits = snprintf(NULL, 0, "%zu", len);
+    size_t start;
+
+    if (snprintf(NULL, 0, "%zu", len + digits) > digits)
+    {
+        ++digits;
+    }
+    len += digits;
+
+    start = sprintf(buf, "%zu %s=", len, key);
+    memcpy(buf + start, value, valueLen);
+    buf[len - 1] = '\n';
+
+    return len;
+}
+
+
+/*
+ * Write the header of an entry, preceded by a pax extended header with the
+ * values that do not fit in the ustar fields.
+*/
+static int writeEntryHeader(const char* name, size_t len, const long long info[NODE_INFO_COUNT], char typeflag,
+                            unsigned long long size)
+{
+    static char records[EXPORT_PATH_MAX + 256];
+    static const long long paxInfo[NODE_INFO_COUNT] = { [NODE_INFO_MODE] = 0644 };
+    struct tar_header header;
+    char number[24];
+    size_t recordsLen = 0;
+    int longPath;
+
+    memset(&header, 0, sizeof(header));
+    longPath = !splitPath(&header, name, len);
+    if (longPath)
+    {
+        recordsLen += formatPaxRecord(records + recordsLen, "path", name, len);
+    }
+    if (size > TAR_SIZE_MAX)
+    {
+        recordsLen += formatPaxRecord(records + recordsLen, "size", number,
+                                      snprintf(number, sizeof(number), "%llu", size));
+    }
+    if (info[NODE_INFO_UID] > TAR_ID_MAX)
+    {
+        recordsLen += formatPaxRecord(records + recordsLen, "uid", number,
+                                      snprintf(number, sizeof(number), "%lld", info[NODE_INFO_UID]));
+    }
+    if (info[NODE_INFO_GID] > TAR_ID_MAX)
+    {
+        recordsLen += formatPaxRecord(records + recordsLen, "gid", number,
+                                      snprintf(number, sizeof(number), "%lld", info[NODE_INFO_GID]));
+    }
+
+    if (recordsLen > 0)
+    {
+        if (0 > writeHeader("././@PaxHeader", 14, paxInfo, 'x', recordsLen)
+            || 0 > writeOutput(records, recordsLen)
+            || 0 > writePadding(recordsLen))
+        {
+            return -EIO;
+        }
+    }
+
+    // The ustar fields keep what fits:
+    if (longPath)
+    {
+        len = sizeof(header.name);
+    }
+
+    return writeHeader(name, len, info, typeflag, size);
+}
+
+
+/* ================ Redis ================ */
+
+static int sendScript(const char* script, int argc, const char* argv[])
+{
+    size_t argvlen[argc + 3];
+    const char* args[argc + 3];
+    int i;
+
+    args[0] = "EVAL";
+    args[1] = script;
+    args[2] = "0";
+    for (i = 0; i < argc; ++i)
+    {
+        args[i + 3] = argv[i];
+    }
+    for (i = 0; i < argc + 3; ++i)
+    {
+        argvlen[i] = strlen(args[i]);
+    }
+
+    if (!redisPipelineAppend(argc + 3, args, argvlen))
+    {
+        failed = 1;
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+// Read the reply of the oldest script sent; returns its handle:
+static int readScriptReply(int* count)
+{
+    int handle = redisPipelineReply(count);
+
+    if (!handle)
+    {
+        failed = 1;
+    }
+
+    return handle;
+}
+
+
+// Ask for the next chunk windows of the chunked files in the batch:
+static int issueChunkRequests()
+{
+    char numbers[3][24];
+    const char* args[7] = { fsName, viewGenStr, numbers[0], numbers[1], numbers[2] };
+    long long chunks;
+    long long count;
+    int i;
+
+    while (batch.outstanding < EXPORT_PIPELINE_CHUNKS && batch.issueEntry < batch.count)
+    {
+        i = batch.issueEntry;
+        if (batch.kinds[i] != EXPORT_CHUNKED_FILE)
+        {
+            ++batch.issueEntry;
+            continue;
+        }
+
+        chunks = (batch.info[i][NODE_INFO_SIZE] + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        count = chunks - batch.issueChunk < EXPORT_WINDOW_CHUNKS ? chunks - batch.issueChunk : EXPORT_WINDOW_CHUNKS;
+
+        snprintf(numbers[0], sizeof(numbers[0]), "%lld", batch.ids[i]);
+        snprintf(numbers[1], sizeof(numbers[1]), "%lld", batch.issueChunk);
+        snprintf(numbers[2], sizeof(numbers[2]), "%lld", count);
+        args[5] = batch.info[i][NODE_INFO_FLAGS] & NODE_FLAG_DEDUP ? "1" : "0";
+        args[6] = batch.info[i][NODE_INFO_FLAGS] & NODE_FLAG_TIERED ? "1" : "0";
+        if (0 > sendScript(chunkScript, 7, args))
+        {
+            return -EIO;
+        }
+
+        batch.outstanding += count;
+        batch.issueChunk += count;
+        if (batch.issueChunk == chunks)
+        {
+            ++batch.issueEntry;
+            batch.issueChunk = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+/* ================ Export ================ */
+
+static int appendPath(const char* name, size_t len, int isDir)
+{
+    if (pathLen + len + isDir >= sizeof(path))
+    {
+        return -ENAMETOOLONG;
+    }
+
+    memcpy(path + pathLen, name, len);
+    pathLen += len;
+    if (isDir)
+    {
+        path[pathLen++] = '/';
+    }
+    path[pathLen] = '\0';
+
+    return 0;
+}
+
+
+// Take a chunk of a tiered file from its marker, reading it from the cold
+// store if it is there:
+static int fetchTieredChunk(char** data, size_t* len)
+{
+    char object[COLD_OBJECT_NAME_MAX + 1];
+    int result;
+
+    if (*len > 0 && (*data)[0] == 'd')
+    {
+        ++*data;
+        --*len;
+        return 0;
+    }
+    else if (*len < 2 || *len - 1 > COLD_OBJECT_NAME_MAX || (*data)[0] != 'c')
+    {
+        return *len == 0 ? 0 : -EINVAL;
+    }
+    else if (!g_coldStore)
+    {
+        fprintf(stderr, "Error: %s: File data is in the cold store, which -c gives.\n", path);
+        failed = 1;
+        return -EIO;
+    }
+
+    memcpy(object, *data + 1, *len - 1);
+    object[*len - 1] = '\0';
+    result = g_coldStore->get(object, coldData, sizeof(coldData));
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: %s: Cannot read cold object %s: %s\n", path, object, strerror(-result));
+        failed = 1;
+        return -EIO;
+    }
+
+    *data = coldData;
+    *len = result;
+
+    return 0;
+}
+
+
+// Write one chunk of a file from its stored form:
+static int writeChunk(const char* data, size_t len, int framed, size_t size)
+{
+    int result;
+
+    if (framed && len > 0)
+    {
+        result = decompressChunk(data, len, raw);
+        if (result < 0)
+        {
+            return result;
+        }
+        data = raw;
+        len = result;
+    }
+
+    if (len > size)
+    {
+        len = size;
+    }
+
+    if (0 > writeOutput(data, len) || 0 > writeZeros(size - len))
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+static int exportFile(int i)
+{
+    const long long* info = batch.info[i];
+    long long size = info[NODE_INFO_SIZE];
+    long long chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int codec = NODE_CODEC(info[NODE_INFO_FLAGS]);
+    int framed = (codec > CODEC_NONE && codec < CODEC_COUNT) || (info[NODE_INFO_FLAGS] & NODE_FLAG_DEDUP);
+    int tiered = (info[NODE_INFO_FLAGS] & NODE_FLAG_TIERED) != 0;
+    long long chunk;
+    char* data;
+    size_t len;
+    int handle;
+    int count;
+    int result = 0;
+    int j;
+
+    if (0 > writeEntryHeader(path, pathLen, info, '0', size))
+    {
+        return -EIO;
+    }
+
+    if (batch.kinds[i] == EXPORT_FILE)
+    {
+        len = batch.inlineLens[i] < size ? batch.inlineLens[i] : size;
+        if (0 > writeOutput(batch.inlineData[i], len) || 0 > writeZeros(size - len))
+        {
+            return -EIO;
+        }
+    }
+
+    for (chunk = 0; batch.kinds[i] == EXPORT_CHUNKED_FILE && chunk < chunks; chunk += count)
+    {
+        if (0 > issueChunkRequests())
+        {
+            return -EIO;
+        }
+
+        handle = readScriptReply(&count);
+        if (!handle)
+        {
+            return -EIO;
+        }
+
+        for (j = 0; j < count && result == 0; ++j)
+        {
+            retrieveBinaryArrayElement(handle, j, &data, &len);
+            if (tiered)
+            {
+                result = fetchTieredChunk(&data, &len);
+            }
+            if (result == 0)
+            {
+                result = writeChunk(data, len, framed,
+                                    chunk + j + 1 < chunks ? CHUNK_SIZE : size - (chunk + j) * CHUNK_SIZE);
+            }
+        }
+        releaseReplyHandle(handle);
+        batch.outstanding -= count;
+
+        if (result == -EIO)
+        {
+            return -EIO;
+        }
+        else if (result < 0)
+        {
+            // The archive cannot be completed without the rest of the file:
+            fprintf(stderr, "Error: %s: Corrupt chunk %lld.\n", path, chunk + j - 1);
+            failed = 1;
+            return result;
+        }
+    }
+
+    ++fileCount;
+    byteCount += size;
+
+    return writePadding(size);
+}
+
+
+// Take the info of the batch from its reply and decide how each entry is exported:
+static void classifyBatch(int handle)
+{
+    char* values[EXPORT_INFO_WIDTH];
+    long long* info;
+    long long mode;
+    int i;
+    int j;
+
+    for (i = 0; i < batch.count; ++i)
+    {
+        info = batch.info[i];
+        retrieveStringArrayElements(handle, i * EXPORT_INFO_WIDTH, NODE_INFO_COUNT, values);
+        retrieveBinaryArrayElement(handle, i * EXPORT_INFO_WIDTH + NODE_INFO_COUNT, &batch.inlineData[i],
+                                   &batch.inlineLens[i]);
+        for (j = 0; j < NODE_INFO_COUNT; ++j)
+        {
+            info[j] = atoll(values[j]);
+        }
+
+        mode = info[NODE_INFO_MODE];
+        if (values[NODE_INFO_MODE][0] == '\0')
+        {
+            // Removed before the snapshot was taken:
+            batch.kinds[i] = EXPORT_SKIP;
+        }
+        else if (S_ISDIR(mode))
+        {
+            batch.kinds[i] = EXPORT_DIR;
+        }
+        else if (!S_ISREG(mode))
+        {
+            fprintf(stderr, "Warning: %s%.*s: Unsupported file type.\n", path, (int)batch.nameLens[i],
+                    batch.names[i]);
+            batch.kinds[i] = EXPORT_SKIP;
+            ++skipCount;
+        }
+        else if (pathLen + batch.nameLens[i] >= sizeof(path))
+        {
+            fprintf(stderr, "Warning: %s%.*s: Path too long.\n", path, (int)batch.nameLens[i], batch.names[i]);
+            batch.kinds[i] = EXPORT_SKIP;
+            ++skipCount;
+        }
+        else
+        {
+            batch.kinds[i] = (info[NODE_INFO_FLAGS] & NODE_FLAG_INLINE) || info[NODE_INFO_SIZE] <= 0
+                ? EXPORT_FILE : EXPORT_CHUNKED_FILE;
+        }
+    }
+
+    batch.issueEntry = 0;
+    batch.issueChunk = 0;
+    batch.outstanding = 0;
+}
+
+
+// Export the files of the batch and set its directories aside:
+static int exportBatch(struct export_dir*** dirs, size_t* dirCountInList, size_t* dirCapacity)
+{
+    char idStrs[EXPORT_INFO_BATCH][24];
+    const char* args[EXPORT_INFO_BATCH + 3] = { fsName, viewGenStr, NULL };
+    char width[8];
+    struct export_dir* dir;
+    struct export_dir** grown;
+    size_t savedLen = pathLen;
+    int handle;
+    int count;
+    int result = 0;
+    int i;
+
+    snprintf(width, sizeof(width), "%d", EXPORT_INFO_WIDTH);
+    args[2] = width;
+    for (i = 0; i < batch.count; ++i)
+    {
+        snprintf(idStrs[i], sizeof(idStrs[i]), "%lld", batch.ids[i]);
+        args[i + 3] = idStrs[i];
+    }
+
+    if (0 > sendScript(infoScript, batch.count + 3, args))
+    {
+        return -EIO;
+    }
+    handle = readScriptReply(&count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count != batch.count * EXPORT_INFO_WIDTH)
+    {
+        releaseReplyHandle(handle);
+        failed = 1;
+        return -EIO;
+    }
+
+    classifyBatch(handle);
+
+    for (i = 0; i < batch.count && result == 0 && !interrupted; ++i)
+    {
+        if (batch.kinds[i] == EXPORT_DIR)
+        {
+            dir = malloc(sizeof(struct export_dir) + batch.nameLens[i]);
+            if (*dirCountInList == *dirCapacity)
+            {
+                *dirCapacity = *dirCapacity ? *dirCapacity * 2 : 16;
+                grown = realloc(*dirs, *dirCapacity * sizeof(struct export_dir*));
+                if (grown)
+                {
+                    *dirs = grown;
+                }
+                else
+                {
+                    free(dir);
+                    dir = NULL;
+                }
+            }
+            if (!dir)
+            {
+                fprintf(stderr, "Error: Out of memory.\n");
+                failed = 1;
+                result = -ENOMEM;
+                break;
+            }
+            dir->nodeId = batch.ids[i];
+            memcpy(dir->info, batch.info[i], sizeof(dir->info));
+            dir->nameLen = batch.nameLens[i];
+            memcpy(dir->name, batch.names[i], batch.nameLens[i]);
+            (*dirs)[(*dirCountInList)++] = dir;
+        }
+        else if (batch.kinds[i] != EXPORT_SKIP)
+        {
+            appendPath(batch.names[i], batch.nameLens[i], 0);
+            result = exportFile(i);
+            pathLen = savedLen;
+            path[pathLen] = '\0';
+        }
+    }
+
+    releaseReplyHandle(handle);
+
+    return result;
+}
+
+
+/*
+ * Export the entries of the directory at the current path: its files
+ * first, then each subdirectory with its contents.
+*/
+static int exportDir(node_id_t dirId)
+{
+    char idStr[24];
+    const char* args[3] = { fsName, viewGenStr, idStr };
+    struct export_dir** dirs = NULL;
+    size_t dirsCount = 0;
+    size_t dirsCapacity = 0;
+    size_t savedLen = pathLen;
+    char* value;
+    size_t len;
+    int handle;
+    int count;
+    int result = 0;
+    int i;
+    size_t d;
+
+    snprintf(idStr, sizeof(idStr), "%lld", dirId);
+    if (0 > sendScript(listScript, 3, args))
+    {
+        return -EIO;
+    }
+    handle = readScriptReply(&count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    batch.count = 0;
+    for (i = 0; i + 1 < count && result == 0 && !interrupted; i += 2)
+    {
+        retrieveBinaryArrayElement(handle, i, &value, &len);
+        batch.names[batch.count] = value;
+        batch.nameLens[batch.count] = len;
+        retrieveBinaryArrayElement(handle, i + 1, &value, &len);
+        batch.ids[batch.count] = atoll(value);
+
+        if (++batch.count == EXPORT_INFO_BATCH || i + 3 >= count)
+        {
+            result = exportBatch(&dirs, &dirsCount, &dirsCapacity);
+            batch.count = 0;
+        }
+    }
+
+    releaseReplyHandle(handle);
+
+    for (d = 0; d < dirsCount; ++d)
+    {
+        if (result == 0 && !interrupted)
+        {
+            if (0 > appendPath(dirs[d]->name, dirs[d]->nameLen, 1))
+            {
+                fprintf(stderr, "Warning: %s%.*s: Path too long.\n", path, (int)dirs[d]->nameLen, dirs[d]->name);
+                ++skipCount;
+            }
+            else
+            {
+                result = writeEntryHeader(path, pathLen, dirs[d]->info, '5', 0);
+                if (result == 0)
+                {
+                    ++dirCount;
+                    result = exportDir(dirs[d]->nodeId);
+                }
+                pathLen = savedLen;
+                path[pathLen] = '\0';
+            }
+        }
+        free(dirs[d]);
+    }
+    free(dirs);
+
+    return result;
+}
+
+
+/* ================ Main ================ */
+
+struct snapshot_lookup
+{
+    const char* name;
+    long long gen;
+};
+
+
+static int findSnapshot(void* ctx, const char* name, long long gen)
+{
+    struct snapshot_lookup* lookup = ctx;
+
+    if (0 == strcmp(name, lookup->name))
+    {
+        lookup->gen = gen;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static void onSignal(int sig)
+{
+    interrupted = 1;
+}
+
+
+static void usage(const char* progName)
+{
+    fprintf(stderr, "Usage: %s [options] [DIR] > ARCHIVE\n", progName);
+    fprintf(stderr, "Write the tree below DIR (default /) of a RediFS file system as a tar archive.\n");
+    fprintf(stderr, "  -h HOST      Redis server host\n");
+    fprintf(stderr, "  -p PORT      Redis server port\n");
+    fprintf(stderr, "  -N NAME      File system name (default %s)\n", DEFAULT_NAME);
+    fprintf(stderr, "  -s SNAPSHOT  Export a snapshot instead of the live file system\n");
+    fprintf(stderr, "  -c STORE     Cold store of tiered file data, as -o cold_store of redifs\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .port = 0,
+        .name = DEFAULT_NAME,
+        .inline_max = DEFAULT_INLINE_MAX,
+    };
+    struct snapshot_lookup lookup = { NULL, -1 };
+    long long info[NODE_INFO_COUNT];
+    struct timespec start;
+    struct timespec end;
+    const char* source = "/";
+    char tempSnapshot[64] = "";
+    node_id_t rootId;
+    int result;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:s:c:")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 's': settings.snapshot = optarg; break;
+            case 'c': settings.cold_store = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind > 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    else if (isatty(STDOUT_FILENO))
+    {
+        fprintf(stderr, "Error: Refusing to write an archive to a terminal.\n");
+        return 1;
+    }
+    if (optind < argc)
+    {
+        source = argv[optind];
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    fsName = settings.name;
+    g_settings = &settings;
+    g_backend = &redisBackend;
+    if (0 > g_backend->open())
+    {
+        fprintf(stderr, "Error: Cannot open the file system.\n");
+        return 1;
+    }
+    else if (g_backend->fs_exists() <= 0)
+    {
+        fprintf(stderr, "Error: No file system named '%s'.\n", settings.name);
+        return 1;
+    }
+
+    // Freeze the live file system for the duration of the export:
+    lookup.name = settings.snapshot;
+    if (!lookup.name)
+    {
+        snprintf(tempSnapshot, sizeof(tempSnapshot), "export-%d", (int)getpid());
+        result = g_backend->snapshot_create(tempSnapshot);
+        if (result == 0)
+        {
+            result = loadSnapshots(tempSnapshot);
+        }
+        if (result < 0)
+        {
+            fprintf(stderr, "Error: Cannot create snapshot '%s': %s\n", tempSnapshot, strerror(-result));
+            return 1;
+        }
+        lookup.name = tempSnapshot;
+    }
+
+    result = g_backend->snapshot_list(findSnapshot, &lookup);
+    if (result == 0 && lookup.gen < 0)
+    {
+        result = -ENOENT;
+    }
+    snprintf(viewGenStr, sizeof(viewGenStr), "%lld", lookup.gen);
+
+    rootId = result < 0 ? result : g_backend->resolve(source, strlen(source));
+    result = rootId < 0 ? rootId : g_backend->get_info(rootId, info);
+    if (result == 0 && !S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        result = -ENOTDIR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: %s: %s\n", source, strerror(-result));
+    }
+    else
+    {
+        setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+        if (0 == exportDir(rootId) && !interrupted)
+        {
+            // End of archive:
+            writeZeros(2 * TAR_BLOCK);
+        }
+        if (0 != fflush(stdout) && !failed)
+        {
+            fprintf(stderr, "Error: Cannot write the archive: %s\n", strerror(errno));
+            failed = 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (tempSnapshot[0])
+    {
+        // Replies still pipelined after a failure are skipped; a lost
+        // connection is opened again on the next command:
+        redisPipelineFlush();
+        if (0 > loadSnapshots(NULL) || 0 > g_backend->snapshot_delete(tempSnapshot))
+        {
+            fprintf(stderr, "Error: Cannot delete snapshot '%s'.\n", tempSnapshot);
+        }
+    }
+    g_backend->close();
+
+    if (result < 0)
+    {
+        return 1;
+    }
+
+    fprintf(stderr, "Exported %llu directories and %llu files, %llu bytes, in %.2f s.\n", dirCount, fileCount,
+            byteCount, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (skipCount > 0)
+    {
+        fprintf(stderr, "Skipped %llu entries.\n", skipCount);
+    }
+
+    if (interrupted)
+    {
+        fprintf(stderr, "Error: Interrupted; the archive is incomplete.\n");
+        return 1;
+    }
+    else if (failed)
+    {
+        fprintf(stderr, "Error: Export failed; the archive is incomplete.\n");
+        return 1;
+    }
+
+    return skipCount > 0 ? 1 : 0;
+}
@@ -0,0 +1,1785 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Consistency check of a RediFS file system, online or offline:
+ *
+ *   redifs_fsck [-h host] [-p port] [-N name] [-j threads] [-r rate] [-y] [-o]
+ *
+ * Worker threads walk the tree from the root and from the reclaim queue,
+ * marking every node they reach and finding directory entries whose node
+ * is missing. Then one SCAN cursor per kind of key runs in parallel:
+ *
+ *   - node info that nothing reaches: an orphan, e.g. left by a create
+ *     that failed before its entry was linked;
+ *   - directory hashes, bloom filters, chunks, blob references and cold
+ *     hashes without a node, or that their node does not use, such as
+ *     chunks past the file size;
+ *   - blob references, live and archived, which are counted to check the
+ *     reference count of every blob afterwards.
+ *
+ * Orphans are confirmed by walking the tree again, so entries linked while
+ * the first walk ran are not taken for orphans, and nodes in an ID range
+ * leased by a running redifs_import are left alone. Nodes below orphaned
+ * directories are reported with their directory.
+ *
+ * Offline, with -o, the walk also adds up the usage below every directory,
+ * which is compared with the usage counters and the parents hash that
+ * mounts keep up to date. This takes about 32 bytes of memory per node.
+ *
+ * With -y, dangling entries and stray keys are removed, orphans are queued
+ * for reclaim, the node ID counter is raised past the largest node ID, and
+ * blob reference counts that are too low are raised. Every removal checks
+ * its condition again atomically and archives the value for the snapshots
+ * first. Lowering reference counts that are too high is only safe without
+ * writers, so it also needs -o, for offline, as does rewriting the usage
+ * counters, which builds them for file systems that predate them. Expired
+ * leases of failed imports are dropped as well. -r limits the keys and
+ * entries read per second, for a check of a file system in use.
+ *
+ * The exit code is 0 without problems, FSCK_EXIT_FIXED when all problems
+ * were repaired, FSCK_EXIT_UNFIXED when some remain, and FSCK_EXIT_ERROR
+ * when the check failed.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "backend.h"
+#include "connection.h"
+#include "dedup.h"
+#include "reclaim.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define FSCK_THREADS 8
+#define FSCK_THREADS_MAX 256
+#define FSCK_BATCH 256 // Directory entries or keys per round trip.
+#define FSCK_CONFIRM_NS 2000000000LL // Least time between finding and removing a stray key.
+#define FSCK_PATH_MAX 4096
+
+#define FSCK_EXIT_FIXED 1
+#define FSCK_EXIT_UNFIXED 4
+#define FSCK_EXIT_ERROR 8
+
+#define BLOB_HASH_BYTES (CHUNK_HASH_LEN / 2)
+
+// Status of a key from stray():
+#define KEY_USED 0
+#define KEY_NO_NODE 1
+#define KEY_UNUSED 2
+
+// Lua function stray(prefix, chunk size, key suffix) telling whether a
+// directory hash or bucket, bloom filter, usage counters, chunk, blob
+// reference hash or cold hash belongs to a node that uses it.
+#define LUA_STRAY_FUNCTION \
+    "local function stray(p, cs, s) " \
+    "local kind, id, c = string.match(s, '^(%a+):(%d+):?(%d*)$') " \
+    "if kind ~= 'node' and kind ~= 'bloom' and kind ~= 'usage' and kind ~= 'data' and kind ~= 'refs' " \
+    "and kind ~= 'cold' then return 0 end " \
+    "local f = redis.call('LRANGE', p .. 'info:' .. id, 0, " LUA_STR(LUA_INFO_FLAGS) ") " \
+    "if #f == 0 then return 1 end " \
+    "local size, flags = tonumber(f[" LUA_STR(LUA_INFO_SIZE) " + 1] or '0'), tonumber(f[" LUA_STR(LUA_INFO_FLAGS) " + 1] or '0') " \
+    "local isDir = " LUA_MODE_IS_DIR("tonumber(f[1])") " " \
+    "local dedup = math.floor(flags / 2) % 2 == 1 " \
+    "if kind == 'node' then " \
+    "if not isDir then return 2 end " \
+    "if c == '' then return 0 end " \
+    "return tonumber(c) < tonumber(redis.call('HGET', p .. 'node:' .. id, '/buckets') or '1') and 0 or 2 end " \
+    "if kind == 'bloom' or kind == 'usage' then return isDir and 0 or 2 end " \
+    "if kind == 'refs' then return (not isDir and dedup) and 0 or 2 end " \
+    "if kind == 'cold' then return (not isDir and math.floor(flags / 4) % 2 == 1) and 0 or 2 end " \
+    "if c == '' or isDir or dedup or flags % 2 == 1 then return 2 end " \
+    "return tonumber(c) < math.ceil(size / cs) and 0 or 2 end "
+
+
+/* ---- Types ---- */
+
+// Directory waiting for a worker:
+struct fsck_dir
+{
+    struct fsck_dir* next;
+    node_id_t nodeId;
+    int orphaned; // Below a node that is being reclaimed.
+    char path[];
+};
+
+struct fsck_dangling
+{
+    node_id_t dirId;
+    node_id_t nodeId;
+    char* name;
+};
+
+struct fsck_stray
+{
+    char* suffix;
+    int status;
+};
+
+// Parallel SCAN over one kind of key:
+struct fsck_scan
+{
+    pthread_t thread;
+    const char* kind; // Key kind after the prefix, or NULL for archived blob references.
+    char pattern[KEY_LEN];
+    int result;
+};
+
+// Node ID range of a running import:
+struct fsck_lease
+{
+    node_id_t first;
+    node_id_t last;
+};
+
+struct blob_count
+{
+    unsigned char hash[BLOB_HASH_BYTES];
+    unsigned int refs; // 0 for a free slot.
+    int found;
+};
+
+// Node reached from the root by an offline check, with the usage below it:
+struct fsck_usage
+{
+    node_id_t parent; // -1 for a node not reached from the root.
+    long long size; // Of a file.
+    long long bytes; // Below a directory.
+    long long inodes;
+};
+
+// Blob whose reference count differs from the references counted:
+struct blob_fix
+{
+    char hash[CHUNK_HASH_LEN + 1];
+    long long counted;
+    int tooLow;
+};
+
+
+/* ---- Globals ---- */
+static char prefix[KEY_LEN]; // "<name>::"
+static char chunkSizeStr[24];
+
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static struct fsck_dir* queueHead = NULL;
+static struct fsck_dir* queueTail = NULL;
+static int busyWorkers = 0;
+static int threadCount = FSCK_THREADS;
+static int failed = 0;
+
+// Nodes reached by the walk, up to the node ID counter at the start:
+static unsigned long long* marks = NULL;
+static node_id_t markLimit = 0;
+static node_id_t maxNodeId = 0;
+static int collect = 1; // Report and remember problems found by the walk.
+static struct fsck_lease* leases = NULL;
+static int leaseCount = 0;
+static struct fsck_usage* usages = NULL; // Offline only; indexed by node ID up to markLimit.
+static unsigned char* dirs = NULL; // Bit per node reached from the root that is a directory.
+
+static pthread_mutex_t listMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fsck_dangling* danglings = NULL;
+static size_t danglingCount = 0;
+static size_t danglingCapacity = 0;
+static struct fsck_stray* strays = NULL;
+static size_t strayCount = 0;
+static size_t strayCapacity = 0;
+static node_id_t* orphans = NULL;
+static size_t orphanCount = 0;
+static size_t orphanCapacity = 0;
+
+static pthread_mutex_t blobMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct blob_count* blobs = NULL;
+static size_t blobCapacity = 0;
+static size_t blobUsed = 0;
+static struct blob_fix* blobFixes = NULL;
+static size_t blobFixCount = 0;
+static size_t blobFixCapacity = 0;
+
+static pthread_mutex_t throttleMutex = PTHREAD_MUTEX_INITIALIZER;
+static double rate = 0; // Keys and entries per second, 0 for no limit.
+static long long throttleNs = 0;
+
+static unsigned long long nodesWalked = 0;
+static unsigned long long keysScanned = 0;
+static unsigned long long problems = 0;
+static unsigned long long fixed = 0;
+static long long strayFoundNs = 0;
+
+
+/* ---- Scripts ---- */
+
+// ARGV: "<name>::", directory node ID, cursor, count. Returns the next
+// cursor, then the name, node ID, mode and size of each entry, with '' as
+// the mode of a missing node.
+static const char* listScript =
+    LUA_DIR_FUNCTIONS
+    "local p = ARGV[1] "
+    "local reply = dirScan(dirBuckets(p .. 'node:' .. ARGV[2]), ARGV[3], tonumber(ARGV[4])) "
+    "local out = { reply[1] } "
+    "for i = 2, #reply, 2 do "
+    "local f = redis.call('LRANGE', p .. 'info:' .. reply[i + 1], 0, " LUA_STR(LUA_INFO_SIZE) ") "
+    "out[#out + 1] = reply[i] "
+    "out[#out + 1] = reply[i + 1] "
+    "out[#out + 1] = f[1] or '' "
+    "out[#out + 1] = f[" LUA_STR(LUA_INFO_SIZE) " + 1] or '0' "
+    "end "
+    "return out";
+
+// ARGV: "<name>::", chunk size, cursor, pattern, count, check, values.
+// Returns the next cursor, then for each key its suffix and stray() status
+// if check is '1', or else the whole key and '0', and if values is '1' the
+// number of values of the hash followed by the values.
+static const char* scanScript =
+    LUA_STRAY_FUNCTION
+    "local p, cs = ARGV[1], tonumber(ARGV[2]) "
+    "local reply = redis.call('SCAN', ARGV[3], 'MATCH', ARGV[4], 'COUNT', ARGV[5]) "
+    "local out = { reply[1] } "
+    "for _, key in ipairs(reply[2]) do "
+    "local s = ARGV[6] == '1' and string.sub(key, #p + 1) or key "
+    "out[#out + 1] = s "
+    "out[#out + 1] = ARGV[6] == '1' and tostring(stray(p, cs, s)) or '0' "
+    "if ARGV[7] == '1' then "
+    "local values = redis.call('HVALS', key) "
+    "out[#out + 1] = tostring(#values) "
+    "for _, v in ipairs(values) do out[#out + 1] = v end "
+    "end end "
+    "return out";
+
+// ARGV: "<name>::", cursor, pattern, count. Returns the next cursor, then
+// the hash, reference count and whether the data exists for each blob.
+static const char* blobScanScript =
+    "local p = ARGV[1] "
+    "local reply = redis.call('SCAN', ARGV[2], 'MATCH', ARGV[3], 'COUNT', ARGV[4]) "
+    "local out = { reply[1] } "
+    "for _, key in ipairs(reply[2]) do "
+    "out[#out + 1] = string.sub(key, #p + 6) "
+    "out[#out + 1] = redis.call('HGET', key, 'refs') or '0' "
+    "out[#out + 1] = tostring(redis.call('HEXISTS', key, 'data')) "
+    "end "
+    "return out";
+
+// KEYS: directory; ARGV: name, node ID, info key
+static const char* unlinkDanglingScript =
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    "local key = dirEntryKey(KEYS[1], ARGV[1]) "
+    "if redis.call('HGET', key, ARGV[1]) ~= ARGV[2] "
+    "or redis.call('EXISTS', ARGV[3]) == 1 then return 0 end "
+    "cowAt(string.match(KEYS[1], '^(.*::)node:%d+$'), KEYS[1]) "
+    "return redis.call('HDEL', key, ARGV[1])";
+
+// ARGV: "<name>::", chunk size, key suffix. References of a blob
+// reference hash are dropped with it.
+static const char* deleteStrayScript =
+    LUA_COW_FUNCTION
+    LUA_STRAY_FUNCTION
+    "local p, s = ARGV[1], ARGV[3] "
+    "if stray(p, tonumber(ARGV[2]), s) == 0 then return 0 end "
+    "cowAt(p, p .. s) "
+    "if string.sub(s, 1, 5) == 'refs:' then "
+    "for _, h in ipairs(redis.call('HVALS', p .. s)) do "
+    "if redis.call('HINCRBY', p .. 'blob:' .. h, 'refs', -1) <= 0 then "
+    "redis.call('RPUSH', p .. 'blob_gc', h) end end end "
+    "return redis.call('UNLINK', p .. s)";
+
+// KEYS: info, orphans; ARGV: node ID
+static const char* queueOrphanScript =
+    "if redis.call('EXISTS', KEYS[1]) == 0 then return 0 end "
+    "return redis.call('RPUSH', KEYS[2], ARGV[1])";
+
+// KEYS: node ID counter; ARGV: largest node ID
+static const char* raiseCounterScript =
+    "if tonumber(redis.call('GET', KEYS[1]) or '0') >= tonumber(ARGV[1]) then return 0 end "
+    "redis.call('SET', KEYS[1], ARGV[1]) "
+    "return 1";
+
+// KEYS: blob, gc list; ARGV: references counted, lower ('1' to also lower)
+static const char* setBlobRefsScript =
+    "local refs = tonumber(redis.call('HGET', KEYS[1], 'refs') or '0') "
+    "local counted = tonumber(ARGV[1]) "
+    "if refs == counted or (refs > counted and ARGV[2] ~= '1') then return 0 end "
+    "redis.call('HSET', KEYS[1], 'refs', counted) "
+    "if counted <= 0 then redis.call('RPUSH', KEYS[2], string.sub(KEYS[1], #KEYS[1] - 31)) end "
+    "return 1";
+
+// ARGV: "<name>::", '1' to rewrite what differs, then "<node ID> <parent
+// ID> <bytes> <inodes>" lines, with bytes '-' for a file. Returns the
+// number of parent IDs that differed, then the ID and stored bytes and
+// inodes of each directory whose counters differed.
+static const char* usageCheckScript =
+    "local p, fix = ARGV[1], ARGV[2] == '1' "
+    "local out = { 0 } "
+    "for id, parent, bytes, inodes in string.gmatch(ARGV[3], '(%d+) (%-?%d+) (%S+) (%d+)') do "
+    "if id ~= '0' and redis.call('HGET', p .. 'parents', id) ~= parent then "
+    "out[1] = out[1] + 1 "
+    "if fix then redis.call('HSET', p .. 'parents', id, parent) end end "
+    "if bytes ~= '-' then "
+    "local u = redis.call('HMGET', p .. 'usage:' .. id, 'bytes', 'inodes') "
+    "if tonumber(u[1] or '0') ~= tonumber(bytes) or tonumber(u[2] or '0') ~= tonumber(inodes) then "
+    "out[#out + 1] = id "
+    "out[#out + 1] = u[1] or '0' "
+    "out[#out + 1] = u[2] or '0' "
+    "if fix then redis.call('HSET', p .. 'usage:' .. id, 'bytes', bytes, 'inodes', inodes) end end end "
+    "end "
+    "out[1] = tostring(out[1]) "
+    "return out";
+
+// KEYS: parents; ARGV: cursor, count. Returns the next cursor, then node IDs.
+static const char* parentsScanScript =
+    "local reply = redis.call('HSCAN', KEYS[1], ARGV[1], 'COUNT', ARGV[2]) "
+    "local out = { reply[1] } "
+    "for i = 1, #reply[2], 2 do out[#out + 1] = reply[2][i] end "
+    "return out";
+
+static const char* leasesScript = "return redis.call('ZRANGEBYSCORE', KEYS[1], ARGV[1], '+inf')";
+
+static const char* dropLeasesScript = "return redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', '(' .. ARGV[1])";
+
+static const char* getIntScript = "return tonumber(redis.call('GET', KEYS[1]) or '0')";
+
+
+/* ================ Util functions ================ */
+
+static long long nowNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+static void sleepNs(long long ns)
+{
+    struct timespec delay = { ns / 1000000000LL, ns % 1000000000LL };
+
+    if (ns > 0)
+    {
+        nanosleep(&delay, NULL);
+    }
+}
+
+
+// Spread the work over time when a rate is set:
+static void throttle(unsigned long long count)
+{
+    long long now;
+    long long delay;
+
+    if (rate <= 0 || count == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&throttleMutex);
+    now = nowNs();
+    if (throttleNs < now)
+    {
+        throttleNs = now;
+    }
+    throttleNs += (long long)(count * 1e9 / rate);
+    delay = throttleNs - now;
+    pthread_mutex_unlock(&throttleMutex);
+
+    sleepNs(delay);
+}
+
+
+static void report(const char* format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    putchar('\n');
+
+    __atomic_add_fetch(&problems, 1, __ATOMIC_RELAXED);
+}
+
+
+static void setFailed()
+{
+    pthread_mutex_lock(&queueMutex);
+    failed = 1;
+    pthread_cond_broadcast(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+
+// Make room for one more element of a list guarded by listMutex:
+static int growList(void** list, size_t* capacity, size_t count, size_t size)
+{
+    void* grown;
+
+    if (count < *capacity)
+    {
+        return 0;
+    }
+
+    grown = realloc(*list, (*capacity ? *capacity * 2 : 64) * size);
+    if (!grown)
+    {
+        return -ENOMEM;
+    }
+    *list = grown;
+    *capacity = *capacity ? *capacity * 2 : 64;
+
+    return 0;
+}
+
+
+// Escape the glob characters of a file system name for SCAN MATCH:
+static void formatPattern(char* pattern, const char* name, const char* suffix)
+{
+    size_t len = 0;
+
+    for (; *name && len + 2 < KEY_LEN - 64; ++name)
+    {
+        if (strchr("*?[]\\", *name))
+        {
+            pattern[len++] = '\\';
+        }
+        pattern[len++] = *name;
+    }
+    snprintf(pattern + len, KEY_LEN - len, "%s", suffix);
+}
+
+
+// Node ID at the start of a key suffix after its kind, or -1:
+static node_id_t parseNodeId(const char* suffix, const char* kind)
+{
+    size_t len = strlen(kind);
+
+    if (0 != strncmp(suffix, kind, len) || suffix[len] != ':' || suffix[len + 1] < '0' || suffix[len + 1] > '9')
+    {
+        return -1;
+    }
+
+    return atoll(suffix + len + 1);
+}
+
+
+static void updateMaxNodeId(node_id_t nodeId)
+{
+    node_id_t seen = __atomic_load_n(&maxNodeId, __ATOMIC_RELAXED);
+
+    while (nodeId > seen && !__atomic_compare_exchange_n(&maxNodeId, &seen, nodeId, 0, __ATOMIC_RELAXED,
+                                                         __ATOMIC_RELAXED));
+}
+
+
+/* ================ Marks ================ */
+
+static void markNode(node_id_t nodeId)
+{
+    if (nodeId >= 0 && nodeId <= markLimit)
+    {
+        __atomic_fetch_or(&marks[nodeId / 64], 1ULL << (nodeId % 64), __ATOMIC_RELAXED);
+    }
+}
+
+
+static int isMarked(node_id_t nodeId)
+{
+    return nodeId >= 0 && nodeId <= markLimit
+        && (__atomic_load_n(&marks[nodeId / 64], __ATOMIC_RELAXED) & (1ULL << (nodeId % 64)));
+}
+
+
+/* ================ Directory queue ================ */
+
+static int queueDir(const char* path, node_id_t nodeId, int orphaned)
+{
+    struct fsck_dir* dir;
+    size_t len = strlen(path);
+
+    dir = malloc(sizeof(struct fsck_dir) + len + 1);
+    if (!dir)
+    {
+        return -ENOMEM;
+    }
+    dir->next = NULL;
+    dir->nodeId = nodeId;
+    dir->orphaned = orphaned;
+    memcpy(dir->path, path, len + 1);
+
+    pthread_mutex_lock(&queueMutex);
+    if (queueTail)
+    {
+        queueTail->next = dir;
+    }
+    else
+    {
+        queueHead = dir;
+    }
+    queueTail = dir;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+
+    return 0;
+}
+
+
+// Take the next directory; NULL once the queue is empty and no worker can add to it:
+static struct fsck_dir* takeDir(struct fsck_dir* done)
+{
+    struct fsck_dir* dir;
+
+    pthread_mutex_lock(&queueMutex);
+    if (done)
+    {
+        --busyWorkers;
+        free(done);
+    }
+
+    while (!queueHead && busyWorkers > 0 && !failed)
+    {
+        pthread_cond_wait(&queueCond, &queueMutex);
+    }
+
+    dir = failed ? NULL : queueHead;
+    if (dir)
+    {
+        queueHead = dir->next;
+        if (!queueHead)
+        {
+            queueTail = NULL;
+        }
+        ++busyWorkers;
+    }
+    else
+    {
+        pthread_cond_broadcast(&queueCond);
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return dir;
+}
+
+
+/* ================ Tree walk ================ */
+
+static int addDangling(const struct fsck_dir* dir, const char* name, node_id_t nodeId)
+{
+    int result;
+
+    report("Dangling entry %s/%s: node %lld is missing", dir->path, name, nodeId);
+
+    pthread_mutex_lock(&listMutex);
+    result = growList((void**)&danglings, &danglingCapacity, danglingCount, sizeof(struct fsck_dangling));
+    if (result == 0)
+    {
+        danglings[danglingCount].dirId = dir->nodeId;
+        danglings[danglingCount].nodeId = nodeId;
+        danglings[danglingCount].name = strdup(name);
+        result = danglings[danglingCount].name ? 0 : -ENOMEM;
+        danglingCount += result == 0;
+    }
+    pthread_mutex_unlock(&listMutex);
+
+    return result;
+}
+
+
+static int walkDir(const struct fsck_dir* dir)
+{
+    char path[FSCK_PATH_MAX];
+    char cursor[DIR_CURSOR_LEN] = "0";
+    char nodeIdStr[24];
+    char countStr[24];
+    const char* args[4] = { prefix, nodeIdStr, cursor, countStr };
+    char* values[4];
+    node_id_t nodeId;
+    int handle;
+    int count;
+    int result = 0;
+    int i;
+
+    snprintf(nodeIdStr, sizeof(nodeIdStr), "%lld", dir->nodeId);
+    snprintf(countStr, sizeof(countStr), "%d", FSCK_BATCH);
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(listScript, 0, args, 4, &count);
+        if (!handle || count < 1)
+        {
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, values);
+        snprintf(cursor, sizeof(cursor), "%s", values[0]);
+
+        for (i = 1; i + 3 < count && result == 0; i += 4)
+        {
+            retrieveStringArrayElements(handle, i, 4, values);
+            nodeId = atoll(values[1]);
+            updateMaxNodeId(nodeId);
+
+            if (values[2][0] == '\0')
+            {
+                // Entries of orphaned directories are reclaimed anyway:
+                if (collect && !dir->orphaned)
+                {
+                    result = addDangling(dir, values[0], nodeId);
+                }
+                continue;
+            }
+
+            markNode(nodeId);
+            if (usages && collect && !dir->orphaned && nodeId > 0 && nodeId <= markLimit && dir->nodeId <= markLimit)
+            {
+                usages[nodeId].parent = dir->nodeId;
+                usages[nodeId].size = S_ISDIR(atoll(values[2])) ? 0 : atoll(values[3]);
+                if (S_ISDIR(atoll(values[2])))
+                {
+                    __atomic_fetch_or(&dirs[nodeId / 8], 1 << (nodeId % 8), __ATOMIC_RELAXED);
+                }
+            }
+            if (S_ISDIR(atoll(values[2])))
+            {
+                if (snprintf(path, sizeof(path), "%s/%s", dir->path, values[0]) >= sizeof(path))
+                {
+                    path[sizeof(path) - 1] = '\0';
+                }
+                result = queueDir(path, nodeId, dir->orphaned);
+            }
+        }
+        releaseReplyHandle(handle);
+
+        if (collect)
+        {
+            __atomic_add_fetch(&nodesWalked, (count - 1) / 4, __ATOMIC_RELAXED);
+        }
+        throttle((count - 1) / 4);
+    }
+    while (result == 0 && 0 != strcmp(cursor, "0"));
+
+    return result;
+}
+
+
+static void* walkerMain(void* arg)
+{
+    struct fsck_dir* dir = NULL;
+
+    while ((dir = takeDir(dir)))
+    {
+        if (walkDir(dir) < 0)
+        {
+            fprintf(stderr, "Error: Cannot read directory %s.\n", dir->path[0] ? dir->path : "/");
+            setFailed();
+        }
+    }
+
+    closeRedisConnection();
+
+    return NULL;
+}
+
+
+// Walk the queued directories with the worker threads:
+static int runWalk()
+{
+    pthread_t threads[threadCount];
+    int started;
+
+    for (started = 0; started < threadCount; ++started)
+    {
+        if (0 != pthread_create(&threads[started], NULL, walkerMain, NULL))
+        {
+            fprintf(stderr, "Error: Cannot start worker thread.\n");
+            setFailed();
+            break;
+        }
+    }
+
+    while (started > 0)
+    {
+        pthread_join(threads[--started], NULL);
+    }
+
+    // Left behind after a failure:
+    while (queueHead)
+    {
+        struct fsck_dir* next = queueHead->next;
+        free(queueHead);
+        queueHead = next;
+    }
+    queueTail = NULL;
+
+    return failed ? -EIO : 0;
+}
+
+
+/*
+ * Mark the nodes reachable from the root and from the reclaim queue.
+*/
+static int markReachable()
+{
+    char key[KEY_LEN];
+    char* idStr;
+    int handle;
+    int count;
+    int result = 0;
+    int i;
+
+    memset(marks, 0, (markLimit / 64 + 1) * sizeof(unsigned long long));
+    markNode(0);
+    result = queueDir("", 0, 0);
+
+    formatKey(key, KEY_ORPHANS);
+    handle = redisCommand_LRANGE(key, 0, -1, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    for (i = 0; i < count && result == 0; ++i)
+    {
+        retrieveStringArrayElements(handle, i, 1, &idStr);
+        markNode(atoll(idStr));
+        result = queueDir("(reclaim queue)", atoll(idStr), 1);
+    }
+    releaseReplyHandle(handle);
+
+    return result < 0 ? result : runWalk();
+}
+
+
+/*
+ * Read the node ID ranges leased by running imports. They are read after
+ * the node ID counter, and a range is leased along with its allocation, so
+ * every range below markLimit in use by an import is seen.
+*/
+static int readLeases()
+{
+    char key[KEY_LEN];
+    char now[24];
+    const char* args[2] = { key, now };
+    char* member;
+    int handle;
+    int count;
+    int i;
+
+    formatKey(key, KEY_ID_LEASES);
+    snprintf(now, sizeof(now), "%lld", (long long)time(NULL));
+    handle = redisCommand_EVAL_ARRAY(leasesScript, 1, args, 2, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+
+    leases = calloc(count + 1, sizeof(struct fsck_lease));
+    if (!leases)
+    {
+        releaseReplyHandle(handle);
+        return -ENOMEM;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        retrieveStringArrayElements(handle, i, 1, &member);
+        if (2 == sscanf(member, "%lld:%lld", &leases[leaseCount].first, &leases[leaseCount].last))
+        {
+            ++leaseCount;
+        }
+    }
+    releaseReplyHandle(handle);
+
+    return 0;
+}
+
+
+static int isLeased(node_id_t nodeId)
+{
+    int i;
+
+    for (i = 0; i < leaseCount; ++i)
+    {
+        if (nodeId >= leases[i].first && nodeId <= leases[i].last)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* ================ Blob references ================ */
+
+static int parseHash(const char* hex, size_t len, unsigned char hash[BLOB_HASH_BYTES])
+{
+    unsigned int byte;
+    size_t i;
+
+    if (len != CHUNK_HASH_LEN || strspn(hex, "0123456789abcdef") < CHUNK_HASH_LEN)
+    {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < BLOB_HASH_BYTES; ++i)
+    {
+        sscanf(hex + 2 * i, "%2x", &byte);
+        hash[i] = byte;
+    }
+
+    return 0;
+}
+
+
+// Find the count of a blob, adding it when asked; blobMutex must be held:
+static struct blob_count* findBlob(const unsigned char hash[BLOB_HASH_BYTES], int add)
+{
+    struct blob_count* old = blobs;
+    size_t oldCapacity = blobCapacity;
+    unsigned long long slot;
+    size_t i;
+
+    if (add && (blobUsed + 1) * 10 > blobCapacity * 7)
+    {
+        blobCapacity = blobCapacity ? blobCapacity * 2 : 1024;
+        blobs = calloc(blobCapacity, sizeof(struct blob_count));
+        if (!blobs)
+        {
+            blobs = old;
+            blobCapacity = oldCapacity;
+            return NULL;
+        }
+        blobUsed = 0;
+        for (i = 0; i < oldCapacity; ++i)
+        {
+            if (old[i].refs > 0)
+            {
+                *findBlob(old[i].hash, 1) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    if (blobCapacity == 0)
+    {
+        return NULL;
+    }
+
+    // Hashes are random already:
+    memcpy(&slot, hash, sizeof(slot));
+    for (i = slot % blobCapacity; blobs[i].refs > 0; i = (i + 1) % blobCapacity)
+    {
+        if (0 == memcmp(blobs[i].hash, hash, BLOB_HASH_BYTES))
+        {
+            return &blobs[i];
+        }
+    }
+
+    if (!add)
+    {
+        return NULL;
+    }
+    memcpy(blobs[i].hash, hash, BLOB_HASH_BYTES);
+    ++blobUsed;
+
+    return &blobs[i];
+}
+
+
+static int countBlobRef(const char* hex, size_t len, const char* keyPrefix, const char* suffix)
+{
+    unsigned char hash[BLOB_HASH_BYTES];
+    struct blob_count* blob;
+
+    if (0 > parseHash(hex, len, hash))
+    {
+        report("Bad blob reference in %s%s", keyPrefix, suffix);
+        return 0;
+    }
+
+    pthread_mutex_lock(&blobMutex);
+    blob = findBlob(hash, 1);
+    if (blob)
+    {
+        ++blob->refs;
+    }
+    pthread_mutex_unlock(&blobMutex);
+
+    return blob ? 0 : -ENOMEM;
+}
+
+
+/* ================ Key scans ================ */
+
+static int addStray(const char* suffix, int status)
+{
+    int result;
+
+    report("Stray key %s%s: %s", prefix, suffix, status == KEY_NO_NODE ? "its node is missing"
+                                                                     : "not used by its node");
+
+    pthread_mutex_lock(&listMutex);
+    result = growList((void**)&strays, &strayCapacity, strayCount, sizeof(struct fsck_stray));
+    if (result == 0)
+    {
+        strays[strayCount].suffix = strdup(suffix);
+        strays[strayCount].status = status;
+        result = strays[strayCount].suffix ? 0 : -ENOMEM;
+        strayCount += result == 0;
+    }
+    strayFoundNs = nowNs();
+    pthread_mutex_unlock(&listMutex);
+
+    return result;
+}
+
+
+static int addOrphan(node_id_t nodeId)
+{
+    int result;
+
+    pthread_mutex_lock(&listMutex);
+    result = growList((void**)&orphans, &orphanCapacity, orphanCount, sizeof(node_id_t));
+    if (result == 0)
+    {
+        orphans[orphanCount++] = nodeId;
+    }
+    pthread_mutex_unlock(&listMutex);
+
+    return result;
+}
+
+
+// Check one key found by a scan; returns the number of reply elements it took:
+static int checkKey(struct fsck_scan* scan, int handle, int index, int count, int* result)
+{
+    char* values[3];
+    char* hex;
+    size_t len;
+    node_id_t nodeId;
+    int status;
+    int refs = 0;
+    int i;
+
+    retrieveStringArrayElements(handle, index, 2, values);
+    status = atoi(values[1]);
+
+    if (scan->kind)
+    {
+        nodeId = parseNodeId(values[0], scan->kind);
+        updateMaxNodeId(nodeId);
+
+        // Nodes created since the check started, or still being imported, are not orphans yet:
+        if (0 == strcmp(scan->kind, KEY_INFO) && nodeId > 0 && nodeId <= markLimit && !isMarked(nodeId))
+        {
+            *result = isLeased(nodeId) ? 0 : addOrphan(nodeId);
+        }
+        else if (nodeId >= 0 && status != KEY_USED)
+        {
+            *result = addStray(values[0], status);
+        }
+    }
+
+    if (0 == strcmp(scan->kind ? scan->kind : KEY_REFS, KEY_REFS))
+    {
+        if (index + 2 >= count)
+        {
+            *result = -EIO;
+            return count - index;
+        }
+        retrieveStringArrayElements(handle, index + 2, 1, values + 2);
+        refs = atoi(values[2]);
+        for (i = 0; i < refs && index + 3 + i < count && *result == 0; ++i)
+        {
+            retrieveBinaryArrayElement(handle, index + 3 + i, &hex, &len);
+            *result = countBlobRef(hex, len, scan->kind ? prefix : "", values[0]);
+        }
+        return 3 + refs;
+    }
+
+    return 2;
+}
+
+
+static void* scanMain(void* arg)
+{
+    struct fsck_scan* scan = (struct fsck_scan*)arg;
+    int refs = !scan->kind || 0 == strcmp(scan->kind, KEY_REFS);
+    char cursor[24] = "0";
+    char countStr[24];
+    const char* args[7] = { prefix, chunkSizeStr, cursor, scan->pattern, countStr, scan->kind ? "1" : "0",
+                            refs ? "1" : "0" };
+    char* value;
+    int handle;
+    int count;
+    int keys;
+    int i;
+
+    snprintf(countStr, sizeof(countStr), "%d", FSCK_BATCH);
+    scan->result = 0;
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(scanScript, 0, args, 7, &count);
+        if (!handle || count < 1)
+        {
+            scan->result = -EIO;
+            break;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, &value);
+        snprintf(cursor, sizeof(cursor), "%s", value);
+
+        for (i = 1, keys = 0; i + 1 < count && scan->result == 0; ++keys)
+        {
+            i += checkKey(scan, handle, i, count, &scan->result);
+        }
+        releaseReplyHandle(handle);
+
+        __atomic_add_fetch(&keysScanned, keys, __ATOMIC_RELAXED);
+        throttle(keys);
+    }
+    while (scan->result == 0 && 0 != strcmp(cursor, "0"));
+
+    closeRedisConnection();
+
+    return NULL;
+}
+
+
+/*
+ * Scan the node keys and the blob references of the file system, one
+ * cursor per kind of key in parallel.
+*/
+static int scanKeys(const char* name)
+{
+    static const char* kinds[] = { KEY_INFO, KEY_NODE, KEY_BLOOM, KEY_USAGE, KEY_DATA, KEY_REFS, KEY_COLD, NULL };
+    struct fsck_scan scans[sizeof(kinds) / sizeof(kinds[0])];
+    char suffix[64];
+    int started;
+    int result = 0;
+
+    for (started = 0; started < sizeof(kinds) / sizeof(kinds[0]); ++started)
+    {
+        scans[started].kind = kinds[started];
+        if (kinds[started])
+        {
+            snprintf(suffix, sizeof(suffix), "::%s:*", kinds[started]);
+        }
+        else
+        {
+            // References held by the snapshots:
+            snprintf(suffix, sizeof(suffix), "@[0-9]*::%s:*", KEY_REFS);
+        }
+        formatPattern(scans[started].pattern, name, suffix);
+
+        if (0 != pthread_create(&scans[started].thread, NULL, scanMain, &scans[started]))
+        {
+            fprintf(stderr, "Error: Cannot start scan thread.\n");
+            result = -EIO;
+            break;
+        }
+    }
+
+    while (started > 0)
+    {
+        pthread_join(scans[--started].thread, NULL);
+        if (scans[started].result < 0)
+        {
+            result = scans[started].result;
+        }
+    }
+
+    return result;
+}
+
+
+/*
+ * Compare the reference count of every blob with the references counted
+ * by the scans.
+*/
+static int checkBlobs(const char* name)
+{
+    char cursor[24] = "0";
+    char countStr[24];
+    char pattern[KEY_LEN];
+    const char* args[4] = { prefix, cursor, pattern, countStr };
+    unsigned char hash[BLOB_HASH_BYTES];
+    struct blob_count* blob;
+    char* values[3];
+    long long refs;
+    long long counted;
+    int handle;
+    int count;
+    size_t i;
+
+    snprintf(countStr, sizeof(countStr), "%d", FSCK_BATCH);
+    formatPattern(pattern, name, "::" KEY_BLOB "*");
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(blobScanScript, 0, args, 4, &count);
+        if (!handle || count < 1)
+        {
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, values);
+        snprintf(cursor, sizeof(cursor), "%s", values[0]);
+
+        for (i = 1; i + 2 < count; i += 3)
+        {
+            retrieveStringArrayElements(handle, i, 3, values);
+            if (0 > parseHash(values[0], strlen(values[0]), hash))
+            {
+                continue;
+            }
+
+            blob = findBlob(hash, 0);
+            refs = atoll(values[1]);
+            counted = blob ? blob->refs : 0;
+            if (blob)
+            {
+                blob->found = 1;
+            }
+
+            if (values[2][0] != '1' && counted > 0)
+            {
+                report("Blob %s: data missing, referenced %lld times", values[0], counted);
+            }
+            else if (refs != counted)
+            {
+                report("Blob %s: %lld references counted, %lld recorded", values[0], counted, refs);
+                if (0 > growList((void**)&blobFixes, &blobFixCapacity, blobFixCount, sizeof(struct blob_fix)))
+                {
+                    releaseReplyHandle(handle);
+                    return -ENOMEM;
+                }
+                memcpy(blobFixes[blobFixCount].hash, values[0], CHUNK_HASH_LEN + 1);
+                blobFixes[blobFixCount].counted = counted;
+                blobFixes[blobFixCount].tooLow = counted > refs;
+                ++blobFixCount;
+            }
+        }
+        releaseReplyHandle(handle);
+
+        __atomic_add_fetch(&keysScanned, (count - 1) / 3, __ATOMIC_RELAXED);
+        throttle((count - 1) / 3);
+    }
+    while (0 != strcmp(cursor, "0"));
+
+    for (i = 0; i < blobCapacity; ++i)
+    {
+        if (blobs[i].refs > 0 && !blobs[i].found)
+        {
+            char hex[CHUNK_HASH_LEN + 1];
+            size_t j;
+
+            for (j = 0; j < BLOB_HASH_BYTES; ++j)
+            {
+                sprintf(hex + 2 * j, "%02x", blobs[i].hash[j]);
+            }
+            report("Blob %s: missing, referenced %u times", hex, blobs[i].refs);
+        }
+    }
+
+    return 0;
+}
+
+
+/* ================ Orphans ================ */
+
+static int compareNodeIds(const void* a, const void* b)
+{
+    node_id_t x = *(const node_id_t*)a;
+    node_id_t y = *(const node_id_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+// Keep the orphans that no walk has reached:
+static void filterOrphans()
+{
+    size_t kept = 0;
+    size_t i;
+
+    for (i = 0; i < orphanCount; ++i)
+    {
+        if (!isMarked(orphans[i]))
+        {
+            orphans[kept++] = orphans[i];
+        }
+    }
+    orphanCount = kept;
+}
+
+
+/*
+ * Confirm the orphans found by the scan with a second walk, then drop the
+ * ones below orphaned directories, which go with their directory.
+*/
+static int confirmOrphans()
+{
+    long long info[NODE_INFO_COUNT];
+    unsigned long long below = 0;
+    size_t total;
+    size_t i;
+    int result;
+
+    qsort(orphans, orphanCount, sizeof(node_id_t), compareNodeIds);
+
+    collect = 0;
+    result = markReachable();
+    if (result < 0)
+    {
+        return result;
+    }
+    filterOrphans();
+
+    for (i = 0; i < orphanCount && result == 0; ++i)
+    {
+        if (0 == g_backend->get_info(orphans[i], info) && S_ISDIR(info[NODE_INFO_MODE]))
+        {
+            result = queueDir("(orphan)", orphans[i], 1);
+        }
+    }
+    result = result < 0 ? result : runWalk();
+    if (result < 0)
+    {
+        return result;
+    }
+    total = orphanCount;
+    filterOrphans();
+    below = total - orphanCount;
+
+    for (i = 0; i < orphanCount; ++i)
+    {
+        if (0 > g_backend->get_info(orphans[i], info))
+        {
+            continue; // Reclaimed meanwhile.
+        }
+        else if (S_ISDIR(info[NODE_INFO_MODE]))
+        {
+            report("Orphan node %lld: directory", orphans[i]);
+        }
+        else
+        {
+            report("Orphan node %lld: file, %lld bytes", orphans[i], info[NODE_INFO_SIZE]);
+        }
+    }
+    if (below > 0)
+    {
+        printf("%llu more orphan nodes are below orphan directories.\n", below);
+    }
+
+    return 0;
+}
+
+
+/* ================ Usage ================ */
+
+static int isDirNode(node_id_t nodeId)
+{
+    return dirs[nodeId / 8] & (1 << (nodeId % 8));
+}
+
+
+// Pass the usage counters of count nodes from first on to the check script:
+static int checkUsageBatch(node_id_t first, int count, int repair, long long* wrongParents)
+{
+    char lines[FSCK_BATCH * 4 * 24];
+    const char* args[3] = { prefix, repair ? "1" : "0", lines };
+    char* values[3];
+    node_id_t nodeId;
+    size_t len = 0;
+    int handle;
+    int reply;
+    int i;
+
+    // Commands take few arguments; the nodes go as lines of one:
+    for (nodeId = first, i = 0; i < count; ++nodeId)
+    {
+        if (nodeId != 0 && usages[nodeId].parent < 0)
+        {
+            continue;
+        }
+
+        if (isDirNode(nodeId))
+        {
+            len += snprintf(lines + len, sizeof(lines) - len, "%lld %lld %lld %lld\n", (long long)nodeId,
+                            (long long)usages[nodeId].parent, usages[nodeId].bytes, usages[nodeId].inodes);
+        }
+        else
+        {
+            len += snprintf(lines + len, sizeof(lines) - len, "%lld %lld - 0\n", (long long)nodeId,
+                            (long long)usages[nodeId].parent);
+        }
+        ++i;
+    }
+
+    handle = redisCommand_EVAL_ARRAY(usageCheckScript, 0, args, 3, &reply);
+    if (!handle || reply < 1)
+    {
+        return -EIO;
+    }
+
+    retrieveStringArrayElements(handle, 0, 1, values);
+    *wrongParents += atoll(values[0]);
+
+    for (i = 1; i + 2 < reply; i += 3)
+    {
+        retrieveStringArrayElements(handle, i, 3, values);
+        nodeId = atoll(values[0]);
+        report("Usage of directory %lld: %s bytes and %s inodes stored, %lld and %lld counted", (long long)nodeId,
+               values[1], values[2], usages[nodeId].bytes, usages[nodeId].inodes);
+        fixed += repair;
+    }
+    releaseReplyHandle(handle);
+
+    throttle(count);
+
+    return 0;
+}
+
+
+// Drop the parent links of nodes that the walk did not reach from the root:
+static int checkStrayParents(int repair)
+{
+    char key[KEY_LEN];
+    char cursor[24] = "0";
+    char countStr[24];
+    const char* args[3] = { key, cursor, countStr };
+    long long strays = 0;
+    node_id_t nodeId;
+    char* value;
+    int handle;
+    int count;
+    int i;
+
+    formatKey(key, KEY_PARENTS);
+    snprintf(countStr, sizeof(countStr), "%d", FSCK_BATCH);
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(parentsScanScript, 1, args, 3, &count);
+        if (!handle || count < 1)
+        {
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, &value);
+        snprintf(cursor, sizeof(cursor), "%s", value);
+
+        for (i = 1; i < count; ++i)
+        {
+            retrieveStringArrayElements(handle, i, 1, &value);
+            nodeId = atoll(value);
+            if (nodeId >= 0 && nodeId <= markLimit && (nodeId == 0 || usages[nodeId].parent < 0))
+            {
+                ++strays;
+                if (repair)
+                {
+                    redisCommand_HDEL(key, value, NULL);
+                }
+            }
+        }
+        releaseReplyHandle(handle);
+        throttle(count - 1);
+    }
+    while (0 != strcmp(cursor, "0"));
+
+    if (strays > 0)
+    {
+        report("Parent links of %lld nodes outside the tree", strays);
+        fixed += repair;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Offline: add up the usage below every directory reached from the root,
+ * and compare it and the parent of every node with what the mounts keep.
+ * With repair, whatever differs is rewritten right away.
+*/
+static int checkUsage(int repair)
+{
+    long long wrongParents = 0;
+    node_id_t nodeId;
+    node_id_t dirId;
+    int count = 0;
+    node_id_t first = 0;
+    int result;
+
+    for (nodeId = 1; nodeId <= markLimit; ++nodeId)
+    {
+        for (dirId = usages[nodeId].parent; dirId >= 0; dirId = dirId == 0 ? -1 : usages[dirId].parent)
+        {
+            usages[dirId].bytes += usages[nodeId].size;
+            usages[dirId].inodes += 1;
+        }
+    }
+
+    for (nodeId = 0; nodeId <= markLimit; ++nodeId)
+    {
+        if (nodeId != 0 && usages[nodeId].parent < 0)
+        {
+            continue;
+        }
+        if (count == 0)
+        {
+            first = nodeId;
+        }
+        if (++count == FSCK_BATCH)
+        {
+            result = checkUsageBatch(first, count, repair, &wrongParents);
+            if (result < 0)
+            {
+                return result;
+            }
+            count = 0;
+        }
+    }
+    if (count > 0)
+    {
+        result = checkUsageBatch(first, count, repair, &wrongParents);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    if (wrongParents > 0)
+    {
+        report("Wrong parent link of %lld nodes", wrongParents);
+        fixed += repair;
+    }
+
+    return checkStrayParents(repair);
+}
+
+
+/* ================ Repairs ================ */
+
+static void repairDanglings()
+{
+    char key[KEY_LEN];
+    char infoKey[KEY_LEN];
+    char nodeIdStr[24];
+    const char* args[4] = { key, NULL, nodeIdStr, infoKey };
+    long long removed;
+    size_t i;
+
+    for (i = 0; i < danglingCount; ++i)
+    {
+        formatNodeKey(key, KEY_NODE, danglings[i].dirId);
+        formatNodeKey(infoKey, KEY_INFO, danglings[i].nodeId);
+        snprintf(nodeIdStr, sizeof(nodeIdStr), "%lld", danglings[i].nodeId);
+        args[1] = danglings[i].name;
+
+        if (redisCommand_EVAL_INT(unlinkDanglingScript, 1, args, 4, &removed) && removed > 0)
+        {
+            // Mounts may have cached the entry:
+            journalChanges(&danglings[i].dirId, 1);
+            ++fixed;
+        }
+    }
+}
+
+
+static void repairStrays()
+{
+    const char* args[3] = { prefix, chunkSizeStr, NULL };
+    long long removed;
+    size_t i;
+
+    // A chunk past the file size may be one that a write has not covered yet:
+    sleepNs(strayFoundNs + FSCK_CONFIRM_NS - nowNs());
+
+    for (i = 0; i < strayCount; ++i)
+    {
+        args[2] = strays[i].suffix;
+
+        if (redisCommand_EVAL_INT(deleteStrayScript, 0, args, 3, &removed) && removed > 0)
+        {
+            ++fixed;
+        }
+        throttle(1);
+    }
+}
+
+
+static void repairOrphans()
+{
+    char infoKey[KEY_LEN];
+    char orphansKey[KEY_LEN];
+    char nodeIdStr[24];
+    const char* args[3] = { infoKey, orphansKey, nodeIdStr };
+    long long queued;
+    int freed;
+    int done;
+    size_t i;
+
+    formatKey(orphansKey, KEY_ORPHANS);
+    for (i = 0; i < orphanCount; ++i)
+    {
+        formatNodeKey(infoKey, KEY_INFO, orphans[i]);
+        snprintf(nodeIdStr, sizeof(nodeIdStr), "%lld", orphans[i]);
+        if (redisCommand_EVAL_INT(queueOrphanScript, 2, args, 3, &queued) && queued > 0)
+        {
+            ++fixed;
+        }
+    }
+
+    // Mounts reclaim in the background too; this drains the queue now:
+    while (orphanCount > 0 && (done = g_backend->reclaim(RECLAIM_BATCH, &freed)) > 0)
+    {
+        throttle(done);
+    }
+}
+
+
+static void repairBlobs(int lower)
+{
+    char key[KEY_LEN];
+    char gcKey[KEY_LEN];
+    char countedStr[24];
+    const char* args[4] = { key, gcKey, countedStr, lower ? "1" : "0" };
+    long long changed;
+    size_t i;
+    int freed;
+
+    formatKey(gcKey, KEY_BLOB_GC);
+    for (i = 0; i < blobFixCount; ++i)
+    {
+        if (!blobFixes[i].tooLow && !lower)
+        {
+            continue;
+        }
+        formatKey(key, KEY_BLOB);
+        strcat(key, blobFixes[i].hash);
+        snprintf(countedStr, sizeof(countedStr), "%lld", blobFixes[i].counted);
+
+        if (redisCommand_EVAL_INT(setBlobRefsScript, 2, args, 4, &changed) && changed > 0)
+        {
+            ++fixed;
+        }
+    }
+
+    // Blobs without references are freed now:
+    while (g_backend->blob_gc(DEDUP_GC_BATCH, &freed) > 0);
+}
+
+
+/* ================ Main ================ */
+
+static void usage(const char* progName)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progName);
+    fprintf(stderr, "Check the consistency of a RediFS file system, which may be mounted.\n");
+    fprintf(stderr, "  -h HOST     Redis server host\n");
+    fprintf(stderr, "  -p PORT     Redis server port\n");
+    fprintf(stderr, "  -N NAME     File system name (default %s)\n", DEFAULT_NAME);
+    fprintf(stderr, "  -j THREADS  Parallel tree walkers (default %d)\n", FSCK_THREADS);
+    fprintf(stderr, "  -r RATE     Keys and entries read per second (default no limit)\n");
+    fprintf(stderr, "  -y          Repair the problems found\n");
+    fprintf(stderr, "  -o          Offline: no mount is writing, so blob reference counts may be lowered\n");
+    fprintf(stderr, "              and the usage counters are checked\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .port = 0,
+        .name = DEFAULT_NAME,
+        .inline_max = DEFAULT_INLINE_MAX,
+    };
+    char key[KEY_LEN];
+    char maxStr[24];
+    const char* args[2] = { key, maxStr };
+    struct timespec start;
+    struct timespec end;
+    long long counter;
+    node_id_t nodeId;
+    int repair = 0;
+    int offline = 0;
+    int result;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:j:r:yo")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 'j': threadCount = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'y': repair = 1; break;
+            case 'o': offline = 1; break;
+            default:
+                usage(argv[0]);
+                return FSCK_EXIT_ERROR;
+        }
+    }
+
+    if (optind != argc || threadCount < 1 || threadCount > FSCK_THREADS_MAX || rate < 0)
+    {
+        usage(argv[0]);
+        return FSCK_EXIT_ERROR;
+    }
+
+    g_settings = &settings;
+    g_backend = &redisBackend;
+    if (0 > g_backend->open())
+    {
+        fprintf(stderr, "Error: Cannot connect to the Redis server.\n");
+        return FSCK_EXIT_ERROR;
+    }
+    else if (g_backend->fs_exists() <= 0)
+    {
+        fprintf(stderr, "Error: No file system named '%s'.\n", settings.name);
+        return FSCK_EXIT_ERROR;
+    }
+
+    formatKey(prefix, "");
+    snprintf(chunkSizeStr, sizeof(chunkSizeStr), "%d", CHUNK_SIZE);
+
+    // Nodes created after this are left alone:
+    formatKey(key, KEY_NODE_ID_CTR);
+    if (!redisCommand_EVAL_INT(getIntScript, 1, args, 1, &counter))
+    {
+        fprintf(stderr, "Error: Cannot read the node ID counter.\n");
+        return FSCK_EXIT_ERROR;
+    }
+    markLimit = counter > 0 ? counter : 0;
+    marks = calloc(markLimit / 64 + 1, sizeof(unsigned long long));
+    if (!marks)
+    {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return FSCK_EXIT_ERROR;
+    }
+    else if (offline)
+    {
+        usages = calloc(markLimit + 1, sizeof(struct fsck_usage));
+        dirs = calloc(markLimit / 8 + 1, 1);
+        if (!usages || !dirs)
+        {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return FSCK_EXIT_ERROR;
+        }
+        for (nodeId = 0; nodeId <= markLimit; ++nodeId)
+        {
+            usages[nodeId].parent = -1;
+        }
+        dirs[0] = 1; // The root directory.
+    }
+
+    if (0 > readLeases())
+    {
+        fprintf(stderr, "Error: Cannot read the import leases.\n");
+        return FSCK_EXIT_ERROR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    result = markReachable();
+    if (result == 0)
+    {
+        result = scanKeys(settings.name);
+    }
+    if (result == 0)
+    {
+        result = checkBlobs(settings.name);
+    }
+    if (result == 0 && orphanCount > 0)
+    {
+        result = confirmOrphans();
+    }
+    if (result == 0 && usages)
+    {
+        result = checkUsage(repair);
+    }
+    if (result == 0)
+    {
+        // The largest node ID seen must not be handed out again:
+        formatKey(key, KEY_NODE_ID_CTR);
+        if (!redisCommand_EVAL_INT(getIntScript, 1, args, 1, &counter))
+        {
+            result = -EIO;
+        }
+        else if (counter < maxNodeId)
+        {
+            report("Node ID counter %lld is below node %lld", counter, maxNodeId);
+        }
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Check failed: %s\n", strerror(-result));
+        g_backend->close();
+        return FSCK_EXIT_ERROR;
+    }
+
+    if (repair && problems > 0)
+    {
+        repairDanglings();
+        repairStrays();
+        repairOrphans();
+        if (counter < maxNodeId)
+        {
+            snprintf(maxStr, sizeof(maxStr), "%lld", maxNodeId);
+            fixed += redisCommand_EVAL_INT(raiseCounterScript, 1, args, 2, &counter) ? 1 : 0;
+        }
+        repairBlobs(offline);
+    }
+    if (repair)
+    {
+        formatKey(key, KEY_ID_LEASES);
+        snprintf(maxStr, sizeof(maxStr), "%lld", (long long)time(NULL));
+        redisCommand_EVAL_INT(dropLeasesScript, 1, args, 2, &counter);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Checked %llu entries and %llu keys in %.2f s: %llu problems", nodesWalked, keysScanned,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, problems);
+    if (repair)
+    {
+        printf(", %llu repaired", fixed);
+    }
+    printf(".\n");
+
+    g_backend->close();
+
+    if (problems == 0)
+    {
+        return 0;
+    }
+
+    return fixed >= problems ? FSCK_EXIT_FIXED : FSCK_EXIT_UNFIXED;
+}
@@ -0,0 +1,865 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Bulk import of a local directory tree into a RediFS file system,
+ * without a mount:
+ *
+ *   redifs_import [-h host] [-p port] [-N name] [-j threads] SRC [DIR]
+ *
+ * copies the contents of SRC into DIR (default "/"), which must be an
+ * empty directory. Worker threads take directories from a shared queue
+ * and write node info, data chunks and directory entries through
+ * per-thread pipelines, using node IDs allocated IMPORT_ID_RANGE at a
+ * time. A node is linked into its directory only after its info and data,
+ * on the same connection, so a mount never sees half-written files; the
+ * tree appears while the import runs. The info of a file goes before its
+ * data, so redifs_fsck never finds chunks without their node, and every
+ * ID range is leased in KEY_ID_LEASES until the import ends, so that
+ * redifs_fsck leaves the nodes not linked yet alone.
+*/
+
+
+/* ---- Includes ---- */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "backend.h"
+#include "compress.h"
+#include "connection.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define IMPORT_THREADS 8
+#define IMPORT_THREADS_MAX 256
+#define IMPORT_ID_RANGE 1024 // Node IDs allocated per round trip.
+#define IMPORT_ENTRY_BATCH 256 // Directory entries per round trip.
+#define IMPORT_PIPELINE_BYTES (8 * 1024 * 1024) // Sent before more is queued.
+#define IMPORT_PIPELINE_COMMANDS 4096
+#define IMPORT_LEASE_SECONDS (24 * 60 * 60) // Lease of an ID range left behind by a failed import.
+
+
+/* ---- Types ---- */
+
+// Directory waiting for a worker:
+struct import_dir
+{
+    struct import_dir* next;
+    node_id_t nodeId;
+    char path[];
+};
+
+struct import_worker
+{
+    pthread_t thread;
+    node_id_t nextId;
+    node_id_t endId;
+    node_id_t* leases; // Last ID of every range allocated.
+    int leaseCount;
+    int leaseCapacity;
+    size_t pipelineBytes;
+    int pipelineCommands;
+
+    // Entries of the directory being read, linked in batches:
+    char entryKey[KEY_LEN];
+    char entryDir[24];
+    char names[IMPORT_ENTRY_BATCH][NAME_MAX + 1];
+    char ids[IMPORT_ENTRY_BATCH][24];
+    int entryCount;
+
+    char chunk[CHUNK_SIZE];
+    char frame[CHUNK_FRAME_MAX];
+
+    unsigned long long dirs;
+    unsigned long long files;
+    unsigned long long bytes;
+    unsigned long long errors;
+};
+
+
+/* ---- Globals ---- */
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static struct import_dir* queueHead = NULL;
+static struct import_dir* queueTail = NULL;
+static int busyWorkers = 0;
+static int failed = 0; // Redis failed; stop everything.
+
+static int codec = CODEC_NONE;
+static unsigned long inlineMax = DEFAULT_INLINE_MAX;
+
+// KEYS: directory, journal generation, journal log; ARGV: entries per
+// bucket, directory ID, "<name>::", then name and node ID pairs. Large
+// directories are split into buckets as they fill, and the directory is
+// journaled for the mounts, like a mount does. The usage of the nodes is
+// charged to the directories above them, without checking quotas; a
+// directory linked after its own entries brings their usage along.
+static const char* linkScript =
+    LUA_COW_FUNCTION
+    LUA_DIR_FUNCTIONS
+    LUA_DIR_BLOOM_FUNCTIONS
+    LUA_DIR_WRITE_FUNCTIONS
+    LUA_JOURNAL_FUNCTION
+    LUA_USAGE_FUNCTIONS
+    "local d, p = ARGV[2], ARGV[3] "
+    "cowAt(p, KEYS[1]) "
+    "for i = 4, #ARGV, 2 do "
+    "local bytes, inodes = usageOf(p, ARGV[i + 1]) "
+    "dirLink(KEYS[1], ARGV[i], ARGV[i + 1], tonumber(ARGV[1])) "
+    "redis.call('HSET', p .. 'parents', ARGV[i + 1], d) "
+    "usageMove(p, false, d, bytes, inodes) end "
+    "journal(KEYS[2], KEYS[3], d) "
+    "return 0";
+
+static const char* idRangeScript =
+    "local last = redis.call('INCRBY', KEYS[1], ARGV[1]) "
+    "redis.call('ZADD', KEYS[2], ARGV[2], (last - ARGV[1] + 1) .. ':' .. last) "
+    "return last";
+
+
+/* ================ Directory queue ================ */
+
+static int queueDir(const char* path, node_id_t nodeId)
+{
+    struct import_dir* dir;
+    size_t len = strlen(path);
+
+    dir = malloc(sizeof(struct import_dir) + len + 1);
+    if (!dir)
+    {
+        return -ENOMEM;
+    }
+    dir->next = NULL;
+    dir->nodeId = nodeId;
+    memcpy(dir->path, path, len + 1);
+
+    pthread_mutex_lock(&queueMutex);
+    if (queueTail)
+    {
+        queueTail->next = dir;
+    }
+    else
+    {
+        queueHead = dir;
+    }
+    queueTail = dir;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+
+    return 0;
+}
+
+
+// Take the next directory; NULL once the queue is empty and no worker can add to it:
+static struct import_dir* takeDir(struct import_dir* done)
+{
+    struct import_dir* dir;
+
+    pthread_mutex_lock(&queueMutex);
+    if (done)
+    {
+        --busyWorkers;
+        free(done);
+    }
+
+    while (!queueHead && busyWorkers > 0 && !failed)
+    {
+        pthread_cond_wait(&queueCond, &queueMutex);
+    }
+
+    dir = failed ? NULL : queueHead;
+    if (dir)
+    {
+        queueHead = dir->next;
+        if (!queueHead)
+        {
+            queueTail = NULL;
+        }
+        ++busyWorkers;
+    }
+    else
+    {
+        pthread_cond_broadcast(&queueCond);
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return dir;
+}
+
+
+static void setFailed()
+{
+    pthread_mutex_lock(&queueMutex);
+    failed = 1;
+    pthread_cond_broadcast(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+
+/* ================ Pipelines ================ */
+
+static int flushWorker(struct import_worker* worker)
+{
+    int result;
+
+    if (worker->pipelineCommands == 0)
+    {
+        return 0;
+    }
+
+    result = redisPipelineFlush();
+    worker->pipelineBytes = 0;
+    worker->pipelineCommands = 0;
+    if (result != 0)
+    {
+        setFailed();
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+static int appendCommand(struct import_worker* worker, int argc, const char* argv[], const size_t argvlen[])
+{
+    int i;
+
+    if (!redisPipelineAppend(argc, argv, argvlen))
+    {
+        setFailed();
+        return -EIO;
+    }
+
+    for (i = 0; i < argc; ++i)
+    {
+        worker->pipelineBytes += argvlen[i];
+    }
+    ++worker->pipelineCommands;
+
+    if (worker->pipelineBytes >= IMPORT_PIPELINE_BYTES || worker->pipelineCommands >= IMPORT_PIPELINE_COMMANDS)
+    {
+        return flushWorker(worker);
+    }
+
+    return 0;
+}
+
+
+static node_id_t allocNodeId(struct import_worker* worker)
+{
+    char key[KEY_LEN];
+    char leaseKey[KEY_LEN];
+    char count[24];
+    char expiry[24];
+    const char* args[4] = { key, leaseKey, count, expiry };
+    node_id_t* leases;
+    long long last;
+
+    if (worker->nextId == worker->endId)
+    {
+        // A plain command would take the first queued reply:
+        if (0 > flushWorker(worker))
+        {
+            return -EIO;
+        }
+
+        if (worker->leaseCount == worker->leaseCapacity)
+        {
+            worker->leaseCapacity = worker->leaseCapacity ? worker->leaseCapacity * 2 : 16;
+            leases = realloc(worker->leases, worker->leaseCapacity * sizeof(node_id_t));
+            if (!leases)
+            {
+                return -ENOMEM;
+            }
+            worker->leases = leases;
+        }
+
+        formatKey(key, KEY_NODE_ID_CTR);
+        formatKey(leaseKey, KEY_ID_LEASES);
+        snprintf(count, sizeof(count), "%d", IMPORT_ID_RANGE);
+        snprintf(expiry, sizeof(expiry), "%lld", (long long)time(NULL) + IMPORT_LEASE_SECONDS);
+        if (!redisCommand_EVAL_INT(idRangeScript, 2, args, 4, &last))
+        {
+            setFailed();
+            return -EIO;
+        }
+        worker->leases[worker->leaseCount++] = last;
+        worker->nextId = last - IMPORT_ID_RANGE + 1;
+        worker->endId = last + 1;
+    }
+
+    return worker->nextId++;
+}
+
+
+/* ================ Import ================ */
+
+static int storeInfo(struct import_worker* worker, node_id_t nodeId, const struct stat* st, long long size,
+                     long long flags, const char* data, size_t len)
+{
+    long long info[NODE_INFO_COUNT];
+    char numbers[NODE_INFO_COUNT][24];
+    char key[KEY_LEN];
+    const char* argv[NODE_INFO_COUNT + 3];
+    size_t argvlen[NODE_INFO_COUNT + 3];
+    int i;
+
+    info[NODE_INFO_MODE] = st->st_mode;
+    info[NODE_INFO_UID] = st->st_uid;
+    info[NODE_INFO_GID] = st->st_gid;
+    info[NODE_INFO_ACCESS_TIME_SEC] = st->st_atim.tv_sec;
+    info[NODE_INFO_ACCESS_TIME_NSEC] = st->st_atim.tv_nsec;
+    info[NODE_INFO_MOD_TIME_SEC] = st->st_mtim.tv_sec;
+    info[NODE_INFO_MOD_TIME_NSEC] = st->st_mtim.tv_nsec;
+    info[NODE_INFO_SIZE] = size;
+    info[NODE_INFO_FLAGS] = flags;
+
+    // Same layout as create_node followed by set_inline:
+    argv[0] = "RPUSH";
+    argvlen[0] = 5;
+    argv[1] = key;
+    argvlen[1] = formatNodeKey(key, KEY_INFO, nodeId);
+    for (i = 0; i < NODE_INFO_COUNT; ++i)
+    {
+        argv[i + 2] = numbers[i];
+        argvlen[i + 2] = snprintf(numbers[i], sizeof(numbers[i]), "%lld", info[i]);
+    }
+    argv[NODE_INFO_COUNT + 2] = data;
+    argvlen[NODE_INFO_COUNT + 2] = len;
+
+    return appendCommand(worker, NODE_INFO_COUNT + 3, argv, argvlen);
+}
+
+
+static int storeSize(struct import_worker* worker, node_id_t nodeId, long long size)
+{
+    char key[KEY_LEN];
+    char index[24];
+    char value[24];
+    const char* argv[4] = { "LSET", key, index, value };
+    size_t argvlen[4] = { 4, 0, 0, 0 };
+
+    argvlen[1] = formatNodeKey(key, KEY_INFO, nodeId);
+    argvlen[2] = snprintf(index, sizeof(index), "%d", NODE_INFO_SIZE);
+    argvlen[3] = snprintf(value, sizeof(value), "%lld", size);
+
+    return appendCommand(worker, 4, argv, argvlen);
+}
+
+
+static int storeChunk(struct import_worker* worker, node_id_t nodeId, long long chunk, size_t len)
+{
+    char key[KEY_LEN];
+    const char* argv[3] = { "SET", key, worker->chunk };
+    size_t argvlen[3] = { 3, 0, len };
+    size_t i;
+
+    // Holes read as zeros:
+    for (i = 0; i < len && worker->chunk[i] == '\0'; ++i);
+    if (i == len)
+    {
+        return 0;
+    }
+
+    if (codec != CODEC_NONE)
+    {
+        argv[2] = worker->frame;
+        argvlen[2] = compressChunk(codec, worker->chunk, len, worker->frame);
+    }
+    argvlen[1] = formatChunkKey(key, nodeId, chunk);
+
+    return appendCommand(worker, 3, argv, argvlen);
+}
+
+
+static ssize_t readFull(int fd, char* buf, size_t size)
+{
+    ssize_t done = 0;
+    ssize_t result;
+
+    while (done < size)
+    {
+        result = read(fd, buf + done, size - done);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            return -errno;
+        }
+        else if (result == 0)
+        {
+            break;
+        }
+        done += result;
+    }
+
+    return done;
+}
+
+
+// Store the data and info of a file; returns 1 if it was skipped:
+static int importFile(struct import_worker* worker, const char* path, node_id_t nodeId, const struct stat* st)
+{
+    long long flags = WITH_NODE_CODEC(0, codec);
+    long long size = 0;
+    long long chunk;
+    ssize_t len;
+    int result = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Warning: Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Small files keep their data with the info, like files written through a mount:
+    if (st->st_size <= inlineMax && inlineMax > 0)
+    {
+        len = readFull(fd, worker->chunk, st->st_size);
+        if (len >= 0)
+        {
+            result = storeInfo(worker, nodeId, st, len, flags | NODE_FLAG_INLINE, worker->chunk, len);
+            worker->bytes += len;
+        }
+        close(fd);
+        return len < 0 ? 1 : result;
+    }
+
+    // The info goes first, so that no chunk is ever without its node:
+    result = storeInfo(worker, nodeId, st, st->st_size, flags, "", 0);
+
+    for (chunk = 0; result == 0; ++chunk)
+    {
+        len = readFull(fd, worker->chunk, CHUNK_SIZE);
+        if (len <= 0)
+        {
+            break;
+        }
+        result = storeChunk(worker, nodeId, chunk, len);
+        size += len;
+    }
+    close(fd);
+
+    if (result < 0)
+    {
+        return result;
+    }
+    else if (len < 0)
+    {
+        fprintf(stderr, "Warning: Cannot read %s: %s\n", path, strerror(-len));
+        return 1; // The node stays behind without an entry, for redifs_fsck.
+    }
+
+    worker->bytes += size;
+
+    // The file changed while it was read:
+    return size == st->st_size ? 0 : storeSize(worker, nodeId, size);
+}
+
+
+static int linkEntries(struct import_worker* worker)
+{
+    const char* argv[9 + 2 * IMPORT_ENTRY_BATCH];
+    size_t argvlen[9 + 2 * IMPORT_ENTRY_BATCH];
+    char genKey[KEY_LEN];
+    char logKey[KEY_LEN];
+    char prefix[KEY_LEN];
+    char maxStr[24];
+    int argc = 9;
+    int i;
+
+    if (worker->entryCount == 0)
+    {
+        return 0;
+    }
+
+    formatKey(genKey, KEY_META_GEN);
+    formatKey(logKey, KEY_META_LOG);
+    formatKey(prefix, "");
+    snprintf(maxStr, sizeof(maxStr), "%d", DIR_BUCKET_ENTRIES);
+    argv[0] = "EVAL";
+    argvlen[0] = 4;
+    argv[1] = linkScript;
+    argvlen[1] = strlen(linkScript);
+    argv[2] = "3";
+    argvlen[2] = 1;
+    argv[3] = worker->entryKey;
+    argvlen[3] = strlen(worker->entryKey);
+    argv[4] = genKey;
+    argvlen[4] = strlen(genKey);
+    argv[5] = logKey;
+    argvlen[5] = strlen(logKey);
+    argv[6] = maxStr;
+    argvlen[6] = strlen(maxStr);
+    argv[7] = worker->entryDir;
+    argvlen[7] = strlen(worker->entryDir);
+    argv[8] = prefix;
+    argvlen[8] = strlen(prefix);
+    for (i = 0; i < worker->entryCount; ++i)
+    {
+        argv[argc] = worker->names[i];
+        argvlen[argc++] = strlen(worker->names[i]);
+        argv[argc] = worker->ids[i];
+        argvlen[argc++] = strlen(worker->ids[i]);
+    }
+    worker->entryCount = 0;
+
+    return appendCommand(worker, argc, argv, argvlen);
+}
+
+
+static int importEntry(struct import_worker* worker, const char* path, const char* name)
+{
+    struct stat st;
+    node_id_t nodeId;
+    int result;
+
+    if (lstat(path, &st) < 0)
+    {
+        fprintf(stderr, "Warning: Cannot stat %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    else if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Warning: Skipping %s, which is not a file or directory.\n", path);
+        return 1;
+    }
+
+    nodeId = allocNodeId(worker);
+    if (nodeId < 0)
+    {
+        return nodeId;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        result = storeInfo(worker, nodeId, &st, 0, 0, "", 0);
+        if (result == 0)
+        {
+            result = queueDir(path, nodeId);
+        }
+        ++worker->dirs;
+    }
+    else
+    {
+        result = importFile(worker, path, nodeId, &st);
+        ++worker->files;
+    }
+    if (result != 0)
+    {
+        return result;
+    }
+
+    strcpy(worker->names[worker->entryCount], name);
+    snprintf(worker->ids[worker->entryCount], sizeof(worker->ids[0]), "%lld", (long long)nodeId);
+    if (++worker->entryCount == IMPORT_ENTRY_BATCH)
+    {
+        return linkEntries(worker);
+    }
+
+    return 0;
+}
+
+
+static int importDir(struct import_worker* worker, const struct import_dir* dir)
+{
+    char path[PATH_MAX];
+    struct dirent* entry;
+    DIR* handle;
+    int result = 0;
+
+    handle = opendir(dir->path);
+    if (!handle)
+    {
+        fprintf(stderr, "Warning: Cannot open %s: %s\n", dir->path, strerror(errno));
+        ++worker->errors;
+        return 0;
+    }
+
+    formatNodeKey(worker->entryKey, KEY_NODE, dir->nodeId);
+    snprintf(worker->entryDir, sizeof(worker->entryDir), "%lld", dir->nodeId);
+    worker->entryCount = 0;
+
+    while (result >= 0 && (entry = readdir(handle)))
+    {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, ".."))
+        {
+            continue;
+        }
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir->path, entry->d_name) >= sizeof(path))
+        {
+            fprintf(stderr, "Warning: Path too long: %s/%s\n", dir->path, entry->d_name);
+            ++worker->errors;
+            continue;
+        }
+
+        result = importEntry(worker, path, entry->d_name);
+        if (result > 0)
+        {
+            ++worker->errors;
+        }
+    }
+    closedir(handle);
+
+    if (result >= 0)
+    {
+        result = linkEntries(worker);
+    }
+
+    return result;
+}
+
+
+/*
+ * Release the ID ranges of a worker once all its nodes are linked. After a
+ * failure they stay leased until they expire, so that the nodes left
+ * behind can still be inspected.
+*/
+static void releaseLeases(struct import_worker* worker)
+{
+    char key[KEY_LEN];
+    char member[48];
+    const char* argv[3] = { "ZREM", key, member };
+    size_t argvlen[3];
+    int i;
+
+    formatKey(key, KEY_ID_LEASES);
+    argvlen[0] = 4;
+    argvlen[1] = strlen(key);
+    for (i = 0; i < worker->leaseCount && !failed; ++i)
+    {
+        argvlen[2] = snprintf(member, sizeof(member), "%lld:%lld",
+                              (long long)(worker->leases[i] - IMPORT_ID_RANGE + 1), (long long)worker->leases[i]);
+        appendCommand(worker, 3, argv, argvlen);
+    }
+    if (!failed)
+    {
+        flushWorker(worker);
+    }
+
+    free(worker->leases);
+    worker->leases = NULL;
+    worker->leaseCount = 0;
+}
+
+
+static void* workerMain(void* arg)
+{
+    struct import_worker* worker = (struct import_worker*)arg;
+    struct import_dir* dir = NULL;
+
+    while ((dir = takeDir(dir)))
+    {
+        if (importDir(worker, dir) < 0)
+        {
+            setFailed();
+        }
+    }
+
+    flushWorker(worker);
+    releaseLeases(worker);
+    closeRedisConnection();
+
+    return NULL;
+}
+
+
+/* ================ Main ================ */
+
+static int countEntry(void* ctx, const char* name)
+{
+    ++*(int*)ctx;
+    return 1;
+}
+
+
+static void usage(const char* progName)
+{
+    fprintf(stderr, "Usage: %s [options] SRC [DIR]\n", progName);
+    fprintf(stderr, "Copy the local directory SRC into the empty directory DIR (default /) of a RediFS file system.\n");
+    fprintf(stderr, "  -h HOST     Redis server host\n");
+    fprintf(stderr, "  -p PORT     Redis server port\n");
+    fprintf(stderr, "  -N NAME     File system name (default %s), created if needed\n", DEFAULT_NAME);
+    fprintf(stderr, "  -j THREADS  Parallel workers (default %d)\n", IMPORT_THREADS);
+    fprintf(stderr, "  -c CODEC    Compression codec for the files (default %s)\n", DEFAULT_CODEC);
+    fprintf(stderr, "  -i BYTES    Largest file stored inline (default %d)\n", DEFAULT_INLINE_MAX);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .port = 0,
+        .name = DEFAULT_NAME,
+        .inline_max = DEFAULT_INLINE_MAX,
+    };
+    long long info[NODE_INFO_COUNT];
+    struct import_worker* workers;
+    struct import_worker total;
+    struct timespec start;
+    struct timespec end;
+    const char* source;
+    const char* target = "/";
+    node_id_t rootId;
+    int threads = IMPORT_THREADS;
+    int entries;
+    int result;
+    int opt;
+    int i;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:j:c:i:")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'c': codec = codecFromName(optarg); break;
+            case 'i': inlineMax = strtoul(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || argc - optind > 2 || threads < 1 || threads > IMPORT_THREADS_MAX)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    else if (codec < 0)
+    {
+        fprintf(stderr, "Error: Unknown codec.\n");
+        return 1;
+    }
+    else if (inlineMax > INLINE_MAX_LIMIT)
+    {
+        fprintf(stderr, "Error: Inline files are limited to %d bytes.\n", INLINE_MAX_LIMIT);
+        return 1;
+    }
+    source = argv[optind];
+    if (optind + 1 < argc)
+    {
+        target = argv[optind + 1];
+    }
+
+    g_settings = &settings;
+    g_backend = &redisBackend;
+    if (0 > g_backend->open())
+    {
+        fprintf(stderr, "Error: Cannot connect to the Redis server.\n");
+        return 1;
+    }
+
+    result = g_backend->fs_exists();
+    if (result == 0)
+    {
+        result = g_backend->fs_create();
+    }
+    if (result <= 0)
+    {
+        fprintf(stderr, "Error: Cannot create file system '%s'.\n", settings.name);
+        return 1;
+    }
+
+    rootId = g_backend->resolve(target, strlen(target));
+    result = rootId < 0 ? rootId : g_backend->get_info(rootId, info);
+    if (result == 0 && !S_ISDIR(info[NODE_INFO_MODE]))
+    {
+        result = -ENOTDIR;
+    }
+    else if (result == 0)
+    {
+        // Entries are added without checking for existing names:
+        entries = 0;
+        result = g_backend->dir_list(rootId, countEntry, &entries);
+        if (result == 0 && entries > 0)
+        {
+            result = -ENOTEMPTY;
+        }
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: %s: %s\n", target, strerror(-result));
+        return 1;
+    }
+
+    if (0 > queueDir(source, rootId))
+    {
+        fprintf(stderr, "Error: Cannot prepare %s.\n", target);
+        return 1;
+    }
+
+    workers = calloc(threads, sizeof(struct import_worker));
+    if (!workers)
+    {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < threads; ++i)
+    {
+        if (0 != pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]))
+        {
+            fprintf(stderr, "Error: Cannot start worker thread.\n");
+            setFailed();
+            threads = i;
+        }
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total.dirs += workers[i].dirs;
+        total.files += workers[i].files;
+        total.bytes += workers[i].bytes;
+        total.errors += workers[i].errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Imported %llu directories and %llu files, %llu bytes, in %.2f s.\n", total.dirs, total.files,
+           total.bytes, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (total.errors > 0)
+    {
+        printf("Skipped %llu entries.\n", total.errors);
+    }
+
+    free(workers);
+    g_backend->close();
+
+    if (failed)
+    {
+        fprintf(stderr, "Error: Import failed; the target directory may be incomplete.\n");
+        return 1;
+    }
+
+    return total.errors > 0 ? 1 : 0;
+}
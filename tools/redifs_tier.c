@@ -0,0 +1,580 @@
+/*
+ * RediFS
+ *
+ * Redis File System based on FUSE
+ * Copyright (C) 2011 Dave van Soest <dave@thebinarykid.nl>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+*/
+
+
+/*
+ * Tiering of idle file data to a cold store, run periodically, e.g. from
+ * cron, while the file system is in use:
+ *
+ *   redifs_tier [-h host] [-p port] [-N name] -s store [-i seconds] [-n]
+ *
+ * Chunks that no one read or wrote for the idle time, by the OBJECT
+ * IDLETIME of their key, are moved to the cold store given as with
+ * -o cold_store of redifs. This needs a Redis maxmemory-policy that keeps
+ * idle times, i.e. not an LFU one.
+ *
+ * A run only sets NODE_FLAG_TIERED on files with idle chunks; their chunks
+ * move in a later run, by when every mount has seen the flag and looks
+ * for stubs. A chunk is written to the store first, then its data key is
+ * replaced by a stub in the cold hash of the file, provided that the value
+ * did not change meanwhile. Files with inline data or deduplicated chunks
+ * are left in Redis. See tier.c for how mounts fault chunks back.
+ *
+ * Every run ends with a sweep that drops the cold objects older than
+ * TIER_SWEEP_GRACE_SECONDS that no stub, live or archived for a snapshot,
+ * refers to. -n reports what a run would do without changing anything.
+*/
+
+
+/* ---- Includes ---- */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "options.h"
+#include "backend.h"
+#include "coldstore.h"
+#include "connection.h"
+#include "tier.h"
+#include "util.h"
+
+
+/* ---- Defines ---- */
+#define TIER_BATCH 256 // Keys per round trip of a scan.
+
+
+/* ---- Types ---- */
+
+// Idle chunk found by a scan:
+struct tier_chunk
+{
+    node_id_t nodeId;
+    long long chunk;
+    int flagged; // Its file has NODE_FLAG_TIERED.
+};
+
+// Cold object names referred to by stubs, sorted for lookups:
+struct tier_refs
+{
+    char** names;
+    size_t count;
+    size_t capacity;
+};
+
+
+/* ---- Globals ---- */
+static char prefix[KEY_LEN]; // "<name>::"
+static char flagStr[24];
+static char runToken[17]; // Keeps object names of different runs apart.
+static unsigned long objectCounter = 0;
+static int dryRun = 0;
+
+static unsigned long long keysScanned = 0;
+static unsigned long long filesMarked = 0;
+static unsigned long long chunksMoved = 0;
+static unsigned long long bytesMoved = 0;
+static unsigned long long objectsDropped = 0;
+
+
+/* ---- Scripts ---- */
+
+// ARGV: "<name>::", cursor, pattern, count, idle seconds. Returns the next
+// cursor, then the node ID, chunk and NODE_FLAG_TIERED bit of each idle
+// chunk of a regular file without inline data or deduplication.
+static const char* scanScript =
+    "local p, idle = ARGV[1], tonumber(ARGV[5]) "
+    "local reply = redis.call('SCAN', ARGV[2], 'MATCH', ARGV[3], 'COUNT', ARGV[4]) "
+    "local out = { reply[1] } "
+    "for _, key in ipairs(reply[2]) do "
+    "local id, c = string.match(string.sub(key, #p + 1), '^data:(%d+):(%d+)$') "
+    "if id and (redis.call('OBJECT', 'IDLETIME', key) or 0) >= idle then "
+    "local f = redis.call('LRANGE', p .. 'info:' .. id, 0, " LUA_STR(LUA_INFO_FLAGS) ") "
+    "local flags = tonumber(f[" LUA_STR(LUA_INFO_FLAGS) " + 1] or '3') "
+    "if #f > 0 and " LUA_MODE_IS("tonumber(f[1])", LUA_MODE_TYPE_REG) " and flags % 4 == 0 then "
+    "out[#out + 1] = id "
+    "out[#out + 1] = c "
+    "out[#out + 1] = tostring(math.floor(flags / 4) % 2) "
+    "end end end "
+    "return out";
+
+// KEYS: info, journal generation, journal log; ARGV: node ID, flag,
+// "<name>::"
+static const char* markScript =
+    LUA_COW_FUNCTION
+    LUA_JOURNAL_FUNCTION
+    "local flags, f = tonumber(redis.call('LINDEX', KEYS[1], " LUA_STR(LUA_INFO_FLAGS) ") or '3'), tonumber(ARGV[2]) "
+    "if flags % 4 ~= 0 or math.floor(flags / f) % 2 == 1 then return 0 end "
+    "cowAt(ARGV[3], KEYS[1]) "
+    "redis.call('LSET', KEYS[1], " LUA_STR(LUA_INFO_FLAGS) ", flags + f) "
+    "journal(KEYS[2], KEYS[3], ARGV[1]) "
+    "return 1";
+
+// KEYS: data; ARGV: idle seconds. Returns the value and its SHA1, or
+// nothing if the chunk is gone or was used since the scan.
+static const char* readScript =
+    "local idle = redis.call('OBJECT', 'IDLETIME', KEYS[1]) "
+    "if not idle or idle < tonumber(ARGV[1]) then return {} end "
+    "local v = redis.call('GET', KEYS[1]) "
+    "return { v, redis.sha1hex(v) }";
+
+// KEYS: data, cold, info; ARGV: chunk, object, SHA1 of the value, flag,
+// "<name>::"
+static const char* stubScript =
+    LUA_COW_FUNCTION
+    "local flags = tonumber(redis.call('LINDEX', KEYS[3], " LUA_STR(LUA_INFO_FLAGS) ") or '0') "
+    "if math.floor(flags / tonumber(ARGV[4])) % 2 == 0 then return 0 end "
+    "local v = redis.call('GET', KEYS[1]) "
+    "if not v or redis.sha1hex(v) ~= ARGV[3] then return 0 end "
+    "cowAt(ARGV[5], KEYS[1]) "
+    "cowAt(ARGV[5], KEYS[2]) "
+    "redis.call('HSET', KEYS[2], ARGV[1], ARGV[2]) "
+    "redis.call('DEL', KEYS[1]) "
+    "return 1";
+
+// ARGV: cursor, pattern, count. Returns the next cursor, then the values
+// of the hashes found.
+static const char* refScanScript =
+    "local reply = redis.call('SCAN', ARGV[1], 'MATCH', ARGV[2], 'COUNT', ARGV[3]) "
+    "local out = { reply[1] } "
+    "for _, key in ipairs(reply[2]) do "
+    "for _, v in ipairs(redis.call('HVALS', key)) do out[#out + 1] = v end "
+    "end "
+    "return out";
+
+
+/* ================ Util functions ================ */
+
+// Escape the glob characters of a file system name for SCAN MATCH:
+static void formatPattern(char* pattern, const char* name, const char* suffix)
+{
+    size_t len = 0;
+
+    for (; *name && len + 2 < KEY_LEN - 64; ++name)
+    {
+        if (strchr("*?[]\\", *name))
+        {
+            pattern[len++] = '\\';
+        }
+        pattern[len++] = *name;
+    }
+    snprintf(pattern + len, KEY_LEN - len, "%s", suffix);
+}
+
+
+static void initRunToken()
+{
+    unsigned long long token = (unsigned long long)time(NULL) * 1000003ULL ^ getpid();
+    int fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd >= 0)
+    {
+        if (sizeof(token) != read(fd, &token, sizeof(token)))
+        {
+            token ^= (unsigned long long)clock();
+        }
+        close(fd);
+    }
+
+    snprintf(runToken, sizeof(runToken), "%016llx", token);
+}
+
+
+/* ================ Moving chunks ================ */
+
+// Set NODE_FLAG_TIERED on a file, so that mounts look for its stubs:
+static int markFile(node_id_t nodeId)
+{
+    char keys[3][KEY_LEN];
+    char idStr[24];
+    const char* args[6] = { keys[0], keys[1], keys[2], idStr, flagStr, prefix };
+    long long marked;
+
+    if (dryRun)
+    {
+        ++filesMarked;
+        return 0;
+    }
+
+    formatNodeKey(keys[0], KEY_INFO, nodeId);
+    formatKey(keys[1], KEY_META_GEN);
+    formatKey(keys[2], KEY_META_LOG);
+    snprintf(idStr, sizeof(idStr), "%lld", nodeId);
+
+    if (!redisCommand_EVAL_INT(markScript, 3, args, 6, &marked))
+    {
+        return -EIO;
+    }
+
+    filesMarked += marked;
+
+    return 0;
+}
+
+
+// Write a chunk to the cold store and replace it by a stub:
+static int moveChunk(node_id_t nodeId, long long chunk, const char* idleStr)
+{
+    char keys[3][KEY_LEN];
+    char chunkStr[24];
+    char object[COLD_OBJECT_NAME_MAX + 1];
+    char sha1[41];
+    const char* readArgs[2] = { keys[0], idleStr };
+    const char* args[8] = { keys[0], keys[1], keys[2], chunkStr, object, sha1, flagStr, prefix };
+    char* value;
+    size_t len;
+    long long stubbed;
+    int handle;
+    int count;
+    int result;
+
+    formatChunkKey(keys[0], nodeId, chunk);
+    formatNodeKey(keys[1], KEY_COLD, nodeId);
+    formatNodeKey(keys[2], KEY_INFO, nodeId);
+
+    handle = redisCommand_EVAL_ARRAY(readScript, 1, readArgs, 2, &count);
+    if (!handle)
+    {
+        return -EIO;
+    }
+    else if (count < 2)
+    {
+        releaseReplyHandle(handle);
+        return 0;
+    }
+
+    retrieveBinaryArrayElement(handle, 1, &value, &len);
+    snprintf(sha1, sizeof(sha1), "%.*s", (int)len, value);
+    retrieveBinaryArrayElement(handle, 0, &value, &len);
+
+    snprintf(chunkStr, sizeof(chunkStr), "%lld", chunk);
+    snprintf(object, sizeof(object), "%lld.%lld.%s.%lx", nodeId, chunk, runToken, ++objectCounter);
+
+    result = dryRun ? 0 : g_coldStore->put(object, value, len);
+    releaseReplyHandle(handle);
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Cannot write cold object %s: %s\n", object, strerror(-result));
+        return result;
+    }
+    else if (dryRun)
+    {
+        ++chunksMoved;
+        bytesMoved += len;
+        return 0;
+    }
+
+    // The stub goes in only if the chunk is as it was written to the store:
+    if (!redisCommand_EVAL_INT(stubScript, 3, args, 8, &stubbed))
+    {
+        result = -EIO;
+    }
+    if (result < 0 || !stubbed)
+    {
+        g_coldStore->drop(object);
+        return result;
+    }
+
+    ++chunksMoved;
+    bytesMoved += len;
+
+    return 0;
+}
+
+
+/*
+ * Scan the chunks of the file system, marking the files with idle chunks,
+ * and moving the idle chunks of files marked before.
+*/
+static int tierChunks(const char* name, long long idleSeconds)
+{
+    struct tier_chunk found[TIER_BATCH * 4];
+    char pattern[KEY_LEN];
+    char cursor[24] = "0";
+    char countStr[24];
+    char idleStr[24];
+    const char* args[5] = { prefix, cursor, pattern, countStr, idleStr };
+    char* values[3];
+    node_id_t lastMarked = -1;
+    int handle;
+    int count;
+    int result = 0;
+    int n;
+    int i;
+
+    formatPattern(pattern, name, "::" KEY_DATA ":*");
+    snprintf(countStr, sizeof(countStr), "%d", TIER_BATCH);
+    snprintf(idleStr, sizeof(idleStr), "%lld", idleSeconds);
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(scanScript, 0, args, 5, &count);
+        if (!handle || count < 1)
+        {
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, values);
+        snprintf(cursor, sizeof(cursor), "%s", values[0]);
+
+        // SCAN may return a few more keys than COUNT:
+        for (i = 1, n = 0; i + 2 < count && n < sizeof(found) / sizeof(found[0]); i += 3, ++n)
+        {
+            retrieveStringArrayElements(handle, i, 3, values);
+            found[n].nodeId = atoll(values[0]);
+            found[n].chunk = atoll(values[1]);
+            found[n].flagged = atoi(values[2]);
+        }
+        releaseReplyHandle(handle);
+        keysScanned += n;
+
+        for (i = 0; i < n && result == 0; ++i)
+        {
+            if (found[i].flagged)
+            {
+                result = moveChunk(found[i].nodeId, found[i].chunk, idleStr);
+            }
+            else if (found[i].nodeId != lastMarked)
+            {
+                result = markFile(found[i].nodeId);
+                lastMarked = found[i].nodeId;
+            }
+        }
+    }
+    while (result == 0 && 0 != strcmp(cursor, "0"));
+
+    return result;
+}
+
+
+/* ================ Sweep ================ */
+
+static int compareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+static int addRef(struct tier_refs* refs, const char* name, size_t len)
+{
+    char** names;
+
+    if (refs->count == refs->capacity)
+    {
+        names = realloc(refs->names, (refs->capacity ? refs->capacity * 2 : 1024) * sizeof(char*));
+        if (!names)
+        {
+            return -ENOMEM;
+        }
+        refs->names = names;
+        refs->capacity = refs->capacity ? refs->capacity * 2 : 1024;
+    }
+
+    refs->names[refs->count] = strndup(name, len);
+    if (!refs->names[refs->count])
+    {
+        return -ENOMEM;
+    }
+    ++refs->count;
+
+    return 0;
+}
+
+
+// Collect the objects that the cold hashes matching pattern refer to:
+static int collectRefs(struct tier_refs* refs, const char* pattern)
+{
+    char cursor[24] = "0";
+    char countStr[24];
+    const char* args[3] = { cursor, pattern, countStr };
+    char* value;
+    size_t len;
+    int handle;
+    int count;
+    int result = 0;
+    int i;
+
+    snprintf(countStr, sizeof(countStr), "%d", TIER_BATCH);
+
+    do
+    {
+        handle = redisCommand_EVAL_ARRAY(refScanScript, 0, args, 3, &count);
+        if (!handle || count < 1)
+        {
+            return -EIO;
+        }
+
+        retrieveStringArrayElements(handle, 0, 1, &value);
+        snprintf(cursor, sizeof(cursor), "%s", value);
+
+        for (i = 1; i < count && result == 0; ++i)
+        {
+            retrieveBinaryArrayElement(handle, i, &value, &len);
+            result = addRef(refs, value, len);
+        }
+        releaseReplyHandle(handle);
+    }
+    while (result == 0 && 0 != strcmp(cursor, "0"));
+
+    return result;
+}
+
+
+static int sweepObject(void* ctx, const char* object, time_t stored)
+{
+    struct tier_refs* refs = (struct tier_refs*)ctx;
+
+    // Objects of a run still going on, or being faulted back, are young:
+    if (time(NULL) - stored < TIER_SWEEP_GRACE_SECONDS
+        || bsearch(&object, refs->names, refs->count, sizeof(char*), compareNames))
+    {
+        return 0;
+    }
+
+    if (dryRun || 0 == g_coldStore->drop(object))
+    {
+        ++objectsDropped;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Drop the cold objects that no stub refers to any more. The references
+ * are collected before the objects are listed, so a stub added meanwhile
+ * is for an object younger than the grace time.
+*/
+static int sweepObjects(const char* name)
+{
+    struct tier_refs refs = { NULL, 0, 0 };
+    char pattern[KEY_LEN];
+    size_t i;
+    int result;
+
+    formatPattern(pattern, name, "::" KEY_COLD ":*");
+    result = collectRefs(&refs, pattern);
+    if (result == 0)
+    {
+        formatPattern(pattern, name, "@[0-9]*::" KEY_COLD ":*");
+        result = collectRefs(&refs, pattern);
+    }
+    if (result == 0)
+    {
+        qsort(refs.names, refs.count, sizeof(char*), compareNames);
+        result = g_coldStore->list(sweepObject, &refs);
+    }
+
+    for (i = 0; i < refs.count; ++i)
+    {
+        free(refs.names[i]);
+    }
+    free(refs.names);
+
+    return result;
+}
+
+
+/* ================ Main ================ */
+
+static void usage(const char* progName)
+{
+    fprintf(stderr, "Usage: %s [options] -s STORE\n", progName);
+    fprintf(stderr, "Move idle file data of a RediFS file system to a cold store.\n");
+    fprintf(stderr, "  -h HOST     Redis server host\n");
+    fprintf(stderr, "  -p PORT     Redis server port\n");
+    fprintf(stderr, "  -N NAME     File system name (default %s)\n", DEFAULT_NAME);
+    fprintf(stderr, "  -s STORE    Cold store, as -o cold_store of redifs\n");
+    fprintf(stderr, "  -i SECONDS  Idle time after which chunks move (default %d)\n", TIER_DEFAULT_IDLE_SECONDS);
+    fprintf(stderr, "  -n          Report what would be done without changing anything\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct redifs_settings settings = {
+        .host = NULL,
+        .port = 0,
+        .name = DEFAULT_NAME,
+        .inline_max = DEFAULT_INLINE_MAX,
+    };
+    long long idleSeconds = TIER_DEFAULT_IDLE_SECONDS;
+    struct timespec start;
+    struct timespec end;
+    int result;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "h:p:N:s:i:n")))
+    {
+        switch (opt)
+        {
+            case 'h': settings.host = optarg; break;
+            case 'p': settings.port = (redifs_port_t)atoi(optarg); break;
+            case 'N': settings.name = optarg; break;
+            case 's': settings.cold_store = optarg; break;
+            case 'i': idleSeconds = atoll(optarg); break;
+            case 'n': dryRun = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc || !settings.cold_store || idleSeconds < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    g_settings = &settings;
+    g_backend = &redisBackend;
+    if (0 > g_backend->open())
+    {
+        fprintf(stderr, "Error: Cannot open the file system.\n");
+        return 1;
+    }
+    else if (g_backend->fs_exists() <= 0)
+    {
+        fprintf(stderr, "Error: No file system named '%s'.\n", settings.name);
+        return 1;
+    }
+
+    formatKey(prefix, "");
+    snprintf(flagStr, sizeof(flagStr), "%d", NODE_FLAG_TIERED);
+    initRunToken();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    result = tierChunks(settings.name, idleSeconds);
+    if (result == 0)
+    {
+        result = sweepObjects(settings.name);
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Tiering failed: %s\n", strerror(-result));
+        g_backend->close();
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%s %llu idle chunks in %.2f s: marked %llu files, moved %llu chunks (%llu bytes), "
+           "dropped %llu cold objects.\n", dryRun ? "Would tier" : "Tiered", keysScanned,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, filesMarked, chunksMoved, bytesMoved,
+           objectsDropped);
+
+    g_backend->close();
+
+    return 0;
+}